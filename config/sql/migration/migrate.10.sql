@@ -0,0 +1,12 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+CREATE TABLE target_images_migrate(filename TEXT UNIQUE, image_data BLOB NOT NULL, real_size INTEGER NOT NULL DEFAULT 0, resume_state TEXT);
+INSERT INTO target_images_migrate(filename, image_data, real_size) SELECT filename, image_data, length(image_data) FROM target_images;
+DROP TABLE target_images;
+ALTER TABLE target_images_migrate RENAME TO target_images;
+
+DELETE FROM version;
+INSERT INTO version VALUES(10);
+
+COMMIT TRANSACTION;
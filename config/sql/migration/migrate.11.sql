@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+CREATE TABLE meta_validators(repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, validators TEXT NOT NULL, UNIQUE(repo, meta_type));
+
+DELETE FROM version;
+INSERT INTO version VALUES(11);
+
+COMMIT TRANSACTION;
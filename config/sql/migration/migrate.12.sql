@@ -0,0 +1,13 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+-- the images are moved to files by SQLStorage on startup, image_data is only kept until then
+CREATE TABLE target_images_migrate(filename TEXT UNIQUE, image_data BLOB, real_size INTEGER NOT NULL DEFAULT 0, resume_state TEXT, sha256 TEXT, expected_size INTEGER NOT NULL DEFAULT 0);
+INSERT INTO target_images_migrate(filename, image_data, real_size, resume_state, expected_size) SELECT filename, image_data, real_size, resume_state, length(image_data) FROM target_images;
+DROP TABLE target_images;
+ALTER TABLE target_images_migrate RENAME TO target_images;
+
+DELETE FROM version;
+INSERT INTO version VALUES(12);
+
+COMMIT TRANSACTION;
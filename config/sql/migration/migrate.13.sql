@@ -0,0 +1,13 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+CREATE TABLE target_images_migrate(filename TEXT UNIQUE, image_data BLOB, real_size INTEGER NOT NULL DEFAULT 0, resume_state TEXT, sha256 TEXT, expected_size INTEGER NOT NULL DEFAULT 0, last_used INTEGER NOT NULL DEFAULT 0);
+-- the rowid names the files of partial downloads
+INSERT INTO target_images_migrate(rowid, filename, image_data, real_size, resume_state, sha256, expected_size, last_used) SELECT rowid, filename, image_data, real_size, resume_state, sha256, expected_size, rowid FROM target_images;
+DROP TABLE target_images;
+ALTER TABLE target_images_migrate RENAME TO target_images;
+
+DELETE FROM version;
+INSERT INTO version VALUES(13);
+
+COMMIT TRANSACTION;
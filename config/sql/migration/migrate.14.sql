@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+CREATE TABLE verified_meta(repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, state BLOB NOT NULL, UNIQUE(repo, meta_type));
+
+DELETE FROM version;
+INSERT INTO version VALUES(14);
+
+COMMIT TRANSACTION;
@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/schema-migrations.adoc
+BEGIN TRANSACTION;
+
+ALTER TABLE target_images ADD COLUMN hash_state BLOB;
+
+DELETE FROM version;
+INSERT INTO version VALUES(15);
+
+COMMIT TRANSACTION;
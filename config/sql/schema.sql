@@ -1,5 +1,5 @@
 CREATE TABLE version(version INTEGER);
-INSERT INTO version(rowid,version) VALUES(1,9);
+INSERT INTO version(rowid,version) VALUES(1,15);
 CREATE TABLE device_info(unique_mark INTEGER PRIMARY KEY CHECK (unique_mark = 0), device_id TEXT, is_registered INTEGER NOT NULL DEFAULT 0 CHECK (is_registered IN (0,1)));
 CREATE TABLE ecu_serials(serial TEXT UNIQUE, hardware_id TEXT NOT NULL, is_primary INTEGER NOT NULL CHECK (is_primary IN (0,1)));
 CREATE TABLE misconfigured_ecus(serial TEXT UNIQUE, hardware_id TEXT NOT NULL, state INTEGER NOT NULL CHECK (state IN (0,1)));
@@ -10,7 +10,9 @@ CREATE TABLE tls_creds(ca_cert BLOB, ca_cert_format TEXT,
                        client_cert BLOB, client_cert_format TEXT,
                        client_pkey BLOB, client_pkey_format TEXT);
 CREATE TABLE meta(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, UNIQUE(repo, meta_type, version));
-CREATE TABLE target_images(filename TEXT UNIQUE, image_data BLOB NOT NULL);
+CREATE TABLE meta_validators(repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, validators TEXT NOT NULL, UNIQUE(repo, meta_type));
+CREATE TABLE verified_meta(repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, state BLOB NOT NULL, UNIQUE(repo, meta_type));
+CREATE TABLE target_images(filename TEXT UNIQUE, image_data BLOB, real_size INTEGER NOT NULL DEFAULT 0, resume_state TEXT, sha256 TEXT, expected_size INTEGER NOT NULL DEFAULT 0, last_used INTEGER NOT NULL DEFAULT 0, hash_state BLOB);
 CREATE TABLE repo_types(repo INTEGER NOT NULL, repo_string TEXT NOT NULL);
 CREATE TABLE meta_types(meta INTEGER NOT NULL, meta_string TEXT NOT NULL);
 INSERT INTO meta_types(rowid,meta,meta_string) VALUES(1,0,'root');
@@ -77,16 +77,11 @@ bool AktualizrSecondary::putMetadataResp(const Uptane::RawMetaPack& meta_pack) {
     return true;
   }
   meta_targets_ = targets;
-  std::vector<Uptane::Target>::const_iterator it;
-  bool target_found = false;
-  for (it = meta_targets_.targets.begin(); it != meta_targets_.targets.end(); ++it) {
-    if (it->IsForSecondary(getSerialResp())) {
-      if (target_found) {
-        detected_attack_ = "Duplicate entry for this ECU";
-        break;
-      }
-      target_found = true;
-      target_ = std_::make_unique<Uptane::Target>(*it);
+  std::vector<const Uptane::Target*> ecu_targets = meta_targets_.targetsForEcu(getSerialResp());
+  if (!ecu_targets.empty()) {
+    target_ = std_::make_unique<Uptane::Target>(*ecu_targets[0]);
+    if (ecu_targets.size() > 1) {
+      detected_attack_ = "Duplicate entry for this ECU";
     }
   }
   storage_->storeRoot(meta_pack.director_root, Uptane::RepositoryType::Director, Uptane::Version(root_.version()));
@@ -158,8 +153,7 @@ bool AktualizrSecondary::sendFirmwareResp(const std::shared_ptr<std::string>& fi
     LOG_ERROR << "Could not install target (" << static_cast<int>(res_code) << "): " << message;
     return false;
   }
-  storage_->saveInstalledVersion(*target_);
-  return true;
+  return storage_->saveInstalledVersion(*target_);
 }
 
 void AktualizrSecondary::extractCredentialsArchive(const std::string& archive, std::string* ca, std::string* cert,
@@ -83,16 +83,12 @@ void OpcuaServerSecondaryDelegate::handleAllMetaDataFilesReceived(opcuabridge::S
       LOG_ERROR << "Uptane security check: " << secondary_->detected_attack_;
       return;
     }
-    bool target_found = false;
     secondary_->meta_targets_ = Uptane::Targets(received_meta_pack_.director_targets);
-    for (auto it = secondary_->meta_targets_.targets.begin(); it != secondary_->meta_targets_.targets.end(); ++it) {
-      if (it->IsForSecondary(secondary_->ecu_serial_)) {
-        if (target_found) {
-          secondary_->detected_attack_ = "Duplicate entry for this ECU";
-          break;
-        }
-        target_found = true;
-        secondary_->target_ = std_::make_unique<Uptane::Target>(*it);
+    std::vector<const Uptane::Target*> ecu_targets = secondary_->meta_targets_.targetsForEcu(secondary_->ecu_serial_);
+    if (!ecu_targets.empty()) {
+      secondary_->target_ = std_::make_unique<Uptane::Target>(*ecu_targets[0]);
+      if (ecu_targets.size() > 1) {
+        secondary_->detected_attack_ = "Duplicate entry for this ECU";
       }
     }
   } catch (const Uptane::SecurityException& ex) {
@@ -126,8 +122,10 @@ void OpcuaServerSecondaryDelegate::handleDirectoryFilesSynchronized(opcuabridge:
       if (res_code != data::UpdateResultCode::kOk) {
         LOG_ERROR << "Could not install target (" << static_cast<int>(res_code) << "): " << message;
         secondary_->pacman->setOperationResult(target_to_install.filename(), res_code, message);
+      } else if (!secondary_->storage_->saveInstalledVersion(target_to_install)) {
+        secondary_->pacman->setOperationResult(target_to_install.filename(), data::UpdateResultCode::kInstallFailed,
+                                               "Could not save the installed version");
       } else {
-        secondary_->storage_->saveInstalledVersion(target_to_install);
         secondary_->pacman->setOperationResult(target_to_install.filename(), data::UpdateResultCode::kOk,
                                                "Installation successful");
       }
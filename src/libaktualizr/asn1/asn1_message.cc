@@ -11,6 +11,7 @@
 #endif
 
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 int Asn1StringAppendCallback(const void* buffer, size_t size, void* priv) {
@@ -53,12 +54,20 @@ void SetString(OCTET_STRING_t* dest, const std::string& str) {
   OCTET_STRING_fromBuf(dest, str.c_str(), static_cast<int>(str.size()));
 }
 
-Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const struct sockaddr_storage& client) {
+Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const struct sockaddr_storage& client,
+                         std::chrono::seconds timeout) {
   int socket_fd = socket(AF_INET6, SOCK_STREAM, 0);
   if (socket_fd < 0) {
     throw std::system_error(errno, std::system_category(), "socket");
   }
   SocketHandle hdl(new int(socket_fd));
+  if (timeout.count() > 0) {
+    // also bounds connect()
+    struct timeval tv {};
+    tv.tv_sec = static_cast<time_t>(timeout.count());
+    setsockopt(*hdl, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&tv), sizeof(tv));
+    setsockopt(*hdl, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&tv), sizeof(tv));
+  }
   if (connect(*hdl, reinterpret_cast<const struct sockaddr*>(&client), sizeof(sockaddr_in6)) < 0) {
     LOG_ERROR << "connect to " << client << " failed:" << std::strerror(errno);
     return Asn1Message::Empty();
@@ -72,12 +81,16 @@ Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const struct sockaddr_stora
   setsockopt(*hdl, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
 
   AKIpUptaneMes_t* m = nullptr;
-  asn_dec_rval_t res;
+  asn_dec_rval_t res{RC_FAIL, 0};
   asn_codec_ctx_s context{};
   DequeueBuffer buffer;
   ssize_t received;
   do {
     received = recv(*hdl, buffer.Tail(), buffer.TailSpace(), 0);
+    if (received < 0) {
+      LOG_ERROR << "Asn1Rpc read from " << client << " failed: " << std::strerror(errno);
+      break;
+    }
     LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string(buffer.Tail(), static_cast<size_t>(received)));
     buffer.HaveEnqueued(static_cast<size_t>(received));
     res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
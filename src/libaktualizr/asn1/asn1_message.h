@@ -1,5 +1,7 @@
 #ifndef ASN1_MESSAGE_H_
 #define ASN1_MESSAGE_H_
+#include <chrono>
+
 #include <boost/intrusive_ptr.hpp>
 
 #include "AKIpUptaneMes.h"
@@ -120,7 +122,9 @@ void SetString(OCTET_STRING_t* dest, const std::string& str);
 
 /**
  * Open a TCP connection to client; send a message and wait for a
- * response.
+ * response. With a non-zero timeout, the request fails if the client
+ * doesn't accept or send data for that long.
  */
-Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const struct sockaddr_storage& client);
+Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const struct sockaddr_storage& client,
+                         std::chrono::seconds timeout = std::chrono::seconds(0));
 #endif  // ASN1_MESSAGE_H_
\ No newline at end of file
@@ -20,6 +20,11 @@ void NetworkConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
   CopyFromConfig(ipdiscovery_port, "ipdiscovery_port", pt);
   CopyFromConfig(ipdiscovery_wait_seconds, "ipdiscovery_wait_seconds", pt);
   CopyFromConfig(ipuptane_port, "ipuptane_port", pt);
+  CopyFromConfig(http_max_retries, "http_max_retries", pt);
+  CopyFromConfig(http_retry_base_delay_ms, "http_retry_base_delay_ms", pt);
+  CopyFromConfig(http_retry_max_delay_ms, "http_retry_max_delay_ms", pt);
+  CopyFromConfig(http_retry_budget, "http_retry_budget", pt);
+  CopyFromConfig(http_compress_requests, "http_compress_requests", pt);
 }
 
 void NetworkConfig::writeToStream(std::ostream& out_stream) const {
@@ -27,6 +32,11 @@ void NetworkConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, ipdiscovery_port, "ipdiscovery_port");
   writeOption(out_stream, ipdiscovery_wait_seconds, "ipdiscovery_wait_seconds");
   writeOption(out_stream, ipuptane_port, "ipuptane_port");
+  writeOption(out_stream, http_max_retries, "http_max_retries");
+  writeOption(out_stream, http_retry_base_delay_ms, "http_retry_base_delay_ms");
+  writeOption(out_stream, http_retry_max_delay_ms, "http_retry_max_delay_ms");
+  writeOption(out_stream, http_retry_budget, "http_retry_budget");
+  writeOption(out_stream, http_compress_requests, "http_compress_requests");
 }
 
 void TlsConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
@@ -74,6 +84,11 @@ void UptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt)
   CopyFromConfig(polling_sec, "polling_sec", pt);
   CopyFromConfig(director_server, "director_server", pt);
   CopyFromConfig(repo_server, "repo_server", pt);
+  CopyFromConfig(download_concurrency, "download_concurrency", pt);
+  CopyFromConfig(verification_threads, "verification_threads", pt);
+  CopyFromConfig(manifest_max_age_sec, "manifest_max_age_sec", pt);
+  CopyFromConfig(secondary_concurrency, "secondary_concurrency", pt);
+  CopyFromConfig(secondary_timeout_sec, "secondary_timeout_sec", pt);
   CopyFromConfig(key_source, "key_source", pt);
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(legacy_interface, "legacy_interface", pt);
@@ -86,6 +101,11 @@ void UptaneConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, polling_sec, "polling_sec");
   writeOption(out_stream, director_server, "director_server");
   writeOption(out_stream, repo_server, "repo_server");
+  writeOption(out_stream, download_concurrency, "download_concurrency");
+  writeOption(out_stream, verification_threads, "verification_threads");
+  writeOption(out_stream, manifest_max_age_sec, "manifest_max_age_sec");
+  writeOption(out_stream, secondary_concurrency, "secondary_concurrency");
+  writeOption(out_stream, secondary_timeout_sec, "secondary_timeout_sec");
   writeOption(out_stream, key_source, "key_source");
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, legacy_interface, "legacy_interface");
@@ -35,6 +35,11 @@ struct NetworkConfig {
   in_port_t ipdiscovery_port{9031};
   uint32_t ipdiscovery_wait_seconds{2};
   in_port_t ipuptane_port{9030};
+  uint32_t http_max_retries{2};
+  uint32_t http_retry_base_delay_ms{1000};
+  uint32_t http_retry_max_delay_ms{60000};
+  uint32_t http_retry_budget{20};
+  bool http_compress_requests{false};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -74,6 +79,11 @@ struct UptaneConfig {
   uint64_t polling_sec{10u};
   std::string director_server;
   std::string repo_server;
+  uint64_t download_concurrency{4u};
+  uint64_t verification_threads{0u};
+  uint64_t manifest_max_age_sec{3600u};
+  uint64_t secondary_concurrency{4u};
+  uint64_t secondary_timeout_sec{30u};
   CryptoSource key_source{CryptoSource::kFile};
   KeyType key_type{KeyType::kRSA2048};
   boost::filesystem::path legacy_interface{};
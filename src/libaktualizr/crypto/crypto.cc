@@ -55,17 +55,77 @@ PublicKey::PublicKey(std::string value, KeyType type) : value_(std::move(value))
   }
 }
 
+struct PublicKey::NativeKey {
+  StructGuard<EVP_PKEY> rsa{nullptr, EVP_PKEY_free};
+  std::string ed25519;  // raw bytes
+  std::string digest;   // identifies the key in SignatureCache
+};
+
+PublicKey::PublicKey(const PublicKey &other)
+    : value_(other.value_), type_(other.type_), native_(std::atomic_load(&other.native_)) {}
+
+PublicKey &PublicKey::operator=(const PublicKey &other) {
+  if (this != &other) {
+    value_ = other.value_;
+    type_ = other.type_;
+    std::atomic_store(&native_, std::atomic_load(&other.native_));
+  }
+  return *this;
+}
+
+static StructGuard<EVP_PKEY> parseRSAPublicKey(const std::string &public_key) {
+  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
+                       BIO_vfree);
+  StructGuard<EVP_PKEY> key(PEM_read_bio_PUBKEY(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+  if (key == nullptr) {
+    LOG_ERROR << "PEM_read_bio_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+  } else if (EVP_PKEY_base_id(key.get()) != EVP_PKEY_RSA) {
+    LOG_ERROR << "Public key is not an RSA key";
+    key.reset();
+  }
+  return key;
+}
+
+std::shared_ptr<const PublicKey::NativeKey> PublicKey::nativeKey() const {
+  std::shared_ptr<const NativeKey> native = std::atomic_load(&native_);
+  if (native != nullptr) {
+    return native;
+  }
+
+  // concurrent callers may both parse the key, one of the results is kept
+  auto parsed = std::make_shared<NativeKey>();
+  if (type_ == KeyType::kED25519) {
+    parsed->ed25519 = boost::algorithm::unhex(value_);
+  } else if (Crypto::IsRsaKeyType(type_)) {
+    parsed->rsa = parseRSAPublicKey(value_);
+  }
+  parsed->digest = Crypto::sha256digest(std::to_string(static_cast<int>(type_)) + ":" + value_);
+  native = parsed;
+  std::atomic_store(&native_, native);
+  return native;
+}
+
 bool PublicKey::VerifySignature(const std::string &signature, const std::string &message) const {
-  switch (type_) {
-    case KeyType::kED25519:
-      return Crypto::ED25519Verify(boost::algorithm::unhex(value_), Utils::fromBase64(signature), message);
-    case KeyType::kRSA2048:
-    case KeyType::kRSA3072:
-    case KeyType::kRSA4096:
-      return Crypto::RSAPSSVerify(value_, Utils::fromBase64(signature), message);
-    default:
-      return false;
+  if (type_ != KeyType::kED25519 && !Crypto::IsRsaKeyType(type_)) {
+    return false;
+  }
+  const std::shared_ptr<const NativeKey> native = nativeKey();
+  SignatureCache &cache = SignatureCache::global();
+  const std::string entry = SignatureCache::entryKey(native->digest, signature, message);
+  if (cache.contains(entry)) {
+    return true;
+  }
+
+  bool res;
+  if (type_ == KeyType::kED25519) {
+    res = Crypto::ED25519Verify(native->ed25519, Utils::fromBase64(signature), message);
+  } else {
+    res = native->rsa != nullptr && Crypto::RSAPSSVerify(native->rsa.get(), Utils::fromBase64(signature), message);
+  }
+  if (res) {
+    cache.insert(entry);
   }
+  return res;
 }
 
 bool PublicKey::operator==(const PublicKey &rhs) const { return value_ == rhs.value_ && type_ == rhs.type_; }
@@ -98,6 +158,64 @@ std::string PublicKey::KeyId() const {
   return keyid;
 }
 
+SignatureCache &SignatureCache::global() {
+  static SignatureCache cache;
+  return cache;
+}
+
+std::string SignatureCache::entryKey(const std::string &key_digest, const std::string &signature,
+                                     const std::string &message) {
+  // the digest of the key itself rather than the key ID claimed by the metadata, which could name another key
+  return key_digest + Crypto::sha256digest(signature) + Crypto::sha256digest(message);
+}
+
+bool SignatureCache::contains(const std::string &entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = index_.find(entry);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  ++stats_.hits;
+  return true;
+}
+
+void SignatureCache::insert(const std::string &entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (capacity_ == 0 || index_.count(entry) != 0) {
+    return;
+  }
+  entries_.push_front(entry);
+  index_[entry] = entries_.begin();
+  evict();
+}
+
+void SignatureCache::setCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  capacity_ = capacity;
+  evict();
+}
+
+void SignatureCache::clear() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.clear();
+  index_.clear();
+  stats_ = Stats();
+}
+
+SignatureCache::Stats SignatureCache::stats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return stats_;
+}
+
+void SignatureCache::evict() {
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back());
+    entries_.pop_back();
+  }
+}
+
 std::string Crypto::sha256digest(const std::string &text) {
   unsigned char sha256_hash[crypto_hash_sha256_BYTES];
   crypto_hash_sha256(sha256_hash, reinterpret_cast<const unsigned char *>(text.c_str()), text.size());
@@ -184,45 +302,35 @@ std::string Crypto::ED25519Sign(const std::string &private_key, const std::strin
 }
 
 bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message) {
-  StructGuard<RSA> rsa(nullptr, RSA_free);
-  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
-                       BIO_vfree);
-  {
-    RSA *r = nullptr;
-    if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
-      LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return false;
-    }
-    rsa.reset(r);
+  StructGuard<EVP_PKEY> key = parseRSAPublicKey(public_key);
+  if (key == nullptr) {
+    return false;
   }
+  return RSAPSSVerify(key.get(), signature, message);
+}
 
-#if AKTUALIZR_OPENSSL_PRE_11
-  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
-#else
-  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
-#endif
-
-  const auto size = static_cast<unsigned int>(RSA_size(rsa.get()));
-  boost::scoped_array<unsigned char> pDecrypted(new unsigned char[size]);
-  /* now we will verify the signature
-    Start by a RAW decrypt of the signature
-  */
-  int status =
-      RSA_public_decrypt(static_cast<int>(signature.size()), reinterpret_cast<const unsigned char *>(signature.c_str()),
-                         pDecrypted.get(), rsa.get(), RSA_NO_PADDING);
-  if (status == -1) {
-    LOG_ERROR << "RSA_public_decrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+// The key is only read, so that it can be shared between threads
+bool Crypto::RSAPSSVerify(EVP_PKEY *public_key, const std::string &signature, const std::string &message) {
+  StructGuard<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new(public_key, nullptr), EVP_PKEY_CTX_free);
+  if (ctx == nullptr || EVP_PKEY_verify_init(ctx.get()) != 1 ||
+      EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PSS_PADDING) != 1 ||
+      EVP_PKEY_CTX_set_signature_md(ctx.get(), EVP_sha256()) != 1 ||
+      EVP_PKEY_CTX_set_rsa_pss_saltlen(ctx.get(), -2 /* salt length recovered from signature*/) != 1) {
+    LOG_ERROR << "Can't set up RSA-PSS verification: " << ERR_error_string(ERR_get_error(), nullptr);
     return false;
   }
 
   std::string digest = Crypto::sha256digest(message);
-
-  /* verify the data */
-  status = RSA_verify_PKCS1_PSS(rsa.get(), reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
-                                pDecrypted.get(), -2 /* salt length recovered from signature*/);
-
+  const int status = EVP_PKEY_verify(ctx.get(), reinterpret_cast<const unsigned char *>(signature.c_str()),
+                                     signature.size(), reinterpret_cast<const unsigned char *>(digest.c_str()),
+                                     digest.size());
+  if (status < 0) {
+    // not a signature of the right size
+    ERR_clear_error();
+  }
   return status == 1;
 }
+
 bool Crypto::ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message) {
   return crypto_sign_verify_detached(reinterpret_cast<const unsigned char *>(signature.c_str()),
                                      reinterpret_cast<const unsigned char *>(message.c_str()), message.size(),
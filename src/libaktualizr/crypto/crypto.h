@@ -14,7 +14,12 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 
 #include "utilities/types.h"
@@ -34,6 +39,9 @@ class PublicKey {
 
   PublicKey(std::string value, KeyType type);
 
+  PublicKey(const PublicKey &other);
+  PublicKey &operator=(const PublicKey &other);
+
   std::string Value() const { return value_; }
 
   KeyType Type() const { return type_; }
@@ -56,14 +64,59 @@ class PublicKey {
   // std::string can be implicitly converted to a Json::Value. Make sure that
   // the Json::Value constructor is not called accidentally.
   PublicKey(std::string);
+
+  struct NativeKey;
+  std::shared_ptr<const NativeKey> nativeKey() const;
+
   std::string value_;
   KeyType type_{KeyType::kUnknown};
+  // parsed on first use and shared between copies, only accessed atomically
+  mutable std::shared_ptr<const NativeKey> native_;
+};
+
+/**
+ * Process-wide record of successful signature verifications, so that the same
+ * signature of the same message by the same key is only checked once. Failed
+ * verifications are never recorded. Holds a bounded number of entries and drops
+ * the least recently used ones.
+ */
+class SignatureCache {
+ public:
+  struct Stats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+  };
+  static const size_t kDefaultCapacity = 4096;
+
+  static SignatureCache &global();
+
+  explicit SignatureCache(size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+  // Digests of the key, the signature and the message
+  static std::string entryKey(const std::string &key_digest, const std::string &signature, const std::string &message);
+  bool contains(const std::string &entry);
+  void insert(const std::string &entry);
+  // 0 disables the cache
+  void setCapacity(size_t capacity);
+  void clear();
+  Stats stats() const;
+
+ private:
+  void evict();  // with mutex_ held
+
+  mutable std::mutex mutex_;
+  size_t capacity_;
+  std::list<std::string> entries_;  // most recently used first
+  std::unordered_map<std::string, std::list<std::string>::iterator> index_;
+  Stats stats_;
 };
 
 class MultiPartHasher {
  public:
   virtual void update(const unsigned char *part, uint64_t size) = 0;
   virtual std::string getHexDigest() = 0;
+  // Raw intermediate state, only meant to be restored on the same machine to continue an interrupted hashing
+  virtual std::string getState() const = 0;
+  virtual bool setState(const std::string &state) = 0;
   virtual ~MultiPartHasher() = default;
 };
 
@@ -77,6 +130,16 @@ class MultiPartSHA512Hasher : public MultiPartHasher {
     crypto_hash_sha512_final(&state_, static_cast<unsigned char *>(sha512_hash));
     return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha512_hash), crypto_hash_sha512_BYTES));
   }
+  std::string getState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool setState(const std::string &state) override {
+    if (state.size() != sizeof(state_)) {
+      return false;
+    }
+    std::memcpy(&state_, state.data(), sizeof(state_));
+    return true;
+  }
 
  private:
   crypto_hash_sha512_state state_{};
@@ -92,6 +155,16 @@ class MultiPartSHA256Hasher : public MultiPartHasher {
     crypto_hash_sha256_final(&state_, static_cast<unsigned char *>(sha256_hash));
     return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha256_hash), crypto_hash_sha256_BYTES));
   }
+  std::string getState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool setState(const std::string &state) override {
+    if (state.size() != sizeof(state_)) {
+      return false;
+    }
+    std::memcpy(&state_, state.data(), sizeof(state_));
+    return true;
+  }
 
  private:
   crypto_hash_sha256_state state_{};
@@ -113,6 +186,7 @@ class Crypto {
   static bool generateKeyPair(KeyType key_type, std::string *public_key, std::string *private_key);
 
   static bool RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message);
+  static bool RSAPSSVerify(EVP_PKEY *public_key, const std::string &signature, const std::string &message);
   static bool ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message);
 
   static bool IsRsaKeyType(KeyType type);
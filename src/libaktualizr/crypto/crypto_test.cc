@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <json/json.h>
 #include <boost/algorithm/hex.hpp>
@@ -296,6 +299,204 @@ TEST(crypto, parseBadPublicKeyJson) {
   EXPECT_EQ(PublicKey{o}.Type(), KeyType::kUnknown);
 }
 
+/* Only successful verifications are remembered. */
+TEST(crypto, signature_cache) {
+  SignatureCache &cache = SignatureCache::global();
+  cache.clear();
+  PublicKey pkey(fs::path("tests/test_data/public.key"));
+  std::string private_key = Utils::readFile("tests/test_data/priv.key");
+  std::string text = "This is text for sign";
+  std::string signature = Utils::toBase64(Crypto::RSAPSSSign(NULL, private_key, text));
+
+  EXPECT_FALSE(pkey.VerifySignature(signature, text + " "));
+  EXPECT_FALSE(pkey.VerifySignature(signature, text + " "));
+  EXPECT_EQ(cache.stats().hits, 0);
+
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_EQ(cache.stats().hits, 1);
+
+  // a cached success doesn't apply to another message, signature or key
+  EXPECT_FALSE(pkey.VerifySignature(signature, text + " "));
+  std::string other_signature = Utils::toBase64(Crypto::RSAPSSSign(NULL, private_key, text + " "));
+  EXPECT_FALSE(pkey.VerifySignature(other_signature, text));
+  std::string other_public, other_private;
+  ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &other_public, &other_private));
+  EXPECT_FALSE(PublicKey(other_public, KeyType::kRSA2048).VerifySignature(signature, text));
+  EXPECT_EQ(cache.stats().hits, 1);
+
+  // bounded
+  cache.setCapacity(1);
+  EXPECT_TRUE(pkey.VerifySignature(other_signature, text + " "));
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_EQ(cache.stats().hits, 1);
+  cache.setCapacity(SignatureCache::kDefaultCapacity);
+}
+
+// Signed manifests of the given number of ECUs, each one with its own key
+void makeSignedManifests(int ecus, std::vector<PublicKey> *keys, std::vector<std::string> *manifests,
+                         std::vector<std::string> *signatures) {
+  for (int i = 0; i < ecus; ++i) {
+    std::string public_key, private_key;
+    ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+    Json::Value manifest;
+    manifest["ecu_serial"] = "secondary_" + std::to_string(i);
+    manifest["installed_image"]["filepath"] = "firmware_" + std::to_string(i) + ".bin";
+    manifest["installed_image"]["fileinfo"]["length"] = 1024 * i;
+    manifests->push_back(Json::FastWriter().write(manifest));
+    signatures->push_back(Utils::toBase64(Crypto::RSAPSSSign(NULL, private_key, manifests->back())));
+    keys->emplace_back(public_key, KeyType::kRSA2048);
+  }
+}
+
+/* Checking the same manifests again in later cycles only hits the cache. */
+TEST(crypto, signature_cache_cycles) {
+  const int ecus = 4;
+  const int cycles = 3;
+  std::vector<PublicKey> keys;
+  std::vector<std::string> manifests;
+  std::vector<std::string> signatures;
+  makeSignedManifests(ecus, &keys, &manifests, &signatures);
+
+  SignatureCache &cache = SignatureCache::global();
+  cache.clear();
+  for (int cycle = 0; cycle < cycles; ++cycle) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      EXPECT_TRUE(keys[i].VerifySignature(signatures[i], manifests[i]));
+      EXPECT_FALSE(keys[i].VerifySignature(signatures[i], manifests[(i + 1) % keys.size()]));
+    }
+  }
+  // failures are looked up every time, successes only in the first cycle
+  EXPECT_EQ(cache.stats().misses, cycles * ecus + ecus);
+  EXPECT_EQ(cache.stats().hits, ecus * (cycles - 1));
+}
+
+/*
+ * Cycles which check the signed manifests of many ECUs, as
+ * SotaUptaneClient::AssembleManifest does, with and without the cache.
+ * crypto.signature_cache_cycles checks the results; this only reports timings,
+ * so it is disabled by default. Run it with --gtest_also_run_disabled_tests.
+ */
+TEST(crypto, DISABLED_SignatureCacheBenchmark) {
+  const int ecus = 32;
+  const int cycles = 10;
+  std::vector<PublicKey> keys;
+  std::vector<std::string> manifests;
+  std::vector<std::string> signatures;
+  makeSignedManifests(ecus, &keys, &manifests, &signatures);
+
+  auto run = [&]() {
+    auto start = std::chrono::steady_clock::now();
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+      for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(keys[i].VerifySignature(signatures[i], manifests[i]));
+      }
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  SignatureCache &cache = SignatureCache::global();
+  cache.clear();
+  cache.setCapacity(0);
+  auto uncached = run();
+  cache.clear();
+  cache.setCapacity(SignatureCache::kDefaultCapacity);
+  auto cached = run();
+  EXPECT_EQ(cache.stats().misses, ecus);
+  EXPECT_EQ(cache.stats().hits, ecus * (cycles - 1));
+
+  std::cout << cycles << " cycles verifying " << ecus << " ECU manifests: " << uncached << "us without cache, "
+            << cached << "us with cache\n";
+}
+
+/* The parsed key is shared by copies and can be used from several threads. */
+TEST(crypto, shared_native_key) {
+  SignatureCache::global().setCapacity(0);
+  std::string public_key, private_key;
+  ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+  const PublicKey pkey(public_key, KeyType::kRSA2048);
+  const std::string text = "This is text for sign";
+  const std::string signature = Utils::toBase64(Crypto::RSAPSSSign(NULL, private_key, text));
+
+  std::vector<std::thread> threads;
+  std::vector<int> verified(8, 0);
+  for (size_t i = 0; i < verified.size(); ++i) {
+    threads.emplace_back([&pkey, &text, &signature, &verified, i]() {
+      const PublicKey copy(pkey);
+      for (int n = 0; n < 20; ++n) {
+        verified[i] += (n % 2 == 0 ? pkey : copy).VerifySignature(signature, text) ? 1 : 0;
+        EXPECT_FALSE(copy.VerifySignature(signature, text + " "));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int count : verified) {
+    EXPECT_EQ(count, 20);
+  }
+
+  PublicKey bad_key("this is bad key", KeyType::kRSA2048);
+  EXPECT_FALSE(bad_key.VerifySignature(signature, text));
+  EXPECT_FALSE(bad_key.VerifySignature(signature, text));
+  SignatureCache::global().setCapacity(SignatureCache::kDefaultCapacity);
+}
+
+/*
+ * Verifications per second when the key is parsed every time and when it is
+ * kept parsed. crypto.shared_native_key and crypto.verify_ed25519 check the
+ * results; this only reports timings, so it is disabled by default. Run it with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(crypto, DISABLED_NativeKeyBenchmark) {
+  SignatureCache::global().setCapacity(0);
+  const int verifications = 500;
+  const std::string text = Utils::readFile("tests/test_data/repo/repo/image/targets_hasupdates.json");
+
+  std::string public_key, private_key;
+  ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+  const std::string signature = Crypto::RSAPSSSign(NULL, private_key, text);
+  const PublicKey pkey(public_key, KeyType::kRSA2048);
+  const std::string signature64 = Utils::toBase64(signature);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < verifications; ++i) {
+    EXPECT_TRUE(Crypto::RSAPSSVerify(public_key, Utils::fromBase64(signature64), text));
+  }
+  auto parsing = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < verifications; ++i) {
+    EXPECT_TRUE(pkey.VerifySignature(signature64, text));
+  }
+  auto parsed = std::chrono::steady_clock::now() - start;
+
+  std::string ed_public, ed_private;
+  ASSERT_TRUE(Crypto::generateEDKeyPair(&ed_public, &ed_private));
+  const std::string ed_signature = Crypto::ED25519Sign(boost::algorithm::unhex(ed_private), text);
+  const PublicKey ed_key(ed_public, KeyType::kED25519);
+  const std::string ed_signature64 = Utils::toBase64(ed_signature);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < verifications; ++i) {
+    EXPECT_TRUE(Crypto::ED25519Verify(boost::algorithm::unhex(ed_public), Utils::fromBase64(ed_signature64), text));
+  }
+  auto ed_parsing = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < verifications; ++i) {
+    EXPECT_TRUE(ed_key.VerifySignature(ed_signature64, text));
+  }
+  auto ed_parsed = std::chrono::steady_clock::now() - start;
+  SignatureCache::global().setCapacity(SignatureCache::kDefaultCapacity);
+
+  auto per_second = [verifications](std::chrono::steady_clock::duration time) {
+    return static_cast<int64_t>(verifications * 1000000 /
+                                std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+  };
+  std::cout << "RSA-2048 verifications per second: " << per_second(parsing) << " parsing the key, "
+            << per_second(parsed) << " with the parsed key\n";
+  std::cout << "ED25519 verifications per second: " << per_second(ed_parsing) << " decoding the key, "
+            << per_second(ed_parsed) << " with the decoded key\n";
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
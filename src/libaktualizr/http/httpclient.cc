@@ -2,6 +2,13 @@
 #include "utilities/utils.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <boost/algorithm/string.hpp>
+#include <map>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -11,15 +18,11 @@
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/ssl.h>
+#include <zlib.h>
 
 #include "crypto/openssl_compat.h"
 #include "utilities/utils.h"
 
-struct WriteStringArg {
-  std::string out;
-  int64_t limit{0};
-};
-
 /*****************************************************************************/
 /**
  * \par Description:
@@ -44,7 +47,232 @@ static size_t writeString(void* contents, size_t size, size_t nmemb, void* userp
   return size * nmemb;
 }
 
-HttpClient::HttpClient() : user_agent(std::string("Aktualizr/") + AKTUALIZR_VERSION) {
+/**
+ * \par Description:
+ *    Compresses data in the gzip format, as used by Content-Encoding: gzip.
+ */
+static std::string gzipCompress(const std::string& data) {
+  z_stream stream{};
+  // 16 added to the window bits selects the gzip header instead of the zlib one
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Could not initialize zlib");
+  }
+  std::string out(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = static_cast<uInt>(out.size());
+  int res = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (res != Z_STREAM_END) {
+    throw std::runtime_error("Could not compress request body");
+  }
+  return out;
+}
+
+/**
+ * \par Description:
+ *    A header handler for the curl library. It picks the cache validators
+ *    (ETag and Last-Modified) and Retry-After out of the response headers.
+ *    https://curl.haxx.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+ */
+static size_t readHeaders(char* buffer, size_t size, size_t nitems, void* userp) {
+  assert(userp);
+  auto* request = static_cast<HttpRequest*>(userp);
+  std::string header(buffer, size * nitems);
+  size_t colon = header.find(':');
+  if (colon != std::string::npos) {
+    std::string name = boost::algorithm::to_lower_copy(header.substr(0, colon));
+    std::string value = boost::algorithm::trim_copy(header.substr(colon + 1));
+    if (name == "etag") {
+      request->validators.etag = value;
+    } else if (name == "last-modified") {
+      request->validators.last_modified = value;
+    } else if (name == "retry-after") {
+      request->retry_after = value;
+    }
+  }
+  return size * nitems;
+}
+
+CurlShareWrapper::CurlShareWrapper() {
+  share_ = curl_share_init();
+  if (share_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl share object");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockFunction);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockFunction);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  // connection pool sharing is only available since curl 7.57.0
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlShareWrapper::~CurlShareWrapper() { curl_share_cleanup(share_); }
+
+void CurlShareWrapper::lockFunction(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+  (void)handle;
+  (void)access;
+  static_cast<CurlShareWrapper*>(userptr)->locks_.at(static_cast<size_t>(data)).lock();
+}
+
+void CurlShareWrapper::unlockFunction(CURL* handle, curl_lock_data data, void* userptr) {
+  (void)handle;
+  static_cast<CurlShareWrapper*>(userptr)->locks_.at(static_cast<size_t>(data)).unlock();
+}
+
+CurlMultiLoop::CurlMultiLoop() {
+  multi_ = curl_multi_init();
+  if (multi_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl multi handle");
+  }
+  if (pipe(wakeup_pipe_.data()) != 0) {
+    curl_multi_cleanup(multi_);
+    throw std::runtime_error(std::string("Could not create wakeup pipe: ") + std::strerror(errno));
+  }
+  for (int fd : wakeup_pipe_) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  thread_ = std::thread(&CurlMultiLoop::run, this);
+}
+
+CurlMultiLoop::~CurlMultiLoop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  wakeup();
+  thread_.join();
+  curl_multi_cleanup(multi_);
+  close(wakeup_pipe_[0]);
+  close(wakeup_pipe_[1]);
+}
+
+/*
+ * done is never called from here, callers may hold a lock that done takes
+ * (see HttpClient::downloadMany()). While the loop is shutting down, the
+ * transfer is aborted by the I/O thread along with the pending ones.
+ */
+void CurlMultiLoop::add(CURL* handle, Completion done, std::chrono::milliseconds delay) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(Pending{handle, std::move(done), std::chrono::steady_clock::now() + delay});
+  }
+  wakeup();
+}
+
+void CurlMultiLoop::cancelDelayed() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_delayed_ = true;
+  }
+  wakeup();
+}
+
+void CurlMultiLoop::wakeup() {
+  const char byte = 0;
+  if (write(wakeup_pipe_[1], &byte, 1) < 0 && errno != EAGAIN) {
+    LOG_ERROR << "Could not wake up the HTTP I/O thread: " << std::strerror(errno);
+  }
+}
+
+void CurlMultiLoop::run() {
+  std::map<CURL*, Completion> running;
+  for (;;) {
+    std::vector<Pending> ready;
+    std::vector<Pending> cancelled;
+    int timeout_ms = kMaxWaitMs;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (shutdown_) {
+        break;
+      }
+      auto now = std::chrono::steady_clock::now();
+      for (auto it = pending_.begin(); it != pending_.end();) {
+        if (it->start <= now) {
+          ready.push_back(std::move(*it));
+          it = pending_.erase(it);
+        } else if (cancel_delayed_) {
+          cancelled.push_back(std::move(*it));
+          it = pending_.erase(it);
+        } else {
+          auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(it->start - now).count() + 1;
+          timeout_ms = std::min(timeout_ms, static_cast<int>(wait));
+          ++it;
+        }
+      }
+      cancel_delayed_ = false;
+    }
+
+    for (auto& transfer : cancelled) {
+      transfer.done(CURLE_ABORTED_BY_CALLBACK);
+    }
+    for (auto& transfer : ready) {
+      CURLMcode mc = curl_multi_add_handle(multi_, transfer.handle);
+      if (mc != CURLM_OK) {
+        LOG_ERROR << "curl multi error: " << curl_multi_strerror(mc);
+        transfer.done(CURLE_FAILED_INIT);
+        continue;
+      }
+      running[transfer.handle] = std::move(transfer.done);
+    }
+
+    int still_running = 0;
+    curl_multi_perform(multi_, &still_running);
+
+    int msgs_in_queue = 0;
+    CURLMsg* msg;
+    while ((msg = curl_multi_info_read(multi_, &msgs_in_queue)) != nullptr) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL* handle = msg->easy_handle;
+      CURLcode result = msg->data.result;
+      curl_multi_remove_handle(multi_, handle);
+      auto it = running.find(handle);
+      Completion done = std::move(it->second);
+      running.erase(it);
+      done(result);
+    }
+
+    curl_waitfd wakeup_fd{wakeup_pipe_[0], CURL_WAIT_POLLIN, 0};
+    curl_multi_wait(multi_, &wakeup_fd, 1, timeout_ms, nullptr);
+    if (wakeup_fd.revents != 0) {
+      char buf[64];
+      while (read(wakeup_pipe_[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+  }
+
+  for (auto& transfer : running) {
+    curl_multi_remove_handle(multi_, transfer.first);
+    transfer.second(CURLE_ABORTED_BY_CALLBACK);
+  }
+  // the completions may add transfers, which are aborted as well
+  for (;;) {
+    std::vector<Pending> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending.swap(pending_);
+    }
+    if (pending.empty()) {
+      break;
+    }
+    for (auto& transfer : pending) {
+      transfer.done(CURLE_ABORTED_BY_CALLBACK);
+    }
+  }
+}
+
+HttpClient::HttpClient()
+    : share_(std::make_shared<CurlShareWrapper>()),
+      loop_(std::make_shared<CurlMultiLoop>()),
+      user_agent(std::string("Aktualizr/") + AKTUALIZR_VERSION),
+      retry_policy_(std::make_shared<BackoffRetryPolicy>(BackoffParams())) {
   curl = curl_easy_init();
   if (curl == nullptr) {
     throw std::runtime_error("Could not initialize curl");
@@ -55,6 +283,8 @@ HttpClient::HttpClient() : user_agent(std::string("Aktualizr/") + AKTUALIZR_VERS
   curlEasySetoptWrapper(curl, CURLOPT_NOSIGNAL, 1L);
   curlEasySetoptWrapper(curl, CURLOPT_TIMEOUT, 60L);
   curlEasySetoptWrapper(curl, CURLOPT_CONNECTTIMEOUT, 60L);
+  curlEasySetoptWrapper(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curlEasySetoptWrapper(curl, CURLOPT_SHARE, share_->get());
 
   // let curl use our write function
   curlEasySetoptWrapper(curl, CURLOPT_WRITEFUNCTION, writeString);
@@ -68,8 +298,17 @@ HttpClient::HttpClient() : user_agent(std::string("Aktualizr/") + AKTUALIZR_VERS
   curlEasySetoptWrapper(curl, CURLOPT_USERAGENT, user_agent.c_str());
 }
 
-HttpClient::HttpClient(const HttpClient& curl_in) : pkcs11_key(curl_in.pkcs11_key), pkcs11_cert(curl_in.pkcs11_key) {
+HttpClient::HttpClient(const HttpClient& curl_in) : share_(curl_in.share_), loop_(curl_in.loop_) {
+  std::lock_guard<std::mutex> lock(curl_in.handles_mutex_);
+  pkcs11_key = curl_in.pkcs11_key;
+  pkcs11_cert = curl_in.pkcs11_cert;
+  retry_policy_ = curl_in.retry_policy_;
+  compress_requests_ = curl_in.compress_requests_.load();
   curl = curl_easy_duphandle(curl_in.curl);
+  if (curl == nullptr) {
+    throw std::runtime_error("Could not duplicate curl handle");
+  }
+  curlEasySetoptWrapper(curl, CURLOPT_SHARE, share_->get());
 
   struct curl_slist* inlist = curl_in.headers;
   headers = nullptr;
@@ -86,31 +325,77 @@ HttpClient::HttpClient(const HttpClient& curl_in) : pkcs11_key(curl_in.pkcs11_ke
     headers = tmp;
     inlist = inlist->next;
   }
+  curlEasySetoptWrapper(curl, CURLOPT_HTTPHEADER, headers);
 }
 
 CurlGlobalInitWrapper HttpClient::manageCurlGlobalInit_{};
 
 HttpClient::~HttpClient() {
+  // requests in flight hold their own handles
   curl_slist_free_all(headers);
   curl_easy_cleanup(curl);
 }
 
-HttpResponse HttpClient::get(const std::string& url, int64_t maxsize) {
-  CURL* curl_get = curl_easy_duphandle(curl);
+/**
+ * Create a per-request copy of the base handle. The copy is attached to the
+ * shared DNS/TLS-session/connection cache, as curl_easy_duphandle does not
+ * inherit the share object, so that it can pick up a live connection left
+ * by a previous request instead of doing a new handshake.
+ *
+ * A curl handle must not be used from several threads at once, so the base
+ * handle is only read under the mutex which setCerts() holds to change it.
+ */
+CURL* HttpClient::dupHandle() {
+  CURL* handle;
+  bool use_pkcs11_key;
+  bool use_pkcs11_cert;
+  {
+    std::lock_guard<std::mutex> lock(handles_mutex_);
+    handle = curl_easy_duphandle(curl);
+    use_pkcs11_key = pkcs11_key;
+    use_pkcs11_cert = pkcs11_cert;
+  }
+  if (handle == nullptr) {
+    throw std::runtime_error("Could not duplicate curl handle");
+  }
+  curlEasySetoptWrapper(handle, CURLOPT_SHARE, share_->get());
 
   // TODO: it is a workaround for an unidentified bug in libcurl. Ideally the bug itself should be fixed.
-  if (pkcs11_key) {
-    curlEasySetoptWrapper(curl_get, CURLOPT_SSLENGINE, "pkcs11");
-    curlEasySetoptWrapper(curl_get, CURLOPT_SSLKEYTYPE, "ENG");
+  if (use_pkcs11_key) {
+    curlEasySetoptWrapper(handle, CURLOPT_SSLENGINE, "pkcs11");
+    curlEasySetoptWrapper(handle, CURLOPT_SSLKEYTYPE, "ENG");
   }
 
-  if (pkcs11_cert) {
-    curlEasySetoptWrapper(curl_get, CURLOPT_SSLCERTTYPE, "ENG");
+  if (use_pkcs11_cert) {
+    curlEasySetoptWrapper(handle, CURLOPT_SSLCERTTYPE, "ENG");
   }
+  return handle;
+}
+
+HttpResponse HttpClient::get(const std::string& url, int64_t maxsize) {
+  return getConditional(url, maxsize, HttpValidators());
+}
+
+HttpResponse HttpClient::getConditional(const std::string& url, int64_t maxsize, const HttpValidators& validators) {
+  HttpResponse response = startGet(url, maxsize, validators).get();
+  http_code = response.http_status_code;
+  return response;
+}
+
+std::future<HttpResponse> HttpClient::getAsync(const std::string& url, int64_t maxsize) {
+  return startGet(url, maxsize, HttpValidators());
+}
+
+std::future<HttpResponse> HttpClient::getConditionalAsync(const std::string& url, int64_t maxsize,
+                                                          const HttpValidators& validators) {
+  return startGet(url, maxsize, validators);
+}
+
+std::future<HttpResponse> HttpClient::startGet(const std::string& url, int64_t maxsize,
+                                               const HttpValidators& validators) {
+  std::shared_ptr<HttpRequest> request = newRequest(maxsize);
+  CURL* curl_get = request->handle;
 
-  // Clear POSTFIELDS to remove any lingering references to strings that have
-  // probably since been deallocated.
-  curlEasySetoptWrapper(curl_get, CURLOPT_POSTFIELDS, "");
   curlEasySetoptWrapper(curl_get, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_get, CURLOPT_HTTPGET, 1L);
   if (maxsize >= 0) {
@@ -120,14 +405,31 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize) {
   }
   curlEasySetoptWrapper(curl_get, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_get, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
+
+  if (!validators.empty()) {
+    for (curl_slist* header = headers; header != nullptr; header = header->next) {
+      request->headers = curl_slist_append(request->headers, header->data);
+    }
+    // If-None-Match takes precedence on the server side anyway
+    if (!validators.etag.empty()) {
+      request->headers = curl_slist_append(request->headers, ("If-None-Match: " + validators.etag).c_str());
+    } else {
+      request->headers =
+          curl_slist_append(request->headers, ("If-Modified-Since: " + validators.last_modified).c_str());
+    }
+    if (request->headers == nullptr) {
+      throw std::runtime_error("curl_slist_append returned null");
+    }
+    curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, request->headers);
+  }
+
   LOG_DEBUG << "GET " << url;
-  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize);
-  curl_easy_cleanup(curl_get);
-  return response;
+  return submit(request);
 }
 
 void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
                           CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
+  std::lock_guard<std::mutex> lock(handles_mutex_);
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYPEER, 1);
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYHOST, 2);
   curlEasySetoptWrapper(curl, CURLOPT_USE_SSL, CURLUSESSL_ALL);
@@ -167,86 +469,226 @@ void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const s
   pkcs11_key = (pkey_source == CryptoSource::kPkcs11);
 }
 
+void HttpClient::newRetryCycle() {
+  std::lock_guard<std::mutex> lock(handles_mutex_);
+  retry_policy_->newCycle();
+}
+
+void HttpClient::interruptRetries() {
+  {
+    std::lock_guard<std::mutex> lock(handles_mutex_);
+    retry_policy_->interrupt();
+  }
+  loop_->cancelDelayed();
+}
+
+// Shared with the copies of this client made afterwards, requests already in flight keep the previous policy
+void HttpClient::setRetryPolicy(std::shared_ptr<RetryPolicy> retry_policy) {
+  std::lock_guard<std::mutex> lock(handles_mutex_);
+  retry_policy_ = std::move(retry_policy);
+}
+
 HttpResponse HttpClient::post(const std::string& url, const Json::Value& data) {
-  curlEasySetoptWrapper(curl, CURLOPT_URL, url.c_str());
-  curlEasySetoptWrapper(curl, CURLOPT_POST, 1);
-  std::string data_str = Json::FastWriter().write(data);
-  curlEasySetoptWrapper(curl, CURLOPT_POSTFIELDS, data_str.c_str());
+  HttpResponse response = postAsync(url, data).get();
+  http_code = response.http_status_code;
+  return response;
+}
+
+std::future<HttpResponse> HttpClient::postAsync(const std::string& url, const Json::Value& data) {
+  std::shared_ptr<HttpRequest> request = newRequest(HttpInterface::kPostRespLimit);
+
+  curlEasySetoptWrapper(request->handle, CURLOPT_URL, url.c_str());
+  curlEasySetoptWrapper(request->handle, CURLOPT_POST, 1);
+  setBody(request.get(), data);
   LOG_TRACE << "post request body:" << data;
-  return perform(curl, RETRY_TIMES, HttpInterface::kPostRespLimit);
+  return submit(request);
 }
 
 HttpResponse HttpClient::put(const std::string& url, const Json::Value& data) {
-  CURL* curl_put = curl_easy_duphandle(curl);
-
-  // TODO: it is a workaround for an unidentified bug in libcurl. Ideally the bug itself should be fixed.
-  if (pkcs11_key) {
-    curlEasySetoptWrapper(curl_put, CURLOPT_SSLENGINE, "pkcs11");
-    curlEasySetoptWrapper(curl_put, CURLOPT_SSLKEYTYPE, "ENG");
-  }
+  HttpResponse response = putAsync(url, data).get();
+  http_code = response.http_status_code;
+  return response;
+}
 
-  if (pkcs11_cert) {
-    curlEasySetoptWrapper(curl_put, CURLOPT_SSLCERTTYPE, "ENG");
-  }
+std::future<HttpResponse> HttpClient::putAsync(const std::string& url, const Json::Value& data) {
+  std::shared_ptr<HttpRequest> request = newRequest(HttpInterface::kPutRespLimit);
 
-  curlEasySetoptWrapper(curl_put, CURLOPT_URL, url.c_str());
-  std::string data_str = Json::FastWriter().write(data);
-  curlEasySetoptWrapper(curl_put, CURLOPT_POSTFIELDS, data_str.c_str());
-  curlEasySetoptWrapper(curl_put, CURLOPT_CUSTOMREQUEST, "PUT");
+  curlEasySetoptWrapper(request->handle, CURLOPT_URL, url.c_str());
+  setBody(request.get(), data);
+  curlEasySetoptWrapper(request->handle, CURLOPT_CUSTOMREQUEST, "PUT");
   LOG_TRACE << "put request body:" << data;
-  HttpResponse result = perform(curl_put, RETRY_TIMES, HttpInterface::kPutRespLimit);
-  curl_easy_cleanup(curl_put);
-  return result;
-}
-
-HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t size_limit) {
-  WriteStringArg response_arg;
-  response_arg.limit = size_limit;
-  curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
-  CURLcode result = curl_easy_perform(curl_handler);
-  curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
-  HttpResponse response(response_arg.out, http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-  if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
-    std::ostringstream error_message;
-    error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
-                  << "): " << response.error_message;
-    LOG_ERROR << error_message.str();
-    if (retry_times != 0) {
-      sleep(1);
-      response = perform(curl_handler, --retry_times, size_limit);
-    }
-  }
-  LOG_TRACE << "response http code: " << response.http_status_code;
-  LOG_TRACE << "response: " << response.body;
-  return response;
+  return submit(request);
 }
 
-HttpResponse HttpClient::download(const std::string& url, curl_write_callback callback, void* userp) {
-  CURL* curl_download = curl_easy_duphandle(curl);
-
-  // TODO: it is a workaround for an unidentified bug in libcurl. Ideally the bug itself should be fixed.
-  if (pkcs11_key) {
-    curlEasySetoptWrapper(curl_download, CURLOPT_SSLENGINE, "pkcs11");
-    curlEasySetoptWrapper(curl_download, CURLOPT_SSLKEYTYPE, "ENG");
+/**
+ * Serializes the request body, gzipped if request compression is enabled and
+ * the body is large enough for it to pay off.
+ */
+void HttpClient::setBody(HttpRequest* request, const Json::Value& data) {
+  request->data = Json::FastWriter().write(data);
+  if (compress_requests_ && request->data.size() >= kMinCompressSize) {
+    request->data = gzipCompress(request->data);
+    for (curl_slist* header = headers; header != nullptr; header = header->next) {
+      request->headers = curl_slist_append(request->headers, header->data);
+    }
+    request->headers = curl_slist_append(request->headers, "Content-Encoding: gzip");
+    if (request->headers == nullptr) {
+      throw std::runtime_error("curl_slist_append returned null");
+    }
+    curlEasySetoptWrapper(request->handle, CURLOPT_HTTPHEADER, request->headers);
   }
+  // the compressed body is binary, it can contain zeros
+  curlEasySetoptWrapper(request->handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request->data.size()));
+  curlEasySetoptWrapper(request->handle, CURLOPT_POSTFIELDS, request->data.c_str());
+}
+
+void HttpClient::setRequestCompression(bool enabled) { compress_requests_ = enabled; }
 
-  if (pkcs11_cert) {
-    curlEasySetoptWrapper(curl_download, CURLOPT_SSLCERTTYPE, "ENG");
+/**
+ * Request with a fresh copy of the base handle, collecting the response body
+ * and the cache validators.
+ */
+std::shared_ptr<HttpRequest> HttpClient::newRequest(int64_t size_limit) {
+  std::shared_ptr<RetryPolicy> retry_policy;
+  {
+    std::lock_guard<std::mutex> lock(handles_mutex_);
+    retry_policy = retry_policy_;
   }
+  auto request = std::make_shared<HttpRequest>(dupHandle(), std::move(retry_policy));
+  // The API responses and metadata are JSON, which compresses well. Curl decompresses them before they reach
+  // writeString, so the size limit applies to the decompressed body. Downloads of targets don't ask for it, the
+  // hashes are over the bytes as they are stored on the server.
+  curlEasySetoptWrapper(request->handle, CURLOPT_ACCEPT_ENCODING, "");
+  request->body.limit = size_limit;
+  curlEasySetoptWrapper(request->handle, CURLOPT_WRITEDATA, static_cast<void*>(&request->body));
+  curlEasySetoptWrapper(request->handle, CURLOPT_HEADERFUNCTION, readHeaders);
+  curlEasySetoptWrapper(request->handle, CURLOPT_HEADERDATA, static_cast<void*>(request.get()));
+  return request;
+}
+
+/**
+ * Hands the request over to the I/O thread. Failed requests (curl errors,
+ * 5xx and 429 responses) are started again after the delay chosen by the
+ * retry policy, the wait happens on the I/O thread as well. The completion
+ * callback runs on the I/O thread.
+ */
+static void startRequest(CurlMultiLoop* loop, const std::shared_ptr<HttpRequest>& request,
+                         std::chrono::milliseconds delay) {
+  loop->add(request->handle,
+            [loop, request](CURLcode result) {
+              long http_code = 0;  // NOLINT
+              curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &http_code);
+              HttpResponse response(request->body.out, http_code, result,
+                                    (result != CURLE_OK) ? curl_easy_strerror(result) : "");
+              response.validators = request->validators;
+              if (request->report_errors && (response.curl_code != CURLE_OK || response.http_status_code >= 500 ||
+                                             response.http_status_code == 429)) {
+                std::ostringstream error_message;
+                error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
+                              << "): " << response.error_message;
+                LOG_ERROR << error_message.str();
+                // aborted means that the client is going away or the retries were interrupted
+                std::chrono::milliseconds retry_delay{0};
+                if (request->retry_policy && result != CURLE_ABORTED_BY_CALLBACK &&
+                    request->retry_policy->shouldRetry(request->retries, request->retry_after, &retry_delay)) {
+                  ++request->retries;
+                  LOG_DEBUG << "Retrying in " << retry_delay.count() << " ms";
+                  request->body.out.clear();
+                  request->validators = HttpValidators();
+                  request->retry_after.clear();
+                  startRequest(loop, request, retry_delay);
+                  return;
+                }
+              }
+              LOG_TRACE << "response http code: " << response.http_status_code;
+              LOG_TRACE << "response: " << response.body;
+              request->done(response);
+            },
+            delay);
+}
+
+std::future<HttpResponse> HttpClient::submit(const std::shared_ptr<HttpRequest>& request) {
+  auto promise = std::make_shared<std::promise<HttpResponse>>();
+  request->done = [promise](const HttpResponse& response) { promise->set_value(response); };
+  startRequest(loop_.get(), request, std::chrono::milliseconds(0));
+  return promise->get_future();
+}
 
-  curlEasySetoptWrapper(curl_download, CURLOPT_URL, url.c_str());
+CURL* HttpClient::downloadHandle(const DownloadRequest& request) {
+  CURL* curl_download = dupHandle();
+
+  curlEasySetoptWrapper(curl_download, CURLOPT_URL, request.url.c_str());
   curlEasySetoptWrapper(curl_download, CURLOPT_HTTPGET, 1L);
   curlEasySetoptWrapper(curl_download, CURLOPT_FOLLOWLOCATION, 1L);
-  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, callback);
-  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEDATA, userp);
+  // error pages are not handed to the callback, they would end up in the image
+  curlEasySetoptWrapper(curl_download, CURLOPT_FAILONERROR, 1L);
+  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, request.callback);
+  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEDATA, request.userp);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
+  // sends a Range request, curl fails with CURLE_RANGE_ERROR if the server ignores it
+  curlEasySetoptWrapper(curl_download, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(request.from));
+  return curl_download;
+}
+
+std::shared_ptr<HttpRequest> HttpClient::newDownload(const DownloadRequest& download) {
+  // downloads are not retried, the caller knows best how to continue
+  auto request = std::make_shared<HttpRequest>(downloadHandle(download), nullptr);
+  request->report_errors = false;
+  LOG_DEBUG << "GET " << download.url;
+  return request;
+}
 
-  CURLcode result = curl_easy_perform(curl_download);
-  curl_easy_getinfo(curl_download, CURLINFO_RESPONSE_CODE, &http_code);
-  HttpResponse response("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-  curl_easy_cleanup(curl_download);
+HttpResponse HttpClient::download(const std::string& url, curl_write_callback callback, void* userp, size_t from) {
+  HttpResponse response = downloadAsync(url, callback, userp, from).get();
+  http_code = response.http_status_code;
   return response;
 }
 
+std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl_write_callback callback,
+                                                    void* userp, size_t from) {
+  return submit(newDownload(DownloadRequest(url, callback, userp, from)));
+}
+
+/*
+ * Keeps up to max_parallel downloads running on the I/O thread, the next one
+ * is started as soon as one of them finishes.
+ */
+std::vector<HttpResponse> HttpClient::downloadMany(const std::vector<DownloadRequest>& requests, size_t max_parallel) {
+  std::vector<HttpResponse> responses(requests.size(), HttpResponse("", 0, CURLE_FAILED_INIT, "Download not started"));
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t next = 0;
+  size_t finished = 0;
+
+  // called with the mutex held
+  std::function<void()> start_next = [&]() {
+    while (next < requests.size()) {
+      size_t index = next++;
+      try {
+        std::shared_ptr<HttpRequest> request = newDownload(requests[index]);
+        request->done = [&, index](const HttpResponse& response) {
+          std::lock_guard<std::mutex> lock(mutex);
+          responses[index] = response;
+          ++finished;
+          start_next();
+          cv.notify_all();
+        };
+        startRequest(loop_.get(), request, std::chrono::milliseconds(0));
+        return;
+      } catch (const std::exception& e) {
+        responses[index] = HttpResponse("", 0, CURLE_FAILED_INIT, e.what());
+        ++finished;
+      }
+    }
+  };
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (size_t i = 0; i < std::max<size_t>(max_parallel, 1); ++i) {
+    start_next();
+  }
+  cv.wait(lock, [&]() { return finished == requests.size(); });
+  return responses;
+}
+
 // vim: set tabstop=2 shiftwidth=2 expandtab:
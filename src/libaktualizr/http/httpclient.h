@@ -3,11 +3,20 @@
 
 #include <curl/curl.h>
 #include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "json/json.h"
 
 #include "httpinterface.h"
 #include "logging/logging.h"
+#include "retrypolicy.h"
 #include "utilities/utils.h"
 
 /**
@@ -23,19 +32,126 @@ class CurlGlobalInitWrapper {
   CurlGlobalInitWrapper(CurlGlobalInitWrapper &&) = delete;
 };
 
+/**
+ * Curl share object holding the DNS cache, TLS session cache and connection
+ * pool. It is shared between all the handles created by an HttpClient (and
+ * its copies) so that consecutive requests to the same server skip the
+ * lookup, TCP connect and full TLS handshake.
+ */
+class CurlShareWrapper {
+ public:
+  CurlShareWrapper();
+  ~CurlShareWrapper();
+  CurlShareWrapper &operator=(const CurlShareWrapper &) = delete;
+  CurlShareWrapper(const CurlShareWrapper &) = delete;
+  CurlShareWrapper &operator=(CurlShareWrapper &&) = delete;
+  CurlShareWrapper(CurlShareWrapper &&) = delete;
+  CURLSH *get() { return share_; }
+
+ private:
+  static void lockFunction(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+  static void unlockFunction(CURL *handle, curl_lock_data data, void *userptr);
+
+  CURLSH *share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+};
+
+/**
+ * Event loop driving all the transfers of an HttpClient (and its copies) on a
+ * single I/O thread, over a curl multi handle.
+ */
+class CurlMultiLoop {
+ public:
+  using Completion = std::function<void(CURLcode)>;
+  CurlMultiLoop();
+  ~CurlMultiLoop();
+  CurlMultiLoop &operator=(const CurlMultiLoop &) = delete;
+  CurlMultiLoop(const CurlMultiLoop &) = delete;
+  CurlMultiLoop &operator=(CurlMultiLoop &&) = delete;
+  CurlMultiLoop(CurlMultiLoop &&) = delete;
+  // Starts the transfer on the I/O thread after the delay. done is always called on the I/O thread, with
+  // CURLE_ABORTED_BY_CALLBACK if the loop is shutting down.
+  void add(CURL *handle, Completion done, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+  // Ends the delay of the transfers that are not started yet, they complete with CURLE_ABORTED_BY_CALLBACK
+  void cancelDelayed();
+
+ private:
+  struct Pending {
+    CURL *handle;
+    Completion done;
+    std::chrono::steady_clock::time_point start;
+  };
+  static const int kMaxWaitMs = 1000;
+  void run();
+  void wakeup();
+
+  CURLM *multi_;
+  std::array<int, 2> wakeup_pipe_{{-1, -1}};
+  std::mutex mutex_;
+  std::vector<Pending> pending_;
+  bool shutdown_{false};
+  bool cancel_delayed_{false};
+  std::thread thread_;
+};
+
+struct WriteStringArg {
+  std::string out;
+  int64_t limit{0};
+};
+
+/**
+ * A request in flight. It owns the curl handle and everything the handle
+ * points to until the I/O thread is done with it.
+ */
+struct HttpRequest {
+  HttpRequest(CURL *handle_in, std::shared_ptr<RetryPolicy> retry_policy_in)
+      : handle(handle_in), retry_policy(std::move(retry_policy_in)) {}
+  ~HttpRequest() {
+    curl_easy_cleanup(handle);
+    curl_slist_free_all(headers);
+  }
+  HttpRequest &operator=(const HttpRequest &) = delete;
+  HttpRequest(const HttpRequest &) = delete;
+  CURL *handle;
+  // no retries if null
+  std::shared_ptr<RetryPolicy> retry_policy;
+  unsigned int retries{0};
+  bool report_errors{true};
+  curl_slist *headers{nullptr};
+  std::string data;
+  WriteStringArg body;
+  HttpValidators validators;
+  std::string retry_after;
+  std::function<void(const HttpResponse &)> done;
+};
+
 class HttpClient : public HttpInterface {
  public:
   HttpClient();
   HttpClient(const HttpClient & /*curl_in*/);
   ~HttpClient() override;
   HttpResponse get(const std::string &url, int64_t maxsize) override;
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const HttpValidators &validators) override;
   HttpResponse post(const std::string &url, const Json::Value &data) override;
   HttpResponse put(const std::string &url, const Json::Value &data) override;
+  std::future<HttpResponse> getAsync(const std::string &url, int64_t maxsize) override;
+  std::future<HttpResponse> getConditionalAsync(const std::string &url, int64_t maxsize,
+                                                const HttpValidators &validators) override;
+  std::future<HttpResponse> postAsync(const std::string &url, const Json::Value &data) override;
+  std::future<HttpResponse> putAsync(const std::string &url, const Json::Value &data) override;
 
-  HttpResponse download(const std::string &url, curl_write_callback callback, void *userp) override;
+  HttpResponse download(const std::string &url, curl_write_callback callback, void *userp, size_t from = 0) override;
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback callback, void *userp,
+                                          size_t from = 0) override;
+  std::vector<HttpResponse> downloadMany(const std::vector<DownloadRequest> &requests, size_t max_parallel) override;
   void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
                 const std::string &pkey, CryptoSource pkey_source) override;
-  long http_code{};  // NOLINT
+  void newRetryCycle() override;
+  void interruptRetries() override;
+  void setRetryPolicy(std::shared_ptr<RetryPolicy> retry_policy);
+  // Sends POST and PUT bodies gzipped, the server has to support Content-Encoding: gzip
+  void setRequestCompression(bool enabled);
+  std::atomic<long> http_code{};  // NOLINT
 
  private:
   FRIEND_TEST(GetTest, download_speed_limit);
@@ -51,14 +167,29 @@ class HttpClient : public HttpInterface {
   static CurlGlobalInitWrapper manageCurlGlobalInit_;
   CURL *curl;
   curl_slist *headers;
-  HttpResponse perform(CURL *curl_handler, int retry_times, int64_t size_limit);
+  std::shared_ptr<CurlShareWrapper> share_;
+  // declared after share_ so that it is destroyed first, the handles in flight still use the share
+  std::shared_ptr<CurlMultiLoop> loop_;
+  // guards the base handle and its settings
+  mutable std::mutex handles_mutex_;
+  CURL *dupHandle();
+  CURL *downloadHandle(const DownloadRequest &request);
+  std::shared_ptr<HttpRequest> newRequest(int64_t size_limit);
+  void setBody(HttpRequest *request, const Json::Value &data);
+  std::shared_ptr<HttpRequest> newDownload(const DownloadRequest &download);
+  std::future<HttpResponse> startGet(const std::string &url, int64_t maxsize, const HttpValidators &validators);
+  std::future<HttpResponse> submit(const std::shared_ptr<HttpRequest> &request);
   std::string user_agent;
 
   static CURLcode sslCtxFunction(CURL *handle, void *sslctx, void *parm);
   std::unique_ptr<TemporaryFile> tls_ca_file;
   std::unique_ptr<TemporaryFile> tls_cert_file;
   std::unique_ptr<TemporaryFile> tls_pkey_file;
-  static const int RETRY_TIMES = 2;
+  // guarded by handles_mutex_
+  std::shared_ptr<RetryPolicy> retry_policy_;
+  std::atomic<bool> compress_requests_{false};
+  // smaller bodies are sent as they are
+  static const size_t kMinCompressSize = 1024;
   static const long kSpeedLimitTimeInterval = 60L;   // NOLINT
   static const long kSpeedLimitBytesPerSec = 5000L;  // NOLINT
 
@@ -2,7 +2,10 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <thread>
 
 #include "json/json.h"
 
@@ -12,6 +15,7 @@
 #include "utilities/utils.h"
 
 static std::string server = "http://127.0.0.1:";
+static std::string tls_server = "https://localhost:";
 
 TEST(CopyConstructorTest, copied) {
   HttpClient http;
@@ -28,6 +32,24 @@ TEST(GetTest, get_performed) {
   EXPECT_EQ(response["path"].asString(), path);
 }
 
+TEST(GetTest, conditional_get) {
+  HttpClient http;
+  HttpResponse resp = http.get(server + "/etag", HttpInterface::kNoLimit);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(resp.body, "content");
+  EXPECT_EQ(resp.validators.etag, "\"0123\"");
+
+  resp = http.getConditional(server + "/etag", HttpInterface::kNoLimit, resp.validators);
+  EXPECT_TRUE(resp.isNotModified());
+  EXPECT_EQ(resp.body, "");
+
+  HttpValidators other;
+  other.etag = "\"4567\"";
+  resp = http.getConditional(server + "/etag", HttpInterface::kNoLimit, other);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(resp.body, "content");
+}
+
 TEST(GetTest, download_size_limit) {
   HttpClient http;
   std::string path = "/large_file";
@@ -68,7 +90,221 @@ TEST(PostTest, put_performed) {
   EXPECT_EQ(json["data"]["key"].asString(), "val");
 }
 
-// TODO: add tests for HttpClient::download
+TEST(AsyncTest, requests_overlap) {
+  HttpClient http;
+  std::vector<std::future<HttpResponse>> gets;
+  for (int i = 0; i < 3; ++i) {
+    gets.push_back(http.getAsync(server + "/download/file", HttpInterface::kNoLimit));
+  }
+  Json::Value data;
+  data["key"] = "val";
+  std::future<HttpResponse> put = http.putAsync(server + "/path/1", data);
+
+  for (auto& get : gets) {
+    HttpResponse response = get.get();
+    EXPECT_TRUE(response.isOk());
+    EXPECT_EQ(response.body, "content");
+  }
+  Json::Value json = put.get().getJson();
+  EXPECT_EQ(json["path"].asString(), "/path/1");
+  EXPECT_EQ(json["data"]["key"].asString(), "val");
+}
+
+static int tlsHandshakes(HttpClient& http) {
+  Json::Value resp = http.get(tls_server + "/handshakes", HttpInterface::kNoLimit).getJson();
+  return resp["handshakes"].asInt();
+}
+
+/*
+ * Consecutive requests, including ones from a copied client, reuse the
+ * already established TLS connection instead of doing a new handshake.
+ */
+TEST(TlsTest, connection_reused) {
+  HttpClient http;
+  std::string cert = Utils::readFile("tests/fake_http_server/client.crt");
+  std::string pkey = Utils::readFile("tests/fake_http_server/client.key");
+  http.setCerts(cert, CryptoSource::kFile, cert, CryptoSource::kFile, pkey, CryptoSource::kFile);
+
+  int handshakes_before = tlsHandshakes(http);
+  EXPECT_GE(handshakes_before, 1);
+
+  Json::Value data;
+  data["key"] = "val";
+  for (int i = 0; i < 5; ++i) {
+    std::string path = "/path/" + std::to_string(i);
+    EXPECT_EQ(http.get(tls_server + path, HttpInterface::kNoLimit).getJson()["path"].asString(), path);
+    EXPECT_EQ(http.put(tls_server + path, data).getJson()["data"]["key"].asString(), "val");
+    EXPECT_EQ(http.post(tls_server + path, data).getJson()["path"].asString(), path);
+  }
+
+  HttpClient http_copy(http);
+  EXPECT_EQ(http_copy.get(tls_server + "/copy", HttpInterface::kNoLimit).getJson()["path"].asString(), "/copy");
+
+  EXPECT_EQ(tlsHandshakes(http), handshakes_before);
+}
+
+static size_t writeString(char* contents, size_t size, size_t nmemb, void* userp) {
+  static_cast<std::string*>(userp)->append(contents, size * nmemb);
+  return size * nmemb;
+}
+
+TEST(DownloadTest, download_many) {
+  HttpClient http;
+  std::vector<std::string> bodies(5);
+  std::vector<DownloadRequest> requests;
+  for (size_t i = 0; i < 4; ++i) {
+    requests.emplace_back(server + "/download", writeString, &bodies[i]);
+  }
+  requests.emplace_back(server + "/large_file", writeString, &bodies[4]);
+
+  std::vector<HttpResponse> responses = http.downloadMany(requests, 2);
+  ASSERT_EQ(responses.size(), requests.size());
+  for (size_t i = 0; i < 4; ++i) {
+    EXPECT_TRUE(responses[i].isOk());
+    EXPECT_EQ(bodies[i], "content");
+  }
+  EXPECT_TRUE(responses[4].isOk());
+  EXPECT_EQ(bodies[4], std::string(2048, '@'));
+}
+
+/*
+ * A single client (and a copy of it) can be used from several threads at
+ * once.
+ */
+TEST(ThreadSafety, parallel_requests) {
+  HttpClient http;
+  HttpClient http_copy(http);
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&http, &http_copy, &failures, t]() {
+      HttpClient& client = (t % 2 == 0) ? http : http_copy;
+      for (int i = 0; i < 25; ++i) {
+        switch (i % 3) {
+          case 0: {
+            HttpResponse response = client.get(server + "/download/file", HttpInterface::kNoLimit);
+            if (!response.isOk() || response.body != "content") {
+              ++failures;
+            }
+            break;
+          }
+          case 1: {
+            if (!client.get(server + "/etag", HttpInterface::kNoLimit).isOk()) {
+              ++failures;
+            }
+            break;
+          }
+          default: {
+            std::string body;
+            HttpResponse response = client.downloadAsync(server + "/download", writeString, &body).get();
+            if (!response.isOk() || body != "content") {
+              ++failures;
+            }
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures, 0);
+}
+
+/*
+ * Responses are requested compressed and the size limit applies to the
+ * decompressed body.
+ */
+TEST(CompressionTest, compressed_response) {
+  HttpClient http;
+  HttpResponse response = http.get(server + "/compressed", HttpInterface::kNoLimit);
+  EXPECT_TRUE(response.isOk());
+  EXPECT_EQ(response.getJson()["data"].asString(), std::string(4096, 'a'));
+
+  // only a couple of kB compressed
+  response = http.get(server + "/gzip_bomb", 64 * 1024);
+  EXPECT_FALSE(response.isOk());
+  EXPECT_EQ(response.curl_code, CURLE_WRITE_ERROR);
+}
+
+TEST(CompressionTest, compressed_request) {
+  HttpClient http;
+  http.setRequestCompression(true);
+  Json::Value data;
+  data["key"] = std::string(4096, 'b');
+  Json::Value json = http.put(server + "/path/1", data).getJson();
+  EXPECT_EQ(json["data"]["key"].asString(), data["key"].asString());
+
+  // small bodies are sent as they are
+  data["key"] = "val";
+  json = http.post(server + "/path/2", data).getJson();
+  EXPECT_EQ(json["data"]["key"].asString(), "val");
+}
+
+/*
+ * Interrupting the retries ends the wait of a request for its next attempt
+ * right away.
+ */
+TEST(RetryTest, interrupt_wait) {
+  HttpClient http;
+  BackoffParams params;
+  params.max_retries = 5;
+  params.base_delay = std::chrono::milliseconds(60000);
+  params.max_delay = std::chrono::milliseconds(60000);
+  http.setRetryPolicy(std::make_shared<BackoffRetryPolicy>(params, std::chrono::system_clock::now,
+                                                           [](uint64_t bound) { return bound; }));
+
+  // nothing listens there
+  std::string unreachable = "http://127.0.0.1:" + TestUtils::getFreePort();
+  auto start = std::chrono::steady_clock::now();
+  std::future<HttpResponse> response = http.getAsync(unreachable, HttpInterface::kNoLimit);
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  http.interruptRetries();
+  EXPECT_FALSE(response.get().isOk());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+/*
+ * A download resumed from an offset receives the rest of the file.
+ */
+TEST(DownloadTest, resume) {
+  HttpClient http;
+  std::string body;
+  HttpResponse resp = http.download(server + "/range", writeString, &body, 4);
+  EXPECT_EQ(resp.curl_code, CURLE_OK);
+  EXPECT_EQ(resp.http_status_code, 206);
+  EXPECT_EQ(body, "456789");
+}
+
+/*
+ * A server that answers a resumed download with the whole file fails the
+ * download before anything is written.
+ */
+TEST(DownloadTest, resume_range_ignored) {
+  HttpClient http;
+  std::string body;
+  HttpResponse resp = http.download(server + "/range_ignored", writeString, &body, 4);
+  EXPECT_EQ(resp.curl_code, CURLE_RANGE_ERROR);
+  EXPECT_EQ(resp.http_status_code, 200);
+  EXPECT_EQ(body, "");
+
+  resp = http.download(server + "/range_ignored", writeString, &body, 0);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(body, "0123456789");
+}
+
+/*
+ * The error page of a failed download is not written.
+ */
+TEST(DownloadTest, resume_server_error) {
+  HttpClient http;
+  std::string body;
+  HttpResponse resp = http.download(server + "/range_error", writeString, &body, 4);
+  EXPECT_EQ(resp.curl_code, CURLE_HTTP_RETURNED_ERROR);
+  EXPECT_EQ(resp.http_status_code, 503);
+  EXPECT_EQ(body, "");
+}
 
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
@@ -78,6 +314,10 @@ int main(int argc, char** argv) {
   server += port;
   TestHelperProcess server_process("tests/fake_http_server/fake_http_server.py", port);
 
+  std::string tls_port = TestUtils::getFreePort();
+  tls_server += tls_port;
+  TestHelperProcess tls_server_process("tests/fake_http_server/fake_tls_server.py", tls_port);
+
   sleep(4);
 
   return RUN_ALL_TESTS();
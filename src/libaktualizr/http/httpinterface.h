@@ -1,8 +1,10 @@
 #ifndef HTTPINTERFACE_H_
 #define HTTPINTERFACE_H_
 
+#include <future>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <curl/curl.h>
 #include "json/json.h"
@@ -10,6 +12,13 @@
 #include "utilities/types.h"
 #include "utilities/utils.h"
 
+// Response headers identifying a version of a resource, sent back in conditional requests
+struct HttpValidators {
+  std::string etag;
+  std::string last_modified;
+  bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
 struct HttpResponse {
   HttpResponse(std::string body_in, const long http_status_code_in, CURLcode curl_code_in,  // NOLINT
                std::string error_message_in)
@@ -21,8 +30,19 @@ struct HttpResponse {
   long http_status_code;  // NOLINT
   CURLcode curl_code;
   std::string error_message;
-  bool isOk() { return (curl_code == CURLE_OK && http_status_code >= 200 && http_status_code < 205); }
-  Json::Value getJson() { return Utils::parseJSON(body); }
+  HttpValidators validators;
+  bool isOk() const { return (curl_code == CURLE_OK && http_status_code >= 200 && http_status_code < 205); }
+  bool isNotModified() const { return curl_code == CURLE_OK && http_status_code == 304; }
+  Json::Value getJson() const { return Utils::parseJSON(body); }
+};
+
+struct DownloadRequest {
+  DownloadRequest(std::string url_in, curl_write_callback callback_in, void *userp_in, size_t from_in = 0)
+      : url(std::move(url_in)), callback(callback_in), userp(userp_in), from(from_in) {}
+  std::string url;
+  curl_write_callback callback;
+  void *userp;
+  size_t from;
 };
 
 class HttpInterface {
@@ -30,15 +50,62 @@ class HttpInterface {
   HttpInterface() = default;
   virtual ~HttpInterface() = default;
   virtual HttpResponse get(const std::string &url, int64_t maxsize) = 0;
+  // Sends If-None-Match/If-Modified-Since with the given validators, a 304 response means the resource has not
+  // changed. Implementations that don't support it just fetch the resource in full.
+  virtual HttpResponse getConditional(const std::string &url, int64_t maxsize, const HttpValidators &validators) {
+    (void)validators;
+    return get(url, maxsize);
+  }
   virtual HttpResponse post(const std::string &url, const Json::Value &data) = 0;
   virtual HttpResponse put(const std::string &url, const Json::Value &data) = 0;
 
-  virtual HttpResponse download(const std::string &url, curl_write_callback callback, void *userp) = 0;
+  // Asynchronous variants, the request runs in the background until the response is needed. Implementations that
+  // don't support it perform the request right away.
+  virtual std::future<HttpResponse> getAsync(const std::string &url, int64_t maxsize) {
+    return readyResponse(get(url, maxsize));
+  }
+  virtual std::future<HttpResponse> getConditionalAsync(const std::string &url, int64_t maxsize,
+                                                        const HttpValidators &validators) {
+    return readyResponse(getConditional(url, maxsize, validators));
+  }
+  virtual std::future<HttpResponse> postAsync(const std::string &url, const Json::Value &data) {
+    return readyResponse(post(url, data));
+  }
+  virtual std::future<HttpResponse> putAsync(const std::string &url, const Json::Value &data) {
+    return readyResponse(put(url, data));
+  }
+
+  // from > 0 requests only the content starting at that offset, e.g. to resume an interrupted download
+  virtual HttpResponse download(const std::string &url, curl_write_callback callback, void *userp, size_t from = 0) = 0;
+  virtual std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback callback, void *userp,
+                                                  size_t from = 0) {
+    return readyResponse(download(url, callback, userp, from));
+  }
+  // Runs several downloads, with at most max_parallel of them at the same time. Responses are in the request order.
+  virtual std::vector<HttpResponse> downloadMany(const std::vector<DownloadRequest> &requests, size_t max_parallel) {
+    (void)max_parallel;
+    std::vector<HttpResponse> responses;
+    for (const auto &request : requests) {
+      responses.push_back(download(request.url, request.callback, request.userp, request.from));
+    }
+    return responses;
+  }
   virtual void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
                         CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) = 0;
+  // Gives failed requests a fresh retry budget, called at the start of each update cycle
+  virtual void newRetryCycle() {}
+  // Stops waiting for and doing retries, requests waiting for one fail right away
+  virtual void interruptRetries() {}
   static constexpr int64_t kNoLimit = 0;  // no limit the size of downloaded data
   static constexpr int64_t kPostRespLimit = 64 * 1024;
   static constexpr int64_t kPutRespLimit = 64 * 1024;
+
+ protected:
+  static std::future<HttpResponse> readyResponse(HttpResponse response) {
+    std::promise<HttpResponse> promise;
+    promise.set_value(std::move(response));
+    return promise.get_future();
+  }
 };
 
 #endif  // HTTPINTERFACE_H_
@@ -0,0 +1,88 @@
+#include "retrypolicy.h"
+
+#include <time.h>
+#include <algorithm>
+#include <cctype>
+
+#include "logging/logging.h"
+
+BackoffRetryPolicy::BackoffRetryPolicy(const BackoffParams &params, Clock clock, Random random)
+    : params_(params),
+      clock_(std::move(clock)),
+      random_(std::move(random)),
+      engine_(std::random_device{}()),
+      budget_left_(params.cycle_budget) {}
+
+void BackoffRetryPolicy::newCycle() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_left_ = params_.cycle_budget;
+}
+
+unsigned int BackoffRetryPolicy::budgetLeft() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return budget_left_;
+}
+
+bool BackoffRetryPolicy::parseRetryAfter(const std::string &value, std::chrono::system_clock::time_point now,
+                                         std::chrono::milliseconds *delay) {
+  if (value.empty()) {
+    return false;
+  }
+  if (std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+    // anything longer is more than thirty years anyway
+    if (value.size() > 9) {
+      *delay = std::chrono::milliseconds::max();
+    } else {
+      *delay = std::chrono::seconds(static_cast<std::chrono::seconds::rep>(std::stoul(value)));
+    }
+    return true;
+  }
+
+  // HTTP-date, always in GMT
+  struct tm tm {};
+  const char *end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S", &tm);
+  if (end == nullptr) {
+    return false;
+  }
+  auto when = std::chrono::system_clock::from_time_t(timegm(&tm));
+  *delay = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(when - now), std::chrono::milliseconds(0));
+  return true;
+}
+
+uint64_t BackoffRetryPolicy::randomDelay(uint64_t bound) {
+  if (random_) {
+    return std::min(random_(bound), bound);
+  }
+  return std::uniform_int_distribution<uint64_t>(0, bound)(engine_);
+}
+
+bool BackoffRetryPolicy::nextDelay(unsigned int retries, const std::string &retry_after,
+                                   std::chrono::milliseconds *delay) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (retries >= params_.max_retries) {
+    return false;
+  }
+  if (budget_left_ == 0) {
+    LOG_WARNING << "No HTTP retries left for this update cycle";
+    return false;
+  }
+
+  std::chrono::milliseconds wait{0};
+  if (parseRetryAfter(retry_after, clock_(), &wait)) {
+    if (wait > params_.max_delay) {
+      LOG_WARNING << "Server asked to retry after " << retry_after << ", giving up";
+      return false;
+    }
+  } else {
+    const auto max_delay = static_cast<uint64_t>(params_.max_delay.count());
+    const auto base_delay = static_cast<uint64_t>(params_.base_delay.count());
+    uint64_t ceiling = max_delay;
+    if (retries < 32 && base_delay <= (max_delay >> retries)) {
+      ceiling = base_delay << retries;
+    }
+    wait = std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(randomDelay(ceiling)));
+  }
+  --budget_left_;
+  *delay = wait;
+  return true;
+}
@@ -0,0 +1,92 @@
+#ifndef HTTP_RETRYPOLICY_H_
+#define HTTP_RETRYPOLICY_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+
+/**
+ * Decides if and when a failed HTTP request is tried again. A policy is shared
+ * by all the requests of an HttpClient (and its copies), so it can limit the
+ * total number of retries.
+ */
+class RetryPolicy {
+ public:
+  RetryPolicy() = default;
+  virtual ~RetryPolicy() = default;
+  RetryPolicy &operator=(const RetryPolicy &) = delete;
+  RetryPolicy(const RetryPolicy &) = delete;
+  RetryPolicy &operator=(RetryPolicy &&) = delete;
+  RetryPolicy(RetryPolicy &&) = delete;
+
+  // Called after a failed attempt, retries is the number of retries already done for this request and
+  // retry_after the value of the Retry-After response header, if any. Returns false to give up, otherwise
+  // *delay is how long to wait before the next attempt.
+  bool shouldRetry(unsigned int retries, const std::string &retry_after, std::chrono::milliseconds *delay) {
+    if (interrupted_) {
+      return false;
+    }
+    return nextDelay(retries, retry_after, delay);
+  }
+  // Resets the per-cycle state, called at the start of each update cycle
+  virtual void newCycle() {}
+  // Stops all the retries for good, e.g. when shutting down
+  void interrupt() { interrupted_ = true; }
+  bool interrupted() const { return interrupted_; }
+
+ protected:
+  virtual bool nextDelay(unsigned int retries, const std::string &retry_after, std::chrono::milliseconds *delay) = 0;
+
+ private:
+  std::atomic<bool> interrupted_{false};
+};
+
+struct BackoffParams {
+  unsigned int max_retries{2};
+  std::chrono::milliseconds base_delay{1000};
+  std::chrono::milliseconds max_delay{60000};
+  // maximum number of retries of all the requests together during an update cycle
+  unsigned int cycle_budget{20};
+};
+
+/**
+ * Exponential backoff with full jitter: the n-th retry waits a random time
+ * between zero and min(max_delay, base_delay * 2^n), so that devices which
+ * failed at the same time don't retry in lockstep. A Retry-After header from
+ * the server takes precedence, but the request is given up if the server
+ * asks to wait longer than max_delay.
+ */
+class BackoffRetryPolicy : public RetryPolicy {
+ public:
+  using Clock = std::function<std::chrono::system_clock::time_point()>;
+  // Returns a uniformly distributed number in [0, bound]
+  using Random = std::function<uint64_t(uint64_t bound)>;
+
+  explicit BackoffRetryPolicy(const BackoffParams &params, Clock clock = std::chrono::system_clock::now,
+                              Random random = nullptr);
+  void newCycle() override;
+  unsigned int budgetLeft() const;
+
+  // Parses the delta-seconds or HTTP-date form of Retry-After, relative to now. Returns false if it is invalid.
+  static bool parseRetryAfter(const std::string &value, std::chrono::system_clock::time_point now,
+                              std::chrono::milliseconds *delay);
+
+ protected:
+  bool nextDelay(unsigned int retries, const std::string &retry_after, std::chrono::milliseconds *delay) override;
+
+ private:
+  uint64_t randomDelay(uint64_t bound);
+
+  const BackoffParams params_;
+  Clock clock_;
+  Random random_;
+  std::mt19937_64 engine_;
+  mutable std::mutex mutex_;
+  unsigned int budget_left_;
+};
+
+#endif  // HTTP_RETRYPOLICY_H_
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#include "http/retrypolicy.h"
+
+using std::chrono::milliseconds;
+
+// Wed, 21 Oct 2015 07:28:00 GMT
+static const std::chrono::system_clock::time_point kNow = std::chrono::system_clock::from_time_t(1445412480);
+
+static std::chrono::system_clock::time_point fixedClock() { return kNow; }
+
+static uint64_t maxRandom(uint64_t bound) { return bound; }
+
+static BackoffParams params(unsigned int max_retries, unsigned int cycle_budget) {
+  BackoffParams p;
+  p.max_retries = max_retries;
+  p.base_delay = milliseconds(1000);
+  p.max_delay = milliseconds(5000);
+  p.cycle_budget = cycle_budget;
+  return p;
+}
+
+/*
+ * The upper bound of the delay doubles with each retry, up to the maximum delay.
+ */
+TEST(RetryPolicy, exponential_backoff) {
+  BackoffRetryPolicy policy(params(6, 100), fixedClock, maxRandom);
+  const std::vector<milliseconds> expected{milliseconds(1000), milliseconds(2000), milliseconds(4000),
+                                           milliseconds(5000), milliseconds(5000), milliseconds(5000)};
+  for (unsigned int retries = 0; retries < expected.size(); ++retries) {
+    milliseconds delay{-1};
+    EXPECT_TRUE(policy.shouldRetry(retries, "", &delay));
+    EXPECT_EQ(delay, expected[retries]);
+  }
+  milliseconds delay{-1};
+  EXPECT_FALSE(policy.shouldRetry(6, "", &delay));
+}
+
+/*
+ * The actual delay is drawn uniformly between zero and the upper bound.
+ */
+TEST(RetryPolicy, full_jitter) {
+  std::vector<uint64_t> bounds;
+  BackoffRetryPolicy policy(params(3, 100), fixedClock, [&bounds](uint64_t bound) {
+    bounds.push_back(bound);
+    return bound / 4;
+  });
+  milliseconds delay{-1};
+  EXPECT_TRUE(policy.shouldRetry(0, "", &delay));
+  EXPECT_EQ(delay, milliseconds(250));
+  EXPECT_TRUE(policy.shouldRetry(2, "", &delay));
+  EXPECT_EQ(delay, milliseconds(1000));
+  EXPECT_EQ(bounds, (std::vector<uint64_t>{1000, 4000}));
+}
+
+/*
+ * All the requests share the retry budget, which is refilled at the start of
+ * each update cycle.
+ */
+TEST(RetryPolicy, cycle_budget) {
+  BackoffRetryPolicy policy(params(2, 3), fixedClock, maxRandom);
+  milliseconds delay{-1};
+  EXPECT_TRUE(policy.shouldRetry(0, "", &delay));
+  EXPECT_TRUE(policy.shouldRetry(0, "", &delay));
+  EXPECT_TRUE(policy.shouldRetry(1, "", &delay));
+  EXPECT_EQ(policy.budgetLeft(), 0u);
+  EXPECT_FALSE(policy.shouldRetry(0, "", &delay));
+
+  policy.newCycle();
+  EXPECT_EQ(policy.budgetLeft(), 3u);
+  EXPECT_TRUE(policy.shouldRetry(0, "", &delay));
+}
+
+/*
+ * Retry-After overrides the backoff, both as a number of seconds and as a
+ * date. The request is given up if the server asks for more than the maximum
+ * delay.
+ */
+TEST(RetryPolicy, retry_after) {
+  BackoffRetryPolicy policy(params(5, 100), fixedClock, maxRandom);
+  milliseconds delay{-1};
+  EXPECT_TRUE(policy.shouldRetry(0, "3", &delay));
+  EXPECT_EQ(delay, milliseconds(3000));
+  EXPECT_TRUE(policy.shouldRetry(0, "Wed, 21 Oct 2015 07:28:04 GMT", &delay));
+  EXPECT_EQ(delay, milliseconds(4000));
+  EXPECT_TRUE(policy.shouldRetry(0, "Wed, 21 Oct 2015 07:27:00 GMT", &delay));
+  EXPECT_EQ(delay, milliseconds(0));
+  // not valid, falls back to the backoff
+  EXPECT_TRUE(policy.shouldRetry(1, "soon", &delay));
+  EXPECT_EQ(delay, milliseconds(2000));
+
+  EXPECT_FALSE(policy.shouldRetry(0, "120", &delay));
+  EXPECT_FALSE(policy.shouldRetry(0, "Wed, 21 Oct 2015 08:00:00 GMT", &delay));
+  EXPECT_FALSE(policy.shouldRetry(0, "99999999999999999999", &delay));
+}
+
+TEST(RetryPolicy, interrupt) {
+  BackoffRetryPolicy policy(params(5, 100), fixedClock, maxRandom);
+  milliseconds delay{-1};
+  EXPECT_TRUE(policy.shouldRetry(0, "", &delay));
+  policy.interrupt();
+  EXPECT_FALSE(policy.shouldRetry(0, "", &delay));
+  policy.newCycle();
+  EXPECT_FALSE(policy.shouldRetry(0, "", &delay));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
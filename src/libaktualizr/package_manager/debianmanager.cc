@@ -7,6 +7,7 @@
 #include <dpkg/pkg-show.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fstream>
 
 Json::Value DebianManager::getInstalledPackages() const {
   Json::Value packages(Json::arrayValue);
@@ -35,15 +36,23 @@ data::InstallOutcome DebianManager::install(const Uptane::Target &target) const
   std::string cmd = "dpkg -i ";
   std::string output;
   TemporaryDirectory package_dir("deb_dir");
-  std::stringstream sstr;
-  sstr << *storage_->openTargetFile(target.filename());
   boost::filesystem::path deb_path = package_dir / target.filename();
-  Utils::writeFile(deb_path, sstr.str());
+  {
+    // streamed from the storage to the package file, without holding the package in memory
+    std::ofstream deb_file(deb_path.c_str(), std::ios::binary);
+    deb_file << *storage_->openTargetFile(target.filename());
+    if (!deb_file) {
+      LOG_ERROR << "Could not write " << deb_path;
+      return data::InstallOutcome(data::UpdateResultCode::kInstallFailed, "Could not write the package file");
+    }
+  }
 
   int status = Utils::shell(cmd + deb_path.string(), &output, true);
   if (status == 0) {
     LOG_INFO << "... Installation of Debian package successful";
-    storage_->saveInstalledVersion(target);
+    if (!storage_->saveInstalledVersion(target)) {
+      return data::InstallOutcome(data::UpdateResultCode::kInstallFailed, "Could not save the installed version");
+    }
     return data::InstallOutcome(data::UpdateResultCode::kOk, "Installing debian package was successful");
   }
   LOG_ERROR << "... Installation of Debian package failed";
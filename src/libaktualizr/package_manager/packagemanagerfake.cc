@@ -23,6 +23,8 @@ Uptane::Target PackageManagerFake::getCurrent() const {
 }
 
 data::InstallOutcome PackageManagerFake::install(const Uptane::Target &target) const {
-  storage_->saveInstalledVersion(target);
+  if (!storage_->saveInstalledVersion(target)) {
+    return data::InstallOutcome(data::UpdateResultCode::kInstallFailed, "Could not save the installed version");
+  }
   return data::InstallOutcome(data::UpdateResultCode::kOk, "Installing fake package was successful");
 }
@@ -137,7 +137,11 @@ void Aktualizr::AddSecondary(const std::shared_ptr<Uptane::SecondaryInterface> &
   uptane_client_->addNewSecondary(secondary);
 }
 
-void Aktualizr::Shutdown() { shutdown_ = true; }
+void Aktualizr::Shutdown() {
+  shutdown_ = true;
+  // don't keep the cycle waiting for the next attempt of a failed request
+  uptane_client_->interruptRetries();
+}
 
 void Aktualizr::CampaignCheck() { uptane_client_->campaignCheck(); }
 
@@ -1,7 +1,16 @@
 #include "sotauptaneclient.h"
 
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <utility>
 
 #include "campaign/campaign.h"
@@ -18,6 +27,13 @@
 std::shared_ptr<SotaUptaneClient> SotaUptaneClient::newDefaultClient(
     Config &config_in, std::shared_ptr<INvStorage> storage_in, std::shared_ptr<event::Channel> events_channel_in) {
   std::shared_ptr<HttpClient> http_client_in = std::make_shared<HttpClient>();
+  BackoffParams retry_params;
+  retry_params.max_retries = config_in.network.http_max_retries;
+  retry_params.base_delay = std::chrono::milliseconds(config_in.network.http_retry_base_delay_ms);
+  retry_params.max_delay = std::chrono::milliseconds(config_in.network.http_retry_max_delay_ms);
+  retry_params.cycle_budget = config_in.network.http_retry_budget;
+  http_client_in->setRetryPolicy(std::make_shared<BackoffRetryPolicy>(retry_params));
+  http_client_in->setRequestCompression(config_in.network.http_compress_requests);
   std::shared_ptr<Uptane::Fetcher> uptane_fetcher =
       std::make_shared<Uptane::Fetcher>(config_in, storage_in, http_client_in, events_channel_in);
   std::shared_ptr<Bootloader> bootloader_in = std::make_shared<Bootloader>(config_in.bootloader);
@@ -46,6 +62,8 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
                                    std::shared_ptr<ReportQueue> report_queue_in,
                                    std::shared_ptr<event::Channel> events_channel_in)
     : config(config_in),
+      director_repo(storage_in),
+      images_repo(storage_in),
       uptane_manifest(config, storage_in),
       storage(std::move(storage_in)),
       http(std::move(http_client)),
@@ -60,6 +78,16 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
     bootloader->setBootOK();
   }
 
+  if (config.uptane.verification_threads > 0) {
+    verification_pool = std::make_shared<WorkerPool>(static_cast<size_t>(config.uptane.verification_threads));
+    director_repo.setVerificationPool(verification_pool);
+    images_repo.setVerificationPool(verification_pool);
+  }
+  manifest_requests = std::make_shared<ManifestRequests>();
+  if (config.uptane.secondary_concurrency > 0) {
+    secondary_pool = std::make_shared<WorkerPool>(static_cast<size_t>(config.uptane.secondary_concurrency));
+  }
+
   if (config.discovery.ipuptane) {
     IpSecondaryDiscovery ip_uptane_discovery{config.network};
     auto ipuptane_secs = ip_uptane_discovery.discover();
@@ -73,7 +101,27 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
   }
 }
 
-SotaUptaneClient::~SotaUptaneClient() { conn.disconnect(); }
+// Shared by collectSecondaryManifests() and the threads asking the secondaries
+struct SotaUptaneClient::ManifestRequests {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::set<Uptane::EcuSerial> running;
+  std::map<Uptane::EcuSerial, Json::Value> answers;
+  // the last thread of each secondary, joined when the secondary is asked again or the client is destroyed
+  std::map<Uptane::EcuSerial, std::thread> threads;
+};
+
+SotaUptaneClient::~SotaUptaneClient() {
+  conn.disconnect();
+  std::map<Uptane::EcuSerial, std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(manifest_requests->mutex);
+    threads.swap(manifest_requests->threads);
+  }
+  for (auto &thread : threads) {
+    thread.second.join();
+  }
+}
 
 void SotaUptaneClient::addNewSecondary(const std::shared_ptr<Uptane::SecondaryInterface> &sec) {
   if (storage->loadEcuRegistered()) {
@@ -136,22 +184,24 @@ void SotaUptaneClient::PackageInstallSetResult(const Uptane::Target &target) {
     result = data::OperationResult::fromOutcome(target.filename(), outcome);
   } else {
     result = data::OperationResult::fromOutcome(target.filename(), PackageInstall(target));
-    if (result.result_code == data::UpdateResultCode::kOk) {
-      storage->saveInstalledVersion(target);
+    if (result.result_code == data::UpdateResultCode::kOk && !storage->saveInstalledVersion(target)) {
+      data::InstallOutcome outcome(data::UpdateResultCode::kInstallFailed, "Could not save the installed version");
+      result = data::OperationResult::fromOutcome(target.filename(), outcome);
     }
   }
   storage->storeInstallationResult(result);
 }
 
-void SotaUptaneClient::reportHwInfo() {
+std::future<HttpResponse> SotaUptaneClient::reportHwInfo() {
   Json::Value hw_info = Utils::getHardwareInfo();
   if (!hw_info.empty()) {
-    http->put(config.tls.server + "/core/system_info", hw_info);
+    return http->putAsync(config.tls.server + "/core/system_info", hw_info);
   }
+  return std::future<HttpResponse>();
 }
 
-void SotaUptaneClient::reportInstalledPackages() {
-  http->put(config.tls.server + "/core/installed", package_manager_->getInstalledPackages());
+std::future<HttpResponse> SotaUptaneClient::reportInstalledPackages() {
+  return http->putAsync(config.tls.server + "/core/installed", package_manager_->getInstalledPackages());
 }
 
 void SotaUptaneClient::reportNetworkInfo() {
@@ -171,6 +221,14 @@ void SotaUptaneClient::reportNetworkInfo() {
 }
 
 Json::Value SotaUptaneClient::AssembleManifest() {
+  Json::Value result = collectVersionManifests();
+  const std::string primary_serial = uptane_manifest.getPrimaryEcuSerial().ToString();
+  result[primary_serial] = uptane_manifest.signVersionManifest(result[primary_serial]["signed"]);
+  return result;
+}
+
+// Like AssembleManifest(), with the version manifest of the primary not signed yet, only under "signed"
+Json::Value SotaUptaneClient::collectVersionManifests() {
   Json::Value result;
   installed_images.clear();
   Json::Value unsigned_ecu_version = package_manager_->getManifest(uptane_manifest.getPrimaryEcuSerial());
@@ -184,24 +242,128 @@ Json::Value SotaUptaneClient::AssembleManifest() {
   installed_images[uptane_manifest.getPrimaryEcuSerial()] =
       unsigned_ecu_version["installed_image"]["filepath"].asString();
 
-  result[uptane_manifest.getPrimaryEcuSerial().ToString()] = uptane_manifest.signVersionManifest(unsigned_ecu_version);
-  for (auto it = secondaries.begin(); it != secondaries.end(); it++) {
-    Json::Value secmanifest = it->second->getManifest();
-    if (secmanifest.isMember("signatures") && secmanifest.isMember("signed")) {
-      const auto public_key = it->second->getPublicKey();
-      const std::string canonical = Json::FastWriter().write(secmanifest["signed"]);
-      const bool verified = public_key.VerifySignature(secmanifest["signatures"][0]["sig"].asString(), canonical);
-      if (verified) {
-        result[it->first.ToString()] = secmanifest;
-        installed_images[it->first] = secmanifest["signed"]["installed_image"]["filepath"].asString();
-      } else {
-        LOG_ERROR << "Secondary manifest verification failed, manifest: " << secmanifest;
+  result[uptane_manifest.getPrimaryEcuSerial().ToString()]["signed"] = unsigned_ecu_version;
+  for (const auto &secmanifest : collectSecondaryManifests()) {
+    result[secmanifest.first.ToString()] = secmanifest.second;
+    installed_images[secmanifest.first] = secmanifest.second["signed"]["installed_image"]["filepath"].asString();
+  }
+  return result;
+}
+
+// Manifest of a secondary, or null if it is not correctly signed
+static Json::Value verifiedSecondaryManifest(Uptane::SecondaryInterface &secondary) {
+  Json::Value secmanifest = secondary.getManifest();
+  if (secmanifest.isMember("signatures") && secmanifest.isMember("signed")) {
+    const auto public_key = secondary.getPublicKey();
+    const std::string canonical = Json::FastWriter().write(secmanifest["signed"]);
+    if (public_key.VerifySignature(secmanifest["signatures"][0]["sig"].asString(), canonical)) {
+      return secmanifest;
+    }
+    LOG_ERROR << "Secondary manifest verification failed, manifest: " << secmanifest;
+  } else {
+    LOG_ERROR << "Secondary manifest is corrupted or not signed, manifest: " << secmanifest;
+  }
+  return Json::nullValue;
+}
+
+/*
+ * Each manifest is requested and verified on a thread of its own, at most
+ * uptane.secondary_concurrency at a time, and each secondary gets
+ * uptane.secondary_timeout_sec from the start of its request. A secondary which
+ * is late is left out of the manifest and reported with an
+ * UnresponsiveSecondaries event. Requests can't be interrupted, so the thread
+ * is left to complete on its own, and the secondary is not asked again before
+ * then. A late answer is dropped as out of date. IP secondaries give up on
+ * their own after a while, so a thread can't be blocked forever.
+ */
+std::map<Uptane::EcuSerial, Json::Value> SotaUptaneClient::collectSecondaryManifests() {
+  std::map<Uptane::EcuSerial, Json::Value> manifests;
+  if (config.uptane.secondary_concurrency == 0) {
+    for (auto it = secondaries.begin(); it != secondaries.end(); it++) {
+      Json::Value secmanifest = verifiedSecondaryManifest(*it->second);
+      if (!secmanifest.isNull()) {
+        manifests[it->first] = secmanifest;
       }
+    }
+    return manifests;
+  }
+
+  const std::chrono::seconds timeout(static_cast<std::chrono::seconds::rep>(config.uptane.secondary_timeout_sec));
+  std::vector<Uptane::EcuSerial> unresponsive;
+  std::vector<std::shared_ptr<Uptane::SecondaryInterface>> queue;
+  std::map<Uptane::EcuSerial, std::chrono::steady_clock::time_point> deadlines;
+  std::shared_ptr<ManifestRequests> requests = manifest_requests;
+  std::unique_lock<std::mutex> lock(requests->mutex);
+  requests->answers.clear();
+  for (auto it = secondaries.rbegin(); it != secondaries.rend(); it++) {
+    if (requests->running.count(it->first) != 0) {
+      LOG_WARNING << "Secondary " << it->first << " has still not sent its last manifest";
+      unresponsive.push_back(it->first);
     } else {
-      LOG_ERROR << "Secondary manifest is corrupted or not signed, manifest: " << secmanifest;
+      queue.push_back(it->second);
+    }
+  }
+
+  while (!queue.empty() || !deadlines.empty()) {
+    while (!queue.empty() && deadlines.size() < config.uptane.secondary_concurrency) {
+      std::shared_ptr<Uptane::SecondaryInterface> secondary = queue.back();
+      queue.pop_back();
+      const Uptane::EcuSerial serial = secondary->getSerial();
+      requests->running.insert(serial);
+      deadlines[serial] = std::chrono::steady_clock::now() + timeout;
+      auto previous = requests->threads.find(serial);
+      if (previous != requests->threads.end()) {
+        // it has returned its answer, and with it released the lock
+        previous->second.join();
+        requests->threads.erase(previous);
+      }
+      requests->threads[serial] = std::thread([requests, secondary, serial]() {
+        Json::Value secmanifest;
+        try {
+          secmanifest = verifiedSecondaryManifest(*secondary);
+        } catch (const std::exception &e) {
+          LOG_ERROR << "Failed to get the manifest of secondary " << serial << ": " << e.what();
+        }
+        std::lock_guard<std::mutex> guard(requests->mutex);
+        requests->running.erase(serial);
+        requests->answers[serial] = secmanifest;
+        requests->cv.notify_all();
+      });
+    }
+
+    for (auto answer = requests->answers.begin(); answer != requests->answers.end();) {
+      if (deadlines.erase(answer->first) != 0 && !answer->second.isNull()) {
+        manifests[answer->first] = answer->second;
+      }
+      answer = requests->answers.erase(answer);
+    }
+    auto next_deadline = std::chrono::steady_clock::time_point::max();
+    const auto now = std::chrono::steady_clock::now();
+    for (auto deadline = deadlines.begin(); deadline != deadlines.end();) {
+      if (timeout.count() > 0 && deadline->second <= now) {
+        LOG_ERROR << "Secondary " << deadline->first << " did not send its manifest in time";
+        unresponsive.push_back(deadline->first);
+        deadline = deadlines.erase(deadline);
+      } else {
+        next_deadline = std::min(next_deadline, deadline->second);
+        ++deadline;
+      }
+    }
+
+    if (!deadlines.empty()) {
+      if (timeout.count() > 0) {
+        requests->cv.wait_until(lock, next_deadline, [&requests]() { return !requests->answers.empty(); });
+      } else {
+        requests->cv.wait(lock, [&requests]() { return !requests->answers.empty(); });
+      }
     }
   }
-  return result;
+  lock.unlock();
+
+  if (!unresponsive.empty()) {
+    sendEvent<event::UnresponsiveSecondaries>(std::move(unresponsive));
+  }
+  return manifests;
 }
 
 bool SotaUptaneClient::hasPendingUpdates(const Json::Value &manifests) {
@@ -248,7 +410,7 @@ bool SotaUptaneClient::updateMeta() {
   return uptaneIteration();
 }
 
-bool SotaUptaneClient::updateDirectorMeta() {
+bool SotaUptaneClient::updateDirectorMeta(Uptane::MetaPrefetch &prefetch) {
   // Uptane step 2 (download time) is not implemented yet.
   // Uptane step 3 (download metadata)
 
@@ -263,8 +425,7 @@ bool SotaUptaneClient::updateDirectorMeta() {
         return false;
       }
     } else {
-      if (!uptane_fetcher->fetchRole(&director_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director,
-                                     Uptane::Role::Root(), Uptane::Version(1))) {
+      if (!prefetch.fetchRoot(&director_root, Uptane::Version(1))) {
         return false;
       }
       if (!director_repo.initRoot(director_root)) {
@@ -278,16 +439,14 @@ bool SotaUptaneClient::updateDirectorMeta() {
   // Update Director Root Metadata
   {
     std::string director_root;
-    if (!uptane_fetcher->fetchLatestRole(&director_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director,
-                                         Uptane::Role::Root())) {
+    if (!prefetch.fetchLatestRoot(&director_root)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(director_root);
     int local_version = director_repo.rootVersion();
 
     for (int version = local_version + 1; version <= remote_version; ++version) {
-      if (!uptane_fetcher->fetchRole(&director_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director,
-                                     Uptane::Role::Root(), Uptane::Version(version))) {
+      if (!prefetch.fetchRoot(&director_root, Uptane::Version(version))) {
         return false;
       }
 
@@ -295,8 +454,14 @@ bool SotaUptaneClient::updateDirectorMeta() {
         last_exception = director_repo.getLastException();
         return false;
       }
+      // the metadata signed with the old root must not survive the new one
+      auto transaction = storage->beginTransaction();
       storage->storeRoot(director_root, Uptane::RepositoryType::Director, Uptane::Version(version));
       storage->clearNonRootMeta(Uptane::RepositoryType::Director);
+      if (!transaction->commit()) {
+        last_exception = Uptane::Exception("director", "Could not store the root metadata");
+        return false;
+      }
     }
 
     if (director_repo.rootExpired()) {
@@ -307,9 +472,10 @@ bool SotaUptaneClient::updateDirectorMeta() {
   // Update Director Targets Metadata
   {
     std::string director_targets;
+    bool not_modified = false;
 
-    if (!uptane_fetcher->fetchLatestRole(&director_targets, Uptane::kMaxDirectorTargetsSize,
-                                         Uptane::RepositoryType::Director, Uptane::Role::Targets())) {
+    if (!prefetch.fetchRole(&director_targets, Uptane::kMaxDirectorTargetsSize, Uptane::Role::Targets(),
+                            &not_modified)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(director_targets);
@@ -322,7 +488,7 @@ bool SotaUptaneClient::updateDirectorMeta() {
       local_version = -1;
     }
 
-    if (!director_repo.verifyTargets(director_targets)) {
+    if (!director_repo.verifyTargets(director_targets, not_modified)) {
       last_exception = director_repo.getLastException();
       return false;
     }
@@ -342,8 +508,10 @@ bool SotaUptaneClient::updateDirectorMeta() {
   return true;
 }
 
-bool SotaUptaneClient::updateImagesMeta() {
+bool SotaUptaneClient::updateImagesMeta(Uptane::MetaPrefetch &prefetch) {
   images_repo.resetMeta();
+  // the images targets are only looked up for the director targets
+  images_repo.setWantedTargets(director_repo.getTargets());
   // Load Initial Images Root Metadata
   {
     std::string images_root;
@@ -353,8 +521,7 @@ bool SotaUptaneClient::updateImagesMeta() {
         return false;
       }
     } else {
-      if (!uptane_fetcher->fetchRole(&images_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Images,
-                                     Uptane::Role::Root(), Uptane::Version(1))) {
+      if (!prefetch.fetchRoot(&images_root, Uptane::Version(1))) {
         return false;
       }
       if (!images_repo.initRoot(images_root)) {
@@ -368,24 +535,27 @@ bool SotaUptaneClient::updateImagesMeta() {
   // Update Image Root Metadata
   {
     std::string images_root;
-    if (!uptane_fetcher->fetchLatestRole(&images_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Images,
-                                         Uptane::Role::Root())) {
+    if (!prefetch.fetchLatestRoot(&images_root)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(images_root);
     int local_version = images_repo.rootVersion();
 
     for (int version = local_version + 1; version <= remote_version; ++version) {
-      if (!uptane_fetcher->fetchRole(&images_root, Uptane::kMaxRootSize, Uptane::RepositoryType::Images,
-                                     Uptane::Role::Root(), Uptane::Version(version))) {
+      if (!prefetch.fetchRoot(&images_root, Uptane::Version(version))) {
         return false;
       }
       if (!images_repo.verifyRoot(images_root)) {
         last_exception = images_repo.getLastException();
         return false;
       }
+      auto transaction = storage->beginTransaction();
       storage->storeRoot(images_root, Uptane::RepositoryType::Images, Uptane::Version(version));
       storage->clearNonRootMeta(Uptane::RepositoryType::Images);
+      if (!transaction->commit()) {
+        last_exception = Uptane::Exception("repo", "Could not store the root metadata");
+        return false;
+      }
     }
 
     if (images_repo.rootExpired()) {
@@ -397,9 +567,9 @@ bool SotaUptaneClient::updateImagesMeta() {
   // Update Images Timestamp Metadata
   {
     std::string images_timestamp;
+    bool not_modified = false;
 
-    if (!uptane_fetcher->fetchLatestRole(&images_timestamp, Uptane::kMaxTimestampSize, Uptane::RepositoryType::Images,
-                                         Uptane::Role::Timestamp())) {
+    if (!prefetch.fetchRole(&images_timestamp, Uptane::kMaxTimestampSize, Uptane::Role::Timestamp(), &not_modified)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(images_timestamp);
@@ -412,7 +582,7 @@ bool SotaUptaneClient::updateImagesMeta() {
       local_version = -1;
     }
 
-    if (!images_repo.verifyTimestamp(images_timestamp)) {
+    if (!images_repo.verifyTimestamp(images_timestamp, not_modified)) {
       last_exception = images_repo.getLastException();
       return false;
     }
@@ -429,13 +599,28 @@ bool SotaUptaneClient::updateImagesMeta() {
     }
   }
 
+  // Nothing else has changed if the timestamp still points to the same snapshot
+  if (images_repo.reuseUnchangedSnapshot()) {
+    if (images_repo.snapshotExpired()) {
+      last_exception = Uptane::ExpiredMetadata("repo", "snapshot");
+      return false;
+    }
+    if (images_repo.targetsExpired()) {
+      last_exception = Uptane::ExpiredMetadata("repo", "targets");
+      return false;
+    }
+    return true;
+  }
+
   // Update Images Snapshot Metadata
   {
     std::string images_snapshot;
+    bool not_modified = false;
 
     int64_t snapshot_size = (images_repo.snapshotSize() > 0) ? images_repo.snapshotSize() : Uptane::kMaxSnapshotSize;
-    if (!uptane_fetcher->fetchLatestRole(&images_snapshot, snapshot_size, Uptane::RepositoryType::Images,
-                                         Uptane::Role::Snapshot())) {
+    // the targets are requested along with the snapshot, their size is checked once the snapshot is verified
+    prefetch.prefetchRole(Uptane::Role::Targets(), Uptane::kMaxImagesTargetsSize);
+    if (!prefetch.fetchRole(&images_snapshot, snapshot_size, Uptane::Role::Snapshot(), &not_modified)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(images_snapshot);
@@ -448,7 +633,7 @@ bool SotaUptaneClient::updateImagesMeta() {
       local_version = -1;
     }
 
-    if (!images_repo.verifySnapshot(images_snapshot)) {
+    if (!images_repo.verifySnapshot(images_snapshot, not_modified)) {
       last_exception = images_repo.getLastException();
       return false;
     }
@@ -468,10 +653,10 @@ bool SotaUptaneClient::updateImagesMeta() {
   // Update Images Targets Metadata
   {
     std::string images_targets;
+    bool not_modified = false;
 
     int64_t targets_size = (images_repo.targetsSize() > 0) ? images_repo.targetsSize() : Uptane::kMaxImagesTargetsSize;
-    if (!uptane_fetcher->fetchLatestRole(&images_targets, targets_size, Uptane::RepositoryType::Images,
-                                         Uptane::Role::Targets())) {
+    if (!prefetch.fetchRole(&images_targets, targets_size, Uptane::Role::Targets(), &not_modified)) {
       return false;
     }
     int remote_version = Uptane::extractVersionUntrusted(images_targets);
@@ -484,7 +669,7 @@ bool SotaUptaneClient::updateImagesMeta() {
       local_version = -1;
     }
 
-    if (!images_repo.verifyTargets(images_targets)) {
+    if (!images_repo.verifyTargets(images_targets, not_modified)) {
       last_exception = images_repo.getLastException();
       return false;
     }
@@ -500,6 +685,7 @@ bool SotaUptaneClient::updateImagesMeta() {
       return false;
     }
   }
+  images_repo.keepSnapshot();
   return true;
 }
 
@@ -547,6 +733,8 @@ bool SotaUptaneClient::checkDirectorMetaOffline() {
 
 bool SotaUptaneClient::checkImagesMetaOffline() {
   images_repo.resetMeta();
+  // the images targets are only looked up for the director targets
+  images_repo.setWantedTargets(director_repo.getTargets());
   // Load Images Root Metadata
   {
     std::string images_root;
@@ -623,7 +811,7 @@ bool SotaUptaneClient::checkImagesMetaOffline() {
 }
 
 bool SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count) {
-  std::vector<Uptane::Target> targets = director_repo.getTargets();
+  const std::vector<Uptane::Target> &targets = director_repo.getTargets();
   if (ecus_count != nullptr) {
     *ecus_count = 0;
   }
@@ -669,7 +857,7 @@ bool SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, u
 bool SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets) {
   // Uptane step 4 - download all the images and verify them against the metadata (for OSTree - pull without
   // deploying)
-  std::vector<Uptane::Target> downloaded_targets;
+  std::vector<Uptane::Target> images_targets;
   for (auto it = targets.cbegin(); it != targets.cend(); ++it) {
     // TODO: delegations
     auto images_target = images_repo.getTarget(*it);
@@ -679,14 +867,25 @@ bool SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets
       sendEvent<event::Error>("Target hash mismatch.");
       return false;
     }
-    downloaded_targets.push_back(*it);
-    // TODO: support downloading encrypted targets from director
-    // TODO: check if the file is already there before downloading
-    if (!uptane_fetcher->fetchVerifyTarget(*images_target)) {
-      sendEvent<event::Error>("Error downloading targets.");
-      return false;
+    images_targets.push_back(*images_target);
+  }
+  // TODO: support downloading encrypted targets from director
+  std::vector<bool> results = uptane_fetcher->fetchVerifyTargets(images_targets);
+  const TargetCacheStats stats = storage->targetCacheStats();
+  LOG_DEBUG << "Target images take " << stats.bytes_held << " bytes, " << stats.bytes_reclaimed
+            << " bytes reclaimed and " << stats.downloads_skipped << " downloads skipped so far";
+  std::vector<Uptane::Target> downloaded_targets;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (results[i]) {
+      downloaded_targets.push_back(targets[i]);
+    } else {
+      LOG_ERROR << "Failed to download " << targets[i];
     }
   }
+  if (downloaded_targets.size() != targets.size()) {
+    sendEvent<event::Error>("Error downloading targets.");
+    return false;
+  }
   if (!targets.empty()) {
     if (targets.size() == downloaded_targets.size()) {
       sendDownloadReport();
@@ -704,8 +903,35 @@ bool SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets
   return true;
 }
 
+int SotaUptaneClient::storedRootVersion(Uptane::RepositoryType repo) {
+  std::string root;
+  if (!storage->loadLatestRoot(&root, repo)) {
+    return 0;
+  }
+  return std::max(Uptane::extractVersionUntrusted(root), 0);
+}
+
 bool SotaUptaneClient::uptaneIteration() {
-  if (!updateDirectorMeta()) {
+  // The metadata of each repository is requested at once, and its missing roots as soon as the latest version is
+  // known. If the director had updates the last time, they are probably still there: the images root and timestamp
+  // are then requested along with the director metadata, and only waited for if there are updates. Otherwise they
+  // are requested once the director reports updates, so that polls without updates only cost the director requests.
+  // The images snapshot and targets are only requested if the timestamp shows that they have changed.
+  std::unique_ptr<Uptane::MetaPrefetch> images_prefetch;
+  auto startImagesPrefetch = [this, &images_prefetch]() {
+    images_prefetch = std_::make_unique<Uptane::MetaPrefetch>(
+        *uptane_fetcher, Uptane::RepositoryType::Images, storedRootVersion(Uptane::RepositoryType::Images),
+        std::vector<std::pair<Uptane::Role, int64_t>>{{Uptane::Role::Timestamp(), Uptane::kMaxTimestampSize}});
+  };
+  Uptane::MetaPrefetch director_prefetch(*uptane_fetcher, Uptane::RepositoryType::Director,
+                                         storedRootVersion(Uptane::RepositoryType::Director),
+                                         {{Uptane::Role::Targets(), Uptane::kMaxDirectorTargetsSize}});
+  if (last_iteration_had_updates) {
+    startImagesPrefetch();
+  }
+  director_prefetch.prefetchRoots();
+
+  if (!updateDirectorMeta(director_prefetch)) {
     LOG_ERROR << "Failed to update director metadata: " << last_exception.what();
     return false;
   }
@@ -715,16 +941,24 @@ bool SotaUptaneClient::uptaneIteration() {
     return false;
   }
 
+  last_iteration_had_updates = !targets.empty();
   if (targets.empty()) {
     return true;
   }
 
   LOG_INFO << "got new updates";
 
-  if (!updateImagesMeta()) {
+  if (images_prefetch == nullptr) {
+    startImagesPrefetch();
+  }
+  images_prefetch->prefetchRoots();
+  if (!updateImagesMeta(*images_prefetch)) {
     LOG_ERROR << "Failed to update images metadata: " << last_exception.what();
     return false;
   }
+  const Uptane::ImagesRepository::Stats stats = images_repo.stats();
+  LOG_DEBUG << "Images snapshot reused in " << stats.snapshot_reused << " cycles, loaded from the storage in "
+            << stats.snapshot_loaded << " and fetched in " << stats.snapshot_changed << " so far";
 
   return true;
 }
@@ -761,14 +995,21 @@ bool SotaUptaneClient::uptaneOfflineIteration(std::vector<Uptane::Target> *targe
 }
 
 void SotaUptaneClient::sendDeviceData() {
-  reportHwInfo();
-  reportInstalledPackages();
+  // the reports don't depend on each other, so they are sent in parallel
+  std::future<HttpResponse> hw_info = reportHwInfo();
+  std::future<HttpResponse> installed_packages = reportInstalledPackages();
   reportNetworkInfo();
   putManifestSimple();
+  if (hw_info.valid()) {
+    hw_info.wait();
+  }
+  installed_packages.wait();
   sendEvent<event::SendDeviceDataComplete>();
 }
 
 void SotaUptaneClient::fetchMeta() {
+  // a new update cycle starts here
+  http->newRetryCycle();
   if (updateMeta()) {
     sendEvent<event::FetchMetaComplete>();
   } else {
@@ -796,7 +1037,7 @@ void SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates)
   // Uptane step 5 (send time to all ECUs) is not implemented yet.
   std::vector<Uptane::Target> primary_updates = findForEcu(updates, uptane_manifest.getPrimaryEcuSerial());
   //   6 - send metadata to all the ECUs
-  sendMetadataToEcus(updates);
+  const std::map<Uptane::EcuSerial, bool> metadata_sent = sendMetadataToEcus(updates);
 
   //   7 - send images to ECUs (deploy for OSTree)
   if (primary_updates.size() != 0u) {
@@ -821,7 +1062,7 @@ void SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates)
     LOG_INFO << "No update to install on primary";
   }
 
-  sendImagesToEcus(updates);
+  sendImagesToEcus(updates, metadata_sent);
 }
 
 void SotaUptaneClient::campaignCheck() {
@@ -863,16 +1104,39 @@ void SotaUptaneClient::sendDownloadReport() {
   report_queue->enqueue(std::move(report));
 }
 
+/*
+ * The manifest is only signed and sent if its content has changed since the
+ * server last accepted it, or if that was more than uptane.manifest_max_age_sec
+ * ago. Signatures differ from one signing to the next, so only the signed
+ * parts of the version manifests are compared.
+ */
 bool SotaUptaneClient::putManifestSimple() {
   // does not send event, so it can be used as a subset of other steps
-  auto manifest = AssembleManifest();
-  if (!hasPendingUpdates(manifest)) {
-    auto signed_manifest = uptane_manifest.signManifest(manifest);
-    HttpResponse response = http->put(config.uptane.director_server + "/manifest", signed_manifest);
-    if (response.isOk()) {
-      storage->clearInstallationResult();
-      return true;
-    }
+  Json::Value manifest = collectVersionManifests();
+  if (hasPendingUpdates(manifest)) {
+    return false;
+  }
+  Json::Value content;
+  for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+    content[it.key().asString()] = (*it)["signed"];
+  }
+  const std::string content_hash = boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(content)));
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::seconds max_age(static_cast<std::chrono::seconds::rep>(config.uptane.manifest_max_age_sec));
+  if (content_hash == last_manifest_hash && now - last_manifest_put < max_age) {
+    LOG_DEBUG << "Manifest has not changed since it was last sent";
+    return true;
+  }
+
+  const std::string primary_serial = uptane_manifest.getPrimaryEcuSerial().ToString();
+  manifest[primary_serial] = uptane_manifest.signVersionManifest(manifest[primary_serial]["signed"]);
+  auto signed_manifest = uptane_manifest.signManifest(manifest);
+  HttpResponse response = http->put(config.uptane.director_server + "/manifest", signed_manifest);
+  if (response.isOk()) {
+    storage->clearInstallationResult();
+    last_manifest_hash = content_hash;
+    last_manifest_put = now;
+    return true;
   }
   return false;
 }
@@ -933,81 +1197,160 @@ void SotaUptaneClient::verifySecondaries() {
   storage->storeMisconfiguredEcus(misconfigured_ecus);
 }
 
-void SotaUptaneClient::rotateSecondaryRoot(Uptane::RepositoryType repo, Uptane::SecondaryInterface &secondary) {
-  std::string latest_root;
-
-  if (!storage->loadLatestRoot(&latest_root, repo)) {
-    LOG_ERROR << "No root metadata to send";
-    return;
+// Runs f(0) to f(count - 1) on pool, or one after the other without a pool, and returns the results in order.
+// The tasks use f and what it refers to, so all of them are waited for before an exception is rethrown.
+template <typename T>
+static std::vector<T> runOnPool(WorkerPool *pool, size_t count, const std::function<T(size_t)> &f) {
+  std::vector<T> results;
+  if (pool == nullptr) {
+    for (size_t i = 0; i < count; ++i) {
+      results.push_back(f(i));
+    }
+    return results;
+  }
+  std::vector<std::future<T>> futures;
+  for (size_t i = 0; i < count; ++i) {
+    futures.push_back(pool->submit([i, &f]() { return f(i); }));
+  }
+  std::exception_ptr error;
+  for (auto &result : futures) {
+    try {
+      results.push_back(result.get());
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
   }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return results;
+}
 
-  int last_root_version = Uptane::extractVersionUntrusted(latest_root);
-
-  int sec_root_version = secondary.getRootVersion((repo == Uptane::RepositoryType::Director));
-  if (sec_root_version >= 0) {
-    for (int v = sec_root_version + 1; v <= last_root_version; v++) {
-      std::string root;
-      if (!storage->loadRoot(&root, repo, Uptane::Version(v))) {
-        LOG_WARNING << "Couldn't find root meta in the storage, trying remote repo";
-        if (!uptane_fetcher->fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(), Uptane::Version(v))) {
-          // TODO: looks problematic, robust procedure needs to be defined
-          LOG_ERROR << "Root metadata could not be fetched, skipping to the next secondary";
-          return;
-        }
-      }
-      if (!secondary.putRoot(root, repo == Uptane::RepositoryType::Director)) {
-        LOG_ERROR << "Sending metadata to " << secondary.getSerial() << " failed";
+// Roots from from_version up to the latest one, stopping before the first one which can't be found
+void SotaUptaneClient::loadRootsFrom(Uptane::RepositoryType repo, int from_version, const std::string &latest_root,
+                                     std::map<int, std::string> *roots) {
+  const int last_root_version = Uptane::extractVersionUntrusted(latest_root);
+  for (int v = from_version; v <= last_root_version; v++) {
+    std::string root;
+    if (v == last_root_version) {
+      root = latest_root;
+    } else if (!storage->loadRoot(&root, repo, Uptane::Version(v))) {
+      LOG_WARNING << "Couldn't find root meta in the storage, trying remote repo";
+      if (!uptane_fetcher->fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(), Uptane::Version(v))) {
+        // TODO: looks problematic, robust procedure needs to be defined
+        LOG_ERROR << "Root metadata version " << v << " could not be fetched";
+        return;
       }
     }
+    (*roots)[v] = std::move(root);
   }
 }
 
-// TODO: the function can't currently return any errors. The problem of error reporting from secondaries should
-// be solved on a system (backend+frontend) error.
-// TODO: the function blocks until it updates all the secondaries. Consider non-blocking operation.
-void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &targets) {
+/*
+ * Every secondary with a target is sent the metadata once, however many
+ * targets it has. The roots the secondaries miss are loaded once for all of
+ * them. Root versions are asked and metadata sent on secondary_pool, at most
+ * uptane.secondary_concurrency secondaries at a time.
+ *
+ * Returns whether each secondary accepted all its roots and the metadata.
+ */
+// TODO: the problem of error reporting from secondaries should be solved on a system (backend+frontend) level.
+std::map<Uptane::EcuSerial, bool> SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &targets) {
+  std::map<Uptane::EcuSerial, bool> results;
+  std::vector<std::shared_ptr<Uptane::SecondaryInterface>> recipients;
+  for (auto targets_it = targets.cbegin(); targets_it != targets.cend(); ++targets_it) {
+    for (auto ecus_it = targets_it->ecus().cbegin(); ecus_it != targets_it->ecus().cend(); ++ecus_it) {
+      auto sec = secondaries.find(ecus_it->first);
+      if (sec != secondaries.end() && results.emplace(sec->first, false).second) {
+        recipients.push_back(sec->second);
+      }
+    }
+  }
+  if (recipients.empty()) {
+    return results;
+  }
+
   Uptane::RawMetaPack meta;
   if (!storage->loadLatestRoot(&meta.director_root, Uptane::RepositoryType::Director)) {
     LOG_ERROR << "No director root metadata to send";
-    return;
+    return results;
   }
   if (!storage->loadNonRoot(&meta.director_targets, Uptane::RepositoryType::Director, Uptane::Role::Targets())) {
     LOG_ERROR << "No director targets metadata to send";
-    return;
+    return results;
   }
   if (!storage->loadLatestRoot(&meta.image_root, Uptane::RepositoryType::Images)) {
     LOG_ERROR << "No images root metadata to send";
-    return;
+    return results;
   }
   if (!storage->loadNonRoot(&meta.image_timestamp, Uptane::RepositoryType::Images, Uptane::Role::Timestamp())) {
     LOG_ERROR << "No images timestamp metadata to send";
-    return;
+    return results;
   }
   if (!storage->loadNonRoot(&meta.image_snapshot, Uptane::RepositoryType::Images, Uptane::Role::Snapshot())) {
     LOG_ERROR << "No images snapshot metadata to send";
-    return;
+    return results;
   }
   if (!storage->loadNonRoot(&meta.image_targets, Uptane::RepositoryType::Images, Uptane::Role::Targets())) {
     LOG_ERROR << "No images targets metadata to send";
-    return;
-  }
-
-  // target images should already have been downloaded to metadata_path/targets/
-  for (auto targets_it = targets.cbegin(); targets_it != targets.cend(); ++targets_it) {
-    for (auto ecus_it = targets_it->ecus().cbegin(); ecus_it != targets_it->ecus().cend(); ++ecus_it) {
-      const Uptane::EcuSerial ecu_serial = ecus_it->first;
-
-      auto sec = secondaries.find(ecu_serial);
-      if (sec != secondaries.end()) {
-        /* Root rotation if necessary */
-        rotateSecondaryRoot(Uptane::RepositoryType::Director, *(sec->second));
-        rotateSecondaryRoot(Uptane::RepositoryType::Images, *(sec->second));
-        if (!sec->second->putMetadata(meta)) {
-          LOG_ERROR << "Sending metadata to " << sec->second->getSerial() << " failed";
+    return results;
+  }
+
+  // Root rotation if necessary, a negative version means that the secondary doesn't need it
+  const std::vector<std::pair<int, int>> root_versions =
+      runOnPool<std::pair<int, int>>(secondary_pool.get(), recipients.size(), [&recipients](size_t i) {
+        return std::make_pair(recipients[i]->getRootVersion(true), recipients[i]->getRootVersion(false));
+      });
+  int director_from = std::numeric_limits<int>::max();
+  int images_from = std::numeric_limits<int>::max();
+  for (const auto &versions : root_versions) {
+    if (versions.first >= 0) {
+      director_from = std::min(director_from, versions.first + 1);
+    }
+    if (versions.second >= 0) {
+      images_from = std::min(images_from, versions.second + 1);
+    }
+  }
+  std::map<int, std::string> director_roots;
+  std::map<int, std::string> images_roots;
+  loadRootsFrom(Uptane::RepositoryType::Director, director_from, meta.director_root, &director_roots);
+  loadRootsFrom(Uptane::RepositoryType::Images, images_from, meta.image_root, &images_roots);
+  const int last_director_version = Uptane::extractVersionUntrusted(meta.director_root);
+  const int last_images_version = Uptane::extractVersionUntrusted(meta.image_root);
+
+  const std::vector<bool> sent = runOnPool<bool>(secondary_pool.get(), recipients.size(), [&](size_t i) {
+    Uptane::SecondaryInterface &secondary = *recipients[i];
+    bool ok = true;
+    for (const bool director : {true, false}) {
+      const int version = director ? root_versions[i].first : root_versions[i].second;
+      const int last_version = director ? last_director_version : last_images_version;
+      const std::map<int, std::string> &roots = director ? director_roots : images_roots;
+      if (version < 0 || version >= last_version) {
+        continue;
+      }
+      for (auto root = roots.upper_bound(version); root != roots.end(); ++root) {
+        if (!secondary.putRoot(root->second, director)) {
+          LOG_ERROR << "Sending metadata to " << secondary.getSerial() << " failed";
+          ok = false;
         }
       }
+      if (roots.count(last_version) == 0) {
+        LOG_ERROR << "Root metadata could not be fetched, " << secondary.getSerial() << " was not fully rotated";
+        ok = false;
+      }
+    }
+    if (!secondary.putMetadata(meta)) {
+      LOG_ERROR << "Sending metadata to " << secondary.getSerial() << " failed";
+      ok = false;
     }
+    return ok;
+  });
+  for (size_t i = 0; i < recipients.size(); ++i) {
+    results[recipients[i]->getSerial()] = sent[i];
   }
+  return results;
 }
 
 void SotaUptaneClient::waitAllInstallsComplete(std::vector<std::future<bool>> firmwareFutures) {
@@ -1017,11 +1360,14 @@ void SotaUptaneClient::waitAllInstallsComplete(std::vector<std::future<bool>> fi
   sendEvent<event::AllInstallsComplete>();
 }
 
-void SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targets) {
+void SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targets,
+                                        const std::map<Uptane::EcuSerial, bool> &metadata_sent) {
   std::vector<std::future<bool>> firmwareFutures;
 
   // target images should already have been downloaded to metadata_path/targets/
   for (auto targets_it = targets.cbegin(); targets_it != targets.cend(); ++targets_it) {
+    // read once and shared between all the secondaries which get the same image
+    std::shared_ptr<std::string> fw;
     for (auto ecus_it = targets_it->ecus().cbegin(); ecus_it != targets_it->ecus().cend(); ++ecus_it) {
       const Uptane::EcuSerial ecu_serial = ecus_it->first;
 
@@ -1029,6 +1375,12 @@ void SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targe
       if (sec == secondaries.end()) {
         continue;
       }
+      // a secondary which refused its metadata would refuse its image as well
+      auto sent = metadata_sent.find(ecu_serial);
+      if (sent != metadata_sent.end() && !sent->second) {
+        LOG_ERROR << "Not sending the image to " << ecu_serial << ", which did not accept the metadata";
+        continue;
+      }
 
       if (sec->second->sconfig.secondary_type == Uptane::SecondaryType::kOpcuaUptane) {
         Json::Value data;
@@ -1047,10 +1399,10 @@ void SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targe
         }
         firmwareFutures.push_back(sec->second->sendFirmwareAsync(std::make_shared<std::string>(creds_archive)));
       } else {
-        std::stringstream sstr;
-        sstr << *storage->openTargetFile(targets_it->filename());
-        const std::string fw = sstr.str();
-        firmwareFutures.push_back(sec->second->sendFirmwareAsync(std::make_shared<std::string>(fw)));
+        if (fw == nullptr) {
+          fw = std::make_shared<std::string>(storage->openTargetFile(targets_it->filename())->rreadAll());
+        }
+        firmwareFutures.push_back(sec->second->sendFirmwareAsync(fw));
       }
     }
   }
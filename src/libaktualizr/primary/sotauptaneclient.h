@@ -1,6 +1,8 @@
 #ifndef SOTA_UPTANE_CLIENT_H_
 #define SOTA_UPTANE_CLIENT_H_
 
+#include <chrono>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -24,6 +26,7 @@
 #include "uptane/secondaryinterface.h"
 #include "uptane/uptanerepository.h"
 #include "utilities/events.h"
+#include "utilities/workerpool.h"
 
 class SotaUptaneClient {
  public:
@@ -50,6 +53,7 @@ class SotaUptaneClient {
   void installationComplete(const std::shared_ptr<event::BaseEvent> &event);
   void campaignCheck();
   void campaignAccept(const std::string &campaign_id);
+  void interruptRetries() { http->interruptRetries(); }
 
  private:
   FRIEND_TEST(Aktualizr, FullNoUpdates);
@@ -61,7 +65,12 @@ class SotaUptaneClient {
   FRIEND_TEST(Uptane, InstallFake);
   FRIEND_TEST(Uptane, restoreVerify);
   FRIEND_TEST(Uptane, PutManifest);
+  FRIEND_TEST(Uptane, UnchangedManifest);
+  FRIEND_TEST(Uptane, ConcurrentSecondaryManifests);
+  FRIEND_TEST(Uptane, ConcurrentMetadataDistribution);
   FRIEND_TEST(Uptane, offlineIteration);
+  FRIEND_TEST(Uptane, PipelinedMetaFetch);
+  FRIEND_TEST(Uptane, UnchangedSnapshot);
   FRIEND_TEST(Uptane, krejectallTest);
   FRIEND_TEST(Uptane, Vector);  // Note hacky name (see uptane_vector_tests.cc)
   FRIEND_TEST(UptaneCI, OneCycleUpdate);
@@ -75,27 +84,32 @@ class SotaUptaneClient {
   bool uptaneIteration();
   bool uptaneOfflineIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count);
   Json::Value AssembleManifest();
+  Json::Value collectVersionManifests();
+  std::map<Uptane::EcuSerial, Json::Value> collectSecondaryManifests();
   std::string secondaryTreehubCredentials() const;
   Uptane::Exception getLastException() const { return last_exception; }
   bool isInstalledOnPrimary(const Uptane::Target &target);
   std::vector<Uptane::Target> findForEcu(const std::vector<Uptane::Target> &targets, const Uptane::EcuSerial &ecu_id);
   data::InstallOutcome PackageInstall(const Uptane::Target &target);
   void PackageInstallSetResult(const Uptane::Target &target);
-  void reportHwInfo();
-  void reportInstalledPackages();
+  std::future<HttpResponse> reportHwInfo();
+  std::future<HttpResponse> reportInstalledPackages();
   void reportNetworkInfo();
   void addSecondary(const std::shared_ptr<Uptane::SecondaryInterface> &sec);
   void verifySecondaries();
-  void sendMetadataToEcus(const std::vector<Uptane::Target> &targets);
-  void sendImagesToEcus(const std::vector<Uptane::Target> &targets);
+  std::map<Uptane::EcuSerial, bool> sendMetadataToEcus(const std::vector<Uptane::Target> &targets);
+  void sendImagesToEcus(const std::vector<Uptane::Target> &targets,
+                        const std::map<Uptane::EcuSerial, bool> &metadata_sent);
   bool hasPendingUpdates(const Json::Value &manifests);
   void sendDownloadReport();
   bool putManifestSimple();
   bool getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count = nullptr);
   bool downloadTargets(const std::vector<Uptane::Target> &targets);
-  void rotateSecondaryRoot(Uptane::RepositoryType repo, Uptane::SecondaryInterface &secondary);
-  bool updateDirectorMeta();
-  bool updateImagesMeta();
+  void loadRootsFrom(Uptane::RepositoryType repo, int from_version, const std::string &latest_root,
+                     std::map<int, std::string> *roots);
+  int storedRootVersion(Uptane::RepositoryType repo);
+  bool updateDirectorMeta(Uptane::MetaPrefetch &prefetch);
+  bool updateImagesMeta(Uptane::MetaPrefetch &prefetch);
   bool checkImagesMetaOffline();
   bool checkDirectorMetaOffline();
   void waitAllInstallsComplete(std::vector<std::future<bool>> firmwareFutures);
@@ -121,9 +135,18 @@ class SotaUptaneClient {
   const std::shared_ptr<Bootloader> bootloader;
   std::shared_ptr<ReportQueue> report_queue;
   Json::Value last_network_info_reported;
+  // of the content of the last manifest accepted by the server, see putManifestSimple()
+  std::string last_manifest_hash;
+  std::chrono::steady_clock::time_point last_manifest_put;
+  // the director had updates at the last uptaneIteration(), so the images metadata is likely to be needed again
+  bool last_iteration_had_updates{false};
   std::map<Uptane::EcuSerial, Uptane::HardwareIdentifier> hw_ids;
   std::map<Uptane::EcuSerial, std::string> installed_images;
   std::shared_ptr<event::Channel> events_channel;
+  std::shared_ptr<WorkerPool> verification_pool;
+  std::shared_ptr<WorkerPool> secondary_pool;
+  struct ManifestRequests;
+  std::shared_ptr<ManifestRequests> manifest_requests;
   boost::signals2::connection conn;
   Uptane::Exception last_exception{"", ""};
 
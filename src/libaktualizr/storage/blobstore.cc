@@ -0,0 +1,108 @@
+#include "blobstore.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+boost::filesystem::path BlobStore::blobPath(const std::string& sha256) const { return dir_ / sha256; }
+
+boost::filesystem::path BlobStore::partialPath(int64_t id) const { return dir_ / "partial" / std::to_string(id); }
+
+bool BlobStore::exists(const std::string& sha256) const {
+  boost::system::error_code ec;
+  return boost::filesystem::is_regular_file(blobPath(sha256), ec);
+}
+
+int BlobStore::openPartial(int64_t id, uint64_t offset, uint64_t size) const {
+  const boost::filesystem::path path = partialPath(id);
+  if (!boost::filesystem::is_directory(path.parent_path())) {
+    Utils::createDirectories(path.parent_path(), S_IRWXU);
+  }
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    LOG_ERROR << "Can't open " << path << ": " << std::strerror(errno);
+    return -1;
+  }
+  // anything written after the last checkpoint is discarded
+  if (ftruncate(fd, static_cast<off_t>(offset)) != 0 || lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+    LOG_ERROR << "Can't truncate " << path << ": " << std::strerror(errno);
+    close(fd);
+    return -1;
+  }
+  // reserve the space up front, so that the download fails early if it doesn't fit and the file is not fragmented
+  if (size > offset &&
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(size - offset)) != 0) {
+    if (errno == ENOSPC) {
+      LOG_ERROR << "Not enough space for " << path;
+      close(fd);
+      return -1;
+    }
+    // not supported by the filesystem
+    LOG_DEBUG << "Can't preallocate " << path << ": " << std::strerror(errno);
+  }
+  return fd;
+}
+
+bool BlobStore::commit(int fd, int64_t id, const std::string& sha256) const {
+  if (fsync(fd) != 0) {
+    LOG_ERROR << "Can't sync " << partialPath(id) << ": " << std::strerror(errno);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  // an existing file with the same name has the same content, replacing it is harmless
+  if (rename(partialPath(id).c_str(), blobPath(sha256).c_str()) != 0) {
+    LOG_ERROR << "Can't move " << partialPath(id) << " to " << blobPath(sha256) << ": " << std::strerror(errno);
+    return false;
+  }
+  return syncDir(dir_);
+}
+
+void BlobStore::removePartial(int64_t id) const {
+  boost::system::error_code ec;
+  boost::filesystem::remove(partialPath(id), ec);
+}
+
+void BlobStore::removeBlob(const std::string& sha256) const {
+  boost::system::error_code ec;
+  boost::filesystem::remove(blobPath(sha256), ec);
+  if (ec) {
+    LOG_ERROR << "Can't remove " << blobPath(sha256) << ": " << ec.message();
+  }
+}
+
+bool BlobStore::writeAll(int fd, const uint8_t* buf, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, buf, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+bool BlobStore::syncDir(const boost::filesystem::path& dir) {
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR << "Can't open " << dir << ": " << std::strerror(errno);
+    return false;
+  }
+  bool res = fsync(fd) == 0;
+  if (!res) {
+    LOG_ERROR << "Can't sync " << dir << ": " << std::strerror(errno);
+  }
+  close(fd);
+  return res;
+}
@@ -0,0 +1,41 @@
+#ifndef BLOBSTORE_H_
+#define BLOBSTORE_H_
+
+#include <cstdint>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * Target images kept as plain files named after their sha256, outside of the
+ * database which only indexes them. Images being written live in a separate
+ * directory until they are complete and are then moved to their final name
+ * with an atomic rename, so a file named after a hash is always complete.
+ */
+class BlobStore {
+ public:
+  explicit BlobStore(boost::filesystem::path dir) : dir_(std::move(dir)) {}
+
+  const boost::filesystem::path& dir() const { return dir_; }
+  boost::filesystem::path blobPath(const std::string& sha256) const;
+  boost::filesystem::path partialPath(int64_t id) const;
+  bool exists(const std::string& sha256) const;
+
+  // Opens the partial file of an image for writing, truncated to offset bytes and with room reserved for size
+  // bytes. Returns a file descriptor positioned at offset or -1.
+  int openPartial(int64_t id, uint64_t offset, uint64_t size) const;
+  // Makes the partial file durable, closes fd and moves the file to its final name
+  bool commit(int fd, int64_t id, const std::string& sha256) const;
+  void removePartial(int64_t id) const;
+  void removeBlob(const std::string& sha256) const;
+
+  // write(2) until everything is written
+  static bool writeAll(int fd, const uint8_t* buf, size_t size);
+
+ private:
+  static bool syncDir(const boost::filesystem::path& dir);
+
+  boost::filesystem::path dir_;
+};
+
+#endif  // BLOBSTORE_H_
@@ -0,0 +1,400 @@
+#include "cachingstorage.h"
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+class CachingStorageTransaction : public StorageTransaction {
+ public:
+  CachingStorageTransaction(CachingStorage& storage, std::unique_ptr<StorageTransaction> backend)
+      : storage_(storage), backend_(std::move(backend)) {
+    std::lock_guard<std::mutex> guard(storage_.mutex_);
+    ++storage_.generation_;
+    ++storage_.transactions_;
+  }
+  ~CachingStorageTransaction() override {
+    backend_.reset();
+    // the writes made meanwhile have only dropped entries, whatever the outcome the cache is consistent
+    std::lock_guard<std::mutex> guard(storage_.mutex_);
+    ++storage_.generation_;
+    --storage_.transactions_;
+  }
+
+  bool commit() override { return backend_->commit(); }
+
+ private:
+  CachingStorage& storage_;
+  std::unique_ptr<StorageTransaction> backend_;
+};
+
+CachingStorage::CachingStorage(const StorageConfig& config, std::shared_ptr<INvStorage> backend)
+    : INvStorage(config), backend_(std::move(backend)) {}
+
+CachingStorage::~CachingStorage() {
+  LOG_DEBUG << "Storage cache: " << hits_ << " hits, " << misses_ << " misses";
+}
+
+template <typename T, typename GetEntry, typename Load>
+bool CachingStorage::load(GetEntry get_entry, Load backend_load, T* value) {
+  if (transactions_ > 0) {
+    ++misses_;
+    return backend_load(value);
+  }
+
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Entry<T>& entry = get_entry();
+    if (entry.known) {
+      ++hits_;
+      if (entry.present && value != nullptr) {
+        *value = entry.value;
+      }
+      return entry.present;
+    }
+    generation = generation_;
+  }
+
+  ++misses_;
+  T loaded{};
+  bool present = backend_load(&loaded);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (generation_ == generation && transactions_ == 0 && cacheable(loaded)) {
+      Entry<T>& entry = get_entry();
+      entry.known = true;
+      entry.present = present;
+      entry.value = present ? loaded : T{};
+    }
+  }
+  if (present && value != nullptr) {
+    *value = std::move(loaded);
+  }
+  return present;
+}
+
+template <typename GetEntry, typename Store>
+void CachingStorage::writeThrough(GetEntry get_entry, const std::string& value, Store backend_store) {
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    generation = ++generation_;
+    get_entry().known = false;
+  }
+
+  backend_store();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  // with concurrent writes, the order in which they reached the backend is not known
+  bool uncontested = generation_ == generation;
+  ++generation_;
+  if (uncontested && transactions_ == 0 && cacheable(value)) {
+    Entry<std::string>& entry = get_entry();
+    entry.known = true;
+    entry.present = true;
+    entry.value = value;
+  }
+}
+
+template <typename Drop, typename Store>
+void CachingStorage::invalidatingStore(Drop drop, Store backend_store) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    ++generation_;
+    drop();
+  }
+
+  backend_store();
+
+  // loads which ran during the write can't fill the cache with the old value
+  std::lock_guard<std::mutex> guard(mutex_);
+  ++generation_;
+}
+
+void CachingStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
+  backend_->storePrimaryKeys(public_key, private_key);
+}
+
+bool CachingStorage::loadPrimaryKeys(std::string* public_key, std::string* private_key) {
+  return backend_->loadPrimaryKeys(public_key, private_key);
+}
+
+bool CachingStorage::loadPrimaryPublic(std::string* public_key) { return backend_->loadPrimaryPublic(public_key); }
+
+bool CachingStorage::loadPrimaryPrivate(std::string* private_key) { return backend_->loadPrimaryPrivate(private_key); }
+
+void CachingStorage::clearPrimaryKeys() { backend_->clearPrimaryKeys(); }
+
+void CachingStorage::storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) {
+  backend_->storeTlsCreds(ca, cert, pkey);
+}
+
+void CachingStorage::storeTlsCa(const std::string& ca) { backend_->storeTlsCa(ca); }
+
+void CachingStorage::storeTlsCert(const std::string& cert) { backend_->storeTlsCert(cert); }
+
+void CachingStorage::storeTlsPkey(const std::string& pkey) { backend_->storeTlsPkey(pkey); }
+
+bool CachingStorage::loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) {
+  return backend_->loadTlsCreds(ca, cert, pkey);
+}
+
+bool CachingStorage::loadTlsCa(std::string* ca) { return backend_->loadTlsCa(ca); }
+
+bool CachingStorage::loadTlsCert(std::string* cert) { return backend_->loadTlsCert(cert); }
+
+bool CachingStorage::loadTlsPkey(std::string* pkey) { return backend_->loadTlsPkey(pkey); }
+
+void CachingStorage::clearTlsCreds() { backend_->clearTlsCreds(); }
+
+void CachingStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
+  const MetaKey key{static_cast<int>(repo), version.version()};
+  const MetaKey latest{static_cast<int>(repo), Uptane::Version().version()};
+  writeThrough(
+      [this, &key, &latest]() -> Entry<std::string>& {
+        // the latest root may or may not be this one
+        roots_.erase(latest);
+        return roots_[key];
+      },
+      data, [this, &data, repo, version]() { backend_->storeRoot(data, repo, version); });
+}
+
+bool CachingStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) {
+  const MetaKey key{static_cast<int>(repo), version.version()};
+  return load([this, &key]() -> Entry<std::string>& { return roots_[key]; },
+              [this, repo, version](std::string* loaded) { return backend_->loadRoot(loaded, repo, version); }, data);
+}
+
+void CachingStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  writeThrough([this, &key]() -> Entry<std::string>& { return non_roots_[key]; }, data,
+               [this, &data, repo, &role]() { backend_->storeNonRoot(data, repo, role); });
+}
+
+bool CachingStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  return load([this, &key]() -> Entry<std::string>& { return non_roots_[key]; },
+              [this, repo, &role](std::string* loaded) { return backend_->loadNonRoot(loaded, repo, role); }, data);
+}
+
+void CachingStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
+  invalidatingStore(
+      [this, repo]() {
+        for (auto* entries : {&non_roots_, &validators_, &verified_}) {
+          for (auto it = entries->begin(); it != entries->end();) {
+            if (it->first.first == static_cast<int>(repo) && it->first.second != Uptane::Role::Root().ToInt()) {
+              it = entries->erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+      },
+      [this, repo]() { backend_->clearNonRootMeta(repo); });
+}
+
+void CachingStorage::clearMetadata() {
+  invalidatingStore(
+      [this]() {
+        roots_.clear();
+        non_roots_.clear();
+        validators_.clear();
+        verified_.clear();
+      },
+      [this]() { backend_->clearMetadata(); });
+}
+
+void CachingStorage::storeMetaValidators(const std::string& validators, Uptane::RepositoryType repo,
+                                         Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  writeThrough([this, &key]() -> Entry<std::string>& { return validators_[key]; }, validators,
+               [this, &validators, repo, &role]() { backend_->storeMetaValidators(validators, repo, role); });
+}
+
+bool CachingStorage::loadMetaValidators(std::string* validators, Uptane::RepositoryType repo, Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  return load(
+      [this, &key]() -> Entry<std::string>& { return validators_[key]; },
+      [this, repo, &role](std::string* loaded) { return backend_->loadMetaValidators(loaded, repo, role); },
+      validators);
+}
+
+void CachingStorage::storeVerifiedMeta(const std::string& state, Uptane::RepositoryType repo, Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  writeThrough([this, &key]() -> Entry<std::string>& { return verified_[key]; }, state,
+               [this, &state, repo, &role]() { backend_->storeVerifiedMeta(state, repo, role); });
+}
+
+bool CachingStorage::loadVerifiedMeta(std::string* state, Uptane::RepositoryType repo, Uptane::Role role) {
+  const MetaKey key{static_cast<int>(repo), role.ToInt()};
+  return load([this, &key]() -> Entry<std::string>& { return verified_[key]; },
+              [this, repo, &role](std::string* loaded) { return backend_->loadVerifiedMeta(loaded, repo, role); },
+              state);
+}
+
+void CachingStorage::storeDeviceId(const std::string& device_id) {
+  // also resets the registration
+  invalidatingStore(
+      [this]() {
+        device_id_.known = false;
+        ecu_registered_.known = false;
+      },
+      [this, &device_id]() { backend_->storeDeviceId(device_id); });
+}
+
+bool CachingStorage::loadDeviceId(std::string* device_id) {
+  return load([this]() -> Entry<std::string>& { return device_id_; },
+              [this](std::string* loaded) { return backend_->loadDeviceId(loaded); }, device_id);
+}
+
+void CachingStorage::clearDeviceId() {
+  invalidatingStore(
+      [this]() {
+        device_id_.known = false;
+        ecu_registered_.known = false;
+      },
+      [this]() { backend_->clearDeviceId(); });
+}
+
+void CachingStorage::storeEcuSerials(const EcuSerials& serials) {
+  invalidatingStore([this]() { ecu_serials_.known = false; },
+                    [this, &serials]() { backend_->storeEcuSerials(serials); });
+}
+
+bool CachingStorage::loadEcuSerials(EcuSerials* serials) {
+  return load([this]() -> Entry<EcuSerials>& { return ecu_serials_; },
+              [this](EcuSerials* loaded) { return backend_->loadEcuSerials(loaded); }, serials);
+}
+
+void CachingStorage::clearEcuSerials() {
+  invalidatingStore([this]() { ecu_serials_.known = false; }, [this]() { backend_->clearEcuSerials(); });
+}
+
+void CachingStorage::storeMisconfiguredEcus(const std::vector<MisconfiguredEcu>& ecus) {
+  invalidatingStore([this]() { misconfigured_ecus_.known = false; },
+                    [this, &ecus]() { backend_->storeMisconfiguredEcus(ecus); });
+}
+
+bool CachingStorage::loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) {
+  return load([this]() -> Entry<std::vector<MisconfiguredEcu>>& { return misconfigured_ecus_; },
+              [this](std::vector<MisconfiguredEcu>* loaded) { return backend_->loadMisconfiguredEcus(loaded); }, ecus);
+}
+
+void CachingStorage::clearMisconfiguredEcus() {
+  invalidatingStore([this]() { misconfigured_ecus_.known = false; }, [this]() { backend_->clearMisconfiguredEcus(); });
+}
+
+void CachingStorage::storeEcuRegistered() {
+  invalidatingStore([this]() { ecu_registered_.known = false; }, [this]() { backend_->storeEcuRegistered(); });
+}
+
+bool CachingStorage::loadEcuRegistered() {
+  bool registered = false;
+  load([this]() -> Entry<bool>& { return ecu_registered_; },
+       [this](bool* loaded) {
+         *loaded = backend_->loadEcuRegistered();
+         return true;
+       },
+       &registered);
+  return registered;
+}
+
+void CachingStorage::clearEcuRegistered() {
+  invalidatingStore([this]() { ecu_registered_.known = false; }, [this]() { backend_->clearEcuRegistered(); });
+}
+
+void CachingStorage::storeInstalledVersions(const std::vector<Uptane::Target>& installed_versions,
+                                            const std::string& current_hash) {
+  invalidatingStore([this]() { installed_versions_.known = false; },
+                    [this, &installed_versions, &current_hash]() {
+                      backend_->storeInstalledVersions(installed_versions, current_hash);
+                    });
+}
+
+std::string CachingStorage::loadInstalledVersions(std::vector<Uptane::Target>* installed_versions) {
+  InstalledVersions loaded;
+  load([this]() -> Entry<InstalledVersions>& { return installed_versions_; },
+       [this](InstalledVersions* from_backend) {
+         from_backend->second = backend_->loadInstalledVersions(&from_backend->first);
+         return true;
+       },
+       &loaded);
+  if (installed_versions != nullptr) {
+    *installed_versions = std::move(loaded.first);
+  }
+  return loaded.second;
+}
+
+void CachingStorage::clearInstalledVersions() {
+  invalidatingStore([this]() { installed_versions_.known = false; }, [this]() { backend_->clearInstalledVersions(); });
+}
+
+void CachingStorage::storeInstallationResult(const data::OperationResult& result) {
+  invalidatingStore([this]() { installation_result_.known = false; },
+                    [this, &result]() { backend_->storeInstallationResult(result); });
+}
+
+bool CachingStorage::loadInstallationResult(data::OperationResult* result) {
+  return load([this]() -> Entry<data::OperationResult>& { return installation_result_; },
+              [this](data::OperationResult* loaded) { return backend_->loadInstallationResult(loaded); }, result);
+}
+
+void CachingStorage::clearInstallationResult() {
+  invalidatingStore([this]() { installation_result_.known = false; },
+                    [this]() { backend_->clearInstallationResult(); });
+}
+
+std::unique_ptr<StorageTargetWHandle> CachingStorage::allocateTargetFile(bool from_director,
+                                                                         const std::string& filename, size_t size) {
+  return backend_->allocateTargetFile(from_director, filename, size);
+}
+
+std::unique_ptr<StorageTargetWHandle> CachingStorage::resumeTargetFile(const std::string& filename, size_t size,
+                                                                       std::string* resume_state) {
+  return backend_->resumeTargetFile(filename, size, resume_state);
+}
+
+std::unique_ptr<StorageTargetRHandle> CachingStorage::openTargetFile(const std::string& filename) {
+  return backend_->openTargetFile(filename);
+}
+
+void CachingStorage::removeTargetFile(const std::string& filename) { backend_->removeTargetFile(filename); }
+
+bool CachingStorage::reuseTargetFile(const std::string& filename, const std::string& sha256, uint64_t size) {
+  return backend_->reuseTargetFile(filename, sha256, size);
+}
+
+TargetCacheStats CachingStorage::targetCacheStats() { return backend_->targetCacheStats(); }
+
+void CachingStorage::cleanUp() {
+  invalidatingStore([this]() { clearEntries(); }, [this]() { backend_->cleanUp(); });
+}
+
+std::unique_ptr<StorageTransaction> CachingStorage::beginTransaction() {
+  return std_::make_unique<CachingStorageTransaction>(*this, backend_->beginTransaction());
+}
+
+CachingStorage::Stats CachingStorage::cacheStats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  return stats;
+}
+
+void CachingStorage::invalidate() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  ++generation_;
+  clearEntries();
+}
+
+void CachingStorage::clearEntries() {
+  roots_.clear();
+  non_roots_.clear();
+  validators_.clear();
+  verified_.clear();
+  device_id_ = Entry<std::string>();
+  ecu_serials_ = Entry<EcuSerials>();
+  misconfigured_ecus_ = Entry<std::vector<MisconfiguredEcu>>();
+  ecu_registered_ = Entry<bool>();
+  installed_versions_ = Entry<InstalledVersions>();
+  installation_result_ = Entry<data::OperationResult>();
+}
@@ -0,0 +1,157 @@
+#ifndef CACHINGSTORAGE_H_
+#define CACHINGSTORAGE_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "invstorage.h"
+
+/**
+ * Keeps the Uptane metadata and the small records which are loaded several
+ * times per update cycle in memory, in front of another storage.
+ *
+ * Raw metadata and validators are written through: they are stored in the
+ * backend and kept as they are. The other records are dropped from memory on
+ * every write and loaded again from the backend, so that they come back exactly
+ * as the backend stores them. Keys, credentials and target images are not
+ * cached, nor are metadata larger than kMaxCachedSize, such as big images
+ * targets, which are read once per update cycle at most.
+ *
+ * The backend must not be modified by anything else while it is in use. While a
+ * transaction is open, the cache is bypassed and writes only drop what they
+ * change, as each thread may see a different state of the backend.
+ */
+class CachingStorage : public INvStorage {
+ public:
+  friend class CachingStorageTransaction;
+  struct Stats {
+    uint64_t hits{0};    // loads answered from memory
+    uint64_t misses{0};  // loads forwarded to the backend
+  };
+
+  CachingStorage(const StorageConfig& config, std::shared_ptr<INvStorage> backend);
+  ~CachingStorage() override;
+
+  StorageType type() override { return backend_->type(); }
+  void storePrimaryKeys(const std::string& public_key, const std::string& private_key) override;
+  bool loadPrimaryKeys(std::string* public_key, std::string* private_key) override;
+  bool loadPrimaryPublic(std::string* public_key) override;
+  bool loadPrimaryPrivate(std::string* private_key) override;
+  void clearPrimaryKeys() override;
+
+  void storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) override;
+  void storeTlsCa(const std::string& ca) override;
+  void storeTlsCert(const std::string& cert) override;
+  void storeTlsPkey(const std::string& pkey) override;
+  bool loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) override;
+  bool loadTlsCa(std::string* ca) override;
+  bool loadTlsCert(std::string* cert) override;
+  bool loadTlsPkey(std::string* pkey) override;
+  void clearTlsCreds() override;
+
+  void storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) override;
+  bool loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) override;
+  void storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) override;
+  void clearNonRootMeta(Uptane::RepositoryType repo) override;
+  void clearMetadata() override;
+  void storeMetaValidators(const std::string& validators, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadMetaValidators(std::string* validators, Uptane::RepositoryType repo, Uptane::Role role) override;
+  void storeVerifiedMeta(const std::string& state, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadVerifiedMeta(std::string* state, Uptane::RepositoryType repo, Uptane::Role role) override;
+
+  void storeDeviceId(const std::string& device_id) override;
+  bool loadDeviceId(std::string* device_id) override;
+  void clearDeviceId() override;
+
+  void storeEcuSerials(const EcuSerials& serials) override;
+  bool loadEcuSerials(EcuSerials* serials) override;
+  void clearEcuSerials() override;
+
+  void storeMisconfiguredEcus(const std::vector<MisconfiguredEcu>& ecus) override;
+  bool loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) override;
+  void clearMisconfiguredEcus() override;
+
+  void storeEcuRegistered() override;
+  bool loadEcuRegistered() override;
+  void clearEcuRegistered() override;
+
+  void storeInstalledVersions(const std::vector<Uptane::Target>& installed_versions,
+                              const std::string& current_hash) override;
+  std::string loadInstalledVersions(std::vector<Uptane::Target>* installed_versions) override;
+  void clearInstalledVersions() override;
+
+  void storeInstallationResult(const data::OperationResult& result) override;
+  bool loadInstallationResult(data::OperationResult* result) override;
+  void clearInstallationResult() override;
+
+  std::unique_ptr<StorageTargetWHandle> allocateTargetFile(bool from_director, const std::string& filename,
+                                                           size_t size) override;
+  std::unique_ptr<StorageTargetWHandle> resumeTargetFile(const std::string& filename, size_t size,
+                                                         std::string* resume_state) override;
+  std::unique_ptr<StorageTargetRHandle> openTargetFile(const std::string& filename) override;
+  void removeTargetFile(const std::string& filename) override;
+  bool reuseTargetFile(const std::string& filename, const std::string& sha256, uint64_t size) override;
+  TargetCacheStats targetCacheStats() override;
+
+  void cleanUp() override;
+  std::unique_ptr<StorageTransaction> beginTransaction() override;
+
+  // larger values are always loaded from the backend
+  static const size_t kMaxCachedSize = 64 * 1024;
+
+  Stats cacheStats() const;
+  // Drops everything kept in memory
+  void invalidate();
+
+ private:
+  template <typename T>
+  struct Entry {
+    bool known{false};
+    bool present{false};
+    T value{};
+  };
+  // repository and role, or repository and version for the roots
+  using MetaKey = std::pair<int, int>;
+  using InstalledVersions = std::pair<std::vector<Uptane::Target>, std::string>;
+
+  template <typename T, typename GetEntry, typename Load>
+  bool load(GetEntry get_entry, Load backend_load, T* value);
+  template <typename GetEntry, typename Store>
+  void writeThrough(GetEntry get_entry, const std::string& value, Store backend_store);
+  template <typename Drop, typename Store>
+  void invalidatingStore(Drop drop, Store backend_store);
+  void clearEntries();  // with mutex_ held
+  static bool cacheable(const std::string& value) { return value.size() <= kMaxCachedSize; }
+  template <typename T>
+  static bool cacheable(const T& /*value*/) {
+    return true;
+  }
+
+  std::shared_ptr<INvStorage> backend_;
+
+  std::atomic<int> transactions_{0};
+  mutable std::mutex mutex_;
+  // incremented by every write, a load only fills the cache if no write happened meanwhile
+  uint64_t generation_{0};
+  std::map<MetaKey, Entry<std::string>> roots_;  // version -1 is the latest root
+  std::map<MetaKey, Entry<std::string>> non_roots_;
+  std::map<MetaKey, Entry<std::string>> validators_;
+  std::map<MetaKey, Entry<std::string>> verified_;
+  Entry<std::string> device_id_;
+  Entry<EcuSerials> ecu_serials_;
+  Entry<std::vector<MisconfiguredEcu>> misconfigured_ecus_;
+  Entry<bool> ecu_registered_;
+  Entry<InstalledVersions> installed_versions_;
+  Entry<data::OperationResult> installation_result_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+#endif  // CACHINGSTORAGE_H_
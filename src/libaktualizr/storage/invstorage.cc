@@ -2,6 +2,7 @@
 
 #include <unistd.h>
 
+#include "cachingstorage.h"
 #include "fsstorage_read.h"
 #include "logging/logging.h"
 #include "sqlstorage.h"
@@ -28,6 +29,12 @@ void StorageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
   CopyFromConfig(type, "type", pt);
   CopyFromConfig(path, "path", pt);
   CopyFromConfig(sqldb_path, "sqldb_path", pt);
+  CopyFromConfig(sqldb_journal_mode, "sqldb_journal_mode", pt);
+  CopyFromConfig(sqldb_synchronous, "sqldb_synchronous", pt);
+  CopyFromConfig(images_path, "images_path", pt);
+  CopyFromConfig(images_quota, "images_quota", pt);
+  CopyFromConfig(images_eviction, "images_eviction", pt);
+  CopyFromConfig(metadata_cache, "metadata_cache", pt);
   CopyFromConfig(uptane_metadata_path, "uptane_metadata_path", pt);
   CopyFromConfig(uptane_private_key_path, "uptane_private_key_path", pt);
   CopyFromConfig(uptane_public_key_path, "uptane_public_key_path", pt);
@@ -40,6 +47,12 @@ void StorageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, type, "type");
   writeOption(out_stream, path, "path");
   writeOption(out_stream, sqldb_path.get(""), "sqldb_path");
+  writeOption(out_stream, sqldb_journal_mode, "sqldb_journal_mode");
+  writeOption(out_stream, sqldb_synchronous, "sqldb_synchronous");
+  writeOption(out_stream, images_path.get(""), "images_path");
+  writeOption(out_stream, images_quota, "images_quota");
+  writeOption(out_stream, images_eviction, "images_eviction");
+  writeOption(out_stream, metadata_cache, "metadata_cache");
   writeOption(out_stream, uptane_metadata_path.get(""), "uptane_metadata_path");
   writeOption(out_stream, uptane_private_key_path.get(""), "uptane_private_key_path");
   writeOption(out_stream, uptane_public_key_path.get(""), "uptane_public_key_path");
@@ -154,6 +167,15 @@ void INvStorage::importData(const ImportConfig& import_config) {
   importInstalledVersions(import_config.base_path);
 }
 
+// a readonly storage may be written by another process meanwhile, it is never cached
+static std::shared_ptr<INvStorage> withCache(const StorageConfig& config, std::shared_ptr<INvStorage> storage,
+                                             const bool readonly) {
+  if (readonly || !config.metadata_cache) {
+    return storage;
+  }
+  return std::make_shared<CachingStorage>(config, std::move(storage));
+}
+
 std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config, const bool readonly) {
   switch (config.type) {
     case StorageType::kSqlite: {
@@ -176,14 +198,14 @@ std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config,
         auto sql_storage = std::make_shared<SQLStorage>(config, readonly);
         FSStorageRead fs_storage(old_config);
         INvStorage::FSSToSQLS(fs_storage, *sql_storage);
-        return sql_storage;
+        return withCache(config, sql_storage, readonly);
       }
       if (!boost::filesystem::exists(db_path)) {
         LOG_INFO << "Bootstrap empty SQL storage";
       } else {
         LOG_INFO << "Use existing SQL storage: " << db_path;
       }
-      return std::make_shared<SQLStorage>(config, readonly);
+      return withCache(config, std::make_shared<SQLStorage>(config, readonly), readonly);
     }
     case StorageType::kFileSystem:
     default:
@@ -192,6 +214,9 @@ std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config,
 }
 
 void INvStorage::FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage) {
+  // all or nothing, the old files are kept until the new database is complete
+  auto transaction = sql_storage.beginTransaction();
+
   std::string public_key;
   std::string private_key;
   if (fs_storage.loadPrimaryKeys(&public_key, &private_key)) {
@@ -270,6 +295,10 @@ void INvStorage::FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage) {
     }
   }
 
+  if (!transaction->commit()) {
+    LOG_ERROR << "Migration from filesystem storage failed";
+    return;
+  }
   // if everything is ok, remove old files.
   fs_storage.cleanUpAll();
 }
@@ -302,7 +331,8 @@ std::string INvStorage::fsReadInstalledVersions(const boost::filesystem::path& f
   return current_hash;
 }
 
-void INvStorage::saveInstalledVersion(const Uptane::Target& target) {
+bool INvStorage::saveInstalledVersion(const Uptane::Target& target) {
+  auto transaction = beginTransaction();
   std::vector<Uptane::Target> versions;
   std::string new_current_hash;
   loadInstalledVersions(&versions);
@@ -310,4 +340,9 @@ void INvStorage::saveInstalledVersion(const Uptane::Target& target) {
     versions.push_back(target);
   }
   storeInstalledVersions(versions, target.sha256Hash());
+  if (!transaction->commit()) {
+    LOG_ERROR << "Could not save the installed version " << target.filename();
+    return false;
+  }
+  return true;
 }
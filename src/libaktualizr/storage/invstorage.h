@@ -1,9 +1,11 @@
 #ifndef INVSTORAGE_H_
 #define INVSTORAGE_H_
 
+#include <array>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
@@ -48,6 +50,16 @@ class StorageTargetWHandle {
   virtual size_t wfeed(const uint8_t* buf, size_t size) = 0;
   virtual void wcommit() = 0;
   virtual void wabort() = 0;
+  // lower-case hex sha256 of the whole file, as hashed by the storage, once it has been committed
+  virtual std::string wsha256() const = 0;
+
+  // Resumable writes: wcheckpoint() makes the data written so far durable along with an opaque state that is handed
+  // back by INvStorage::resumeTargetFile(). wsuspend() does the same and closes the handle. wrevert() closes the handle
+  // and drops what was written since the last checkpoint, or the whole file if there is none.
+  virtual size_t woffset() const = 0;
+  virtual void wcheckpoint(const std::string& resume_state) = 0;
+  virtual void wsuspend(const std::string& resume_state) = 0;
+  virtual void wrevert() = 0;
 
   friend std::istream& operator>>(std::istream& is, StorageTargetWHandle& handle) {
     std::array<uint8_t, 256> arr{};
@@ -72,14 +84,41 @@ class StorageTargetRHandle {
   virtual size_t rsize() const = 0;
   virtual size_t rread(uint8_t* buf, size_t size) = 0;
   virtual void rclose() = 0;
+  // Read-only view of the whole file, mapped in memory and valid until the handle is closed. Returns nullptr if the
+  // storage can't map it, rread() has to be used then.
+  virtual const uint8_t* rmap() { return nullptr; }
+
+  // Reads the whole file into a string allocated once, for the consumers which need the image in memory
+  std::string rreadAll() {
+    std::string data(rsize(), '\0');
+    size_t offset = 0;
+    while (offset < data.size()) {
+      size_t nread = rread(reinterpret_cast<uint8_t*>(&data[offset]), data.size() - offset);
+      if (nread == 0) {
+        throw ReadError("could not read the whole file");
+      }
+      offset += nread;
+    }
+    return data;
+  }
 
   friend std::ostream& operator<<(std::ostream& os, StorageTargetRHandle& handle) {
-    std::array<uint8_t, 256> arr{};
+    const uint8_t* data = handle.rmap();
+    if (data != nullptr) {
+      os.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(handle.rsize()));
+      return os;
+    }
+
+    std::vector<uint8_t> buf(64 * 1024);
     size_t written = 0;
     while (written < handle.rsize()) {
-      size_t nread = handle.rread(arr.data(), arr.size());
+      size_t nread = handle.rread(buf.data(), buf.size());
+      if (nread == 0) {
+        os.setstate(std::ios::failbit);
+        break;
+      }
 
-      os.write(reinterpret_cast<char*>(arr.data()), static_cast<std::streamsize>(nread));
+      os.write(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(nread));
       written += nread;
     }
 
@@ -87,6 +126,23 @@ class StorageTargetRHandle {
   }
 };
 
+// Usage of the space taken by the target images
+struct TargetCacheStats {
+  uint64_t bytes_held{0};  // images and downloads in progress
+  // counted since the storage was opened
+  uint64_t bytes_reclaimed{0};
+  uint64_t images_evicted{0};
+  uint64_t downloads_skipped{0};
+};
+
+// A group of writes made persistent together, see INvStorage::beginTransaction()
+class StorageTransaction {
+ public:
+  virtual ~StorageTransaction() = default;
+  // Returns false if the writes could not be made persistent, they are rolled back then
+  virtual bool commit() = 0;
+};
+
 // Functions loading/storing multiple pieces of data are supposed to do so atomically as far as implementation makes it
 // possible
 class INvStorage {
@@ -119,6 +175,12 @@ class INvStorage {
   virtual bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) = 0;
   virtual void clearNonRootMeta(Uptane::RepositoryType repo) = 0;
   virtual void clearMetadata() = 0;
+  // HTTP cache validators (ETag, Last-Modified) of the latest metadata fetched for a role, opaque to the storage
+  virtual void storeMetaValidators(const std::string& validators, Uptane::RepositoryType repo, Uptane::Role role) = 0;
+  virtual bool loadMetaValidators(std::string* validators, Uptane::RepositoryType repo, Uptane::Role role) = 0;
+  // State of the latest verified metadata for a role, opaque to the storage
+  virtual void storeVerifiedMeta(const std::string& state, Uptane::RepositoryType repo, Uptane::Role role) = 0;
+  virtual bool loadVerifiedMeta(std::string* state, Uptane::RepositoryType repo, Uptane::Role role) = 0;
 
   virtual void storeDeviceId(const std::string& device_id) = 0;
   virtual bool loadDeviceId(std::string* device_id) = 0;
@@ -148,11 +210,23 @@ class INvStorage {
   // Incremental file API
   virtual std::unique_ptr<StorageTargetWHandle> allocateTargetFile(bool from_director, const std::string& filename,
                                                                    size_t size) = 0;
+  // Returns nullptr if there is no suspended write of this file with the given size
+  virtual std::unique_ptr<StorageTargetWHandle> resumeTargetFile(const std::string& filename, size_t size,
+                                                                 std::string* resume_state) = 0;
   virtual std::unique_ptr<StorageTargetRHandle> openTargetFile(const std::string& filename) = 0;
   virtual void removeTargetFile(const std::string& filename) = 0;
+  // Makes an image which is already stored, under this or any other name, available as filename without downloading
+  // it again. Returns false if no complete image with this sha256 and size is stored.
+  virtual bool reuseTargetFile(const std::string& filename, const std::string& sha256, uint64_t size) = 0;
+  virtual TargetCacheStats targetCacheStats() = 0;
 
   virtual void cleanUp() = 0;
 
+  // All the storage accesses made by the calling thread until commit() belong to the transaction: they are written to
+  // disk at once, or not at all if the transaction is destroyed without commit(). Transactions can be nested, only the
+  // outermost one writes to disk. The transaction must not be used from another thread.
+  virtual std::unique_ptr<StorageTransaction> beginTransaction() = 0;
+
   // Special constructors and utilities
   static std::shared_ptr<INvStorage> newStorage(const StorageConfig& config, bool readonly = false);
   static void FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage);
@@ -161,7 +235,7 @@ class INvStorage {
 
   // Not purely virtual
   void importData(const ImportConfig& import_config);
-  void saveInstalledVersion(const Uptane::Target& target);
+  bool saveInstalledVersion(const Uptane::Target& target);
 
  private:
   void importSimple(const boost::filesystem::path& base_path, store_data_t store_func, load_data_t load_func,
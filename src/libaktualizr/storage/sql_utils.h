@@ -1,13 +1,18 @@
 #ifndef SQL_UTILS_H_
 #define SQL_UTILS_H_
 
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
 
 #include <sqlite3.h>
+#include <sys/stat.h>
 
 #include "logging/logging.h"
 
@@ -28,14 +33,60 @@ class SQLException : public std::runtime_error {
   ~SQLException() noexcept override = default;
 };
 
+// Prepared statements of one connection, kept for reuse and keyed by their SQL text
+class SQLiteStatementCache {
+ public:
+  SQLiteStatementCache() = default;
+  ~SQLiteStatementCache() { clear(); }
+  SQLiteStatementCache& operator=(const SQLiteStatementCache&) = delete;
+  SQLiteStatementCache(const SQLiteStatementCache&) = delete;
+
+  // nullptr if there is no idle statement for this SQL
+  sqlite3_stmt* take(const std::string& sql) {
+    auto it = statements_.find(sql);
+    if (it == statements_.end()) {
+      return nullptr;
+    }
+    sqlite3_stmt* statement = it->second;
+    statements_.erase(it);
+    return statement;
+  }
+
+  void give(const std::string& sql, sqlite3_stmt* statement) {
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    if (statements_.size() >= kMaxSize) {
+      sqlite3_finalize(statement);
+      return;
+    }
+    statements_.emplace(sql, statement);
+  }
+
+  void clear() {
+    for (auto& statement : statements_) {
+      sqlite3_finalize(statement.second);
+    }
+    statements_.clear();
+  }
+
+ private:
+  static const size_t kMaxSize = 64;
+  std::unordered_multimap<std::string, sqlite3_stmt*> statements_;
+};
+
 class SQLiteStatement {
  public:
   template <typename... Types>
   SQLiteStatement(sqlite3* db, const std::string& zSql, const Types&... args)
-      : db_(db), stmt_(nullptr, sqlite3_finalize), bind_cnt_(1) {
-    sqlite3_stmt* statement;
+      : SQLiteStatement(db, static_cast<SQLiteStatementCache*>(nullptr), zSql, args...) {}
+
+  // The statement is taken from the cache if possible and given back to it when destroyed
+  template <typename... Types>
+  SQLiteStatement(sqlite3* db, SQLiteStatementCache* cache, const std::string& zSql, const Types&... args)
+      : db_(db), stmt_(nullptr, Release{cache, zSql}), bind_cnt_(1) {
+    sqlite3_stmt* statement = (cache != nullptr) ? cache->take(zSql) : nullptr;
 
-    if (sqlite3_prepare_v2(db_, zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
+    if (statement == nullptr && sqlite3_prepare_v2(db_, zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Could not prepare statement: " << sqlite3_errmsg(db_);
       throw SQLException();
     }
@@ -53,7 +104,7 @@ class SQLiteStatement {
     if (b == nullptr) {
       return boost::none;
     }
-    return std::string(b);
+    return std::string(b, static_cast<size_t>(sqlite3_column_bytes(stmt_.get(), iCol)));
   }
 
   inline boost::optional<std::string> get_result_col_str(int iCol) {
@@ -121,35 +172,146 @@ class SQLiteStatement {
     bindArguments(args...);
   }
 
+  struct Release {
+    SQLiteStatementCache* cache;
+    std::string sql;
+    void operator()(sqlite3_stmt* statement) const {
+      if (cache != nullptr) {
+        cache->give(sql, statement);
+      } else {
+        sqlite3_finalize(statement);
+      }
+    }
+  };
+
   sqlite3* db_;
-  std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> stmt_;
+  std::unique_ptr<sqlite3_stmt, Release> stmt_;
   int bind_cnt_;
   // copies of data that need to persist for the object duration
   // (avoid vector because of resizing issues)
   std::list<std::string> owned_data_;
 };
 
-// Unique ownership SQLite3 connection
-class SQLite3Guard {
- public:
-  sqlite3* get() { return handle_.get(); }
-  int get_rc() { return rc_; }
+// SQLite3 connection along with its prepared statements
+struct SQLite3Connection {
+  // how long a statement waits for a lock held by another connection, possibly of another process, before failing
+  // with SQLITE_BUSY
+  static constexpr int kBusyTimeoutMs = 5000;
 
-  explicit SQLite3Guard(const char* path, bool readonly) : handle_(nullptr, sqlite3_close), rc_(0) {
+  SQLite3Connection(const char* path, bool readonly) : handle(nullptr, sqlite3_close) {
     sqlite3* h;
     if (readonly) {
-      rc_ = sqlite3_open_v2(path, &h, SQLITE_OPEN_READONLY, nullptr);
+      rc = sqlite3_open_v2(path, &h, SQLITE_OPEN_READONLY, nullptr);
     } else {
-      rc_ = sqlite3_open(path, &h);
+      rc = sqlite3_open(path, &h);
+    }
+    handle.reset(h);
+    if (rc == SQLITE_OK) {
+      sqlite3_busy_timeout(h, kBusyTimeoutMs);
+    }
+    fileId(path, &file_id);
+  }
+
+  // identifies the database file, to notice when it has been removed or replaced
+  static bool fileId(const char* path, std::pair<dev_t, ino_t>* id) {
+    struct stat st {};
+    if (stat(path, &st) != 0) {
+      return false;
     }
-    handle_.reset(h);
+    *id = {st.st_dev, st.st_ino};
+    return true;
   }
 
+  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle;
+  int rc{0};
+  std::pair<dev_t, ino_t> file_id{0, 0};
+  // declared after the handle, the statements have to be finalized before the connection is closed
+  SQLiteStatementCache statements;
+};
+
+class SQLite3Guard;
+
+// Connections to one database, reused instead of opening a new one for each access
+class SQLite3Pool : public std::enable_shared_from_this<SQLite3Pool> {
+ public:
+  // init_sql is run on each new connection, e.g. to set per-connection pragmas
+  SQLite3Pool(boost::filesystem::path path, bool readonly, std::string init_sql = "", size_t max_idle = 4)
+      : path_(std::move(path)), readonly_(readonly), init_sql_(std::move(init_sql)), max_idle_(max_idle) {}
+
+  // Takes an idle connection or opens a new one, it is given back when the guard is destroyed
+  SQLite3Guard acquire();
+
+  void release(std::unique_ptr<SQLite3Connection> connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < max_idle_) {
+      idle_.push_back(std::move(connection));
+    }
+  }
+
+ private:
+  const boost::filesystem::path path_;
+  const bool readonly_;
+  const std::string init_sql_;
+  const size_t max_idle_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<SQLite3Connection>> idle_;
+};
+
+// Unique ownership SQLite3 connection, either standalone or borrowed from a pool.
+// Inside of a transaction, it can also be a nested use of the transaction's
+// connection, on which transactions become savepoints.
+class SQLite3Guard {
+ public:
+  sqlite3* get() { return connection_->handle.get(); }
+  int get_rc() { return connection_->rc; }
+
+  explicit SQLite3Guard(const char* path, bool readonly)
+      : owned_(new SQLite3Connection(path, readonly)), connection_(owned_.get()) {}
+
   explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false)
       : SQLite3Guard(path.c_str(), readonly) {}
 
+  SQLite3Guard(std::unique_ptr<SQLite3Connection> connection, std::shared_ptr<SQLite3Pool> pool)
+      : owned_(std::move(connection)), connection_(owned_.get()), pool_(std::move(pool)) {}
+
+  // nested use of a connection owned by another guard
+  explicit SQLite3Guard(SQLite3Connection* outer) : connection_(outer), nested_(true) {}
+
+  SQLite3Guard(SQLite3Guard&& other) noexcept
+      : owned_(std::move(other.owned_)),
+        connection_(other.connection_),
+        pool_(std::move(other.pool_)),
+        nested_(other.nested_),
+        savepoints_(other.savepoints_) {
+    other.connection_ = nullptr;
+    other.savepoints_ = 0;
+  }
+  SQLite3Guard& operator=(SQLite3Guard&&) = delete;
+  SQLite3Guard(const SQLite3Guard&) = delete;
+  SQLite3Guard& operator=(const SQLite3Guard&) = delete;
+
+  ~SQLite3Guard() {
+    if (connection_ == nullptr) {
+      return;
+    }
+    // same as closing the connection for a transaction that has not been committed
+    while (savepoints_ > 0) {
+      rollbackTransaction();
+    }
+    if (pool_ == nullptr) {
+      return;
+    }
+    if (sqlite3_get_autocommit(connection_->handle.get()) == 0) {
+      rollbackTransaction();
+    }
+    pool_->release(std::move(owned_));
+  }
+
+  SQLite3Connection* connection() { return connection_; }
+  bool nested() const { return nested_; }
+
   int exec(const char* sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
-    return sqlite3_exec(handle_.get(), sql, callback, cb_arg, nullptr);
+    return sqlite3_exec(connection_->handle.get(), sql, callback, cb_arg, nullptr);
   }
 
   int exec(const std::string& sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
@@ -158,20 +320,32 @@ class SQLite3Guard {
 
   template <typename... Types>
   SQLiteStatement prepareStatement(const std::string& zSql, const Types&... args) {
-    return SQLiteStatement(handle_.get(), zSql, args...);
+    return SQLiteStatement(connection_->handle.get(), &connection_->statements, zSql, args...);
   }
 
-  std::string errmsg() const { return sqlite3_errmsg(handle_.get()); }
+  std::string errmsg() const { return sqlite3_errmsg(connection_->handle.get()); }
 
   // Transaction handling
   //
   // A transactional series of db operations should be realized between calls of
   // `beginTranscation()` and `commitTransaction()`. If no commit is done before
-  // the destruction of the `SQLite3Guard` (and thus the SQLite connection) or
-  // if `rollbackTransaction()` is called explicitely, the changes will be
-  // rolled back
+  // the destruction of the `SQLite3Guard` (and thus the SQLite connection, or
+  // its return to the pool) or if `rollbackTransaction()` is called
+  // explicitely, the changes will be rolled back.
+  //
+  // On a nested guard, they are savepoints of the outer transaction: they can
+  // be rolled back on their own, but are only made persistent with it.
 
   bool beginTransaction() {
+    if (nested_) {
+      int ret = exec("SAVEPOINT nested;", nullptr, nullptr);
+      if (ret != SQLITE_OK) {
+        LOG_ERROR << "Can't create savepoint: " << errmsg();
+        return false;
+      }
+      ++savepoints_;
+      return true;
+    }
     // Note: transaction cannot be nested and this will fail if another
     // transaction was open on the same connection
     int ret = exec("BEGIN TRANSACTION;", nullptr, nullptr);
@@ -182,6 +356,15 @@ class SQLite3Guard {
   }
 
   bool commitTransaction() {
+    if (nested_) {
+      int ret = exec("RELEASE SAVEPOINT nested;", nullptr, nullptr);
+      if (ret != SQLITE_OK) {
+        LOG_ERROR << "Can't release savepoint: " << errmsg();
+        return false;
+      }
+      --savepoints_;
+      return true;
+    }
     int ret = exec("COMMIT TRANSACTION;", nullptr, nullptr);
     if (ret != SQLITE_OK) {
       LOG_ERROR << "Can't commit transaction: " << errmsg();
@@ -190,6 +373,17 @@ class SQLite3Guard {
   }
 
   bool rollbackTransaction() {
+    if (nested_) {
+      if (savepoints_ == 0) {
+        return false;
+      }
+      --savepoints_;
+      int ret = exec("ROLLBACK TO SAVEPOINT nested; RELEASE SAVEPOINT nested;", nullptr, nullptr);
+      if (ret != SQLITE_OK) {
+        LOG_ERROR << "Can't rollback to savepoint: " << errmsg();
+      }
+      return ret == SQLITE_OK;
+    }
     int ret = exec("ROLLBACK TRANSACTION;", nullptr, nullptr);
     if (ret != SQLITE_OK) {
       LOG_ERROR << "Can't rollback transaction: " << errmsg();
@@ -198,8 +392,42 @@ class SQLite3Guard {
   }
 
  private:
-  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle_;
-  int rc_;
+  std::unique_ptr<SQLite3Connection> owned_;
+  SQLite3Connection* connection_;
+  std::shared_ptr<SQLite3Pool> pool_;
+  bool nested_{false};
+  int savepoints_{0};
 };
 
+inline SQLite3Guard SQLite3Pool::acquire() {
+  std::unique_ptr<SQLite3Connection> connection;
+  std::pair<dev_t, ino_t> file_id{0, 0};
+  const bool file_exists = SQLite3Connection::fileId(path_.c_str(), &file_id);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // connections to a file which is not there anymore would keep using the old one
+    idle_.erase(std::remove_if(idle_.begin(), idle_.end(),
+                               [&](const std::unique_ptr<SQLite3Connection>& idle) {
+                                 return !file_exists || idle->file_id != file_id;
+                               }),
+                idle_.end());
+    if (!idle_.empty()) {
+      connection = std::move(idle_.back());
+      idle_.pop_back();
+    }
+  }
+  if (connection == nullptr) {
+    connection = std::unique_ptr<SQLite3Connection>(new SQLite3Connection(path_.c_str(), readonly_));
+    if (connection->rc != SQLITE_OK) {
+      // not worth keeping
+      return SQLite3Guard(std::move(connection), nullptr);
+    }
+    if (!init_sql_.empty() &&
+        sqlite3_exec(connection->handle.get(), init_sql_.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+      LOG_ERROR << "Can't set up database connection: " << sqlite3_errmsg(connection->handle.get());
+    }
+  }
+  return SQLite3Guard(std::move(connection), shared_from_this());
+}
+
 #endif  // SQL_UTILS_H_
@@ -16,6 +16,66 @@ TEST(sql_utils, PrepareRvalue) {
   EXPECT_EQ(statement.step(), SQLITE_DONE);
 }
 
+/*
+ * Statements given back to the cache are reset and can be bound again.
+ */
+TEST(sql_utils, CachedStatement) {
+  TemporaryDirectory temp_dir;
+  SQLite3Guard db((temp_dir.Path() / "test.db").c_str());
+  db.exec("CREATE TABLE example(ex1 INTEGER);", NULL, NULL);
+
+  sqlite3_stmt* first;
+  {
+    auto statement = db.prepareStatement<int>("INSERT INTO example(ex1) VALUES (?);", 1);
+    first = statement.get();
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+  }
+  {
+    auto statement = db.prepareStatement<int>("INSERT INTO example(ex1) VALUES (?);", 2);
+    EXPECT_EQ(statement.get(), first);
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+    // in use, a new one is prepared
+    auto other = db.prepareStatement<int>("INSERT INTO example(ex1) VALUES (?);", 3);
+    EXPECT_NE(other.get(), first);
+    EXPECT_EQ(other.step(), SQLITE_DONE);
+  }
+
+  auto statement = db.prepareStatement("SELECT sum(ex1) FROM example;");
+  EXPECT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 6);
+}
+
+/*
+ * Pooled connections are reused and rolled back if they are given back in
+ * the middle of a transaction.
+ */
+TEST(sql_utils, PooledConnection) {
+  TemporaryDirectory temp_dir;
+  auto pool = std::make_shared<SQLite3Pool>(temp_dir.Path() / "test.db", false);
+
+  sqlite3* handle;
+  {
+    SQLite3Guard db = pool->acquire();
+    handle = db.get();
+    db.exec("CREATE TABLE example(ex1 INTEGER);", NULL, NULL);
+    EXPECT_TRUE(db.beginTransaction());
+    auto statement = db.prepareStatement<int>("INSERT INTO example(ex1) VALUES (?);", 1);
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+  }
+
+  SQLite3Guard db = pool->acquire();
+  EXPECT_EQ(db.get(), handle);
+  auto statement = db.prepareStatement("SELECT count(*) FROM example;");
+  EXPECT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 0);
+  EXPECT_TRUE(db.beginTransaction());
+  EXPECT_TRUE(db.commitTransaction());
+
+  // a second user gets its own connection
+  SQLite3Guard db2 = pool->acquire();
+  EXPECT_NE(db2.get(), handle);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
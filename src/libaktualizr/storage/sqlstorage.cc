@@ -1,15 +1,47 @@
 #include "sqlstorage.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 
+#include <boost/algorithm/string.hpp>
+
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "sql_utils.h"
 #include "utilities/utils.h"
 
+// Per-connection settings, the journal mode is set once for the database
+static std::string connectionPragmas(const StorageConfig& config) {
+  static const std::vector<std::string> modes{"off", "normal", "full", "extra"};
+  std::string synchronous = boost::algorithm::to_lower_copy(config.sqldb_synchronous);
+  if (std::find(modes.begin(), modes.end(), synchronous) == modes.end()) {
+    LOG_ERROR << "Invalid sqldb_synchronous value " << config.sqldb_synchronous << ", using full";
+    synchronous = "full";
+  }
+  return "PRAGMA synchronous=" + synchronous + ";";
+}
+
+static std::string journalMode(const StorageConfig& config) {
+  static const std::vector<std::string> modes{"delete", "truncate", "persist", "wal"};
+  std::string mode = boost::algorithm::to_lower_copy(config.sqldb_journal_mode);
+  if (std::find(modes.begin(), modes.end(), mode) == modes.end()) {
+    LOG_ERROR << "Invalid sqldb_journal_mode value " << config.sqldb_journal_mode << ", using delete";
+    mode = "delete";
+  }
+  return mode;
+}
+
 boost::filesystem::path SQLStorage::dbPath() const { return config_.sqldb_path.get(config_.path); }
 
 // find metadata with version set to -1 (e.g. after migration) and assign proper version to it
@@ -63,7 +95,11 @@ void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, Uptane::Role role
   db.commitTransaction();
 }
 
-SQLStorage::SQLStorage(const StorageConfig& config, bool readonly) : INvStorage(config), readonly_(readonly) {
+SQLStorage::SQLStorage(const StorageConfig& config, bool readonly)
+    : INvStorage(config),
+      readonly_(readonly),
+      pool_(std::make_shared<SQLite3Pool>(dbPath(), readonly, connectionPragmas(config))),
+      blobs_(config.images_path.get(config.path)) {
   boost::filesystem::path db_parent_path = dbPath().parent_path();
   if (!boost::filesystem::is_directory(db_parent_path)) {
     Utils::createDirectories(db_parent_path, S_IRWXU);
@@ -79,6 +115,15 @@ SQLStorage::SQLStorage(const StorageConfig& config, bool readonly) : INvStorage(
     }
   }
 
+  if (!readonly) {
+    // persistent in the database file for WAL, so it only has to be done once
+    SQLite3Guard db = dbConnection();
+    const std::string pragma = "PRAGMA journal_mode=" + journalMode(config) + ";";
+    if (db.exec(pragma.c_str(), nullptr, nullptr) != SQLITE_OK) {
+      LOG_ERROR << "Can't set journal mode: " << db.errmsg();
+    }
+  }
+
   if (!dbMigrate()) {
     LOG_ERROR << "SQLite database migration failed";
     // Continue to run anyway, it can't be worse
@@ -90,10 +135,25 @@ SQLStorage::SQLStorage(const StorageConfig& config, bool readonly) : INvStorage(
   } catch (...) {
     LOG_ERROR << "SQLite database metadata version migration failed";
   }
+
+  if (!readonly) {
+    try {
+      migrateTargetImages();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Moving target images out of the database failed: " << e.what();
+    }
+  }
 }
 
 SQLite3Guard SQLStorage::dbConnection() {
-  SQLite3Guard db(dbPath(), readonly_);
+  {
+    std::lock_guard<std::mutex> lock(transactions_mutex_);
+    auto it = transactions_.find(std::this_thread::get_id());
+    if (it != transactions_.end()) {
+      return SQLite3Guard(it->second);
+    }
+  }
+  SQLite3Guard db = pool_->acquire();
   if (db.get_rc() != SQLITE_OK) {
     throw SQLException(std::string("Can't open database: ") + db.errmsg());
   }
@@ -530,6 +590,20 @@ void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
   if (del_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Can't clear metadata: " << db.errmsg();
   }
+
+  auto del_validators = db.prepareStatement<int>("DELETE FROM meta_validators WHERE (repo=? AND meta_type != 0);",
+                                                 static_cast<int>(repo));
+
+  if (del_validators.step() != SQLITE_DONE) {
+    LOG_ERROR << "Can't clear metadata validators: " << db.errmsg();
+  }
+
+  auto del_verified = db.prepareStatement<int>("DELETE FROM verified_meta WHERE (repo=? AND meta_type != 0);",
+                                               static_cast<int>(repo));
+
+  if (del_verified.step() != SQLITE_DONE) {
+    LOG_ERROR << "Can't clear verified metadata: " << db.errmsg();
+  }
 }
 
 void SQLStorage::clearMetadata() {
@@ -539,6 +613,82 @@ void SQLStorage::clearMetadata() {
     LOG_ERROR << "Can't clear metadata: " << db.errmsg();
     return;
   }
+
+  if (db.exec("DELETE FROM meta_validators;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Can't clear metadata validators: " << db.errmsg();
+    return;
+  }
+
+  if (db.exec("DELETE FROM verified_meta;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Can't clear verified metadata: " << db.errmsg();
+    return;
+  }
+}
+
+void SQLStorage::storeMetaValidators(const std::string& validators, Uptane::RepositoryType repo, Uptane::Role role) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, int, std::string>(
+      "INSERT OR REPLACE INTO meta_validators(repo, meta_type, validators) VALUES (?,?,?);", static_cast<int>(repo),
+      role.ToInt(), validators);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Can't set metadata validators: " << db.errmsg();
+    return;
+  }
+}
+
+bool SQLStorage::loadMetaValidators(std::string* validators, Uptane::RepositoryType repo, Uptane::Role role) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, int>(
+      "SELECT validators FROM meta_validators WHERE (repo=? AND meta_type=?);", static_cast<int>(repo), role.ToInt());
+  int result = statement.step();
+
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << "Metadata validators not present";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Can't get metadata validators: " << db.errmsg();
+    return false;
+  }
+  if (validators != nullptr) {
+    *validators = statement.get_result_col_str(0).value();
+  }
+
+  return true;
+}
+
+void SQLStorage::storeVerifiedMeta(const std::string& state, Uptane::RepositoryType repo, Uptane::Role role) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, int, SQLBlob>(
+      "INSERT OR REPLACE INTO verified_meta(repo, meta_type, state) VALUES (?,?,?);", static_cast<int>(repo),
+      role.ToInt(), SQLBlob(state));
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Can't set verified metadata: " << db.errmsg();
+    return;
+  }
+}
+
+bool SQLStorage::loadVerifiedMeta(std::string* state, Uptane::RepositoryType repo, Uptane::Role role) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, int>("SELECT state FROM verified_meta WHERE (repo=? AND meta_type=?);",
+                                                 static_cast<int>(repo), role.ToInt());
+  int result = statement.step();
+
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << "Verified metadata not present";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Can't get verified metadata: " << db.errmsg();
+    return false;
+  }
+  if (state != nullptr) {
+    *state = statement.get_result_col_blob(0).value();
+  }
+
+  return true;
 }
 
 void SQLStorage::storeDeviceId(const std::string& device_id) {
@@ -933,15 +1083,59 @@ void SQLStorage::clearInstallationResult() {
   }
 }
 
+// Removes the image file of a hash once no target refers to it anymore. To be called in the transaction which removed
+// the reference, so that it can't race with a handle committing the same image.
+static void releaseBlob(SQLite3Guard& db, const BlobStore& blobs, const std::string& sha256) {
+  if (sha256.empty()) {
+    return;
+  }
+  auto statement = db.prepareStatement<std::string>("SELECT count(*) FROM target_images WHERE sha256 = ?;", sha256);
+  if (statement.step() != SQLITE_ROW) {
+    LOG_ERROR << "Can't count references to image " << sha256 << ": " << db.errmsg();
+    return;
+  }
+  if (statement.get_result_col_int(0) == 0) {
+    blobs.removeBlob(sha256);
+  }
+}
+
+// Deletes a target and its data in the current transaction, returns false if there is no such target
+static bool deleteTarget(SQLite3Guard& db, const BlobStore& blobs, const std::string& filename) {
+  auto statement = db.prepareStatement<std::string>("SELECT rowid, sha256 FROM target_images WHERE filename = ?;",
+                                                    filename);
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return false;
+  }
+  if (result != SQLITE_ROW) {
+    throw SQLException("Can't get target " + filename + ": " + db.errmsg());
+  }
+  const int64_t row_id = statement.get_result_col_int(0);
+  const std::string sha256 = statement.get_result_col_str(1).value_or("");
+
+  statement = db.prepareStatement<int64_t>("DELETE FROM target_images WHERE rowid = ?;", row_id);
+  if (statement.step() != SQLITE_DONE) {
+    throw SQLException("Can't remove target " + filename + ": " + db.errmsg());
+  }
+  blobs.removePartial(row_id);
+  releaseBlob(db, blobs, sha256);
+  return true;
+}
+
+// The image is written directly to its file in the blob store, the database only records the progress. The sha256 of
+// the data is computed along the way and gives the final name of the file.
 class SQLTargetWHandle : public StorageTargetWHandle {
  public:
   SQLTargetWHandle(const SQLStorage& storage, std::string filename, size_t size)
       : db_(storage.dbPath()),
+        blobs_(storage.blobs_),
         filename_(std::move(filename)),
         expected_size_(size),
         written_size_(0),
         closed_(false),
-        blob_(nullptr) {
+        checkpointed_(false),
+        row_id_(0),
+        fd_(-1) {
     StorageTargetWHandle::WriteError exc("could not save file " + filename_ + " to sql storage");
 
     if (db_.get_rc() != SQLITE_OK) {
@@ -949,126 +1143,325 @@ class SQLTargetWHandle : public StorageTargetWHandle {
       throw exc;
     }
 
-    // allocate a zero blob
+    // replaces any previous version of the file
     if (!db_.beginTransaction()) {
       throw exc;
     }
+    try {
+      deleteTarget(db_, blobs_, filename_);
+    } catch (const SQLException& e) {
+      LOG_ERROR << e.what();
+      throw exc;
+    }
 
-    auto statement = db_.prepareStatement<std::string, SQLZeroBlob>(
-        "INSERT OR REPLACE INTO target_images (filename, image_data) VALUES (?, ?);", filename_,
-        SQLZeroBlob{expected_size_});
+    // a non-null resume_state marks the file as incomplete until it is committed
+    auto statement = db_.prepareStatement<std::string, int64_t>(
+        "INSERT INTO target_images (filename, real_size, resume_state, expected_size) VALUES (?, 0, '', ?);",
+        filename_, static_cast<int64_t>(expected_size_));
 
     if (statement.step() != SQLITE_DONE) {
       LOG_ERROR << "Statement step failure: " << db_.errmsg();
       throw exc;
     }
+    row_id_ = static_cast<int64_t>(sqlite3_last_insert_rowid(db_.get()));
+    if (!db_.commitTransaction()) {
+      throw exc;
+    }
+
+    fd_ = blobs_.openPartial(row_id_, 0, expected_size_);
+    if (fd_ < 0) {
+      SQLTargetWHandle::wabort();
+      throw exc;
+    }
+  }
+
+  // continue a write suspended with wsuspend() or interrupted after a wcheckpoint()
+  SQLTargetWHandle(const SQLStorage& storage, std::string filename, size_t size, std::string* resume_state)
+      : db_(storage.dbPath()),
+        blobs_(storage.blobs_),
+        filename_(std::move(filename)),
+        expected_size_(size),
+        written_size_(0),
+        closed_(false),
+        checkpointed_(true),
+        row_id_(0),
+        fd_(-1) {
+    StorageTargetWHandle::WriteError exc("could not resume writing file " + filename_ + " to sql storage");
+
+    if (db_.get_rc() != SQLITE_OK) {
+      LOG_ERROR << "Can't open database: " << db_.errmsg();
+      throw exc;
+    }
 
-    // open the created blob for writing
-    sqlite3_int64 row_id = sqlite3_last_insert_rowid(db_.get());
+    auto statement = db_.prepareStatement<std::string>(
+        "SELECT rowid, real_size, resume_state, hash_state FROM target_images WHERE filename = ? AND "
+        "resume_state IS NOT NULL;",
+        filename_);
+
+    if (statement.step() != SQLITE_ROW) {
+      LOG_ERROR << "No suspended file in db: " << filename_;
+      throw exc;
+    }
+
+    row_id_ = statement.get_result_col_int(0);
+    written_size_ = static_cast<size_t>(statement.get_result_col_int(1));
+    if (written_size_ > expected_size_) {
+      LOG_ERROR << "Suspended file " << filename_ << " is larger than expected";
+      throw exc;
+    }
+    if (resume_state != nullptr) {
+      *resume_state = statement.get_result_col_str(2).value_or("");
+    }
+    // the data written before the interruption is not read again, the hash state saved along with it is used instead
+    if (!hasher_.setState(statement.get_result_col_blob(3).value_or(""))) {
+      LOG_ERROR << "No hash state saved for suspended file " << filename_;
+      throw exc;
+    }
+    boost::system::error_code ec;
+    if (boost::filesystem::file_size(blobs_.partialPath(row_id_), ec) < written_size_ || ec) {
+      LOG_ERROR << "Suspended file " << filename_ << " is shorter than its last checkpoint";
+      throw exc;
+    }
 
-    if (sqlite3_blob_open(db_.get(), "main", "target_images", "image_data", row_id, 1, &blob_) != SQLITE_OK) {
-      LOG_ERROR << "Could not open blob " << db_.errmsg();
+    fd_ = blobs_.openPartial(row_id_, written_size_, expected_size_);
+    if (fd_ < 0) {
       throw exc;
     }
   }
 
   ~SQLTargetWHandle() override {
     if (!closed_) {
-      LOG_WARNING << "Handle for file " << filename_ << " has not been committed or aborted, forcing abort";
-      SQLTargetWHandle::wabort();
+      if (checkpointed_) {
+        LOG_WARNING << "Handle for file " << filename_ << " has not been committed or aborted, reverting to checkpoint";
+        closed_ = true;
+      } else {
+        LOG_WARNING << "Handle for file " << filename_ << " has not been committed or aborted, forcing abort";
+        SQLTargetWHandle::wabort();
+      }
     }
+    closeFd();
   }
 
   size_t wfeed(const uint8_t* buf, size_t size) override {
-    if (sqlite3_blob_write(blob_, buf, static_cast<int>(size), static_cast<int>(written_size_)) != SQLITE_OK) {
-      LOG_ERROR << "Could not write in blob: " << db_.errmsg();
+    if (written_size_ + size > expected_size_) {
+      LOG_ERROR << "Could not write in file: " << filename_ << " is larger than expected";
+      return 0;
+    }
+    if (!BlobStore::writeAll(fd_, buf, size)) {
+      LOG_ERROR << "Could not write in file " << blobs_.partialPath(row_id_) << ": " << std::strerror(errno);
       return 0;
     }
+    hasher_.update(buf, size);
     written_size_ += size;
     return size;
   }
 
   void wcommit() override {
     closed_ = true;
-    sqlite3_blob_close(blob_);
-    blob_ = nullptr;
-    if (!db_.commitTransaction()) {
-      throw StorageTargetWHandle::WriteError("could not save file " + filename_ + " to sql storage");
+    StorageTargetWHandle::WriteError exc("could not save file " + filename_ + " to sql storage");
+    sha256_ = boost::algorithm::to_lower_copy(hasher_.getHexDigest());
+
+    // the file is moved while the database is locked for writing, see releaseBlob()
+    if (!db_.beginTransaction()) {
+      throw exc;
+    }
+    auto statement = db_.prepareStatement<int64_t, std::string, int64_t>(
+        "UPDATE target_images SET real_size = ?, resume_state = NULL, hash_state = NULL, sha256 = ?, last_used = "
+        "(SELECT ifnull(max(last_used), 0) + 1 FROM target_images) WHERE rowid = ?;",
+        static_cast<int64_t>(written_size_), sha256_, row_id_);
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Statement step failure: " << db_.errmsg();
+      throw exc;
+    }
+    const int fd = fd_;
+    fd_ = -1;
+    if (!blobs_.commit(fd, row_id_, sha256_) || !db_.commitTransaction()) {
+      db_.rollbackTransaction();
+      throw exc;
     }
   }
 
   void wabort() noexcept override {
     closed_ = true;
-    if (blob_ != nullptr) {
-      sqlite3_blob_close(blob_);
-      blob_ = nullptr;
+    closeFd();
+
+    try {
+      auto statement = db_.prepareStatement<int64_t>("DELETE FROM target_images WHERE rowid = ?;", row_id_);
+      if (statement.step() != SQLITE_DONE) {
+        LOG_ERROR << "Could not remove partial file " << filename_ << ": " << db_.errmsg();
+      }
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Could not remove partial file " << filename_ << ": " << e.what();
     }
+    blobs_.removePartial(row_id_);
+  }
+
+  std::string wsha256() const override { return sha256_; }
 
-    db_.rollbackTransaction();
+  size_t woffset() const override { return written_size_; }
+
+  void wcheckpoint(const std::string& resume_state) override {
+    if (!checkpoint(resume_state)) {
+      throw StorageTargetWHandle::WriteError("could not save progress of file " + filename_ + " to sql storage");
+    }
+    checkpointed_ = true;
+  }
+
+  void wsuspend(const std::string& resume_state) override {
+    closed_ = true;
+    if (!checkpoint(resume_state)) {
+      throw StorageTargetWHandle::WriteError("could not save progress of file " + filename_ + " to sql storage");
+    }
+    closeFd();
+  }
+
+  void wrevert() noexcept override {
+    if (!checkpointed_) {
+      wabort();
+      return;
+    }
+    // the next resumeTargetFile() truncates the file to the checkpoint
+    closed_ = true;
+    closeFd();
   }
 
  private:
+  // the data must be on disk before the progress is recorded
+  bool checkpoint(const std::string& resume_state) {
+    if (fdatasync(fd_) != 0) {
+      LOG_ERROR << "Could not sync file " << blobs_.partialPath(row_id_) << ": " << std::strerror(errno);
+      return false;
+    }
+    auto statement = db_.prepareStatement<int64_t, std::string, SQLBlob, int64_t>(
+        "UPDATE target_images SET real_size = ?, resume_state = ?, hash_state = ? WHERE rowid = ?;",
+        static_cast<int64_t>(written_size_), resume_state, SQLBlob(hasher_.getState()), row_id_);
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Statement step failure: " << db_.errmsg();
+      return false;
+    }
+    return true;
+  }
+
+  void closeFd() {
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
   SQLite3Guard db_;
+  const BlobStore blobs_;
   const std::string filename_;
   size_t expected_size_;
   size_t written_size_;
   bool closed_;
-  sqlite3_blob* blob_;
+  bool checkpointed_;
+  int64_t row_id_;
+  int fd_;
+  MultiPartSHA256Hasher hasher_;
+  std::string sha256_;
 };
 
 std::unique_ptr<StorageTargetWHandle> SQLStorage::allocateTargetFile(bool from_director, const std::string& filename,
                                                                      size_t size) {
   (void)from_director;
 
+  try {
+    evictTargetFiles(size);
+  } catch (const SQLException& e) {
+    LOG_ERROR << "Could not make room for " << filename << ": " << e.what();
+  }
   return std::unique_ptr<StorageTargetWHandle>(new SQLTargetWHandle(*this, filename, size));
 }
 
-class SQLTargetRHandle : public StorageTargetRHandle {
- public:
-  SQLTargetRHandle(const SQLStorage& storage, const std::string& filename)
-      : db_(storage.dbPath()), filename_(filename), size_(0), read_size_(0), closed_(false), blob_(nullptr) {
-    StorageTargetRHandle::ReadError exc("could not read file " + filename_ + " from sql storage");
+std::unique_ptr<StorageTargetWHandle> SQLStorage::resumeTargetFile(const std::string& filename, size_t size,
+                                                                   std::string* resume_state) {
+  {
+    SQLite3Guard db = dbConnection();
 
-    if (db_.get_rc() != SQLITE_OK) {
-      LOG_ERROR << "Can't open database: " << db_.errmsg();
-      throw exc;
-    }
+    auto statement = db.prepareStatement<std::string>(
+        "SELECT rowid, expected_size FROM target_images WHERE filename = ? AND resume_state IS NOT NULL;", filename);
 
-    if (!db_.beginTransaction()) {
-      throw exc;
+    int result = statement.step();
+    if (result == SQLITE_DONE) {
+      return nullptr;
     }
-
-    auto statement = db_.prepareStatement<std::string>("SELECT rowid FROM target_images WHERE filename = ?;", filename);
-
-    int err = statement.step();
-    if (err == SQLITE_DONE) {
-      LOG_ERROR << "No such file in db: " + filename_;
-      throw exc;
+    if (result != SQLITE_ROW) {
+      LOG_ERROR << "Can't get suspended file " << filename << ": " << db.errmsg();
+      return nullptr;
     }
-    if (err != SQLITE_ROW) {
-      LOG_ERROR << "Statement step failure: " << db_.errmsg();
-      throw exc;
+    if (static_cast<size_t>(statement.get_result_col_int(1)) != size) {
+      LOG_DEBUG << "Suspended file " << filename << " has a different size, not resuming";
+      return nullptr;
+    }
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(blobs_.partialPath(statement.get_result_col_int(0)), ec)) {
+      LOG_DEBUG << "Suspended file " << filename << " is gone, not resuming";
+      return nullptr;
     }
+  }
 
-    auto row_id = statement.get_result_col_int(0);
+  try {
+    return std::unique_ptr<StorageTargetWHandle>(new SQLTargetWHandle(*this, filename, size, resume_state));
+  } catch (const StorageTargetWHandle::WriteError& e) {
+    LOG_DEBUG << "Not resuming " << filename << ": " << e.what();
+    return nullptr;
+  }
+}
 
-    if (sqlite3_blob_open(db_.get(), "main", "target_images", "image_data", row_id, 0, &blob_) != SQLITE_OK) {
-      LOG_ERROR << "Could not open blob: " << db_.errmsg();
-      throw exc;
-    }
-    size_ = static_cast<size_t>(sqlite3_blob_bytes(blob_));
+class SQLTargetRHandle : public StorageTargetRHandle {
+ public:
+  SQLTargetRHandle(SQLStorage& storage, const std::string& filename)
+      : filename_(filename), size_(0), read_size_(0), fd_(-1), map_(nullptr) {
+    StorageTargetRHandle::ReadError exc("could not read file " + filename_ + " from sql storage");
 
-    if (!db_.commitTransaction()) {
+    std::string sha256;
+    {
+      SQLite3Guard db = storage.dbConnection();
+      auto statement = db.prepareStatement<std::string>(
+          "SELECT sha256 FROM target_images WHERE filename = ? AND resume_state IS NULL;", filename);
+
+      int err = statement.step();
+      if (err == SQLITE_DONE) {
+        LOG_ERROR << "No such file in db: " + filename_;
+        throw exc;
+      }
+      if (err != SQLITE_ROW) {
+        LOG_ERROR << "Statement step failure: " << db.errmsg();
+        throw exc;
+      }
+      sha256 = statement.get_result_col_str(0).value_or("");
+
+      // for the eviction of the least recently used images
+      if (!storage.readonly_) {
+        statement = db.prepareStatement<std::string>(
+            "UPDATE target_images SET last_used = (SELECT ifnull(max(last_used), 0) + 1 FROM target_images) WHERE "
+            "filename = ?;",
+            filename);
+        if (statement.step() != SQLITE_DONE) {
+          LOG_WARNING << "Can't update last use of " << filename_ << ": " << db.errmsg();
+        }
+      }
+    }
+    if (sha256.empty()) {
+      LOG_ERROR << "File " << filename_ << " has not been moved out of the database";
       throw exc;
     }
-  }
 
-  ~SQLTargetRHandle() override {
-    if (!closed_) {
+    // once open, the file stays readable even if the target is removed
+    const boost::filesystem::path path = storage.blobs_.blobPath(sha256);
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+      LOG_ERROR << "Could not open " << path << ": " << std::strerror(errno);
       SQLTargetRHandle::rclose();
+      throw exc;
     }
+    size_ = static_cast<size_t>(st.st_size);
   }
 
+  ~SQLTargetRHandle() override { SQLTargetRHandle::rclose(); }
+
   size_t rsize() const override { return size_; }
 
   size_t rread(uint8_t* buf, size_t size) override {
@@ -1079,27 +1472,57 @@ class SQLTargetRHandle : public StorageTargetRHandle {
       return 0;
     }
 
-    if (sqlite3_blob_read(blob_, buf, static_cast<int>(size), static_cast<int>(read_size_)) != SQLITE_OK) {
-      LOG_ERROR << "Could not read from blob: " << db_.errmsg();
+    ssize_t nread = read(fd_, buf, size);
+    if (nread <= 0) {
+      LOG_ERROR << "Could not read file " << filename_ << ": " << std::strerror(errno);
       return 0;
     }
-    read_size_ += size;
+    read_size_ += static_cast<size_t>(nread);
 
-    return size;
+    return static_cast<size_t>(nread);
+  }
+
+  const uint8_t* rmap() override {
+    if (map_ != nullptr) {
+      return map_;
+    }
+    if (fd_ < 0) {
+      return nullptr;
+    }
+    // mmap() rejects empty mappings
+    static const uint8_t empty = 0;
+    if (size_ == 0) {
+      return &empty;
+    }
+
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+      LOG_WARNING << "Could not map file " << filename_ << ": " << std::strerror(errno);
+      return nullptr;
+    }
+    // images are mostly consumed from start to end
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    map_ = static_cast<uint8_t*>(addr);
+    return map_;
   }
 
   void rclose() noexcept override {
-    sqlite3_blob_close(blob_);
-    closed_ = true;
+    if (map_ != nullptr) {
+      munmap(map_, size_);
+      map_ = nullptr;
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
   }
 
  private:
-  SQLite3Guard db_;
   const std::string filename_;
   size_t size_;
   size_t read_size_;
-  bool closed_;
-  sqlite3_blob* blob_;
+  int fd_;
+  uint8_t* map_;
 };
 
 std::unique_ptr<StorageTargetRHandle> SQLStorage::openTargetFile(const std::string& filename) {
@@ -1109,19 +1532,314 @@ std::unique_ptr<StorageTargetRHandle> SQLStorage::openTargetFile(const std::stri
 void SQLStorage::removeTargetFile(const std::string& filename) {
   SQLite3Guard db = dbConnection();
 
-  auto statement = db.prepareStatement<std::string>("DELETE FROM target_images WHERE filename=?;", filename);
-
-  if (statement.step() != SQLITE_DONE) {
-    LOG_ERROR << "Statement step failure: " << db.errmsg();
+  bool found;
+  try {
+    if (!db.beginTransaction()) {
+      throw SQLException(std::string("Can't start transaction: ") + db.errmsg());
+    }
+    found = deleteTarget(db, blobs_, filename);
+    if (found && !db.commitTransaction()) {
+      throw SQLException("Can't remove target " + filename + ": " + db.errmsg());
+    }
+  } catch (const SQLException& e) {
+    LOG_ERROR << e.what();
     throw std::runtime_error("Could not remove target file");
   }
 
-  if (sqlite3_changes(db.get()) != 1) {
+  if (!found) {
     throw std::runtime_error("Target file " + filename + " not found");
   }
 }
 
-void SQLStorage::cleanUp() { boost::filesystem::remove_all(dbPath()); }
+// Space taken by the images, each of them counted once however many targets refer to it, and reserved for the
+// downloads in progress
+static uint64_t targetBytesHeld(SQLite3Guard& db) {
+  auto statement = db.prepareStatement(
+      "SELECT (SELECT ifnull(sum(size), 0) FROM (SELECT max(real_size) AS size FROM target_images WHERE sha256 IS NOT "
+      "NULL AND resume_state IS NULL GROUP BY sha256)) + (SELECT ifnull(sum(expected_size), 0) FROM target_images "
+      "WHERE resume_state IS NOT NULL);");
+  if (statement.step() != SQLITE_ROW) {
+    throw SQLException(std::string("Can't get size of target images: ") + db.errmsg());
+  }
+  return static_cast<uint64_t>(statement.get_result_col_int(0));
+}
+
+// sha256 of the images the director wants installed: the ones being downloaded and the ones waiting to be installed
+static std::set<std::string> directorTargetHashes(SQLite3Guard& db) {
+  std::set<std::string> hashes;
+  auto statement = db.prepareStatement<int, int>(
+      "SELECT meta FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;",
+      static_cast<int>(Uptane::RepositoryType::Director), Uptane::Role::Targets().ToInt());
+  if (statement.step() != SQLITE_ROW) {
+    return hashes;
+  }
+  try {
+    const Json::Value targets =
+        Utils::parseJSON(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)))["signed"]["targets"];
+    for (auto it = targets.begin(); it != targets.end(); ++it) {
+      hashes.insert(boost::algorithm::to_lower_copy((*it)["hashes"]["sha256"].asString()));
+    }
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Can't read the director targets: " << e.what();
+  }
+  return hashes;
+}
+
+bool SQLStorage::reuseTargetFile(const std::string& filename, const std::string& sha256, uint64_t size) {
+  const std::string hash = boost::algorithm::to_lower_copy(sha256);
+  SQLite3Guard db = dbConnection();
+  if (!db.beginTransaction()) {
+    LOG_ERROR << "Can't start transaction: " << db.errmsg();
+    return false;
+  }
+
+  auto statement = db.prepareStatement<std::string, int64_t>(
+      "SELECT count(*) FROM target_images WHERE sha256 = ? AND real_size = ? AND resume_state IS NULL;", hash,
+      static_cast<int64_t>(size));
+  if (statement.step() != SQLITE_ROW || statement.get_result_col_int(0) == 0 || !blobs_.exists(hash)) {
+    return false;
+  }
+
+  try {
+    statement = db.prepareStatement<std::string>(
+        "SELECT sha256 = ? AND resume_state IS NULL FROM target_images WHERE filename = ?;", hash, filename);
+    if (statement.step() == SQLITE_ROW && statement.get_result_col_int(0) != 0) {
+      statement = db.prepareStatement<std::string>(
+          "UPDATE target_images SET last_used = (SELECT ifnull(max(last_used), 0) + 1 FROM target_images) WHERE "
+          "filename = ?;",
+          filename);
+    } else {
+      deleteTarget(db, blobs_, filename);
+      statement = db.prepareStatement<std::string, int64_t, std::string, int64_t>(
+          "INSERT INTO target_images (filename, real_size, sha256, expected_size, last_used) VALUES (?, ?, ?, ?, "
+          "(SELECT ifnull(max(last_used), 0) + 1 FROM target_images));",
+          filename, static_cast<int64_t>(size), hash, static_cast<int64_t>(size));
+    }
+    if (statement.step() != SQLITE_DONE) {
+      throw SQLException("Can't reuse image for " + filename + ": " + db.errmsg());
+    }
+  } catch (const SQLException& e) {
+    LOG_ERROR << e.what();
+    return false;
+  }
+
+  if (!db.commitTransaction()) {
+    return false;
+  }
+  ++downloads_skipped_;
+  return true;
+}
+
+void SQLStorage::evictTargetFiles(uint64_t size) {
+  const uint64_t quota = config_.images_quota;
+  if (quota == 0) {
+    return;
+  }
+  std::string policy = boost::algorithm::to_lower_copy(config_.images_eviction);
+  if (policy != "lru" && policy != "installed") {
+    LOG_ERROR << "Invalid images_eviction value " << config_.images_eviction << ", using lru";
+    policy = "lru";
+  }
+
+  SQLite3Guard db = dbConnection();
+  uint64_t held = targetBytesHeld(db);
+  if (held + size <= quota) {
+    return;
+  }
+
+  std::set<std::string> keep = directorTargetHashes(db);
+  if (policy == "installed") {
+    // the current version and the last one installed before it
+    auto statement = db.prepareStatement(
+        "SELECT lower(hash) FROM installed_versions WHERE is_current = 1 UNION SELECT * FROM (SELECT lower(hash) FROM "
+        "installed_versions WHERE is_current = 0 ORDER BY rowid DESC LIMIT 1);");
+    while (statement.step() == SQLITE_ROW) {
+      keep.insert(statement.get_result_col_str(0).value_or(""));
+    }
+  }
+
+  std::vector<std::pair<std::string, std::string>> candidates;
+  {
+    auto statement = db.prepareStatement(
+        "SELECT filename, sha256 FROM target_images WHERE resume_state IS NULL ORDER BY last_used, rowid;");
+    while (statement.step() == SQLITE_ROW) {
+      candidates.emplace_back(statement.get_result_col_str(0).value_or(""),
+                              statement.get_result_col_str(1).value_or(""));
+    }
+  }
+
+  const uint64_t held_before = held;
+  uint64_t evicted = 0;
+  for (const auto& candidate : candidates) {
+    if (held + size <= quota) {
+      break;
+    }
+    if (keep.count(candidate.second) != 0) {
+      continue;
+    }
+    if (!db.beginTransaction()) {
+      throw SQLException(std::string("Can't start transaction: ") + db.errmsg());
+    }
+    deleteTarget(db, blobs_, candidate.first);
+    if (!db.commitTransaction()) {
+      throw SQLException("Can't remove target " + candidate.first + ": " + db.errmsg());
+    }
+    ++evicted;
+    held = targetBytesHeld(db);
+  }
+
+  if (evicted > 0) {
+    const uint64_t reclaimed = held_before > held ? held_before - held : 0;
+    LOG_INFO << "Removed " << evicted << " target images to stay within the quota, " << reclaimed << " bytes reclaimed";
+    bytes_reclaimed_ += reclaimed;
+    images_evicted_ += evicted;
+  }
+  if (held + size > quota) {
+    LOG_WARNING << "Target images take " << held + size << " bytes, more than the quota of " << quota << " bytes";
+  }
+}
+
+TargetCacheStats SQLStorage::targetCacheStats() {
+  TargetCacheStats stats;
+  try {
+    SQLite3Guard db = dbConnection();
+    stats.bytes_held = targetBytesHeld(db);
+  } catch (const SQLException& e) {
+    LOG_ERROR << e.what();
+  }
+  stats.bytes_reclaimed = bytes_reclaimed_;
+  stats.images_evicted = images_evicted_;
+  stats.downloads_skipped = downloads_skipped_;
+  return stats;
+}
+
+// Moves the images stored in the database by older versions to the blob store. Incomplete images are moved as well,
+// so that their download can still be resumed.
+void SQLStorage::migrateTargetImages() {
+  std::vector<int64_t> row_ids;
+  {
+    SQLite3Guard db = dbConnection();
+    auto statement = db.prepareStatement("SELECT rowid FROM target_images WHERE image_data IS NOT NULL;");
+    while (statement.step() == SQLITE_ROW) {
+      row_ids.push_back(statement.get_result_col_int(0));
+    }
+  }
+  if (row_ids.empty()) {
+    return;
+  }
+
+  LOG_INFO << "Moving " << row_ids.size() << " target images out of the database";
+  for (const int64_t row_id : row_ids) {
+    SQLite3Guard db = dbConnection();
+    auto statement = db.prepareStatement<int64_t>(
+        "SELECT real_size, resume_state IS NULL, filename FROM target_images WHERE rowid = ?;", row_id);
+    if (statement.step() != SQLITE_ROW) {
+      continue;
+    }
+    const auto real_size = static_cast<uint64_t>(statement.get_result_col_int(0));
+    const bool complete = statement.get_result_col_int(1) != 0;
+    const std::string filename = statement.get_result_col_str(2).value_or("");
+
+    sqlite3_blob* blob = nullptr;
+    if (sqlite3_blob_open(db.get(), "main", "target_images", "image_data", row_id, 0, &blob) != SQLITE_OK) {
+      LOG_ERROR << "Could not open blob of " << filename << ": " << db.errmsg();
+      continue;
+    }
+    const int fd = blobs_.openPartial(row_id, 0, real_size);
+    MultiPartSHA256Hasher hasher;
+    std::array<uint8_t, 64 * 1024> buf{};
+    bool ok = fd >= 0 && real_size <= static_cast<uint64_t>(sqlite3_blob_bytes(blob));
+    for (uint64_t offset = 0; ok && offset < real_size; offset += buf.size()) {
+      const auto chunk = static_cast<size_t>(std::min(static_cast<uint64_t>(buf.size()), real_size - offset));
+      ok = sqlite3_blob_read(blob, buf.data(), static_cast<int>(chunk), static_cast<int>(offset)) == SQLITE_OK &&
+           BlobStore::writeAll(fd, buf.data(), chunk);
+      hasher.update(buf.data(), chunk);
+    }
+    sqlite3_blob_close(blob);
+
+    std::string sha256;
+    if (ok && complete) {
+      sha256 = boost::algorithm::to_lower_copy(hasher.getHexDigest());
+      ok = blobs_.commit(fd, row_id, sha256);
+    } else if (fd >= 0) {
+      ok = ok && fdatasync(fd) == 0;
+      close(fd);
+    }
+    if (!ok) {
+      LOG_ERROR << "Could not move target image " << filename << " out of the database";
+      blobs_.removePartial(row_id);
+      continue;
+    }
+
+    if (complete) {
+      statement = db.prepareStatement<std::string, int64_t>(
+          "UPDATE target_images SET image_data = NULL, sha256 = ? WHERE rowid = ?;", sha256, row_id);
+    } else {
+      statement = db.prepareStatement<SQLBlob, int64_t>(
+          "UPDATE target_images SET image_data = NULL, hash_state = ? WHERE rowid = ?;", SQLBlob(hasher.getState()),
+          row_id);
+    }
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Could not update target image " << filename << ": " << db.errmsg();
+    }
+  }
+
+  // give the space back to the filesystem
+  SQLite3Guard db = dbConnection();
+  if (db.exec("VACUUM;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_WARNING << "Can't vacuum the database: " << db.errmsg();
+  }
+}
+
+void SQLStorage::cleanUp() {
+  boost::filesystem::remove_all(dbPath());
+  boost::filesystem::remove_all(dbPath().string() + "-wal");
+  boost::filesystem::remove_all(dbPath().string() + "-shm");
+  boost::filesystem::remove_all(blobs_.dir());
+}
+
+class SQLStorageTransaction : public StorageTransaction {
+ public:
+  explicit SQLStorageTransaction(SQLStorage& storage) : storage_(storage), db_(storage.dbConnection()) {
+    if (!db_.beginTransaction()) {
+      throw SQLException(std::string("Can't start transaction: ") + db_.errmsg());
+    }
+    if (!db_.nested()) {
+      std::lock_guard<std::mutex> lock(storage_.transactions_mutex_);
+      storage_.transactions_[std::this_thread::get_id()] = db_.connection();
+      registered_ = true;
+    }
+  }
+  ~SQLStorageTransaction() override { unregister(); }
+  SQLStorageTransaction(const SQLStorageTransaction&) = delete;
+  SQLStorageTransaction& operator=(const SQLStorageTransaction&) = delete;
+
+  bool commit() override {
+    bool res = db_.commitTransaction();
+    if (!res) {
+      db_.rollbackTransaction();
+    }
+    unregister();
+    return res;
+  }
+
+ private:
+  void unregister() {
+    if (registered_) {
+      std::lock_guard<std::mutex> lock(storage_.transactions_mutex_);
+      storage_.transactions_.erase(std::this_thread::get_id());
+      registered_ = false;
+    }
+  }
+
+  SQLStorage& storage_;
+  SQLite3Guard db_;
+  bool registered_{false};
+};
+
+std::unique_ptr<StorageTransaction> SQLStorage::beginTransaction() {
+  return std_::make_unique<SQLStorageTransaction>(*this);
+}
 
 std::string SQLStorage::getTableSchemaFromDb(const std::string& tablename) {
   SQLite3Guard db = dbConnection();
@@ -1,10 +1,16 @@
 #ifndef SQLSTORAGE_H_
 #define SQLSTORAGE_H_
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 
 #include <sqlite3.h>
 
+#include "blobstore.h"
 #include "invstorage.h"
 #include "sql_utils.h"
 
@@ -19,6 +25,7 @@ class SQLStorage : public INvStorage {
  public:
   friend class SQLTargetWHandle;
   friend class SQLTargetRHandle;
+  friend class SQLStorageTransaction;
   explicit SQLStorage(const StorageConfig& config, bool readonly);
   ~SQLStorage() override = default;
   void storePrimaryKeys(const std::string& public_key, const std::string& private_key) override;
@@ -43,6 +50,10 @@ class SQLStorage : public INvStorage {
   bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) override;
   void clearNonRootMeta(Uptane::RepositoryType repo) override;
   void clearMetadata() override;
+  void storeMetaValidators(const std::string& validators, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadMetaValidators(std::string* validators, Uptane::RepositoryType repo, Uptane::Role role) override;
+  void storeVerifiedMeta(const std::string& state, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadVerifiedMeta(std::string* state, Uptane::RepositoryType repo, Uptane::Role role) override;
 
   void storeDeviceId(const std::string& device_id) override;
   bool loadDeviceId(std::string* device_id) override;
@@ -66,9 +77,14 @@ class SQLStorage : public INvStorage {
 
   std::unique_ptr<StorageTargetWHandle> allocateTargetFile(bool from_director, const std::string& filename,
                                                            size_t size) override;
+  std::unique_ptr<StorageTargetWHandle> resumeTargetFile(const std::string& filename, size_t size,
+                                                         std::string* resume_state) override;
   std::unique_ptr<StorageTargetRHandle> openTargetFile(const std::string& filename) override;
   void removeTargetFile(const std::string& filename) override;
+  bool reuseTargetFile(const std::string& filename, const std::string& sha256, uint64_t size) override;
+  TargetCacheStats targetCacheStats() override;
   void cleanUp() override;
+  std::unique_ptr<StorageTransaction> beginTransaction() override;
   StorageType type() override { return StorageType::kSqlite; };
 
   std::string getTableSchemaFromDb(const std::string& tablename);
@@ -78,10 +94,23 @@ class SQLStorage : public INvStorage {
   boost::filesystem::path dbPath() const;
 
  private:
+  // Borrows one of the connections kept open by the storage. Its prepared statements are cached, so the same queries
+  // are only parsed once. If the calling thread has a transaction open, its connection is used instead.
   SQLite3Guard dbConnection();
   // request info
   void cleanMetaVersion(Uptane::RepositoryType repo, Uptane::Role role);
+  void migrateTargetImages();
+  // removes images until size more bytes fit in the quota
+  void evictTargetFiles(uint64_t size);
   bool readonly_{false};
+  std::shared_ptr<SQLite3Pool> pool_;
+  BlobStore blobs_;
+  std::atomic<uint64_t> bytes_reclaimed_{0};
+  std::atomic<uint64_t> images_evicted_{0};
+  std::atomic<uint64_t> downloads_skipped_{0};
+  std::mutex transactions_mutex_;
+  // connections of the transactions in progress, by thread
+  std::map<std::thread::id, SQLite3Connection*> transactions_;
 };
 
 #endif  // SQLSTORAGE_H_
@@ -1,3 +1,8 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
 #include <boost/tokenizer.hpp>
 
 #include <gtest/gtest.h>
@@ -209,6 +214,59 @@ TEST(sqlstorage, DbMigration7to8) {
 /**
  * Check that old metadata is still valid
  */
+/*
+ * Images stored in the database by older versions are moved to the blob
+ * store, including incomplete ones which can still be resumed.
+ */
+TEST(sqlstorage, DbMigration11to12TargetImages) {
+  auto tdb = makeDbWithVersion(DbVersion(11));
+  {
+    SQLite3Guard db(tdb.db_path.c_str());
+    if (db.exec("INSERT INTO target_images VALUES ('complete', 'abc', 3, NULL);", nullptr, nullptr) != SQLITE_OK) {
+      FAIL();
+    }
+    // "de" written out of 4 bytes
+    if (db.exec("INSERT INTO target_images VALUES ('partial', X'64650000', 2, 'state');", nullptr, nullptr) !=
+        SQLITE_OK) {
+      FAIL();
+    }
+  }
+
+  StorageConfig config;
+  config.path = tdb.dir->Path();
+  config.sqldb_path = tdb.db_path;
+  SQLStorage storage(config, false);
+  EXPECT_TRUE(dbSchemaCheck(storage));
+
+  {
+    SQLite3Guard db(tdb.db_path.c_str());
+    auto statement = db.prepareStatement("SELECT count(*) FROM target_images WHERE image_data IS NOT NULL;");
+    EXPECT_EQ(statement.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_int(0), 0);
+  }
+
+  // sha256 of "abc"
+  const std::string sha256 = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  EXPECT_TRUE(boost::filesystem::exists(config.images_path.get(config.path) / sha256));
+  std::stringstream sstr;
+  sstr << *storage.openTargetFile("complete");
+  EXPECT_EQ(sstr.str(), "abc");
+
+  std::string state;
+  auto whandle = storage.resumeTargetFile("partial", 4, &state);
+  ASSERT_TRUE(whandle != nullptr);
+  EXPECT_EQ(state, "state");
+  EXPECT_EQ(whandle->woffset(), 2);
+  const uint8_t wb[] = "fg";
+  EXPECT_EQ(whandle->wfeed(wb, 2), 2);
+  whandle->wcommit();
+  // sha256 of "defg", the migration saved the hash state of the incomplete image
+  EXPECT_EQ(whandle->wsha256(), "4c8a43980498636e9c1d1595fa5d115af7937c2422dfe68a2520a52b7a5fb4de");
+  sstr.str("");
+  sstr << *storage.openTargetFile("partial");
+  EXPECT_EQ(sstr.str(), "defg");
+}
+
 TEST(sqlstorage, migrate_root_works) {
   TemporaryDirectory temp_dir;
   StorageConfig config;
@@ -246,6 +304,153 @@ TEST(sqlstorage, migrate_root_works) {
   EXPECT_TRUE(sign["keys"].isMember("1ba3b2932863c0c6e5ff857ecdeb476b69b8b9f9ba4e36723eb10faf7768818b"));
 }
 
+/*
+ * A suspended file is resumed from the saved hash state, unless the partial
+ * file has lost data written before the checkpoint.
+ */
+TEST(sqlstorage, ResumeTruncatedTarget) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+  const uint8_t wb[] = "abcd";
+
+  {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage.allocateTargetFile(false, "testfile", 4);
+    fhandle->wfeed(wb, 2);
+    fhandle->wsuspend("state");
+  }
+  const boost::filesystem::path partial = config.images_path.get(config.path) / "partial" / "1";
+  ASSERT_EQ(boost::filesystem::file_size(partial), 2);
+  boost::filesystem::resize_file(partial, 1);
+  EXPECT_TRUE(storage.resumeTargetFile("testfile", 4, nullptr) == nullptr);
+}
+
+/*
+ * Stores and loads on reused connections and prepared statements see each
+ * other's changes, as well as those made on a connection of its own.
+ */
+TEST(sqlstorage, ConnectionReuse) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+
+  for (int i = 0; i < 5; ++i) {
+    std::string device_id = "device" + std::to_string(i);
+    storage.storeDeviceId(device_id);
+    std::string loaded;
+    EXPECT_TRUE(storage.loadDeviceId(&loaded));
+    EXPECT_EQ(loaded, device_id);
+  }
+
+  {
+    SQLite3Guard db(storage.dbPath());
+    auto statement = db.prepareStatement<std::string>("UPDATE device_info SET device_id = ?;", "standalone");
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+  }
+  std::string loaded;
+  EXPECT_TRUE(storage.loadDeviceId(&loaded));
+  EXPECT_EQ(loaded, "standalone");
+}
+
+/*
+ * Micro-benchmark of the reuse of connections and prepared statements: the
+ * same loads and stores as done by SQLStorage, with a new connection for
+ * each of them as a reference. sqlstorage.ConnectionReuse checks the results;
+ * this only reports timings, so it is disabled by default. Run it with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(sqlstorage, DISABLED_ConnectionReuseBenchmark) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+  const int iterations = 500;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    {
+      SQLite3Guard db(storage.dbPath());
+      auto statement = db.prepareStatement<std::string>(
+          "INSERT OR REPLACE INTO device_info(unique_mark,device_id,is_registered) VALUES(0,?,0);",
+          "device" + std::to_string(i));
+      EXPECT_EQ(statement.step(), SQLITE_DONE);
+    }
+    SQLite3Guard db(storage.dbPath());
+    auto statement = db.prepareStatement("SELECT device_id FROM device_info LIMIT 1;");
+    EXPECT_EQ(statement.step(), SQLITE_ROW);
+  }
+  auto fresh = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    std::string device_id = "device" + std::to_string(i);
+    storage.storeDeviceId(device_id);
+    std::string loaded;
+    EXPECT_TRUE(storage.loadDeviceId(&loaded));
+    EXPECT_EQ(loaded, device_id);
+  }
+  auto pooled = std::chrono::steady_clock::now() - start;
+
+  std::cout << iterations << " stores and loads, new connections: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(fresh).count()
+            << " ms, reused connections: " << std::chrono::duration_cast<std::chrono::milliseconds>(pooled).count()
+            << " ms\n";
+}
+
+/* The journal mode is taken from the configuration, invalid values are ignored. */
+TEST(sqlstorage, JournalMode) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_journal_mode = "WAL";
+  config.sqldb_synchronous = "normal";
+
+  auto journalMode = [&config]() {
+    SQLite3Guard db(config.sqldb_path.get(config.path));
+    auto statement = db.prepareStatement("PRAGMA journal_mode;");
+    EXPECT_EQ(statement.step(), SQLITE_ROW);
+    return statement.get_result_col_str(0).value();
+  };
+
+  {
+    SQLStorage storage(config, false);
+    storage.storeDeviceId("device");
+  }
+  EXPECT_EQ(journalMode(), "wal");
+
+  config.sqldb_journal_mode = "invalid";
+  {
+    SQLStorage storage(config, false);
+    std::string device_id;
+    EXPECT_TRUE(storage.loadDeviceId(&device_id));
+    EXPECT_EQ(device_id, "device");
+  }
+  EXPECT_EQ(journalMode(), "delete");
+}
+
+/* A write waits for a lock held by another connection instead of failing at once. */
+TEST(sqlstorage, BusyTimeout) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+
+  SQLite3Guard other(storage.dbPath());
+  ASSERT_EQ(other.exec("BEGIN EXCLUSIVE;", nullptr, nullptr), SQLITE_OK);
+  std::thread holder([&other]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(other.exec("COMMIT;", nullptr, nullptr), SQLITE_OK);
+  });
+  storage.storeDeviceId("device");
+  holder.join();
+
+  std::string device_id;
+  EXPECT_TRUE(storage.loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device");
+}
+
 TEST(sqlstorage, migrate_from_fs) {
   TemporaryDirectory temp_dir;
   StorageConfig config;
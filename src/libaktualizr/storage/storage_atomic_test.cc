@@ -15,6 +15,8 @@
 #include "logging/logging.h"
 
 StorageType storage_test_type;
+// write the keys and the device id in a single transaction, in WAL mode
+bool storage_test_transaction = false;
 
 std::unique_ptr<INvStorage> Storage(const StorageConfig& config) {
   if (config.type == StorageType::kSqlite) {
@@ -29,7 +31,12 @@ StorageConfig MakeConfig(StorageType type, const boost::filesystem::path& storag
 
   config.type = type;
   if (config.type == StorageType::kSqlite) {
+    config.path = storage_dir;
     config.sqldb_path = storage_dir / "test.db";
+    if (storage_test_transaction) {
+      config.sqldb_journal_mode = "wal";
+      config.sqldb_synchronous = "normal";
+    }
   } else {
     throw std::runtime_error("Invalid config type");
   }
@@ -50,7 +57,14 @@ static void tight_store_keys(const TightProcess& t) {
 
   EXPECT_EQ(write(t.pipefd[1], &c, 1), 1);
   while (true) {
-    storage->storePrimaryKeys(std::to_string(k), std::to_string(k));
+    if (storage_test_transaction) {
+      auto transaction = storage->beginTransaction();
+      storage->storePrimaryKeys(std::to_string(k), std::to_string(k));
+      storage->storeDeviceId(std::to_string(k));
+      transaction->commit();
+    } else {
+      storage->storePrimaryKeys(std::to_string(k), std::to_string(k));
+    }
     k += 1;
   }
 }
@@ -63,10 +77,14 @@ static void check_consistent_state(const boost::filesystem::path& storage_dir) {
   EXPECT_TRUE(storage->loadPrimaryKeys(&pub, &priv));
 
   EXPECT_EQ(pub, priv);
+  if (storage_test_transaction) {
+    std::string device_id;
+    EXPECT_TRUE(storage->loadDeviceId(&device_id));
+    EXPECT_EQ(pub, device_id);
+  }
 }
 
-void atomic_test() {
-  unsigned int n_procs = 70;
+void atomic_test(unsigned int n_procs) {
   std::list<TightProcess> procs;
 
   for (auto k = 0u; k < n_procs; k++) {
@@ -108,13 +126,21 @@ void atomic_test() {
   }
 }
 
-// To run these tests:
+// To run the disabled tests:
 // ./build/tests/t_storage_atomic --gtest_also_run_disabled_tests
 
 TEST(DISABLED_storage_atomic, sql) {
   // disabled for now because it uses too much resources for CI
   storage_test_type = StorageType::kSqlite;
-  atomic_test();
+  storage_test_transaction = false;
+  atomic_test(70);
+}
+
+// fewer processes than above, so that it can run in CI
+TEST(storage_atomic, sql_transaction) {
+  storage_test_type = StorageType::kSqlite;
+  storage_test_transaction = true;
+  atomic_test(8);
 }
 
 #ifndef __NO_MAIN__
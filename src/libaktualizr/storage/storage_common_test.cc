@@ -1,11 +1,19 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <fstream>
+#include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
+#include "storage/cachingstorage.h"
 #include "storage/sqlstorage.h"
 #include "utilities/types.h"
 #include "utilities/utils.h"
@@ -28,6 +36,7 @@ StorageConfig MakeConfig(StorageType type, const boost::filesystem::path &storag
 
   config.type = type;
   if (config.type == StorageType::kSqlite) {
+    config.path = storage_dir;
     config.sqldb_path = storage_dir / "test.db";
   } else {
     throw std::runtime_error("Invalid config type");
@@ -209,6 +218,60 @@ TEST(storage, load_store_root) {
   boost::filesystem::remove_all(storage_test_dir);
 }
 
+TEST(storage, load_store_meta_validators) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+
+  storage->storeMetaValidators("root", Uptane::RepositoryType::Director, Uptane::Role::Root());
+  storage->storeMetaValidators("targets", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  storage->storeMetaValidators("old", Uptane::RepositoryType::Images, Uptane::Role::Timestamp());
+  storage->storeMetaValidators("timestamp", Uptane::RepositoryType::Images, Uptane::Role::Timestamp());
+
+  std::string validators;
+  EXPECT_TRUE(storage->loadMetaValidators(&validators, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+  EXPECT_EQ(validators, "timestamp");
+  EXPECT_FALSE(storage->loadMetaValidators(&validators, Uptane::RepositoryType::Images, Uptane::Role::Snapshot()));
+
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director);
+  EXPECT_TRUE(storage->loadMetaValidators(&validators, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  EXPECT_EQ(validators, "root");
+  EXPECT_FALSE(storage->loadMetaValidators(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_TRUE(storage->loadMetaValidators(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+
+  storage->clearMetadata();
+  EXPECT_FALSE(storage->loadMetaValidators(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  EXPECT_FALSE(storage->loadMetaValidators(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/* Verified metadata is binary and kept as it is. */
+TEST(storage, load_store_verified_meta) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+
+  const std::string state("\x01\x00\x00\xff state", 10);
+  storage->storeVerifiedMeta(state, Uptane::RepositoryType::Director, Uptane::Role::Root());
+  storage->storeVerifiedMeta("targets", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  storage->storeVerifiedMeta("snapshot", Uptane::RepositoryType::Images, Uptane::Role::Snapshot());
+
+  std::string loaded;
+  EXPECT_TRUE(storage->loadVerifiedMeta(&loaded, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  EXPECT_EQ(loaded, state);
+  EXPECT_FALSE(storage->loadVerifiedMeta(&loaded, Uptane::RepositoryType::Images, Uptane::Role::Targets()));
+
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director);
+  EXPECT_TRUE(storage->loadVerifiedMeta(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  EXPECT_FALSE(storage->loadVerifiedMeta(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_TRUE(storage->loadVerifiedMeta(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Snapshot()));
+
+  storage->clearMetadata();
+  EXPECT_FALSE(storage->loadVerifiedMeta(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  EXPECT_FALSE(storage->loadVerifiedMeta(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Snapshot()));
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
 TEST(storage, load_store_deviceid) {
   mkdir(storage_test_dir.c_str(), S_IRWXU);
   std::unique_ptr<INvStorage> storage = Storage();
@@ -225,6 +288,61 @@ TEST(storage, load_store_deviceid) {
   boost::filesystem::remove_all(storage_test_dir);
 }
 
+/*
+ * Writes made in a transaction are only visible once it is committed, and are
+ * discarded if it is destroyed before. Nested transactions can be rolled back
+ * on their own.
+ */
+TEST(storage, transaction) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+  storage->storeDeviceId("device_0");
+
+  {
+    auto transaction = storage->beginTransaction();
+    storage->storeDeviceId("device_1");
+    storage->storeEcuRegistered();
+    std::string device_id;
+    EXPECT_TRUE(storage->loadDeviceId(&device_id));
+    EXPECT_EQ(device_id, "device_1");
+  }
+  std::string device_id;
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device_0");
+  EXPECT_FALSE(storage->loadEcuRegistered());
+
+  {
+    auto transaction = storage->beginTransaction();
+    storage->storeDeviceId("device_2");
+    {
+      auto nested = storage->beginTransaction();
+      storage->storeEcuRegistered();
+    }
+    {
+      auto nested = storage->beginTransaction();
+      storage->storeMisconfiguredEcus({MisconfiguredEcu(Uptane::EcuSerial("secondary"),
+                                                        Uptane::HardwareIdentifier("hw"), EcuState::kOld)});
+      EXPECT_TRUE(nested->commit());
+    }
+
+    // not visible from other threads before the commit
+    std::thread other([&storage]() {
+      std::string other_device_id;
+      EXPECT_TRUE(storage->loadDeviceId(&other_device_id));
+      EXPECT_EQ(other_device_id, "device_0");
+    });
+    other.join();
+
+    EXPECT_TRUE(transaction->commit());
+  }
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device_2");
+  EXPECT_FALSE(storage->loadEcuRegistered());
+  EXPECT_TRUE(storage->loadMisconfiguredEcus(nullptr));
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
 TEST(storage, load_store_ecu_serials) {
   mkdir(storage_test_dir.c_str(), S_IRWXU);
   std::unique_ptr<INvStorage> storage = Storage();
@@ -314,6 +432,7 @@ TEST(storage, store_target) {
     fhandle->wfeed(wb, 1);
     fhandle->wfeed(wb + 1, 1);
     fhandle->wcommit();
+    EXPECT_EQ(fhandle->wsha256(), "fb8e20fc2e4c3f248c60c39bd652f3c1347298bb977b8b4d5903b85055620603");
   }
 
   // read
@@ -361,6 +480,480 @@ TEST(storage, store_target) {
   boost::filesystem::remove_all(storage_test_dir);
 }
 
+/*
+ * Targets with the same content share one file in the blob store, which is
+ * removed with the last of them.
+ */
+TEST(storage, target_blobs) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+
+  for (const auto &filename : {"first", "second"}) {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->allocateTargetFile(false, filename, 3);
+    std::stringstream("abc") >> *fhandle;
+  }
+  // sha256 of "abc"
+  const boost::filesystem::path blob = storage_test_config.images_path.get(storage_test_config.path) /
+                                       "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  EXPECT_TRUE(boost::filesystem::exists(blob));
+
+  std::unique_ptr<StorageTargetRHandle> rhandle = storage->openTargetFile("first");
+  storage->removeTargetFile("first");
+  EXPECT_TRUE(boost::filesystem::exists(blob));
+  storage->removeTargetFile("second");
+  EXPECT_FALSE(boost::filesystem::exists(blob));
+
+  // still readable through an open handle
+  std::stringstream sstr;
+  sstr << *rhandle;
+  EXPECT_EQ(sstr.str(), "abc");
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+static void storeTarget(INvStorage &storage, const std::string &filename, const std::string &content) {
+  std::unique_ptr<StorageTargetWHandle> fhandle = storage.allocateTargetFile(false, filename, content.size());
+  std::stringstream(content) >> *fhandle;
+}
+
+static Uptane::Target makeTarget(const std::string &filename, const std::string &content) {
+  Json::Value target_json;
+  target_json["length"] = Json::UInt64(content.size());
+  target_json["hashes"]["sha256"] = boost::algorithm::hex(Crypto::sha256digest(content));
+  return Uptane::Target(filename, target_json);
+}
+
+/*
+ * A stored image can be made available under another name without writing it
+ * again, if the hash and size match.
+ */
+TEST(storage, reuse_target) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+  storeTarget(*storage, "first", "abc");
+  const std::string sha256 = makeTarget("first", "abc").sha256Hash();
+
+  EXPECT_FALSE(storage->reuseTargetFile("second", sha256, 4));
+  EXPECT_FALSE(storage->reuseTargetFile("second", makeTarget("second", "abd").sha256Hash(), 3));
+  EXPECT_TRUE(storage->reuseTargetFile("second", sha256, 3));
+  EXPECT_TRUE(storage->reuseTargetFile("first", sha256, 3));
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile("second");
+  EXPECT_EQ(sstr.str(), "abc");
+
+  TargetCacheStats stats = storage->targetCacheStats();
+  EXPECT_EQ(stats.bytes_held, 3);
+  EXPECT_EQ(stats.downloads_skipped, 2);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/*
+ * When the quota would be exceeded, the least recently used images are
+ * removed first.
+ */
+TEST(storage, target_quota_lru) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  StorageConfig config = storage_test_config;
+  config.images_quota = 8;
+  std::unique_ptr<INvStorage> storage = Storage(config);
+
+  storeTarget(*storage, "first", "1111");
+  storeTarget(*storage, "second", "2222");
+  storage->openTargetFile("first");
+  storeTarget(*storage, "third", "3333");
+
+  EXPECT_NO_THROW(storage->openTargetFile("first"));
+  EXPECT_THROW(storage->openTargetFile("second"), StorageTargetRHandle::ReadError);
+  EXPECT_NO_THROW(storage->openTargetFile("third"));
+
+  TargetCacheStats stats = storage->targetCacheStats();
+  EXPECT_EQ(stats.bytes_held, 8);
+  EXPECT_EQ(stats.bytes_reclaimed, 4);
+  EXPECT_EQ(stats.images_evicted, 1);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/*
+ * With the installed policy, the images of the current and previous installed
+ * versions are kept.
+ */
+TEST(storage, target_quota_installed) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  StorageConfig config = storage_test_config;
+  config.images_quota = 12;
+  config.images_eviction = "installed";
+  std::unique_ptr<INvStorage> storage = Storage(config);
+
+  storeTarget(*storage, "v1", "1111");
+  storeTarget(*storage, "v2", "2222");
+  storeTarget(*storage, "v3", "3333");
+  storage->saveInstalledVersion(makeTarget("v1", "1111"));
+  storage->saveInstalledVersion(makeTarget("v2", "2222"));
+  storage->saveInstalledVersion(makeTarget("v3", "3333"));
+  storeTarget(*storage, "v4", "4444");
+
+  EXPECT_THROW(storage->openTargetFile("v1"), StorageTargetRHandle::ReadError);
+  EXPECT_NO_THROW(storage->openTargetFile("v2"));
+  EXPECT_NO_THROW(storage->openTargetFile("v3"));
+  EXPECT_NO_THROW(storage->openTargetFile("v4"));
+
+  // v4 is the only one which can go
+  storeTarget(*storage, "v5", "5555");
+  EXPECT_NO_THROW(storage->openTargetFile("v2"));
+  EXPECT_NO_THROW(storage->openTargetFile("v3"));
+  EXPECT_THROW(storage->openTargetFile("v4"), StorageTargetRHandle::ReadError);
+  EXPECT_EQ(storage->targetCacheStats().bytes_held, 12);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/*
+ * The images of the update listed by the director are not removed, even when
+ * the update alone does not fit in the quota.
+ */
+TEST(storage, target_quota_update) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  StorageConfig config = storage_test_config;
+  config.images_quota = 6;
+  std::unique_ptr<INvStorage> storage = Storage(config);
+
+  Json::Value director_targets;
+  for (const auto& target : {makeTarget("first", "1111"), makeTarget("second", "2222")}) {
+    director_targets["signed"]["targets"][target.filename()]["hashes"]["sha256"] = target.sha256Hash();
+    director_targets["signed"]["targets"][target.filename()]["length"] = 4;
+  }
+  storage->storeNonRoot(Utils::jsonToStr(director_targets), Uptane::RepositoryType::Director,
+                        Uptane::Role::Targets());
+
+  storeTarget(*storage, "old", "0000");
+  storeTarget(*storage, "first", "1111");
+  storeTarget(*storage, "second", "2222");
+
+  EXPECT_THROW(storage->openTargetFile("old"), StorageTargetRHandle::ReadError);
+  EXPECT_NO_THROW(storage->openTargetFile("first"));
+  EXPECT_NO_THROW(storage->openTargetFile("second"));
+
+  TargetCacheStats stats = storage->targetCacheStats();
+  EXPECT_EQ(stats.bytes_held, 8);
+  EXPECT_EQ(stats.images_evicted, 1);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+static std::shared_ptr<CachingStorage> CachedStorage() {
+  return std::make_shared<CachingStorage>(storage_test_config,
+                                          std::make_shared<SQLStorage>(storage_test_config, false));
+}
+
+/*
+ * The cache gives back what was written last and follows the deletions of
+ * metadata.
+ */
+TEST(storage, caching) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::shared_ptr<CachingStorage> storage = CachedStorage();
+  std::string data;
+
+  EXPECT_FALSE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  storage->storeNonRoot("targets", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  storage->storeNonRoot("timestamp", Uptane::RepositoryType::Images, Uptane::Role::Timestamp());
+  storage->storeMetaValidators("etag", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets");
+  EXPECT_TRUE(storage->loadMetaValidators(&data, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_EQ(data, "etag");
+  EXPECT_EQ(storage->cacheStats().hits, 2);
+  EXPECT_EQ(storage->cacheStats().misses, 1);
+
+  // large metadata is not kept in memory
+  const std::string large(CachingStorage::kMaxCachedSize + 1, 't');
+  storage->storeNonRoot(large, Uptane::RepositoryType::Images, Uptane::Role::Targets());
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Images, Uptane::Role::Targets()));
+    EXPECT_EQ(data, large);
+  }
+  EXPECT_EQ(storage->cacheStats().hits, 2);
+  EXPECT_EQ(storage->cacheStats().misses, 3);
+
+  storage->storeRoot("root1", Uptane::RepositoryType::Director, Uptane::Version(1));
+  EXPECT_TRUE(storage->loadLatestRoot(&data, Uptane::RepositoryType::Director));
+  EXPECT_EQ(data, "root1");
+  storage->storeRoot("root2", Uptane::RepositoryType::Director, Uptane::Version(2));
+  EXPECT_TRUE(storage->loadLatestRoot(&data, Uptane::RepositoryType::Director));
+  EXPECT_EQ(data, "root2");
+  EXPECT_TRUE(storage->loadRoot(&data, Uptane::RepositoryType::Director, Uptane::Version(1)));
+  EXPECT_EQ(data, "root1");
+
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director);
+  EXPECT_FALSE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_FALSE(storage->loadMetaValidators(&data, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+  EXPECT_TRUE(storage->loadLatestRoot(&data, Uptane::RepositoryType::Director));
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+
+  storage->clearMetadata();
+  EXPECT_FALSE(storage->loadLatestRoot(&data, Uptane::RepositoryType::Director));
+  EXPECT_FALSE(storage->loadNonRoot(&data, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+
+  // records are loaded again from the backend after a write
+  storage->storeDeviceId("device");
+  storage->storeEcuRegistered();
+  EXPECT_TRUE(storage->loadEcuRegistered());
+  storage->storeDeviceId("device");
+  EXPECT_FALSE(storage->loadEcuRegistered());
+  storage->saveInstalledVersion(makeTarget("v1", "1111"));
+  std::vector<Uptane::Target> installed;
+  EXPECT_EQ(storage->loadInstalledVersions(&installed), makeTarget("v1", "1111").sha256Hash());
+  EXPECT_EQ(installed.size(), 1);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/*
+ * Transactions see their own writes, the other threads the committed state.
+ */
+TEST(storage, caching_transaction) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::shared_ptr<CachingStorage> storage = CachedStorage();
+  storage->storeDeviceId("device_0");
+  std::string device_id;
+
+  {
+    auto transaction = storage->beginTransaction();
+    storage->storeDeviceId("device_1");
+    EXPECT_TRUE(storage->loadDeviceId(&device_id));
+    EXPECT_EQ(device_id, "device_1");
+  }
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device_0");
+
+  {
+    auto transaction = storage->beginTransaction();
+    storage->storeDeviceId("device_2");
+    std::thread other([&storage]() {
+      std::string other_device_id;
+      EXPECT_TRUE(storage->loadDeviceId(&other_device_id));
+      EXPECT_EQ(other_device_id, "device_0");
+    });
+    other.join();
+    EXPECT_TRUE(transaction->commit());
+  }
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device_2");
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+// The storage accesses of an update cycle: metadata sent to the secondaries, with a check of their roots
+static void updateCycleLoads(INvStorage &storage, int secondaries) {
+  std::string data;
+  EcuSerials serials;
+  storage.loadDeviceId(&data);
+  storage.loadEcuSerials(&serials);
+  storage.loadInstalledVersions(nullptr);
+  for (const auto repo : {Uptane::RepositoryType::Director, Uptane::RepositoryType::Images}) {
+    storage.loadLatestRoot(&data, repo);
+    for (const auto &role : {Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+      storage.loadNonRoot(&data, repo, role);
+    }
+  }
+  for (int i = 0; i < secondaries; ++i) {
+    storage.loadLatestRoot(&data, Uptane::RepositoryType::Director);
+    storage.loadLatestRoot(&data, Uptane::RepositoryType::Images);
+  }
+  storage.loadInstallationResult(nullptr);
+}
+
+// Metadata of both repositories, read again from the database on the next loads
+static void storeCycleMeta(CachingStorage &storage) {
+  storage.storeDeviceId("device");
+  const std::string meta(4096, 'm');
+  for (const auto repo : {Uptane::RepositoryType::Director, Uptane::RepositoryType::Images}) {
+    storage.storeRoot(meta, repo, Uptane::Version(1));
+    for (const auto &role : {Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+      storage.storeNonRoot(meta, repo, role);
+    }
+  }
+  storage.invalidate();
+}
+
+/*
+ * Only the first of several update cycles reaches the database.
+ */
+TEST(storage, caching_update_cycles) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  const int secondaries = 3;
+  const int cycles = 3;
+  std::shared_ptr<CachingStorage> storage = CachedStorage();
+  storeCycleMeta(*storage);
+
+  for (int i = 0; i < cycles; ++i) {
+    updateCycleLoads(*storage, secondaries);
+  }
+  const CachingStorage::Stats stats = storage->cacheStats();
+  EXPECT_EQ(stats.misses, 12);
+  EXPECT_EQ(stats.hits, cycles * (12 + 2 * secondaries) - 12);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+/*
+ * Micro-benchmark of the metadata cache, with the loads of update cycles
+ * with many secondaries. storage.caching_update_cycles checks the results;
+ * this only reports timings, so it is disabled by default. Run it with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(storage, DISABLED_CachingBenchmark) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  const int secondaries = 100;
+  const int cycles = 20;
+  std::shared_ptr<CachingStorage> cached = CachedStorage();
+  std::unique_ptr<INvStorage> uncached = Storage();
+  storeCycleMeta(*cached);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < cycles; ++i) {
+    updateCycleLoads(*uncached, secondaries);
+  }
+  auto direct = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < cycles; ++i) {
+    updateCycleLoads(*cached, secondaries);
+  }
+  auto with_cache = std::chrono::steady_clock::now() - start;
+
+  const CachingStorage::Stats stats = cached->cacheStats();
+  std::cout << "Per cycle with " << secondaries << " secondaries: " << (stats.hits + stats.misses) / cycles
+            << " loads, " << stats.hits / cycles << " saved; "
+            << std::chrono::duration_cast<std::chrono::microseconds>(direct).count() / cycles << " us without cache, "
+            << std::chrono::duration_cast<std::chrono::microseconds>(with_cache).count() / cycles << " us with cache\n";
+  // only the first cycle reaches the database
+  EXPECT_EQ(stats.misses, 12);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+TEST(storage, resume_target) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+  const uint8_t wb[] = "abcd";
+
+  // nothing to resume
+  EXPECT_TRUE(storage->resumeTargetFile("testfile", 4, nullptr) == nullptr);
+
+  // suspend after a checkpoint, the suspended file is not readable
+  {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->allocateTargetFile(false, "testfile", 4);
+    fhandle->wfeed(wb, 1);
+    fhandle->wcheckpoint("state1");
+    fhandle->wfeed(wb + 1, 1);
+    fhandle->wsuspend("state2");
+    EXPECT_THROW(storage->openTargetFile("testfile"), StorageTargetRHandle::ReadError);
+  }
+
+  // size mismatch
+  EXPECT_TRUE(storage->resumeTargetFile("testfile", 5, nullptr) == nullptr);
+
+  // resume and complete
+  {
+    std::string state;
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->resumeTargetFile("testfile", 4, &state);
+    ASSERT_TRUE(fhandle != nullptr);
+    EXPECT_EQ(state, "state2");
+    EXPECT_EQ(fhandle->woffset(), 2);
+    fhandle->wfeed(wb + 2, 2);
+    fhandle->wcommit();
+    // the hash of the part written before the suspension has been kept
+    EXPECT_EQ(fhandle->wsha256(), "88d4266fd4e6338d13b845fcf289579d209c897823b9217da3e161936f031589");
+  }
+
+  {
+    std::stringstream sstr;
+    std::unique_ptr<StorageTargetRHandle> rhandle = storage->openTargetFile("testfile");
+    sstr << *rhandle;
+    EXPECT_EQ(sstr.str(), "abcd");
+    EXPECT_TRUE(storage->resumeTargetFile("testfile", 4, nullptr) == nullptr);
+  }
+
+  // an interrupted write keeps the data up to the last checkpoint, abort drops everything
+  {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->allocateTargetFile(false, "testfile2", 4);
+    fhandle->wfeed(wb, 1);
+    fhandle->wcheckpoint("state");
+    fhandle->wfeed(wb + 1, 1);
+  }
+  {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->resumeTargetFile("testfile2", 4, nullptr);
+    ASSERT_TRUE(fhandle != nullptr);
+    EXPECT_EQ(fhandle->woffset(), 1);
+    fhandle->wabort();
+    EXPECT_TRUE(storage->resumeTargetFile("testfile2", 4, nullptr) == nullptr);
+    EXPECT_THROW(storage->openTargetFile("testfile2"), StorageTargetRHandle::ReadError);
+  }
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
+// VmHWM of the process, in kB
+static uint64_t peakRss() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+/*
+ * A whole image is read with a single copy in memory, and can be accessed
+ * through a mapping without any copy.
+ */
+TEST(storage, read_target_memory) {
+  mkdir(storage_test_dir.c_str(), S_IRWXU);
+  std::unique_ptr<INvStorage> storage = Storage();
+  const size_t size = 32 * 1024 * 1024;
+  {
+    std::vector<uint8_t> chunk(1024 * 1024);
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->allocateTargetFile(false, "big", size);
+    for (size_t written = 0; written < size; written += chunk.size()) {
+      std::fill(chunk.begin(), chunk.end(), static_cast<uint8_t>(written / chunk.size()));
+      fhandle->wfeed(chunk.data(), chunk.size());
+    }
+    fhandle->wcommit();
+  }
+
+  {
+    std::unique_ptr<StorageTargetRHandle> rhandle = storage->openTargetFile("big");
+    const uint8_t* data = rhandle->rmap();
+    ASSERT_TRUE(data != nullptr);
+    EXPECT_EQ(data[0], 0);
+    EXPECT_EQ(data[size - 1], 31);
+  }
+
+  // resets the peak to the current usage
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5" << std::flush;
+  if (!clear_refs || peakRss() == 0) {
+    std::cout << "Peak memory usage can't be measured, skipping\n";
+    boost::filesystem::remove_all(storage_test_dir);
+    return;
+  }
+  const uint64_t before = peakRss();
+  {
+    const std::string data = storage->openTargetFile("big")->rreadAll();
+    ASSERT_EQ(data.size(), size);
+    EXPECT_EQ(data[size / 2], 16);
+  }
+  EXPECT_LE((peakRss() - before) * 1024, size + size / 4);
+
+  boost::filesystem::remove_all(storage_test_dir);
+}
+
 TEST(storage, import_data) {
   mkdir(storage_test_dir.c_str(), S_IRWXU);
   boost::filesystem::create_directories(storage_test_dir / "import");
@@ -1,6 +1,7 @@
 #ifndef STORAGE_CONFIG_H
 #define STORAGE_CONFIG_H
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -25,6 +26,12 @@ struct StorageConfig {
 
   // SQLite storage
   BasedPath sqldb_path{"sql.db"};  // based on `/var/sota`
+  std::string sqldb_journal_mode{"delete"};
+  std::string sqldb_synchronous{"full"};
+  BasedPath images_path{"images"};  // target images, indexed in the database
+  uint64_t images_quota{0};          // bytes, 0 for no limit
+  std::string images_eviction{"lru"};
+  bool metadata_cache{true};  // keep the metadata in memory, see CachingStorage
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
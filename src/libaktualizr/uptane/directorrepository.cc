@@ -7,9 +7,21 @@ void DirectorRepository::resetMeta() {
   targets = Targets();
 }
 
-bool DirectorRepository::verifyTargets(const std::string& targets_raw) {
+bool DirectorRepository::verifyTargets(const std::string& targets_raw, bool already_verified) {
+  const std::string context = VerifiedMeta::hash(targets_raw) + root_hash_;
+  if (!root_hash_.empty() && loadVerified(Role::Targets(), context, &targets)) {
+    return true;
+  }
   try {
-    targets = Targets(RepositoryType::Director, Utils::parseJSON(targets_raw), root);  // signature verification
+    if (already_verified) {
+      targets = Targets(Utils::parseJSON(targets_raw));
+    } else {
+      targets = Targets(RepositoryType::Director, Utils::parseJSON(targets_raw), root);  // signature verification
+    }
+    // only what was verified here is recorded, the root may have changed since already verified metadata was checked
+    if (!already_verified && !root_hash_.empty()) {
+      storeVerified(Role::Targets(), context, targets);
+    }
   } catch (const Uptane::Exception& e) {
     LOG_ERROR << "Signature verification for director targets metadata failed";
     last_exception = e;
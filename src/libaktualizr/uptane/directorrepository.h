@@ -10,10 +10,12 @@ namespace Uptane {
  */
 class DirectorRepository : public RepositoryCommon {
  public:
-  DirectorRepository() : RepositoryCommon(RepositoryType::Director) {}
+  explicit DirectorRepository(std::shared_ptr<INvStorage> storage_in = nullptr)
+      : RepositoryCommon(RepositoryType::Director, std::move(storage_in)) {}
   void resetMeta();
 
-  bool verifyTargets(const std::string& targets_raw);
+  // already_verified: the metadata has not changed since its signatures were checked, see Fetcher::fetchLatestRole
+  bool verifyTargets(const std::string& targets_raw, bool already_verified = false);
   std::vector<Target>& getTargets() { return targets.targets; }
   bool targetsExpired() { return targets.isExpired(TimeStamp::Now()); }
 
@@ -38,6 +38,13 @@ class OversizedTarget : public Exception {
   ~OversizedTarget() noexcept override = default;
 };
 
+class TargetStorageError : public Exception {
+ public:
+  TargetStorageError(const std::string& targetname, const std::string& error)
+      : Exception(targetname, "The target could not be stored: " + error) {}
+  ~TargetStorageError() noexcept override = default;
+};
+
 class IllegalThreshold : public Exception {
  public:
   IllegalThreshold(const std::string& reponame, const std::string& what_arg) : Exception(reponame, what_arg) {}
@@ -1,35 +1,294 @@
 #include "fetcher.h"
 
+#include <algorithm>
+#include <map>
+
 #ifdef BUILD_OSTREE
 #include "package_manager/ostreemanager.h"  // TODO: Hide behind PackageManagerInterface
 #endif
 
 namespace Uptane {
 
+std::string Fetcher::roleUrl(RepositoryType repo, Uptane::Role role, Version version) const {
+  std::string base_url = (repo == RepositoryType::Director) ? config.uptane.director_server : config.uptane.repo_server;
+  return base_url + "/" + version.RoleFileName(role);
+}
+
 bool Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, Uptane::Role role, Version version) {
+  PendingRole pending = startFetchRole(maxsize, repo, role, version);
+  return finishFetch(&pending, result);
+}
+
+PendingRole Fetcher::startFetchRole(int64_t maxsize, RepositoryType repo, Uptane::Role role, Version version) {
   // TODO: chain-loading root.json
-  std::string base_url = (repo == RepositoryType::Director) ? config.uptane.director_server : config.uptane.repo_server;
-  std::string url = base_url + "/" + version.RoleFileName(role);
-  HttpResponse response = http->get(url, maxsize);
+  PendingRole pending(repo, role);
+  pending.maxsize = maxsize;
+  pending.response = http->getAsync(roleUrl(repo, role, version), maxsize);
+  return pending;
+}
+
+/*
+ * Validators are only used if the stored metadata is exactly what was received
+ * along with them, so a 304 response always refers to the stored copy.
+ */
+bool Fetcher::loadCachedRole(std::string* result, HttpValidators* validators, RepositoryType repo, Uptane::Role role) {
+  std::string stored_validators;
+  if (!storage->loadMetaValidators(&stored_validators, repo, role)) {
+    return false;
+  }
+  bool stored =
+      (role == Role::Root()) ? storage->loadLatestRoot(result, repo) : storage->loadNonRoot(result, repo, role);
+  if (!stored) {
+    return false;
+  }
+  Json::Value json = Utils::parseJSON(stored_validators);
+  if (!json.isObject() || json["sha256"].asString() != boost::algorithm::hex(Crypto::sha256digest(*result))) {
+    return false;
+  }
+  validators->etag = json["etag"].asString();
+  validators->last_modified = json["last_modified"].asString();
+  return !validators->empty();
+}
+
+bool Fetcher::fetchLatestRole(std::string* result, int64_t maxsize, RepositoryType repo, Uptane::Role role,
+                              bool* not_modified) {
+  PendingRole pending = startFetchLatestRole(maxsize, repo, role);
+  return finishFetch(&pending, result, not_modified);
+}
+
+PendingRole Fetcher::startFetchLatestRole(int64_t maxsize, RepositoryType repo, Uptane::Role role) {
+  PendingRole pending(repo, role);
+  pending.maxsize = maxsize;
+  HttpValidators validators;
+  pending.conditional = loadCachedRole(&pending.cached, &validators, repo, role);
+  pending.response = http->getConditionalAsync(roleUrl(repo, role, Version()), maxsize,
+                                               pending.conditional ? validators : HttpValidators());
+  return pending;
+}
+
+bool Fetcher::finishFetch(PendingRole* pending, std::string* result, bool* not_modified) {
+  HttpResponse response = pending->response.get();
+  if (pending->conditional && response.isNotModified()) {
+    LOG_DEBUG << RepoString(pending->repo) << " " << pending->role << " has not changed";
+    *result = std::move(pending->cached);
+    if (not_modified != nullptr) {
+      *not_modified = true;
+    }
+    return true;
+  }
   if (!response.isOk()) {
     return false;
   }
   *result = response.body;
+  if (not_modified != nullptr) {
+    *not_modified = false;
+  }
+
+  if (!response.validators.empty()) {
+    Json::Value json;
+    json["etag"] = response.validators.etag;
+    json["last_modified"] = response.validators.last_modified;
+    json["sha256"] = boost::algorithm::hex(Crypto::sha256digest(response.body));
+    storage->storeMetaValidators(Json::FastWriter().write(json), pending->repo, pending->role);
+  }
   return true;
 }
 
-static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
-  assert(userp);
-  auto* ds = static_cast<Uptane::DownloadMetaStruct*>(userp);
-  uint64_t downloaded = size * nmemb;
-  auto expected = static_cast<uint64_t>(ds->target.length());
-  if ((ds->downloaded_length + downloaded) > expected) {
-    return downloaded + 1;  // curl will abort if return unexpected size;
+MetaPrefetch::MetaPrefetch(Fetcher& fetcher, RepositoryType repo, int local_root_version,
+                           const std::vector<std::pair<Role, int64_t>>& roles)
+    : fetcher_(fetcher),
+      repo_(repo),
+      local_root_version_(local_root_version),
+      latest_root_(fetcher.startFetchLatestRole(kMaxRootSize, repo, Role::Root())),
+      last_requested_root_(local_root_version) {
+  if (local_root_version_ == 0) {
+    // needed whatever the latest version is
+    roots_.emplace(1, fetcher_.startFetchRole(kMaxRootSize, repo_, Role::Root(), Version(1)));
+    last_requested_root_ = 1;
+  }
+  for (const auto& role : roles) {
+    roles_.emplace(role.first, fetcher_.startFetchLatestRole(role.second, repo_, role.first));
+  }
+}
+
+void MetaPrefetch::takeLatestRoot() {
+  if (latest_root_taken_) {
+    return;
+  }
+  latest_root_taken_ = true;
+  latest_root_ok_ = fetcher_.finishFetch(&latest_root_, &latest_root_raw_);
+  if (latest_root_ok_) {
+    remote_root_version_ = extractVersionUntrusted(latest_root_raw_);
+  }
+}
+
+void MetaPrefetch::requestRoots(int next) {
+  const int last = std::min(remote_root_version_, next + kRootWindow - 1);
+  for (int version = last_requested_root_ + 1; version <= last; ++version) {
+    roots_.emplace(version, fetcher_.startFetchRole(kMaxRootSize, repo_, Role::Root(), Version(version)));
+  }
+  last_requested_root_ = std::max(last_requested_root_, last);
+}
+
+void MetaPrefetch::prefetchRoots() {
+  takeLatestRoot();
+  requestRoots(last_requested_root_ + 1);
+}
+
+void MetaPrefetch::prefetchRole(Role role, int64_t maxsize) {
+  if (roles_.count(role) == 0) {
+    roles_.emplace(role, fetcher_.startFetchLatestRole(maxsize, repo_, role));
+  }
+}
+
+bool MetaPrefetch::fetchLatestRoot(std::string* result) {
+  takeLatestRoot();
+  if (!latest_root_ok_) {
+    return false;
+  }
+  *result = latest_root_raw_;
+  return true;
+}
+
+bool MetaPrefetch::fetchRoot(std::string* result, Version version) {
+  const int number = version.version();
+  if (number > local_root_version_) {
+    rotated_ = true;
+  }
+  if (latest_root_taken_) {
+    requestRoots(number + 1);
+  }
+  auto it = roots_.find(number);
+  if (it == roots_.end()) {
+    return fetcher_.fetchRole(result, kMaxRootSize, repo_, Role::Root(), version);
+  }
+  PendingRole pending = std::move(it->second);
+  roots_.erase(it);
+  return fetcher_.finishFetch(&pending, result);
+}
+
+bool MetaPrefetch::fetchRole(std::string* result, int64_t maxsize, Role role, bool* not_modified) {
+  bool ok;
+  auto it = roles_.find(role);
+  if (it == roles_.end()) {
+    ok = fetcher_.fetchLatestRole(result, maxsize, repo_, role, not_modified);
+  } else {
+    PendingRole pending = std::move(it->second);
+    roles_.erase(it);
+    ok = fetcher_.finishFetch(&pending, result, not_modified);
+    const bool larger_limit =
+        pending.maxsize != HttpInterface::kNoLimit && (maxsize == HttpInterface::kNoLimit || maxsize > pending.maxsize);
+    if (!ok && larger_limit) {
+      // the metadata may just be larger than the default limit
+      ok = fetcher_.fetchLatestRole(result, maxsize, repo_, role, not_modified);
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+  if (maxsize != HttpInterface::kNoLimit && static_cast<int64_t>(result->size()) > maxsize) {
+    LOG_ERROR << RepoString(repo_) << " " << role << " metadata is larger than expected";
+    return false;
+  }
+  if (rotated_ && not_modified != nullptr) {
+    // verified with the previous root only
+    *not_modified = false;
+  }
+  return true;
+}
+
+std::string DownloadMetaStruct::resumeState() const {
+  Json::Value state;
+  state["hash"] = target.hashes()[0].HashString();
+  const MultiPartHasher& current_hasher =
+      (hash_type == Hash::Type::kSha512) ? static_cast<const MultiPartHasher&>(sha512_hasher) : sha256_hasher;
+  state["hasher"] = boost::algorithm::hex(current_hasher.getState());
+  return Json::FastWriter().write(state);
+}
+
+bool DownloadMetaStruct::restoreState(const std::string& state) {
+  Json::Value json = Utils::parseJSON(state);
+  if (!json.isObject() || json["hash"].asString() != target.hashes()[0].HashString()) {
+    return false;
+  }
+  try {
+    return hasher().setState(boost::algorithm::unhex(json["hasher"].asString()));
+  } catch (const boost::algorithm::hex_decode_error&) {
+    return false;
+  }
+}
+
+void DownloadMetaStruct::startWriter(StorageTargetWHandle* fhandle_in) {
+  fhandle = fhandle_in;
+  received_length = downloaded_length;
+  writer = std_::make_unique<DownloadWriter>(this);
+}
+
+DownloadWriter::DownloadWriter(DownloadMetaStruct* ds) : ds_(ds) {}
+
+DownloadWriter::~DownloadWriter() { finish(); }
+
+bool DownloadWriter::push(const char* data, size_t size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return queued_size_ < kDownloadQueueSize || failed_; });
+  if (failed_) {
+    return false;
+  }
+  // only the downloads which are receiving data have a thread
+  if (!thread_.joinable()) {
+    thread_ = std::thread(&DownloadWriter::run, this);
   }
+  chunks_.emplace_back(data, size);
+  queued_size_ += size;
+  cv_.notify_all();
+  return true;
+}
+
+bool DownloadWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  return !failed_;
+}
+
+void DownloadWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [this]() { return !chunks_.empty() || finished_; });
+    if (chunks_.empty()) {
+      return;
+    }
+    std::string chunk = std::move(chunks_.front());
+    chunks_.pop_front();
+    const bool skip = failed_;
+    lock.unlock();
+    // the rest of the download is dropped after a failed write
+    const std::string error = skip ? std::string() : write(chunk);
+    lock.lock();
+    queued_size_ -= chunk.size();
+    if (!error.empty()) {
+      failed_ = true;
+      ds_->storage_error = error;
+    }
+    cv_.notify_all();
+  }
+}
+
+std::string DownloadWriter::write(const std::string& chunk) {
+  DownloadMetaStruct* ds = ds_;
+  uint64_t downloaded = chunk.size();
+  auto expected = static_cast<uint64_t>(ds->target.length());
 
-  // incomplete writes will stop the download (written_size != nmemb*size)
-  size_t written_size = ds->fhandle->wfeed(reinterpret_cast<uint8_t*>(contents), downloaded);
-  ds->hasher().update(reinterpret_cast<const unsigned char*>(contents), written_size);
+  size_t written_size = ds->fhandle->wfeed(reinterpret_cast<const uint8_t*>(chunk.data()), chunk.size());
+  if (written_size != downloaded) {
+    return "could not write the data";
+  }
+  ds->hasher().update(reinterpret_cast<const unsigned char*>(chunk.data()), written_size);
   unsigned int calculated = 0;
   if (loggerGetSeverity() <= boost::log::trivial::severity_level::trace) {
     if (ds->downloaded_length > 0) {
@@ -37,6 +296,15 @@ static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* u
     }
   }
   ds->downloaded_length += downloaded;
+  if (ds->downloaded_length - ds->checkpoint_length >= kDownloadCheckpointSize && ds->downloaded_length < expected) {
+    try {
+      ds->fhandle->wcheckpoint(ds->resumeState());
+      ds->checkpoint_length = ds->downloaded_length;
+    } catch (const StorageTargetWHandle::WriteError& e) {
+      LOG_ERROR << "Could not save download progress: " << e.what();
+      return e.what();
+    }
+  }
   calculated = static_cast<unsigned int>((ds->downloaded_length * 100) / expected);
   if (loggerGetSeverity() <= boost::log::trivial::severity_level::trace) {
     std::cout << "Downloading: " << calculated << "%";
@@ -49,36 +317,186 @@ static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* u
     auto event = std::make_shared<event::DownloadProgressReport>(ds->target, "Downloading", calculated);
     (*(ds->events_channel))(event);
   }
-  return written_size;
+  return std::string();
+}
+
+// Runs on the HTTP I/O thread, the data is written by the DownloadWriter of the download
+static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  assert(userp);
+  auto* ds = static_cast<Uptane::DownloadMetaStruct*>(userp);
+  uint64_t downloaded = size * nmemb;
+  auto expected = static_cast<uint64_t>(ds->target.length());
+  if ((ds->received_length + downloaded) > expected) {
+    ds->oversized = true;
+    return downloaded + 1;  // curl will abort if return unexpected size;
+  }
+
+  // an earlier write failed, stop the download
+  if (!ds->writer->push(contents, downloaded)) {
+    return 0;
+  }
+  ds->received_length += downloaded;
+  return downloaded;
+}
+
+// Skips the download if the same image is already stored, from a previous attempt or under another name
+bool Fetcher::reuseStoredTarget(const Target& target) {
+  const std::string sha256 = target.sha256Hash();
+  if (sha256.empty() || !storage->reuseTargetFile(target.filename(), sha256, static_cast<uint64_t>(target.length()))) {
+    return false;
+  }
+  LOG_INFO << "Image of " << target.filename() << " is already stored, not downloading it again";
+  return true;
+}
+
+std::unique_ptr<StorageTargetWHandle> Fetcher::openTargetDownload(DownloadMetaStruct* ds) {
+  const Target& target = ds->target;
+  auto size = static_cast<size_t>(target.length());
+  std::string resume_state;
+  std::unique_ptr<StorageTargetWHandle> fhandle = storage->resumeTargetFile(target.filename(), size, &resume_state);
+  if (fhandle != nullptr) {
+    if (ds->restoreState(resume_state)) {
+      ds->downloaded_length = fhandle->woffset();
+      ds->checkpoint_length = ds->downloaded_length;
+      LOG_INFO << "Resuming download of " << target.filename() << " from byte " << ds->downloaded_length;
+      return fhandle;
+    }
+    LOG_WARNING << "Partial download of " << target.filename() << " does not match the target, starting over";
+    fhandle->wabort();
+    fhandle.reset();
+  }
+  return storage->allocateTargetFile(false, target.filename(), size);
+}
+
+// Returns false if the download has to be restarted from scratch, throws if it failed
+bool Fetcher::finishTargetDownload(DownloadMetaStruct* ds, std::unique_ptr<StorageTargetWHandle> fhandle,
+                                   const HttpResponse& response) {
+  const Target& target = ds->target;
+  if (!ds->writer->finish() || response.curl_code == CURLE_WRITE_ERROR) {
+    fhandle->wabort();
+    if (ds->oversized) {
+      throw OversizedTarget(target.filename());
+    }
+    throw TargetStorageError(target.filename(), ds->storage_error);
+  }
+  // a resumed download is answered with 206 Partial Content
+  if (response.curl_code != CURLE_OK || (!response.isOk() && response.http_status_code != 206)) {
+    if (response.curl_code == CURLE_RANGE_ERROR && response.http_status_code == 200) {
+      LOG_WARNING << "Server can't resume the download of " << target.filename() << ", starting over";
+      fhandle->wabort();
+      return false;
+    }
+    if (response.http_status_code >= 200 && response.http_status_code < 300) {
+      // the transfer broke off, keep what has been received so far for the next attempt
+      try {
+        fhandle->wsuspend(ds->resumeState());
+      } catch (const StorageTargetWHandle::WriteError& e) {
+        LOG_ERROR << "Could not save download progress: " << e.what();
+        fhandle->wabort();
+      }
+    } else {
+      // nothing after the last checkpoint can be trusted without a successful response
+      fhandle->wrevert();
+    }
+    throw Exception("image", "Could not download file, error: " + response.error_message + " (http code " +
+                                 std::to_string(response.http_status_code) + ")");
+  }
+  fhandle->wcommit();
+
+  // The download hasher was restored from the checkpoint when resuming, so it only vouches for what was received.
+  // The storage hashed the file as it was written, which catches a stored part that doesn't match.
+  const std::string sha256 = target.sha256Hash();
+  if ((!sha256.empty() && fhandle->wsha256() != sha256) ||
+      !target.MatchWith(Hash(ds->hash_type, ds->hasher().getHexDigest()))) {
+    // don't let a corrupted (possibly resumed) file be picked up again
+    storage->removeTargetFile(target.filename());
+    throw TargetHashMismatch(target.filename());
+  }
+  return true;
+}
+
+std::vector<bool> Fetcher::fetchVerifyTargets(const std::vector<Target>& targets) {
+  std::vector<bool> results(targets.size(), false);
+  // the writers of the downloads are stopped before the handles go away
+  std::vector<std::unique_ptr<StorageTargetWHandle>> fhandles;
+  std::vector<std::unique_ptr<DownloadMetaStruct>> downloads;
+  std::vector<size_t> download_indices;
+  std::vector<DownloadRequest> requests;
+  std::map<std::string, size_t> started;
+  std::vector<std::pair<size_t, size_t>> duplicates;
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    const Target& target = targets[i];
+    if (target.IsOstree() || target.hashes().empty()) {
+      results[i] = fetchVerifyTarget(target);
+      continue;
+    }
+    auto it = started.find(target.filename());
+    if (it != started.end()) {
+      duplicates.emplace_back(i, it->second);
+      continue;
+    }
+    if (reuseStoredTarget(target)) {
+      results[i] = true;
+      continue;
+    }
+    try {
+      auto ds = std_::make_unique<DownloadMetaStruct>(target, events_channel);
+      std::unique_ptr<StorageTargetWHandle> fhandle = openTargetDownload(ds.get());
+      ds->startWriter(fhandle.get());
+      requests.emplace_back(config.uptane.repo_server + "/targets/" + target.filename(), DownloadHandler, ds.get(),
+                            static_cast<size_t>(ds->downloaded_length));
+      started[target.filename()] = i;
+      downloads.push_back(std::move(ds));
+      fhandles.push_back(std::move(fhandle));
+      download_indices.push_back(i);
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Error while downloading a target: " << e.what();
+    }
+  }
+
+  std::vector<HttpResponse> responses =
+      http->downloadMany(requests, static_cast<size_t>(config.uptane.download_concurrency));
+  for (size_t k = 0; k < downloads.size(); ++k) {
+    size_t i = download_indices[k];
+    try {
+      if (finishTargetDownload(downloads[k].get(), std::move(fhandles[k]), responses[k])) {
+        results[i] = true;
+      } else {
+        results[i] = fetchVerifyTarget(targets[i]);
+      }
+    } catch (const Exception& e) {
+      LOG_WARNING << "Error while downloading a target: " << e.what();
+    }
+  }
+
+  for (const auto& duplicate : duplicates) {
+    results[duplicate.first] = results[duplicate.second];
+  }
+  return results;
 }
 
 bool Fetcher::fetchVerifyTarget(const Target& target) {
   bool result = false;
   try {
     if (!target.IsOstree()) {
-      DownloadMetaStruct ds(target, events_channel);
-      std::unique_ptr<StorageTargetWHandle> fhandle =
-          storage->allocateTargetFile(false, target.filename(), static_cast<size_t>(target.length()));
-      ds.fhandle = fhandle.get();
-      ds.downloaded_length = 0;
-
       if (target.hashes().empty()) {
         throw Exception("image", "No hash defined for the target");
       }
-
-      HttpResponse response =
-          http->download(config.uptane.repo_server + "/targets/" + target.filename(), DownloadHandler, &ds);
-      if (!response.isOk()) {
-        fhandle->wabort();
-        if (response.curl_code == CURLE_WRITE_ERROR) {
-          throw OversizedTarget(target.filename());
-        }
-        throw Exception("image", "Could not download file, error: " + response.error_message);
+      if (reuseStoredTarget(target)) {
+        return true;
       }
-      fhandle->wcommit();
 
-      if (!target.MatchWith(Hash(ds.hash_type, ds.hasher().getHexDigest()))) {
-        throw TargetHashMismatch(target.filename());
+      // the writer of the download is stopped before the handle goes away
+      std::unique_ptr<StorageTargetWHandle> fhandle;
+      DownloadMetaStruct ds(target, events_channel);
+      fhandle = openTargetDownload(&ds);
+      ds.startWriter(fhandle.get());
+
+      HttpResponse response = http->download(config.uptane.repo_server + "/targets/" + target.filename(),
+                                             DownloadHandler, &ds, static_cast<size_t>(ds.downloaded_length));
+      if (!finishTargetDownload(&ds, std::move(fhandle), response)) {
+        return fetchVerifyTarget(target);
       }
       result = true;
     } else {
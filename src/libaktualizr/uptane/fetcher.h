@@ -1,6 +1,16 @@
 #ifndef UPTANE_FETCHER_H_
 #define UPTANE_FETCHER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "config/config.h"
 #include "http/httpinterface.h"
 #include "storage/invstorage.h"
@@ -12,15 +22,68 @@ constexpr int64_t kMaxRootSize = 64 * 1024;
 constexpr int64_t kMaxDirectorTargetsSize = 64 * 1024;
 constexpr int64_t kMaxTimestampSize = 64 * 1024;
 constexpr int64_t kMaxSnapshotSize = 64 * 1024;
-constexpr int64_t kMaxImagesTargetsSize = 1024 * 1024;
+// images targets are read one target at a time, see TargetsParser
+constexpr int64_t kMaxImagesTargetsSize = 8 * 1024 * 1024;
+// Progress of target downloads is made persistent every kDownloadCheckpointSize bytes
+constexpr uint64_t kDownloadCheckpointSize = 1024 * 1024;
+// Data of a target download received but not yet written to storage, beyond which the transfer waits for the storage
+constexpr size_t kDownloadQueueSize = 4 * 1024 * 1024;
+
+struct DownloadMetaStruct;
+
+/**
+ * Writes the data of a target download to storage on its own thread. The
+ * data is received on the HTTP I/O thread which drives all the transfers, so
+ * the writes, the checkpoints with their fdatasync() and the progress events
+ * are kept off it.
+ */
+class DownloadWriter {
+ public:
+  explicit DownloadWriter(DownloadMetaStruct* ds);
+  ~DownloadWriter();
+  DownloadWriter& operator=(const DownloadWriter&) = delete;
+  DownloadWriter(const DownloadWriter&) = delete;
+  // Queues the data, waits if too much is queued already. Returns false once a write has failed.
+  bool push(const char* data, size_t size);
+  // Waits until everything queued is written. Returns false if a write failed, see DownloadMetaStruct::storage_error.
+  bool finish();
+
+ private:
+  void run();
+  // returns the error, empty on success
+  std::string write(const std::string& chunk);
+
+  DownloadMetaStruct* ds_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> chunks_;
+  size_t queued_size_{0};
+  bool failed_{false};
+  bool finished_{false};
+  std::thread thread_;
+};
 
 struct DownloadMetaStruct {
   DownloadMetaStruct(Target target_in, std::shared_ptr<event::Channel> events_channel_in)
       : hash_type{target_in.hashes()[0].type()},
         events_channel{std::move(events_channel_in)},
         target{std::move(target_in)} {}
+  // the writer uses the other members until it is stopped
+  ~DownloadMetaStruct() { writer.reset(); }
+  DownloadMetaStruct& operator=(const DownloadMetaStruct&) = delete;
+  DownloadMetaStruct(const DownloadMetaStruct&) = delete;
+  // Hands the data received by DownloadHandler to fhandle_in through a DownloadWriter
+  void startWriter(StorageTargetWHandle* fhandle_in);
+  // received by DownloadHandler, on the HTTP I/O thread
+  uint64_t received_length{};
+  // written to storage, by the writer
   uint64_t downloaded_length{};
+  uint64_t checkpoint_length{};
+  // why DownloadHandler stopped the download, if it did
+  bool oversized{false};
+  std::string storage_error;
   StorageTargetWHandle* fhandle{};
+  std::unique_ptr<DownloadWriter> writer;
   const Hash::Type hash_type;
   MultiPartHasher& hasher() {
     switch (hash_type) {
@@ -32,6 +95,9 @@ struct DownloadMetaStruct {
         throw std::runtime_error("Unknown hash algorithm");
     }
   }
+  // Opaque state stored along with a partially downloaded target, so that the download and hashing can be resumed
+  std::string resumeState() const;
+  bool restoreState(const std::string& state);
   std::shared_ptr<event::Channel> events_channel;
   Target target;
 
@@ -40,6 +106,18 @@ struct DownloadMetaStruct {
   MultiPartSHA512Hasher sha512_hasher;
 };
 
+// A metadata request in flight, see Fetcher::startFetchRole() and Fetcher::startFetchLatestRole()
+struct PendingRole {
+  PendingRole(RepositoryType repo_in, Role role_in) : repo(repo_in), role(std::move(role_in)) {}
+  RepositoryType repo;
+  Role role;
+  int64_t maxsize{HttpInterface::kNoLimit};
+  std::future<HttpResponse> response;
+  // stored copy which the validators of a conditional request refer to
+  std::string cached;
+  bool conditional{false};
+};
+
 class Fetcher {
  public:
   Fetcher(const Config& config_in, std::shared_ptr<INvStorage> storage_in, std::shared_ptr<HttpInterface> http_in,
@@ -49,18 +127,84 @@ class Fetcher {
         config(config_in),
         events_channel(std::move(events_channel_in)) {}
   bool fetchVerifyTarget(const Target& target);
+  // Downloads several targets in parallel, at most uptane.download_concurrency at a time. Returns per-target results.
+  std::vector<bool> fetchVerifyTargets(const std::vector<Target>& targets);
   bool fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, Uptane::Role role, Version version);
-  bool fetchLatestRole(std::string* result, int64_t maxsize, RepositoryType repo, Uptane::Role role) {
-    return fetchRole(result, maxsize, repo, role, Version());
-  }
+  // Conditional request based on the validators stored with the previous response. If the server reports that the
+  // metadata has not changed, result is the stored copy and *not_modified is set.
+  bool fetchLatestRole(std::string* result, int64_t maxsize, RepositoryType repo, Uptane::Role role,
+                       bool* not_modified = nullptr);
+  // Start the same requests without waiting for the response, several of them can be in flight at the same time.
+  // The response is read, and the validators stored, by finishFetch().
+  PendingRole startFetchRole(int64_t maxsize, RepositoryType repo, Uptane::Role role, Version version);
+  PendingRole startFetchLatestRole(int64_t maxsize, RepositoryType repo, Uptane::Role role);
+  bool finishFetch(PendingRole* pending, std::string* result, bool* not_modified = nullptr);
 
  private:
+  bool reuseStoredTarget(const Target& target);
+  std::unique_ptr<StorageTargetWHandle> openTargetDownload(DownloadMetaStruct* ds);
+  bool loadCachedRole(std::string* result, HttpValidators* validators, RepositoryType repo, Uptane::Role role);
+  bool finishTargetDownload(DownloadMetaStruct* ds, std::unique_ptr<StorageTargetWHandle> fhandle,
+                            const HttpResponse& response);
+
+  std::string roleUrl(RepositoryType repo, Uptane::Role role, Version version) const;
+
   std::shared_ptr<HttpInterface> http;
   std::shared_ptr<INvStorage> storage;
   const Config& config;
   std::shared_ptr<event::Channel> events_channel;
 };
 
+/**
+ * Requests the metadata of one repository ahead of its verification, so that
+ * the round trips of the whole update cycle overlap instead of following each
+ * other. The latest root and the other roles are requested at once, then the
+ * missing root versions, a few at a time, as soon as the latest root tells how
+ * many there are. The responses are still taken one by one in the order of
+ * verification, and anything which wasn't requested in advance is fetched
+ * when it is taken.
+ *
+ * Everything runs on the calling thread, the requests are only in flight in
+ * the background. If the root is rotated after the other roles were
+ * requested, these are never reported as not modified, as they have to be
+ * verified again with the new root.
+ */
+class MetaPrefetch {
+ public:
+  // local_root_version is the version of the stored root, 0 if there is none yet
+  MetaPrefetch(Fetcher& fetcher, RepositoryType repo, int local_root_version,
+               const std::vector<std::pair<Role, int64_t>>& roles);
+  // Start requesting the root versions after the local one, once the latest root is there
+  void prefetchRoots();
+  // Start requesting a role which wasn't requested with the others, if it isn't yet
+  void prefetchRole(Role role, int64_t maxsize);
+  bool fetchLatestRoot(std::string* result);
+  bool fetchRoot(std::string* result, Version version);
+  // maxsize is checked again here, the request was done with the limit known beforehand
+  bool fetchRole(std::string* result, int64_t maxsize, Role role, bool* not_modified);
+
+  // root versions requested at the same time
+  static const int kRootWindow = 8;
+
+ private:
+  void takeLatestRoot();
+  // request the root versions up to kRootWindow - 1 after next, once the latest version is known
+  void requestRoots(int next);
+
+  Fetcher& fetcher_;
+  RepositoryType repo_;
+  int local_root_version_;
+  PendingRole latest_root_;
+  bool latest_root_taken_{false};
+  bool latest_root_ok_{false};
+  std::string latest_root_raw_;
+  int remote_root_version_{0};
+  int last_requested_root_{0};
+  std::map<int, PendingRole> roots_;
+  std::map<Role, PendingRole> roles_;
+  bool rotated_{false};
+};
+
 }  // namespace Uptane
 
 #endif
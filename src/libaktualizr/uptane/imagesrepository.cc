@@ -1,5 +1,9 @@
 #include "imagesrepository.h"
 
+#include <algorithm>
+
+#include "uptane/targetsparser.h"
+
 namespace Uptane {
 
 void ImagesRepository::resetMeta() {
@@ -7,11 +11,47 @@ void ImagesRepository::resetMeta() {
   targets = Targets();
   snapshot = Snapshot();
   timestamp = TimestampMeta();
+  timestamp_hash_.clear();
+  snapshot_hash_.clear();
+  wanted_targets_.clear();
+  all_targets_wanted_ = true;
+  wanted_targets_hash_.clear();
 }
 
-bool ImagesRepository::verifyTimestamp(const std::string& timestamp_raw) {
+void ImagesRepository::setWantedTargets(const std::vector<Target>& director_targets) {
+  wanted_targets_.clear();
+  Json::Value names(Json::arrayValue);
+  for (const auto& target : director_targets) {
+    wanted_targets_.insert(target.filename());
+  }
+  for (const auto& name : wanted_targets_) {
+    names.append(name);
+  }
+  all_targets_wanted_ = false;
+  wanted_targets_hash_ = VerifiedMeta::hash(Utils::jsonToCanonicalStr(names));
+}
+
+bool ImagesRepository::verifyTimestamp(const std::string& timestamp_raw, bool already_verified) {
+  timestamp_hash_.clear();
+  const std::string timestamp_hash = VerifiedMeta::hash(timestamp_raw);
+  const std::string context = timestamp_hash + root_hash_;
+  if (!root_hash_.empty() && loadVerified(Role::Timestamp(), context, &timestamp)) {
+    timestamp_hash_ = timestamp_hash;
+    return true;
+  }
   try {
-    timestamp = TimestampMeta(RepositoryType::Images, Utils::parseJSON(timestamp_raw), root);  // signature verification
+    if (already_verified) {
+      timestamp = TimestampMeta(Utils::parseJSON(timestamp_raw));
+    } else {
+      // signature verification
+      timestamp = TimestampMeta(RepositoryType::Images, Utils::parseJSON(timestamp_raw), root);
+    }
+    if (!root_hash_.empty()) {
+      timestamp_hash_ = timestamp_hash;
+      if (!already_verified) {
+        storeVerified(Role::Timestamp(), context, timestamp);
+      }
+    }
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for timestamp metadata failed";
     last_exception = e;
@@ -20,7 +60,14 @@ bool ImagesRepository::verifyTimestamp(const std::string& timestamp_raw) {
   return true;
 }
 
-bool ImagesRepository::verifySnapshot(const std::string& snapshot_raw) {
+bool ImagesRepository::verifySnapshot(const std::string& snapshot_raw, bool already_verified) {
+  snapshot_hash_.clear();
+  const std::string snapshot_hash = VerifiedMeta::hash(snapshot_raw);
+  const std::string context = snapshot_hash + root_hash_ + timestamp_hash_;
+  if (!timestamp_hash_.empty() && loadVerified(Role::Snapshot(), context, &snapshot)) {
+    snapshot_hash_ = snapshot_hash;
+    return true;
+  }
   try {
     const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(snapshot_raw));
     bool hash_exists = false;
@@ -48,10 +95,20 @@ bool ImagesRepository::verifySnapshot(const std::string& snapshot_raw) {
       LOG_ERROR << "No hash found for shapshot.json";
       return false;
     }
-    snapshot = Snapshot(RepositoryType::Images, Utils::parseJSON(snapshot_raw), root);  // signature verification
+    if (already_verified) {
+      snapshot = Snapshot(Utils::parseJSON(snapshot_raw));
+    } else {
+      snapshot = Snapshot(RepositoryType::Images, Utils::parseJSON(snapshot_raw), root);  // signature verification
+    }
     if (snapshot.version() != timestamp.snapshot_version()) {
       return false;
     }
+    if (!timestamp_hash_.empty()) {
+      snapshot_hash_ = snapshot_hash;
+      if (!already_verified) {
+        storeVerified(Role::Snapshot(), context, snapshot);
+      }
+    }
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for snapshot metadata failed";
     last_exception = e;
@@ -60,26 +117,47 @@ bool ImagesRepository::verifySnapshot(const std::string& snapshot_raw) {
   return true;
 }
 
-bool ImagesRepository::verifyTargets(const std::string& targets_raw) {
+bool ImagesRepository::verifyTargets(const std::string& targets_raw, bool already_verified) {
+  const std::string context = VerifiedMeta::hash(targets_raw) + root_hash_ + snapshot_hash_ + wanted_targets_hash_;
+  if (!snapshot_hash_.empty() && loadVerified(Role::Targets(), context, &targets)) {
+    return true;
+  }
   try {
-    const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(targets_raw));
+    // Large metadata is read one target at a time, keeping only the wanted ones. The few documents which the
+    // parser refuses are parsed as a whole.
+    TargetsParser parsed;
+    TargetsParser::Filter keep;
+    if (!all_targets_wanted_) {
+      keep = [this](const Target& target) { return wanted_targets_.count(target.filename()) != 0; };
+    }
+    const bool streamed = parsed.parse(targets_raw, keep);
+    Json::Value json;
+    std::string canonical;
+    if (!streamed) {
+      json = Utils::parseJSON(targets_raw);
+      canonical = Utils::jsonToCanonicalStr(json);
+    }
+
     bool hash_exists = false;
     for (const auto& it : snapshot.targets_hashes()) {
       switch (it.type()) {
         case Hash::Type::kSha256:
-          if (Hash(Hash::Type::kSha256, boost::algorithm::hex(Crypto::sha256digest(canonical))) != it) {
-            LOG_ERROR << "Hash verification for targets metadata failed";
-            return false;
+        case Hash::Type::kSha512: {
+          std::string digest;
+          if (streamed) {
+            digest = parsed.documentDigest(it.type());
+          } else if (it.type() == Hash::Type::kSha256) {
+            digest = boost::algorithm::hex(Crypto::sha256digest(canonical));
+          } else {
+            digest = boost::algorithm::hex(Crypto::sha512digest(canonical));
           }
-          hash_exists = true;
-          break;
-        case Hash::Type::kSha512:
-          if (Hash(Hash::Type::kSha512, boost::algorithm::hex(Crypto::sha512digest(canonical))) != it) {
+          if (Hash(it.type(), digest) != it) {
             LOG_ERROR << "Hash verification for targets metadata failed";
             return false;
           }
           hash_exists = true;
           break;
+        }
         default:
           break;
       }
@@ -88,10 +166,31 @@ bool ImagesRepository::verifyTargets(const std::string& targets_raw) {
       LOG_ERROR << "No hash found for targets.json";
       return false;
     }
-    targets = Targets(RepositoryType::Images, Utils::parseJSON(targets_raw), root);  // signature verification
+    if (streamed) {
+      if (already_verified) {
+        targets = Targets(parsed);
+      } else {
+        targets = Targets(RepositoryType::Images, parsed, root);  // signature verification
+      }
+    } else {
+      if (already_verified) {
+        targets = Targets(json);
+      } else {
+        targets = Targets(RepositoryType::Images, json, root);  // signature verification
+      }
+      if (keep) {
+        targets.targets.erase(std::remove_if(targets.targets.begin(), targets.targets.end(),
+                                             [&keep](const Target& target) { return !keep(target); }),
+                              targets.targets.end());
+        targets.reindex();
+      }
+    }
     if (targets.version() != snapshot.targets_version()) {
       return false;
     }
+    if (!already_verified && !snapshot_hash_.empty()) {
+      storeVerified(Role::Targets(), context, targets);
+    }
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for images targets metadata failed";
     last_exception = e;
@@ -100,12 +199,73 @@ bool ImagesRepository::verifyTargets(const std::string& targets_raw) {
   return true;
 }
 
+// Identifies the snapshot which the verified timestamp points to, in the current context
+std::string ImagesRepository::unchangedKey() const {
+  if (root_hash_.empty() || timestamp_hash_.empty()) {
+    return std::string();
+  }
+  std::string key = root_hash_ + wanted_targets_hash_ + std::to_string(timestamp.snapshot_version());
+  for (const auto& hash : timestamp.snapshot_hashes()) {
+    key += ":" + hash.TypeString() + "=" + hash.HashString();
+  }
+  return key;
+}
+
+void ImagesRepository::keepSnapshot() {
+  kept_key_ = unchangedKey();
+  if (kept_key_.empty()) {
+    return;
+  }
+  kept_snapshot_ = snapshot;
+  kept_targets_ = targets;
+  kept_snapshot_hash_ = snapshot_hash_;
+}
+
+bool ImagesRepository::reuseUnchangedSnapshot() {
+  const std::string key = unchangedKey();
+  if (!key.empty() && kept_key_.empty() && loadStoredSnapshot()) {
+    keepSnapshot();
+    ++stats_.snapshot_loaded;
+    LOG_DEBUG << "Images snapshot has not changed, taking the stored snapshot and targets metadata";
+    return true;
+  }
+  if (key.empty() || key != kept_key_) {
+    ++stats_.snapshot_changed;
+    return false;
+  }
+  snapshot = kept_snapshot_;
+  targets = kept_targets_;
+  snapshot_hash_ = kept_snapshot_hash_;
+  ++stats_.snapshot_reused;
+  LOG_DEBUG << "Images snapshot has not changed, keeping the snapshot and targets metadata";
+  return true;
+}
+
+// The stored snapshot and targets are the last ones which were verified. Their hashes and versions are checked
+// against the verified timestamp, which binds them to it, so their signatures are not checked again.
+bool ImagesRepository::loadStoredSnapshot() {
+  std::string snapshot_raw;
+  std::string targets_raw;
+  if (storage_ == nullptr || !storage_->loadNonRoot(&snapshot_raw, RepositoryType::Images, Role::Snapshot()) ||
+      !storage_->loadNonRoot(&targets_raw, RepositoryType::Images, Role::Targets()) ||
+      extractVersionUntrusted(snapshot_raw) != timestamp.snapshot_version()) {
+    return false;
+  }
+  if (verifySnapshot(snapshot_raw, true) && verifyTargets(targets_raw, true)) {
+    return true;
+  }
+  snapshot = Snapshot();
+  targets = Targets();
+  snapshot_hash_.clear();
+  return false;
+}
+
 std::unique_ptr<Uptane::Target> ImagesRepository::getTarget(const Uptane::Target& director_target) {
-  auto it = std::find(targets.targets.cbegin(), targets.targets.cend(), director_target);
-  if (it == targets.targets.cend()) {
+  const Uptane::Target* target = targets.findTarget(director_target);
+  if (target == nullptr) {
     return std::unique_ptr<Uptane::Target>(nullptr);
   } else {
-    return std_::make_unique<Uptane::Target>(*it);
+    return std_::make_unique<Uptane::Target>(*target);
   }
 }
 
@@ -1,27 +1,49 @@
 #ifndef IMAGES_REPOSITORY_H_
 #define IMAGES_REPOSITORY_H_
 
+#include <set>
+
 #include "uptanerepository.h"
 
 namespace Uptane {
 
 class ImagesRepository : public RepositoryCommon {
  public:
-  ImagesRepository() : RepositoryCommon(RepositoryType::Images) {}
+  struct Stats {
+    uint64_t snapshot_reused{0};   // cycles which kept the snapshot and targets of the previous one
+    uint64_t snapshot_loaded{0};   // cycles which took them from the storage instead, after a restart
+    uint64_t snapshot_changed{0};  // cycles which had to fetch and verify them
+  };
+
+  explicit ImagesRepository(std::shared_ptr<INvStorage> storage_in = nullptr)
+      : RepositoryCommon(RepositoryType::Images, std::move(storage_in)) {}
 
   void resetMeta();
 
-  bool verifyTargets(const std::string& targets_raw);
+  // already_verified: the metadata has not changed since its signatures were checked, see Fetcher::fetchLatestRole.
+  // Hashes and versions are still checked against the rest of the metadata.
+  bool verifyTargets(const std::string& targets_raw, bool already_verified = false);
   bool targetsExpired() { return targets.isExpired(TimeStamp::Now()); }
   int64_t targetsSize() { return snapshot.targets_size(); }
   std::unique_ptr<Uptane::Target> getTarget(const Uptane::Target& director_target);
+  // Only keep the targets which the director asks for, the others are never looked up. All targets are kept until
+  // this is called and after resetMeta().
+  void setWantedTargets(const std::vector<Target>& director_targets);
 
-  bool verifyTimestamp(const std::string& timestamp_raw);
+  bool verifyTimestamp(const std::string& timestamp_raw, bool already_verified = false);
   bool timestampExpired() { return timestamp.isExpired(TimeStamp::Now()); }
 
-  bool verifySnapshot(const std::string& snapshot_raw);
+  bool verifySnapshot(const std::string& snapshot_raw, bool already_verified = false);
   bool snapshotExpired() { return snapshot.isExpired(TimeStamp::Now()); }
   int64_t snapshotSize() { return timestamp.snapshot_size(); }
+  // Called once the snapshot and targets have passed all checks, so that the next cycles can take them again
+  void keepSnapshot();
+  // Called once the timestamp is verified. If it points to the same snapshot as when keepSnapshot() was last called,
+  // with the same root and wanted targets, the snapshot and targets from then are taken again, and they need neither
+  // be fetched nor verified. If nothing has been kept yet, the stored snapshot and targets are taken if the timestamp
+  // points to them; they are checked against it but not fetched. Returns false if they have to be fetched.
+  bool reuseUnchangedSnapshot();
+  Stats stats() const { return stats_; }
 
   Exception getLastException() const { return last_exception; }
 
@@ -29,6 +51,21 @@ class ImagesRepository : public RepositoryCommon {
   Uptane::Targets targets;
   Uptane::TimestampMeta timestamp;
   Uptane::Snapshot snapshot;
+  // of the raw metadata which gave the expected hashes of the snapshot and the targets
+  std::string timestamp_hash_;
+  std::string snapshot_hash_;
+  std::set<std::string> wanted_targets_;
+  bool all_targets_wanted_{true};
+  std::string wanted_targets_hash_;  // part of the context of the targets, empty when all are kept
+
+  std::string unchangedKey() const;
+  bool loadStoredSnapshot();
+  // kept across resetMeta()
+  Uptane::Snapshot kept_snapshot_;
+  Uptane::Targets kept_targets_;
+  std::string kept_snapshot_hash_;
+  std::string kept_key_;
+  Stats stats_;
 
   Exception last_exception{"", ""};
 };
@@ -7,6 +7,9 @@
 
 namespace Uptane {
 
+// A secondary which stops answering doesn't keep the thread asking for its manifest busy for longer
+static const std::chrono::seconds kManifestTimeout(120);
+
 PublicKey IpUptaneSecondary::getPublicKey() {
   LOG_INFO << "Getting the public key of a secondary";
   Asn1Message::Ptr req(Asn1Message::Empty());
@@ -86,7 +89,7 @@ Json::Value IpUptaneSecondary::getManifest() {
 
   req->present(AKIpUptaneMes_PR_manifestReq);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = Asn1Rpc(req, getAddr(), kManifestTimeout);
 
   if (resp->present() != AKIpUptaneMes_PR_manifestResp) {
     LOG_ERROR << "Failed to get public key response message from secondary";
@@ -51,25 +51,17 @@ bool ManagedSecondary::putMetadata(const RawMetaPack &meta_pack) {
   expected_target_hashes.clear();
   expected_target_length = 0;
 
-  bool target_found = false;
-
-  std::vector<Uptane::Target>::const_iterator it;
-  for (it = current_meta.director_targets.targets.begin(); it != current_meta.director_targets.targets.end(); ++it) {
-    // TODO: what about hardware ID? Also missing in Uptane::Target
-    if (it->ecus().find(getSerial()) != it->ecus().end()) {
-      if (target_found) {
-        detected_attack = "Duplicate entry for this ECU";
-        break;
-      }
-      expected_target_name = it->filename();
-      expected_target_hashes = it->hashes();
-      expected_target_length = it->length();
-      target_found = true;
-    }
-  }
-
-  if (!target_found) {
+  // TODO: what about hardware ID? Also missing in Uptane::Target
+  std::vector<const Uptane::Target *> targets = current_meta.director_targets.targetsForEcu(getSerial());
+  if (targets.empty()) {
     detected_attack = "No update for this ECU";
+  } else {
+    expected_target_name = targets[0]->filename();
+    expected_target_hashes = targets[0]->hashes();
+    expected_target_length = targets[0]->length();
+    if (targets.size() > 1) {
+      detected_attack = "Duplicate entry for this ECU";
+    }
   }
 
   return true;
@@ -43,16 +43,8 @@ bool PartialVerificationSecondary::putMetadata(const RawMetaPack &meta) {
     return true;
   }
   meta_targets_ = targets;
-  std::vector<Uptane::Target>::const_iterator it;
-  bool target_found = false;
-  for (it = meta_targets_.targets.begin(); it != meta_targets_.targets.end(); ++it) {
-    if (it->IsForSecondary(getSerial())) {
-      if (target_found) {
-        detected_attack_ = "Duplicate entry for this ECU";
-        break;
-      }
-      target_found = true;
-    }
+  if (meta_targets_.targetsForEcu(getSerial()).size() > 1) {
+    detected_attack_ = "Duplicate entry for this ECU";
   }
   return true;
 }
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
 
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
@@ -6,6 +11,7 @@
 using Uptane::Root;
 
 Root::Root(const RepositoryType repo, const Json::Value &json, Root &root) : Root(repo, json) {
+  pool_ = root.pool_;
   root.UnpackSignedObject(repo, json);
   this->UnpackSignedObject(repo, json);
 }
@@ -73,10 +79,93 @@ Root::Root(const RepositoryType repo, const Json::Value &json) : policy_(Policy:
   }
 }
 
+namespace {
+
+struct SignatureToCheck {
+  Uptane::KeyId keyid;
+  PublicKey key;
+  std::string signature;
+};
+
+bool checkSignature(const SignatureToCheck &sig, const std::string &canonical) {
+  if (sig.key.VerifySignature(sig.signature, canonical)) {
+    return true;
+  }
+  LOG_WARNING << "Signature was present but invalid: " << sig.signature << " with KeyId: " << sig.keyid;
+  return false;
+}
+
+// Signatures of one object checked concurrently, shared by the threads which check them
+class ConcurrentSignatureCheck {
+ public:
+  ConcurrentSignatureCheck(std::vector<SignatureToCheck> signatures, std::string canonical, int64_t threshold)
+      : signatures_(std::move(signatures)), canonical_(std::move(canonical)), threshold_(threshold) {}
+
+  // Checks signatures until none is left or the result is known
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!decided() && next_ < signatures_.size()) {
+      const SignatureToCheck &sig = signatures_[next_++];
+      lock.unlock();
+      bool valid = false;
+      std::exception_ptr error;
+      try {
+        valid = checkSignature(sig, canonical_);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      ++finished_;
+      valid_ += valid ? 1 : 0;
+      if (error && !error_) {
+        error_ = error;
+      }
+      cv_.notify_all();
+    }
+  }
+
+  // Number of valid signatures, which may be short of the total if the threshold can't be met anyway
+  int64_t wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return decided() || finished_ == signatures_.size(); });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return valid_;
+  }
+
+ private:
+  // with mutex_ held
+  bool decided() const {
+    return error_ || valid_ >= threshold_ ||
+           valid_ + static_cast<int64_t>(signatures_.size() - finished_) < threshold_;
+  }
+
+  const std::vector<SignatureToCheck> signatures_;
+  const std::string canonical_;
+  const int64_t threshold_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t next_{0};
+  size_t finished_{0};
+  int64_t valid_{0};
+  std::exception_ptr error_;
+};
+
+}  // namespace
+
 void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const Json::Value &signed_object) {
+  // the canonical form is only needed when the signatures are checked
+  const std::string canonical =
+      (policy_ == Policy::kCheck) ? Json::FastWriter().write(signed_object["signed"]) : std::string();
+  UnpackSignedObject(repo, signed_object["signed"]["_type"].asString(), canonical, signed_object["signatures"]);
+}
+
+void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const std::string &type, const std::string &canonical,
+                                      const Json::Value &signatures) {
   const std::string repository = RepoString(repo);
 
-  const Uptane::Role role(signed_object["signed"]["_type"].asString());
+  const Uptane::Role role(type);
   if (policy_ == Policy::kAcceptAll) {
     return;
   }
@@ -85,10 +174,7 @@ void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const Json::Val
   }
   assert(policy_ == Policy::kCheck);
 
-  const std::string canonical = Json::FastWriter().write(signed_object["signed"]);
-  const Json::Value signatures = signed_object["signatures"];
-  int valid_signatures = 0;
-
+  std::vector<SignatureToCheck> to_check;
   std::set<std::string> used_keyids;
   for (Json::ValueIterator sig = signatures.begin(); sig != signatures.end(); ++sig) {
     const std::string keyid = (*sig)["keyid"].asString();
@@ -113,17 +199,28 @@ void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const Json::Val
       LOG_WARNING << "KeyId " << keyid << " is not valid to sign for this role (" << role.ToString() << ").";
       continue;
     }
-    const std::string signature = (*sig)["sig"].asString();
-    if (keys_[keyid].VerifySignature(signature, canonical)) {
-      valid_signatures++;
-    } else {
-      LOG_WARNING << "Signature was present but invalid: " << signature << " with KeyId: " << keyid;
-    }
+    to_check.push_back({keyid, keys_[keyid], (*sig)["sig"].asString()});
   }
   const int64_t threshold = thresholds_for_role_[role];
   if (threshold < kMinSignatures || kMaxSignatures < threshold) {
     throw IllegalThreshold(repository, "Invalid signature threshold");
   }
+
+  int64_t valid_signatures = 0;
+  if (pool_ == nullptr || to_check.size() < 2) {
+    for (const auto &sig : to_check) {
+      valid_signatures += checkSignature(sig, canonical) ? 1 : 0;
+    }
+  } else {
+    // the calling thread checks signatures too
+    const size_t helpers = std::min(pool_->size(), to_check.size() - 1);
+    auto check = std::make_shared<ConcurrentSignatureCheck>(std::move(to_check), canonical, threshold);
+    for (size_t i = 0; i < helpers; ++i) {
+      pool_->post([check]() { check->work(); });
+    }
+    check->work();
+    valid_signatures = check->wait();
+  }
   // One signature and it is bad: throw bad key ID.
   // Multiple signatures but not enough good ones to pass threshold: throw unmet threshold.
   if (signatures.size() == 1 && valid_signatures == 0) {
@@ -133,7 +230,7 @@ void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const Json::Val
     throw UnmetThreshold(repository, role.ToString());
   }
 
-  const Uptane::Role actual_role(Uptane::Role(signed_object["signed"]["_type"].asString()));
+  const Uptane::Role actual_role(type);
   if (role != actual_role) {
     LOG_ERROR << "Object was signed for a different role";
     LOG_TRACE << "  role:" << role;
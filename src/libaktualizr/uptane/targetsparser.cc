@@ -0,0 +1,337 @@
+#include "uptane/targetsparser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+
+#include "crypto/crypto.h"
+#include "utilities/utils.h"
+
+namespace Uptane {
+
+struct TargetsParser::Member {
+  std::string name;
+  const char *begin;
+  const char *end;
+};
+
+// Finds the members of objects and the extent of values, which are then parsed one at a time with Json::Reader
+class TargetsParser::Scanner {
+ public:
+  Scanner(const char *begin, const char *end) : pos_(begin), end_(end) {}
+
+  // Members of the object at the current position, sorted by name. Duplicate names are refused.
+  bool object(std::vector<Member> *members) {
+    skipSpaces();
+    if (!consume('{')) {
+      return false;
+    }
+    skipSpaces();
+    if (!consume('}')) {
+      for (;;) {
+        Member member;
+        skipSpaces();
+        if (!name(&member.name)) {
+          return false;
+        }
+        skipSpaces();
+        if (!consume(':') || !value(&member.begin, &member.end)) {
+          return false;
+        }
+        members->push_back(std::move(member));
+        skipSpaces();
+        if (consume('}')) {
+          break;
+        }
+        if (!consume(',')) {
+          return false;
+        }
+      }
+    }
+    std::sort(members->begin(), members->end(), [](const Member &l, const Member &r) { return l.name < r.name; });
+    return std::adjacent_find(members->cbegin(), members->cend(), [](const Member &l, const Member &r) {
+             return l.name == r.name;
+           }) == members->cend();
+  }
+
+  bool value(const char **begin, const char **end) {
+    skipSpaces();
+    if (pos_ == end_) {
+      return false;
+    }
+    *begin = pos_;
+    const char c = *pos_;
+    bool ok = true;
+    if (c == '"') {
+      ok = string();
+    } else if (c == '{' || c == '[') {
+      ok = nested();
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+      while (pos_ != end_ && ((*pos_ >= '0' && *pos_ <= '9') || std::strchr(".eE+-", *pos_) != nullptr)) {
+        ++pos_;
+      }
+    } else {
+      ok = literal("true") || literal("false") || literal("null");
+    }
+    *end = pos_;
+    return ok;
+  }
+
+  bool atEnd() {
+    skipSpaces();
+    return pos_ == end_;
+  }
+
+ private:
+  void skipSpaces() {
+    while (pos_ != end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\r' || *pos_ == '\n')) {
+      ++pos_;
+    }
+  }
+
+  bool consume(char c) {
+    if (pos_ != end_ && *pos_ == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool literal(const char *text) {
+    const size_t size = std::strlen(text);
+    if (static_cast<size_t>(end_ - pos_) < size || std::strncmp(pos_, text, size) != 0) {
+      return false;
+    }
+    pos_ += size;
+    return true;
+  }
+
+  bool string() {
+    if (!consume('"')) {
+      return false;
+    }
+    while (pos_ != end_) {
+      const char c = *pos_++;
+      if (c == '\\') {
+        if (pos_ == end_) {
+          return false;
+        }
+        ++pos_;
+      } else if (c == '"') {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Objects and arrays, only checked well enough to find their end. Comments are refused.
+  bool nested() {
+    size_t depth = 0;
+    while (pos_ != end_) {
+      const char c = *pos_;
+      if (c == '"') {
+        if (!string()) {
+          return false;
+        }
+        continue;
+      }
+      ++pos_;
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          return true;
+        }
+      } else if (c == '/') {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  bool name(std::string *decoded) {
+    const char *begin = pos_;
+    if (!string()) {
+      return false;
+    }
+    if (std::find(begin + 1, pos_ - 1, '\\') == pos_ - 1) {
+      decoded->assign(begin + 1, pos_ - 1);
+    } else {
+      Json::Value parsed;
+      if (!Json::Reader().parse(begin, pos_, parsed)) {
+        return false;
+      }
+      *decoded = parsed.asString();
+    }
+    // Json::Value cuts names at the first null character
+    return decoded->find('\0') == std::string::npos;
+  }
+
+  const char *pos_;
+  const char *end_;
+};
+
+static bool parseValue(const char *begin, const char *end, Json::Value *value) {
+  return Json::Reader().parse(begin, end, *value);
+}
+
+static void writeMember(const std::string &name, const std::string &canonical_value, std::string *out) {
+  *out += Json::valueToQuotedString(name.c_str());
+  *out += ':';
+  *out += canonical_value;
+}
+
+bool TargetsParser::parse(const std::string &raw, const Filter &keep) {
+  signed_canonical_.clear();
+  prefix_ = "{";
+  suffix_.clear();
+  signatures_ = Json::Value();
+  header_ = Json::Value(Json::objectValue);
+  targets_.clear();
+  targets_read_ = 0;
+
+  Scanner scanner(raw.data(), raw.data() + raw.size());
+  std::vector<Member> members;
+  if (!scanner.object(&members) || !scanner.atEnd()) {
+    return false;
+  }
+  Json::FastWriter writer;
+  bool signed_found = false;
+  for (const auto &member : members) {
+    if (member.name == "signed") {
+      if (!parseSigned(member, keep)) {
+        return false;
+      }
+      prefix_ += "\"signed\":";
+      signed_found = true;
+      continue;
+    }
+    Json::Value value;
+    if (!parseValue(member.begin, member.end, &value)) {
+      return false;
+    }
+    if (member.name == "signatures") {
+      signatures_ = value;
+    }
+    if (signed_found) {
+      suffix_ += ',';
+      writeMember(member.name, writer.write(value), &suffix_);
+    } else {
+      writeMember(member.name, writer.write(value), &prefix_);
+      prefix_ += ',';
+    }
+  }
+  suffix_ += '}';
+  return signed_found;
+}
+
+bool TargetsParser::parseSigned(const Member &signed_part, const Filter &keep) {
+  Scanner scanner(signed_part.begin, signed_part.end);
+  std::vector<Member> members;
+  if (!scanner.object(&members)) {
+    return false;
+  }
+  Json::FastWriter writer;
+  bool targets_found = false;
+  signed_canonical_.reserve(static_cast<size_t>(signed_part.end - signed_part.begin));
+  signed_canonical_ += '{';
+  for (size_t i = 0; i < members.size(); ++i) {
+    if (i > 0) {
+      signed_canonical_ += ',';
+    }
+    if (members[i].name == "targets") {
+      writeMember(members[i].name, std::string(), &signed_canonical_);
+      if (!parseTargets(members[i], keep, writer)) {
+        return false;
+      }
+      targets_found = true;
+      continue;
+    }
+    Json::Value value;
+    if (!parseValue(members[i].begin, members[i].end, &value)) {
+      return false;
+    }
+    writeMember(members[i].name, writer.write(value), &signed_canonical_);
+    header_[members[i].name] = value;
+  }
+  signed_canonical_ += '}';
+  return targets_found;
+}
+
+bool TargetsParser::parseTargets(const Member &targets, const Filter &keep, Json::FastWriter &writer) {
+  Scanner scanner(targets.begin, targets.end);
+  std::vector<Member> members;
+  if (!scanner.object(&members)) {
+    return false;
+  }
+  signed_canonical_ += '{';
+  for (size_t i = 0; i < members.size(); ++i) {
+    Json::Value content;
+    if (!parseValue(members[i].begin, members[i].end, &content)) {
+      return false;
+    }
+    if (i > 0) {
+      signed_canonical_ += ',';
+    }
+    writeMember(members[i].name, writer.write(content), &signed_canonical_);
+    ++targets_read_;
+    try {
+      Target target(members[i].name, content);
+      if (!keep || keep(target)) {
+        targets_.push_back(std::move(target));
+      }
+    } catch (const std::exception &) {
+      // leave malformed targets to the usual parser, which checks the signatures first
+      return false;
+    }
+  }
+  signed_canonical_ += '}';
+  return true;
+}
+
+bool TargetsParser::readVersion(const std::string &raw, int *version) {
+  Scanner scanner(raw.data(), raw.data() + raw.size());
+  std::vector<Member> members;
+  if (!scanner.object(&members) || !scanner.atEnd()) {
+    return false;
+  }
+  Json::Value version_json;
+  for (const auto &member : members) {
+    if (member.name != "signed") {
+      continue;
+    }
+    Scanner signed_scanner(member.begin, member.end);
+    std::vector<Member> signed_members;
+    if (!signed_scanner.object(&signed_members)) {
+      return false;
+    }
+    for (const auto &signed_member : signed_members) {
+      if (signed_member.name == "version" && !parseValue(signed_member.begin, signed_member.end, &version_json)) {
+        return false;
+      }
+    }
+  }
+  *version = version_json.isIntegral() ? version_json.asInt() : -1;
+  return true;
+}
+
+std::string TargetsParser::documentDigest(Hash::Type type) const {
+  std::unique_ptr<MultiPartHasher> hasher;
+  switch (type) {
+    case Hash::Type::kSha256:
+      hasher = std_::make_unique<MultiPartSHA256Hasher>();
+      break;
+    case Hash::Type::kSha512:
+      hasher = std_::make_unique<MultiPartSHA512Hasher>();
+      break;
+    default:
+      return std::string();
+  }
+  for (const std::string *part : {&prefix_, &signed_canonical_, &suffix_}) {
+    hasher->update(reinterpret_cast<const unsigned char *>(part->data()), part->size());
+  }
+  return hasher->getHexDigest();
+}
+
+}  // namespace Uptane
@@ -0,0 +1,67 @@
+#ifndef UPTANE_TARGETSPARSER_H_
+#define UPTANE_TARGETSPARSER_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "uptane/tuf.h"
+
+namespace Uptane {
+
+/**
+ * Reads targets metadata without building a JSON tree of the whole document.
+ * The targets are parsed one at a time, written out in canonical form for the
+ * signature and hash checks, and only kept when the filter accepts them, so
+ * that peak memory stays around twice the size of the raw metadata plus the
+ * kept targets, whatever the number of targets.
+ *
+ * Documents which can't be read exactly as Json::Reader reads them, for
+ * example with comments, duplicate names or syntax errors, are refused and
+ * should be parsed as a whole instead.
+ */
+class TargetsParser {
+ public:
+  using Filter = std::function<bool(const Target &)>;
+
+  // An empty filter keeps all targets. Return false if the document is refused.
+  bool parse(const std::string &raw, const Filter &keep = Filter());
+
+  // Canonical form of the signed part, as used for signatures
+  const std::string &signedCanonical() const { return signed_canonical_; }
+  const Json::Value &signatures() const { return signatures_; }
+  // The signed part without its targets
+  const Json::Value &signedHeader() const { return header_; }
+  // The kept targets, ordered by filename like in a parsed document
+  std::vector<Target> &targets() { return targets_; }
+  size_t targetsRead() const { return targets_read_; }
+
+  // Hex digest of the canonical form of the whole document, kUnknownAlgorithm gives an empty string
+  std::string documentDigest(Hash::Type type) const;
+
+  // Read the version of any metadata like extractVersionUntrusted() does, without parsing the whole document.
+  // Return false if the document is refused.
+  static bool readVersion(const std::string &raw, int *version);
+
+ private:
+  struct Member;
+  class Scanner;
+
+  bool parseSigned(const Member &signed_part, const Filter &keep);
+  bool parseTargets(const Member &targets, const Filter &keep, Json::FastWriter &writer);
+
+  std::string signed_canonical_;
+  // canonical form of the whole document around the signed part
+  std::string prefix_;
+  std::string suffix_;
+  Json::Value signatures_;
+  Json::Value header_;
+  std::vector<Target> targets_;
+  size_t targets_read_{0};
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_TARGETSPARSER_H_
@@ -0,0 +1,229 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/hex.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "uptane/exceptions.h"
+#include "uptane/targetsparser.h"
+#include "uptane/tuf.h"
+#include "utilities/utils.h"
+
+// Bytes held through operator new and their peak, to compare the memory used by the parsers
+static std::atomic<int64_t> allocated{0};
+static std::atomic<int64_t> peak_allocated{0};
+
+void *operator new(size_t size) {
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  const int64_t now = allocated += static_cast<int64_t>(malloc_usable_size(p));
+  int64_t peak = peak_allocated;
+  while (now > peak && !peak_allocated.compare_exchange_weak(peak, now)) {
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p != nullptr) {
+    allocated -= static_cast<int64_t>(malloc_usable_size(p));
+    std::free(p);
+  }
+}
+
+// Peak of the bytes allocated while running f, above those held before
+template <class F>
+int64_t peakAllocation(F f) {
+  const int64_t before = allocated;
+  peak_allocated = before;
+  f();
+  return peak_allocated - before;
+}
+
+// Parse like TargetsParser and like the usual parser, and compare the results
+void expectSameAsDom(const std::string &raw) {
+  const Json::Value json = Utils::parseJSON(raw);
+  Uptane::TargetsParser parsed;
+  ASSERT_TRUE(parsed.parse(raw)) << raw;
+  EXPECT_EQ(parsed.signedCanonical(), Utils::jsonToCanonicalStr(json["signed"]));
+  EXPECT_EQ(parsed.documentDigest(Uptane::Hash::Type::kSha256),
+            boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(json))));
+  EXPECT_EQ(parsed.documentDigest(Uptane::Hash::Type::kSha512),
+            boost::algorithm::hex(Crypto::sha512digest(Utils::jsonToCanonicalStr(json))));
+  EXPECT_EQ(parsed.signatures(), json["signatures"]);
+  EXPECT_EQ(parsed.targetsRead(), json["signed"]["targets"].size());
+  int version = 0;
+  EXPECT_TRUE(Uptane::TargetsParser::readVersion(raw, &version));
+  EXPECT_EQ(version, json["signed"]["version"].asInt());
+  EXPECT_EQ(Uptane::Targets(parsed), Uptane::Targets(json));
+}
+
+TEST(TargetsParser, SameAsDom) {
+  for (const std::string path : {"tests/test_data/repo/repo/image/targets_hasupdates.json",
+                                 "tests/test_data/repo/repo/director/targets_multisec.json",
+                                 "tests/test_data/prov/metadata/repo/targets.json", "tests/tuf/sample1/targets.json"}) {
+    expectSameAsDom(Utils::readFile(path));
+  }
+  // unsorted names, spaces, escapes, unicode, control characters and other metadata around
+  expectSameAsDom(
+      " {\n\t\"z\": [1, -0, 2.50, 1e3, \"\\u00e9\\ud83d\\ude00\"], \"signed\" : {\"version\": 2, \"targets\": {"
+      "\"b\\/\\\"c\\\"\": {\"length\": 10, \"hashes\": {\"sha256\": \"AB\"}, \"custom\": {\"ecuIdentifiers\": "
+      "{\"ecu\": {\"hardwareId\": \"hw\"}}}}, \"a\tb\": {\"length\": 20, \"hashes\": {\"sha512\": \"cd\"}}, "
+      "\"\": {\"length\": 0, \"hashes\": {\"sha256\": \"ef\"}}}, \"_type\": \"Targets\", "
+      "\"expires\": \"2038-01-19T03:14:06Z\", \"custom\": null},"
+      "\"signatures\": [{\"keyid\": \"k\", \"method\": \"ed25519\", \"sig\": \"s\"}], \"a\": true}\r\n");
+  expectSameAsDom(
+      "{\"signed\":{\"_type\":\"Targets\",\"expires\":\"2038-01-19T03:14:06Z\",\"targets\":{},\"version\":1},"
+      "\"signatures\":[]}");
+}
+
+TEST(TargetsParser, Refused) {
+  Uptane::TargetsParser parsed;
+  const std::string valid =
+      "{\"signed\":{\"_type\":\"Targets\",\"targets\":{\"a\":{\"length\":1}},\"version\":1},\"signatures\":[]}";
+  EXPECT_TRUE(parsed.parse(valid));
+  // comments, duplicate names, trailing content, syntax errors and missing parts
+  EXPECT_FALSE(parsed.parse("// comment\n" + valid));
+  EXPECT_FALSE(parsed.parse(
+      "{\"signed\":{\"_type\":\"Targets\",\"targets\":{\"a\":{\"length\":1 /* one */}},\"version\":1}}"));
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"targets\":{\"a\":{\"length\":1},\"a\":{\"length\":2}}}}"));
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"targets\":{}},\"signed\":{\"targets\":{}}}"));
+  EXPECT_FALSE(parsed.parse(valid + "x"));
+  EXPECT_FALSE(parsed.parse(valid.substr(0, valid.size() - 2)));
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"targets\":{\"a\":{\"length\":1,}}}}"));
+  const char null_in_name[] = "{\"signed\":{\"targets\":{\"a\0b\":{}}}}";
+  EXPECT_FALSE(parsed.parse(std::string(null_in_name, sizeof(null_in_name) - 1)));
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"targets\":[]}}"));
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"version\":1}}"));
+  EXPECT_FALSE(parsed.parse("{\"signatures\":[]}"));
+  EXPECT_FALSE(parsed.parse("[]"));
+  EXPECT_FALSE(parsed.parse(""));
+  // a target which can't be read
+  EXPECT_FALSE(parsed.parse("{\"signed\":{\"targets\":{\"a\":{\"length\":\"one\"}}}}"));
+
+  // the version is read from anything readable
+  int version = 0;
+  EXPECT_TRUE(Uptane::TargetsParser::readVersion("{\"signed\":{\"version\":\"1\"}}", &version));
+  EXPECT_EQ(version, -1);
+  EXPECT_FALSE(Uptane::TargetsParser::readVersion("{\"signed\":{\"version\":1} // comment\n}", &version));
+  EXPECT_EQ(Uptane::extractVersionUntrusted("{\"signed\":{\"version\":1} // comment\n}"), 1);
+}
+
+TEST(TargetsParser, Filter) {
+  const std::string raw = Utils::readFile("tests/test_data/repo/repo/image/targets_hasupdates.json");
+  Uptane::TargetsParser parsed;
+  ASSERT_TRUE(
+      parsed.parse(raw, [](const Uptane::Target &target) { return target.filename() == "secondary_firmware.txt"; }));
+  EXPECT_EQ(parsed.targetsRead(), 2u);
+  ASSERT_EQ(parsed.targets().size(), 1u);
+  EXPECT_EQ(parsed.targets()[0].filename(), "secondary_firmware.txt");
+  // the signatures cover all targets
+  EXPECT_EQ(parsed.signedCanonical(), Utils::jsonToCanonicalStr(Utils::parseJSON(raw)["signed"]));
+}
+
+TEST(TargetsParser, Signatures) {
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  Uptane::Root root(Uptane::RepositoryType::Images,
+                    Utils::parseJSONFile("tests/test_data/repo/repo/image/root.json"), accept_all);
+  const std::string raw = Utils::readFile("tests/test_data/repo/repo/image/targets_hasupdates.json");
+  Uptane::TargetsParser parsed;
+  ASSERT_TRUE(parsed.parse(raw));
+  const Uptane::Targets targets(Uptane::RepositoryType::Images, parsed, root);
+  EXPECT_EQ(targets.version(), 3);
+  ASSERT_NE(targets.findByFilename("primary_firmware.txt"), nullptr);
+
+  std::string tampered = raw;
+  tampered.replace(tampered.find("\"length\":59"), 11, "\"length\":60");
+  ASSERT_TRUE(parsed.parse(tampered));
+  EXPECT_THROW(Uptane::Targets(Uptane::RepositoryType::Images, parsed, root), Uptane::BadKeyId);
+}
+
+// Targets metadata with count targets, whose lengths are 0 to count - 1
+static std::string manyTargets(size_t count) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  for (size_t i = 0; i < count; ++i) {
+    const std::string n = std::to_string(i);
+    Json::Value target;
+    target["length"] = static_cast<Json::Int64>(i);
+    target["hashes"]["sha256"] = boost::algorithm::hex(Crypto::sha256digest(n));
+    target["custom"]["ecuIdentifiers"]["ecu" + n]["hardwareId"] = "hw" + n;
+    target["custom"]["targetFormat"] = "BINARY";
+    json["signed"]["targets"]["target" + n] = target;
+  }
+  return Utils::jsonToCanonicalStr(json);
+}
+
+/*
+ * Metadata with many targets is read in full while only the filtered targets
+ * are kept.
+ */
+TEST(TargetsParser, ManyTargets) {
+  const size_t count = 1000;
+  const std::string raw = manyTargets(count);
+  const Json::Value parsed_json = Utils::parseJSON(raw);
+
+  Uptane::TargetsParser parsed;
+  ASSERT_TRUE(parsed.parse(raw, [](const Uptane::Target &target) { return target.length() % 100 == 0; }));
+  EXPECT_EQ(parsed.documentDigest(Uptane::Hash::Type::kSha256),
+            boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(parsed_json))));
+  EXPECT_EQ(parsed.targetsRead(), count);
+  EXPECT_EQ(Uptane::Targets(parsed).targets.size(), 10u);
+  EXPECT_EQ(Uptane::Targets(parsed_json).targets.size(), count);
+}
+
+/*
+ * Time and peak memory to read targets metadata with 50000 targets, as a
+ * whole and with TargetsParser keeping 10 targets. Run it with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(TargetsParser, DISABLED_Benchmark) {
+  const size_t count = 50000;
+  const std::string raw = manyTargets(count);
+
+  std::string dom_digest;
+  auto start = std::chrono::steady_clock::now();
+  const int64_t dom_peak = peakAllocation([&raw, &dom_digest, count]() {
+    const Json::Value parsed_json = Utils::parseJSON(raw);
+    dom_digest = boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(parsed_json)));
+    const Uptane::Targets targets(parsed_json);
+    EXPECT_EQ(targets.targets.size(), count);
+  });
+  auto dom_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  const int64_t streamed_peak = peakAllocation([&raw, &dom_digest, count]() {
+    Uptane::TargetsParser parsed;
+    ASSERT_TRUE(parsed.parse(raw, [](const Uptane::Target &target) { return target.length() % 5000 == 0; }));
+    EXPECT_EQ(parsed.documentDigest(Uptane::Hash::Type::kSha256), dom_digest);
+    EXPECT_EQ(parsed.targetsRead(), count);
+    const Uptane::Targets targets(parsed);
+    EXPECT_EQ(targets.targets.size(), 10u);
+  });
+  auto streamed_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Reading " << count << " targets (" << raw.size() / 1024 << " KiB): "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(dom_time).count() << "ms and "
+            << dom_peak / 1024 << " KiB at most as a whole, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(streamed_time).count() << "ms and "
+            << streamed_peak / 1024 << " KiB at most one target at a time\n";
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
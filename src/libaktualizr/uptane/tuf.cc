@@ -10,6 +10,7 @@
 
 #include "crypto/crypto.h"
 #include "logging/logging.h"
+#include "uptane/targetsparser.h"
 #include "utilities/exceptions.h"
 
 using Uptane::Hash;
@@ -228,6 +229,91 @@ void Uptane::Targets::init(const Json::Value &json) {
     Target t(t_it.key().asString(), *t_it);
     targets.push_back(t);
   }
+  reindex();
+}
+
+void Uptane::Targets::reindex() {
+  by_filename_.clear();
+  by_sha256_.clear();
+  by_ecu_.clear();
+  by_filename_.reserve(targets.size());
+  by_sha256_.reserve(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    const Target &target = targets[i];
+    by_filename_.emplace(target.filename(), i);
+    std::string sha256 = target.sha256Hash();
+    if (!sha256.empty()) {
+      by_sha256_.emplace(sha256, i);
+    }
+    for (const auto &ecu : target.ecus()) {
+      by_ecu_.emplace(ecu.first.ToString(), i);
+    }
+  }
+  indexed_size_ = targets.size();
+}
+
+const Uptane::Target *Uptane::Targets::findTarget(const Target &target) const {
+  const Target *found = findByFilename(target.filename());
+  if (found != nullptr && *found == target) {
+    return found;
+  }
+  return nullptr;
+}
+
+const Uptane::Target *Uptane::Targets::findByFilename(const std::string &filename) const {
+  if (indexed()) {
+    auto it = by_filename_.find(filename);
+    if (it == by_filename_.end()) {
+      return nullptr;
+    }
+    if (targets[it->second].filename() == filename) {
+      return &targets[it->second];
+    }
+  }
+  auto it = std::find_if(targets.cbegin(), targets.cend(),
+                         [&filename](const Target &target) { return target.filename() == filename; });
+  return (it == targets.cend()) ? nullptr : &*it;
+}
+
+std::vector<const Uptane::Target *> Uptane::Targets::findBySha256(const std::string &sha256) const {
+  const std::string key = boost::algorithm::to_lower_copy(sha256);
+  return lookup(by_sha256_, key, [&key](const Target &target) { return target.sha256Hash() == key; });
+}
+
+std::vector<const Uptane::Target *> Uptane::Targets::targetsForEcu(const EcuSerial &ecu) const {
+  return lookup(by_ecu_, ecu.ToString(), [&ecu](const Target &target) { return target.IsForSecondary(ecu); });
+}
+
+std::vector<const Uptane::Target *> Uptane::Targets::lookup(const std::unordered_multimap<std::string, size_t> &index,
+                                                            const std::string &key,
+                                                            const std::function<bool(const Target &)> &matches) const {
+  std::vector<const Target *> found;
+  if (indexed()) {
+    std::vector<size_t> positions;
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      positions.push_back(it->second);
+    }
+    std::sort(positions.begin(), positions.end());
+    bool stale = false;
+    for (size_t pos : positions) {
+      if (!matches(targets[pos])) {
+        stale = true;
+        break;
+      }
+      found.push_back(&targets[pos]);
+    }
+    if (!stale) {
+      return found;
+    }
+    found.clear();
+  }
+  for (const auto &target : targets) {
+    if (matches(target)) {
+      found.push_back(&target);
+    }
+  }
+  return found;
 }
 
 Uptane::Targets::Targets(const Json::Value &json) : BaseMeta(json) { init(json); }
@@ -236,6 +322,25 @@ Uptane::Targets::Targets(RepositoryType repo, const Json::Value &json, Root &roo
   init(json);
 }
 
+void Uptane::Targets::init(TargetsParser &parsed) {
+  const Json::Value &header = parsed.signedHeader();
+  version_ = header["version"].asInt();
+  expiry_ = Uptane::TimeStamp(header["expires"].asString());
+  if (header["_type"] != "Targets") {
+    throw Uptane::InvalidMetadata("", "targets", "invalid targets.json");
+  }
+  targets = std::move(parsed.targets());
+  reindex();
+}
+
+Uptane::Targets::Targets(TargetsParser &parsed) { init(parsed); }
+
+Uptane::Targets::Targets(RepositoryType repo, TargetsParser &parsed, Root &root) {
+  root.UnpackSignedObject(repo, parsed.signedHeader()["_type"].asString(), parsed.signedCanonical(),
+                          parsed.signatures());
+  init(parsed);
+}
+
 void Uptane::TimestampMeta::init(const Json::Value &json) {
   Json::Value hashes_list = json["signed"]["meta"]["snapshot.json"]["hashes"];
   Json::Value meta_size = json["signed"]["meta"]["snapshot.json"]["length"];
@@ -319,6 +424,10 @@ std::string Uptane::RepoString(RepositoryType repo) {
 }
 
 int Uptane::extractVersionUntrusted(const std::string &meta) {
+  int version;
+  if (TargetsParser::readVersion(meta, &version)) {
+    return version;
+  }
   auto version_json = Utils::parseJSON(meta)["signed"]["version"];
   if (!version_json.isIntegral()) {
     return -1;
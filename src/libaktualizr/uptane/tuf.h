@@ -6,11 +6,14 @@
  */
 
 #include <functional>
+#include <memory>
 #include <ostream>
 #include <set>
+#include <unordered_map>
 #include "uptane/exceptions.h"
 
 #include "crypto/crypto.h"
+#include "utilities/workerpool.h"
 
 namespace Uptane {
 
@@ -233,6 +236,7 @@ class Target {
 
   Json::Value toDebugJson() const;
   friend std::ostream &operator<<(std::ostream &os, const Target &t);
+  friend class VerifiedMeta;
 
  private:
   std::string filename_;
@@ -246,6 +250,8 @@ std::ostream &operator<<(std::ostream &os, const Target &t);
 
 /* Metadata objects */
 class Root;
+class TargetsParser;
+class VerifiedMeta;
 class BaseMeta {
  public:
   BaseMeta() = default;
@@ -257,6 +263,7 @@ class BaseMeta {
   Json::Value original() const { return original_object_; }
 
   bool operator==(const BaseMeta &rhs) const { return version_ == rhs.version() && expiry_ == rhs.expiry(); }
+  friend class VerifiedMeta;
 
  protected:
   int version_ = {-1};
@@ -297,11 +304,25 @@ class Root : public BaseMeta {
    * @return
    */
   void UnpackSignedObject(RepositoryType repo, const Json::Value &signed_object);
+  /**
+   * The same checks for metadata which was not parsed as a whole, given the
+   * "_type", the canonical form of the signed part and the signatures.
+   */
+  void UnpackSignedObject(RepositoryType repo, const std::string &type, const std::string &canonical,
+                          const Json::Value &signatures);
+  /**
+   * Check the signatures of a role concurrently on the given pool, and stop as
+   * soon as the threshold is met or can't be met anymore. The calling thread
+   * takes part in the checks. A Root created from this one keeps the pool.
+   * Without a pool, the signatures are checked one after the other.
+   */
+  void setVerificationPool(std::shared_ptr<WorkerPool> pool) { pool_ = std::move(pool); }
   bool operator==(const Root &rhs) const {
     return version_ == rhs.version_ && expiry_ == rhs.expiry_ && keys_ == rhs.keys_ &&
            keys_for_role_ == rhs.keys_for_role_ && thresholds_for_role_ == rhs.thresholds_for_role_ &&
            policy_ == rhs.policy_;
   }
+  friend class VerifiedMeta;
 
  private:
   static const int64_t kMinSignatures = 1;
@@ -311,12 +332,16 @@ class Root : public BaseMeta {
   std::map<KeyId, PublicKey> keys_;
   std::set<std::pair<Role, KeyId> > keys_for_role_;
   std::map<Role, int64_t> thresholds_for_role_;
+  std::shared_ptr<WorkerPool> pool_;
 };
 
 class Targets : public BaseMeta {
  public:
   explicit Targets(const Json::Value &json);
   Targets(RepositoryType repo, const Json::Value &json, Root &root);
+  // From metadata read by a TargetsParser, its kept targets are moved here
+  explicit Targets(TargetsParser &parsed);
+  Targets(RepositoryType repo, TargetsParser &parsed, Root &root);
   Targets() = default;
 
   std::vector<Uptane::Target> targets;
@@ -324,8 +349,31 @@ class Targets : public BaseMeta {
     return version_ == rhs.version() && expiry_ == rhs.expiry() && targets == rhs.targets;
   }
 
+  /**
+   * Lookups through indexes of targets, which are built when the metadata is
+   * parsed. Call reindex() after changing targets, until then the lookups which
+   * notice the change scan the whole list.
+   */
+  const Target *findTarget(const Target &target) const;
+  const Target *findByFilename(const std::string &filename) const;
+  // In the order of the metadata
+  std::vector<const Target *> findBySha256(const std::string &sha256) const;
+  std::vector<const Target *> targetsForEcu(const EcuSerial &ecu) const;
+  void reindex();
+  friend class VerifiedMeta;
+
  private:
   void init(const Json::Value &json);
+  void init(TargetsParser &parsed);
+  bool indexed() const { return indexed_size_ == targets.size(); }
+  std::vector<const Target *> lookup(const std::unordered_multimap<std::string, size_t> &index, const std::string &key,
+                                     const std::function<bool(const Target &)> &matches) const;
+
+  // positions in targets
+  std::unordered_map<std::string, size_t> by_filename_;
+  std::unordered_multimap<std::string, size_t> by_sha256_;  // lower case
+  std::unordered_multimap<std::string, size_t> by_ecu_;
+  size_t indexed_size_{0};
 };
 
 class TimestampMeta : public BaseMeta {
@@ -336,6 +384,7 @@ class TimestampMeta : public BaseMeta {
   std::vector<Hash> snapshot_hashes() const { return snapshot_hashes_; };
   int64_t snapshot_size() const { return snapshot_size_; };
   int snapshot_version() const { return snapshot_version_; };
+  friend class VerifiedMeta;
 
  private:
   void init(const Json::Value &json);
@@ -357,6 +406,7 @@ class Snapshot : public BaseMeta {
     return version_ == rhs.version() && expiry_ == rhs.expiry() && targets_size_ == rhs.targets_size_ &&
            targets_version_ == rhs.targets_version_ && targets_hashes_ == rhs.targets_hashes_;
   }
+  friend class VerifiedMeta;
 
  private:
   void init(const Json::Value &json);
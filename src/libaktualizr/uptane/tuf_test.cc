@@ -1,11 +1,19 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/hex.hpp>
 #include <json/json.h>
 
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
 #include "uptane/tuf.h"
 #include "utilities/utils.h"
+#include "utilities/workerpool.h"
 
 Uptane::TimeStamp now("2017-01-01T01:00:00Z");
 
@@ -46,6 +54,216 @@ TEST(Root, RootJsonRsassaPssSha256) {
   EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director, initial_root, root));
 }
 
+// A root with the given number of RSA keys for every role, signed by all of them
+Json::Value makeRoot(size_t keys, int64_t threshold, std::vector<std::string>* private_keys) {
+  Json::Value signed_part;
+  signed_part["_type"] = "Root";
+  signed_part["version"] = 1;
+  signed_part["expires"] = "2038-01-19T03:14:06Z";
+  std::vector<std::string> keyids;
+  for (size_t i = 0; i < keys; ++i) {
+    std::string public_key, private_key;
+    EXPECT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+    const PublicKey key(public_key, KeyType::kRSA2048);
+    signed_part["keys"][key.KeyId()] = key.ToUptane();
+    keyids.push_back(key.KeyId());
+    private_keys->push_back(private_key);
+  }
+  for (const std::string role : {"root", "targets", "snapshot", "timestamp"}) {
+    for (const auto& keyid : keyids) {
+      signed_part["roles"][role]["keyids"].append(keyid);
+    }
+    signed_part["roles"][role]["threshold"] = static_cast<Json::Int64>(threshold);
+  }
+
+  Json::Value root;
+  root["signed"] = signed_part;
+  const std::string canonical = Json::FastWriter().write(signed_part);
+  for (size_t i = 0; i < keys; ++i) {
+    Json::Value signature;
+    signature["keyid"] = keyids[i];
+    signature["method"] = "rsassa-pss";
+    signature["sig"] = Utils::toBase64(Crypto::RSAPSSSign(nullptr, (*private_keys)[i], canonical));
+    root["signatures"].append(signature);
+  }
+  return root;
+}
+
+/*
+ * Signatures checked on a pool give the same results and exceptions as when
+ * they are checked one after the other.
+ */
+TEST(Root, ConcurrentVerification) {
+  SignatureCache::global().setCapacity(0);
+  std::vector<std::string> private_keys;
+  const Json::Value json = makeRoot(6, 4, &private_keys);
+  auto pool = std::make_shared<WorkerPool>(4);
+
+  for (bool concurrent : {false, true}) {
+    Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+    accept_all.setVerificationPool(concurrent ? pool : nullptr);
+    Uptane::Root root(Uptane::RepositoryType::Director, json, accept_all);
+    EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director, json, root));
+
+    // three bad signatures out of six, with a threshold of four
+    Json::Value bad = json;
+    for (Json::ArrayIndex i = 0; i < 3; ++i) {
+      bad["signatures"][i]["sig"] = json["signatures"][i + 3]["sig"];
+    }
+    EXPECT_THROW(root.UnpackSignedObject(Uptane::RepositoryType::Director, bad), Uptane::UnmetThreshold);
+    // two bad ones are fine
+    bad["signatures"][2] = json["signatures"][2];
+    EXPECT_NO_THROW(root.UnpackSignedObject(Uptane::RepositoryType::Director, bad));
+
+    Json::Value duplicate = json;
+    duplicate["signatures"].append(json["signatures"][0]);
+    EXPECT_THROW(root.UnpackSignedObject(Uptane::RepositoryType::Director, duplicate), Uptane::NonUniqueSignatures);
+  }
+  SignatureCache::global().setCapacity(SignatureCache::kDefaultCapacity);
+}
+
+/*
+ * Time to check a root signed by eight keys, one signature after the other and
+ * on a pool, with a threshold of eight and of three. Root.ConcurrentVerification
+ * checks the results; this only reports timings, so it is disabled by default.
+ * Run it with --gtest_also_run_disabled_tests.
+ */
+TEST(Root, DISABLED_ConcurrentVerificationBenchmark) {
+  SignatureCache::global().setCapacity(0);
+  const int iterations = 20;
+  auto pool = std::make_shared<WorkerPool>(4);
+
+  for (int64_t threshold : {8, 3}) {
+    std::vector<std::string> private_keys;
+    const Json::Value json = makeRoot(8, threshold, &private_keys);
+    Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+    Uptane::Root root(Uptane::RepositoryType::Director, json, accept_all);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      root.UnpackSignedObject(Uptane::RepositoryType::Director, json);
+    }
+    auto sequential = std::chrono::steady_clock::now() - start;
+
+    root.setVerificationPool(pool);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      root.UnpackSignedObject(Uptane::RepositoryType::Director, json);
+    }
+    auto concurrent = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Checking 8 signatures with a threshold of " << threshold << ": "
+              << std::chrono::duration_cast<std::chrono::microseconds>(sequential).count() / iterations
+              << "us one after the other, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(concurrent).count() / iterations
+              << "us with a pool of 4 threads\n";
+  }
+  SignatureCache::global().setCapacity(SignatureCache::kDefaultCapacity);
+}
+
+// Targets metadata with the given number of targets, each one for its own ECU
+Json::Value makeTargets(size_t count) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  for (size_t i = 0; i < count; ++i) {
+    const std::string n = std::to_string(i);
+    Json::Value target;
+    target["length"] = static_cast<Json::Int64>(i);
+    target["hashes"]["sha256"] = boost::algorithm::hex(Crypto::sha256digest(n));
+    target["custom"]["ecuIdentifiers"]["ecu" + n]["hardwareId"] = "hw" + n;
+    json["signed"]["targets"]["target" + n] = target;
+  }
+  return json;
+}
+
+TEST(Targets, Lookups) {
+  Uptane::Targets targets(makeTargets(10));
+  ASSERT_EQ(targets.targets.size(), 10u);
+
+  const Uptane::Target* target = targets.findByFilename("target3");
+  ASSERT_NE(target, nullptr);
+  EXPECT_EQ(target->length(), 3);
+  EXPECT_EQ(targets.findByFilename("target10"), nullptr);
+  EXPECT_EQ(targets.findTarget(*target), target);
+
+  // same name, other hash
+  Json::Value other;
+  other["length"] = 3;
+  other["hashes"]["sha256"] = boost::algorithm::hex(Crypto::sha256digest("4"));
+  EXPECT_EQ(targets.findTarget(Uptane::Target("target3", other)), nullptr);
+
+  const std::string sha256 = boost::algorithm::hex(Crypto::sha256digest("5"));
+  std::vector<const Uptane::Target*> found = targets.findBySha256(sha256);
+  ASSERT_EQ(found.size(), 1u);
+  EXPECT_EQ(found[0]->filename(), "target5");
+  EXPECT_EQ(targets.findBySha256(boost::algorithm::to_lower_copy(sha256)), found);
+
+  found = targets.targetsForEcu(Uptane::EcuSerial("ecu7"));
+  ASSERT_EQ(found.size(), 1u);
+  EXPECT_EQ(found[0]->filename(), "target7");
+  EXPECT_TRUE(targets.targetsForEcu(Uptane::EcuSerial("ecu10")).empty());
+
+  // copies have their own indexes
+  Uptane::Targets copy = targets;
+  EXPECT_EQ(copy.findByFilename("target3"), &copy.targets[3]);
+
+  // changes are seen before reindexing, through a scan
+  Json::Value extra;
+  extra["length"] = 10;
+  extra["hashes"]["sha256"] = sha256;
+  extra["custom"]["ecuIdentifiers"]["ecu7"]["hardwareId"] = "hw7";
+  targets.targets.emplace_back("target10", extra);
+  ASSERT_NE(targets.findByFilename("target10"), nullptr);
+  EXPECT_EQ(targets.findBySha256(sha256).size(), 2u);
+  EXPECT_EQ(targets.targetsForEcu(Uptane::EcuSerial("ecu7")).size(), 2u);
+  targets.reindex();
+  EXPECT_EQ(targets.findByFilename("target10"), &targets.targets[10]);
+  found = targets.targetsForEcu(Uptane::EcuSerial("ecu7"));
+  ASSERT_EQ(found.size(), 2u);
+  EXPECT_EQ(found[0]->filename(), "target7");
+  EXPECT_EQ(found[1]->filename(), "target10");
+}
+
+/*
+ * Time to parse targets metadata with 50000 targets and to look up 1000 of
+ * them, through the indexes and by scanning the list. Targets.Lookups checks the
+ * results; this only reports timings, so it is disabled by default. Run it with
+ * --gtest_also_run_disabled_tests.
+ */
+TEST(Targets, DISABLED_LookupBenchmark) {
+  const size_t count = 50000;
+  const size_t lookups = 1000;
+  const Json::Value json = makeTargets(count);
+
+  auto start = std::chrono::steady_clock::now();
+  Uptane::Targets targets(json);
+  auto parsing = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(targets.targets.size(), count);
+  std::vector<Uptane::Target> wanted;
+  for (size_t i = 0; i < lookups; ++i) {
+    wanted.push_back(targets.targets[(i * 7919) % count]);
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (const auto& target : wanted) {
+    EXPECT_NE(std::find(targets.targets.cbegin(), targets.targets.cend(), target), targets.targets.cend());
+  }
+  auto scanning = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (const auto& target : wanted) {
+    EXPECT_NE(targets.findTarget(target), nullptr);
+  }
+  auto indexed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Parsing " << count << " targets took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(parsing).count() << "ms, looking up " << lookups
+            << " of them took " << std::chrono::duration_cast<std::chrono::microseconds>(scanning).count()
+            << "us by scanning and " << std::chrono::duration_cast<std::chrono::microseconds>(indexed).count()
+            << "us through the indexes\n";
+}
+
 TEST(TimeStamp, Parsing) {
   Uptane::TimeStamp t_old("2038-01-19T02:00:00Z");
   Uptane::TimeStamp t_new("2038-01-19T03:14:06Z");
@@ -3,10 +3,17 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -19,8 +26,12 @@
 #include "storage/fsstorage_read.h"
 #include "storage/invstorage.h"
 #include "test_utils.h"
+#include "uptane/directorrepository.h"
+#include "uptane/fetcher.h"
+#include "uptane/imagesrepository.h"
 #include "uptane/tuf.h"
 #include "uptane/uptanerepository.h"
+#include "uptane/verifiedmeta.h"
 #include "uptane_test_common.h"
 #include "utilities/utils.h"
 
@@ -231,6 +242,288 @@ TEST(Uptane, PutManifest) {
  * Verify successful installation of a provided fake package. Skip fetching and
  * downloading.
  */
+class ManifestCountingHttpFake : public HttpFake {
+ public:
+  using HttpFake::HttpFake;
+  HttpResponse put(const std::string &url, const Json::Value &data) override {
+    if (url.find("/director/manifest") != std::string::npos) {
+      ++manifests_put;
+    }
+    return HttpFake::put(url, data);
+  }
+  int manifests_put{0};
+};
+
+/*
+ * The manifest is only signed and sent again when its content has changed, or
+ * when the last one sent is older than uptane.manifest_max_age_sec.
+ */
+TEST(Uptane, UnchangedManifest) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<ManifestCountingHttpFake>(temp_dir.Path());
+  Config config;
+  config.storage.path = temp_dir.Path();
+  boost::filesystem::copy_file("tests/test_data/cred.zip", (temp_dir / "cred.zip").string());
+  boost::filesystem::copy_file("tests/test_data/firmware.txt", (temp_dir / "firmware.txt").string());
+  boost::filesystem::copy_file("tests/test_data/firmware_name.txt", (temp_dir / "firmware_name.txt").string());
+  config.provision.provision_path = temp_dir / "cred.zip";
+  config.provision.mode = ProvisionMode::kAutomatic;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.provision.primary_ecu_serial = "testecuserial";
+  config.pacman.type = PackageManager::kNone;
+  UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hardware");
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = SotaUptaneClient::newTestClient(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  auto sent_time = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(http->manifests_put, 1);
+
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  auto skipped_time = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(http->manifests_put, 1);
+
+  // a secondary reports another firmware
+  Utils::writeFile(temp_dir / "firmware.txt", std::string("new firmware"));
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_EQ(http->manifests_put, 2);
+  Json::Value json = Utils::parseJSONFile((temp_dir / http->test_manifest).string());
+  EXPECT_EQ(json["signed"]["ecu_version_manifests"]["secondary_ecu_serial"]["signed"]["installed_image"]["fileinfo"]
+                ["length"]
+                    .asUInt(),
+            12u);
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_EQ(http->manifests_put, 2);
+
+  // too old, sent again even if unchanged
+  config.uptane.manifest_max_age_sec = 0;
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_EQ(http->manifests_put, 3);
+
+  std::cout << "Manifest signed and sent in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(sent_time).count()
+            << "us, unchanged one skipped in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(skipped_time).count() << "us\n";
+}
+
+// Stands for an IP secondary which takes some time to answer
+class LatencySecondary : public Uptane::SecondaryInterface {
+ public:
+  LatencySecondary(const std::string &serial, std::chrono::milliseconds latency_in)
+      : Uptane::SecondaryInterface(secondaryConfig(serial)), latency(latency_in) {
+    Crypto::generateKeyPair(KeyType::kED25519, &public_key, &private_key);
+  }
+
+  PublicKey getPublicKey() override { return PublicKey(public_key, KeyType::kED25519); }
+  Json::Value getManifest() override {
+    ++manifests_running;
+    std::this_thread::sleep_for(latency);
+    --manifests_running;
+    Json::Value manifest;
+    manifest["ecu_serial"] = getSerial().ToString();
+    manifest["installed_image"]["filepath"] = "firmware.txt";
+    Json::Value signature;
+    signature["method"] = "ed25519";
+    signature["sig"] =
+        Utils::toBase64(Crypto::Sign(KeyType::kED25519, nullptr, private_key, Json::FastWriter().write(manifest)));
+    Json::Value signed_manifest;
+    signed_manifest["signed"] = manifest;
+    signed_manifest["signatures"].append(signature);
+    return signed_manifest;
+  }
+  bool putMetadata(const Uptane::RawMetaPack & /* meta_pack */) override {
+    std::this_thread::sleep_for(latency);
+    ++metadata_put;
+    if (throw_on_metadata) {
+      throw std::runtime_error("connection lost");
+    }
+    return accept_metadata;
+  }
+  int32_t getRootVersion(bool /* director */) override { return root_version; }
+  bool putRoot(const std::string &root, bool director) override {
+    std::lock_guard<std::mutex> guard(mutex);
+    (director ? director_roots_put : images_roots_put).push_back(Uptane::extractVersionUntrusted(root));
+    return true;
+  }
+  std::future<bool> sendFirmwareAsync(const std::shared_ptr<std::string> & /* data */) override {
+    std::promise<bool> result;
+    result.set_value(true);
+    return result.get_future();
+  }
+
+  const std::chrono::milliseconds latency;
+  int32_t root_version{-1};
+  bool accept_metadata{true};
+  bool throw_on_metadata{false};
+  std::atomic<int> metadata_put{0};
+  std::atomic<int> manifests_running{0};
+  std::mutex mutex;
+  std::vector<int> director_roots_put;
+  std::vector<int> images_roots_put;
+
+ private:
+  static Uptane::SecondaryConfig secondaryConfig(const std::string &serial) {
+    Uptane::SecondaryConfig sconfig;
+    sconfig.secondary_type = Uptane::SecondaryType::kIpUptane;
+    sconfig.ecu_serial = serial;
+    sconfig.ecu_hardware_id = "ip_secondary_hw";
+    return sconfig;
+  }
+
+  std::string public_key;
+  std::string private_key;
+};
+
+/*
+ * Manifests of 24 secondaries answering in 50ms and one hanging for 2s,
+ * collected one after the other and 8 at a time with a timeout of 1s.
+ */
+TEST(Uptane, ConcurrentSecondaryManifests) {
+  const int count = 24;
+  std::vector<std::shared_ptr<LatencySecondary>> ip_secondaries;
+  for (int i = 0; i < count; ++i) {
+    ip_secondaries.push_back(
+        std::make_shared<LatencySecondary>("ip_secondary_" + std::to_string(i), std::chrono::milliseconds(50)));
+  }
+  auto hung = std::make_shared<LatencySecondary>("hung_secondary", std::chrono::milliseconds(2000));
+
+  std::chrono::steady_clock::duration times[2];
+  for (uint64_t concurrency : {0u, 8u}) {
+    TemporaryDirectory temp_dir;
+    auto http = std::make_shared<HttpFake>(temp_dir.Path());
+    Config config;
+    config.storage.path = temp_dir.Path();
+    config.pacman.type = PackageManager::kNone;
+    config.uptane.secondary_concurrency = concurrency;
+    config.uptane.secondary_timeout_sec = 1;
+    auto storage = INvStorage::newStorage(config.storage);
+    auto events_channel = std::make_shared<event::Channel>();
+    std::vector<Uptane::EcuSerial> unresponsive;
+    events_channel->connect([&unresponsive](const std::shared_ptr<event::BaseEvent> &event) {
+      if (event->variant == "UnresponsiveSecondaries") {
+        const auto serials = dynamic_cast<event::UnresponsiveSecondaries *>(event.get())->serials;
+        unresponsive.insert(unresponsive.end(), serials.begin(), serials.end());
+      }
+    });
+    auto sota_client = SotaUptaneClient::newTestClient(config, storage, http, events_channel);
+    for (const auto &secondary : ip_secondaries) {
+      sota_client->addSecondary(secondary);
+    }
+    sota_client->addSecondary(hung);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto manifests = sota_client->collectSecondaryManifests();
+    times[concurrency > 0 ? 1 : 0] = std::chrono::steady_clock::now() - start;
+    if (concurrency == 0) {
+      EXPECT_EQ(manifests.size(), count + 1u);
+      EXPECT_TRUE(unresponsive.empty());
+      continue;
+    }
+    EXPECT_EQ(manifests.size(), static_cast<size_t>(count));
+    EXPECT_EQ(manifests.count(hung->getSerial()), 0u);
+    EXPECT_EQ(manifests[Uptane::EcuSerial("ip_secondary_0")]["signed"]["ecu_serial"].asString(), "ip_secondary_0");
+    ASSERT_EQ(unresponsive.size(), 1u);
+    EXPECT_EQ(unresponsive[0], hung->getSerial());
+
+    // not asked again while its last request runs
+    manifests = sota_client->collectSecondaryManifests();
+    EXPECT_EQ(manifests.size(), static_cast<size_t>(count));
+    EXPECT_EQ(unresponsive.size(), 2u);
+
+    // the request left running is waited for, not left behind
+    EXPECT_EQ(hung->manifests_running.load(), 1);
+    sota_client.reset();
+    EXPECT_EQ(hung->manifests_running.load(), 0);
+  }
+
+  std::cout << "Manifests of " << count + 1 << " secondaries collected in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(times[0]).count()
+            << "ms one after the other, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(times[1]).count() << "ms 8 at a time\n";
+}
+
+/*
+ * Metadata sent to 24 secondaries taking 50ms each, with every secondary in
+ * two targets, one after the other and 8 at a time.
+ */
+TEST(Uptane, ConcurrentMetadataDistribution) {
+  const int count = 24;
+  std::chrono::steady_clock::duration times[2];
+  for (uint64_t concurrency : {0u, 8u}) {
+    TemporaryDirectory temp_dir;
+    auto http = std::make_shared<HttpFake>(temp_dir.Path());
+    Config config;
+    config.storage.path = temp_dir.Path();
+    config.pacman.type = PackageManager::kNone;
+    config.uptane.secondary_concurrency = concurrency;
+    auto storage = INvStorage::newStorage(config.storage);
+    for (int v = 1; v <= 3; ++v) {
+      const std::string root = "{\"signed\":{\"version\":" + std::to_string(v) + "}}";
+      storage->storeRoot(root, Uptane::RepositoryType::Director, Uptane::Version(v));
+      if (v <= 2) {
+        storage->storeRoot(root, Uptane::RepositoryType::Images, Uptane::Version(v));
+      }
+    }
+    storage->storeNonRoot("{}", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+    for (const auto &role : {Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+      storage->storeNonRoot("{}", Uptane::RepositoryType::Images, role);
+    }
+    auto sota_client = SotaUptaneClient::newTestClient(config, storage, http);
+
+    std::vector<std::shared_ptr<LatencySecondary>> ip_secondaries;
+    std::vector<Json::Value> targets_json(3);
+    for (int i = 0; i < count; ++i) {
+      const std::string serial = "ip_secondary_" + std::to_string(i);
+      ip_secondaries.push_back(std::make_shared<LatencySecondary>(serial, std::chrono::milliseconds(50)));
+      sota_client->addSecondary(ip_secondaries.back());
+      targets_json[static_cast<size_t>(i % 3)]["custom"]["ecuIdentifiers"][serial]["hardwareId"] = "ip_secondary_hw";
+      targets_json[static_cast<size_t>((i + 1) % 3)]["custom"]["ecuIdentifiers"][serial]["hardwareId"] =
+          "ip_secondary_hw";
+    }
+    ip_secondaries[0]->root_version = 1;
+    ip_secondaries[1]->root_version = 2;
+    ip_secondaries[2]->accept_metadata = false;
+    std::vector<Uptane::Target> targets;
+    for (size_t i = 0; i < targets_json.size(); ++i) {
+      targets.emplace_back("firmware" + std::to_string(i), targets_json[i]);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = sota_client->sendMetadataToEcus(targets);
+    times[concurrency > 0 ? 1 : 0] = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(results.size(), static_cast<size_t>(count));
+    for (const auto &secondary : ip_secondaries) {
+      EXPECT_EQ(secondary->metadata_put.load(), 1);
+      EXPECT_EQ(results.at(secondary->getSerial()), secondary->accept_metadata);
+    }
+    EXPECT_EQ(ip_secondaries[0]->director_roots_put, std::vector<int>({2, 3}));
+    EXPECT_EQ(ip_secondaries[0]->images_roots_put, std::vector<int>({2}));
+    EXPECT_EQ(ip_secondaries[1]->director_roots_put, std::vector<int>({3}));
+    EXPECT_TRUE(ip_secondaries[1]->images_roots_put.empty());
+    EXPECT_TRUE(ip_secondaries[3]->director_roots_put.empty());
+
+    // on the pool, the exception is only passed on once all secondaries are done
+    ip_secondaries[0]->throw_on_metadata = true;
+    EXPECT_THROW(sota_client->sendMetadataToEcus(targets), std::runtime_error);
+    if (concurrency > 0) {
+      for (const auto &secondary : ip_secondaries) {
+        EXPECT_EQ(secondary->metadata_put.load(), 2);
+      }
+    }
+  }
+
+  std::cout << "Metadata sent to " << count << " secondaries in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(times[0]).count()
+            << "ms one after the other, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(times[1]).count() << "ms 8 at a time\n";
+}
+
 TEST(Uptane, InstallFake) {
   Config conf("tests/config/basic.toml");
   TemporaryDirectory temp_dir;
@@ -575,39 +868,773 @@ TEST(Uptane, restoreVerify) {
 
   EXPECT_NO_THROW(sota_client->initialize());
   sota_client->AssembleManifest();
-  // 1st attempt, don't get anything
+  // The server fails less and less often. The metadata of each repository is requested at once, the images one only
+  // once the director's is verified. Each attempt stores what it could verify before the first failure, and what is
+  // stored is kept until an attempt succeeds.
+  auto stored_count = [&storage]() {
+    int count = 0;
+    for (auto repo : {Uptane::RepositoryType::Director, Uptane::RepositoryType::Images}) {
+      count += storage->loadLatestRoot(nullptr, repo) ? 1 : 0;
+      for (const auto &role : {Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+        count += storage->loadNonRoot(nullptr, repo, role) ? 1 : 0;
+      }
+    }
+    return count;
+  };
+  // No role is stored without the ones it is verified against: root, timestamp, snapshot then targets in each
+  // repository, and the director before the images repository.
+  auto expect_parents_stored = [&storage](int attempt) {
+    const std::vector<std::pair<Uptane::RepositoryType, Uptane::Role>> chain = {
+        {Uptane::RepositoryType::Director, Uptane::Role::Root()},
+        {Uptane::RepositoryType::Director, Uptane::Role::Targets()},
+        {Uptane::RepositoryType::Images, Uptane::Role::Root()},
+        {Uptane::RepositoryType::Images, Uptane::Role::Timestamp()},
+        {Uptane::RepositoryType::Images, Uptane::Role::Snapshot()},
+        {Uptane::RepositoryType::Images, Uptane::Role::Targets()}};
+    std::string missing;
+    for (const auto &link : chain) {
+      const bool is_stored = (link.second == Uptane::Role::Root())
+                                 ? storage->loadLatestRoot(nullptr, link.first)
+                                 : storage->loadNonRoot(nullptr, link.first, link.second);
+      const std::string name = Uptane::RepoString(link.first) + " " + link.second.ToString();
+      if (!is_stored) {
+        missing = name;
+      } else {
+        EXPECT_TRUE(missing.empty()) << name << " is stored without " << missing << " after attempt " << attempt;
+      }
+    }
+  };
   EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_FALSE(storage->loadLatestRoot(nullptr, Uptane::RepositoryType::Director));
+  int attempts = 1;
+  expect_parents_stored(attempts);
+  int stored = stored_count();
+  while (attempts < 10 && !sota_client->uptaneIteration()) {
+    ++attempts;
+    expect_parents_stored(attempts);
+    const int now_stored = stored_count();
+    EXPECT_GE(now_stored, stored);
+    stored = now_stored;
+  }
+  expect_parents_stored(attempts + 1);
+  EXPECT_LT(attempts, 10);
+  EXPECT_EQ(stored_count(), 6);
+}
 
-  // 2nd attempt, get director root.json
-  EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadLatestRoot(nullptr, Uptane::RepositoryType::Director));
-  EXPECT_FALSE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
+static Uptane::Target makeFileTarget(const std::string& filename, const std::string& content) {
+  Json::Value target_json;
+  target_json["length"] = Json::UInt64(content.size());
+  target_json["hashes"]["sha256"] = boost::algorithm::hex(Crypto::sha256digest(content));
+  return Uptane::Target(filename, target_json);
+}
 
-  // 3rd attempt, get director targets.json
-  EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadLatestRoot(nullptr, Uptane::RepositoryType::Director));
-  EXPECT_TRUE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Director, Uptane::Role::Targets()));
-  EXPECT_FALSE(storage->loadLatestRoot(nullptr, Uptane::RepositoryType::Images));
+/*
+ * Simulate a download of the first half of a target that was interrupted, with
+ * the received content being stored as the stored one.
+ */
+static void storePartialDownload(INvStorage& storage, const Uptane::Target& target, const std::string& content,
+                                 const std::string& stored) {
+  Uptane::DownloadMetaStruct ds(target, nullptr);
+  std::unique_ptr<StorageTargetWHandle> fhandle =
+      storage.allocateTargetFile(false, target.filename(), static_cast<size_t>(target.length()));
+  size_t half = content.size() / 2;
+  fhandle->wfeed(reinterpret_cast<const uint8_t*>(stored.data()), half);
+  ds.hasher().update(reinterpret_cast<const unsigned char*>(content.data()), half);
+  fhandle->wsuspend(ds.resumeState());
+}
 
-  // 4th attempt, get images root.json
-  EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadLatestRoot(nullptr, Uptane::RepositoryType::Images));
-  EXPECT_FALSE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
+static void storePartialDownload(INvStorage& storage, const Uptane::Target& target, const std::string& content) {
+  storePartialDownload(storage, target, content, content);
+}
 
-  // 5th attempt, get images timestamp.json
-  EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Timestamp()));
-  EXPECT_FALSE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Snapshot()));
+/*
+ * A partially downloaded target is fetched from where it was interrupted and
+ * the result is verified against the hash of the whole image.
+ */
+TEST(Uptane, ResumeDownload) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
 
-  // 6th attempt, get images snapshot.json
-  EXPECT_FALSE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Snapshot()));
-  EXPECT_FALSE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Targets()));
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  storePartialDownload(*storage, target, content);
 
-  // 7th attempt, get images targets.json, successful iteration
-  EXPECT_TRUE(sota_client->uptaneIteration());
-  EXPECT_TRUE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Images, Uptane::Role::Targets()));
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_TRUE(fetcher.fetchVerifyTarget(target));
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * A resumed download is rejected if the part stored before the interruption is
+ * not what was received, even though the download hash state matches.
+ */
+TEST(Uptane, ResumeDownloadCorrupted) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  std::string stored = content;
+  stored[0] = static_cast<char>(~stored[0]);
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  storePartialDownload(*storage, target, content, stored);
+
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_FALSE(fetcher.fetchVerifyTarget(target));
+  EXPECT_THROW(storage->openTargetFile(target.filename()), StorageTargetRHandle::ReadError);
+
+  // the next attempt starts over
+  EXPECT_TRUE(fetcher.fetchVerifyTarget(target));
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * A partial download left by a different version of a target is not resumed.
+ */
+TEST(Uptane, ResumeDownloadOtherTarget) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  std::string old_content(content.size(), 'x');
+  storePartialDownload(*storage, makeFileTarget("primary_firmware.txt", old_content), old_content);
+
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_TRUE(fetcher.fetchVerifyTarget(target));
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * Answers ranged downloads the way curl reports a server that ignores the
+ * range (200) or fails the request (any other code).
+ */
+class HttpFakeRange : public HttpFake {
+ public:
+  HttpFakeRange(const boost::filesystem::path& test_dir_in, long range_status_in)  // NOLINT
+      : HttpFake(test_dir_in), range_status(range_status_in) {}
+
+  HttpResponse download(const std::string& url, curl_write_callback callback, void* userp, size_t from) override {
+    if (from == 0) {
+      return HttpFake::download(url, callback, userp, from);
+    }
+    ++ranged_requests;
+    return HttpResponse("", range_status, (range_status == 200) ? CURLE_RANGE_ERROR : CURLE_HTTP_RETURNED_ERROR,
+                        "ranged request failed");
+  }
+
+  long range_status;  // NOLINT
+  int ranged_requests{0};
+};
+
+/*
+ * A download is started over if the server sends the whole image instead of
+ * the requested range.
+ */
+TEST(Uptane, ResumeDownloadRangeIgnored) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeRange>(temp_dir.Path(), 200);
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  storePartialDownload(*storage, target, content);
+
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_TRUE(fetcher.fetchVerifyTarget(target));
+  EXPECT_EQ(http->ranged_requests, 1);
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * A server error on a resumed download fails the attempt but keeps the
+ * partial image for the next one.
+ */
+TEST(Uptane, ResumeDownloadServerError) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeRange>(temp_dir.Path(), 503);
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  storePartialDownload(*storage, target, content);
+
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_FALSE(fetcher.fetchVerifyTarget(target));
+  EXPECT_EQ(http->ranged_requests, 1);
+
+  std::string resume_state;
+  std::unique_ptr<StorageTargetWHandle> fhandle =
+      storage->resumeTargetFile(target.filename(), content.size(), &resume_state);
+  ASSERT_NE(fhandle, nullptr);
+  EXPECT_EQ(fhandle->woffset(), content.size() / 2);
+  fhandle->wrevert();
+
+  // the server recovers and the download continues where it was
+  auto http_ok = std::make_shared<HttpFake>(temp_dir.Path());
+  Uptane::Fetcher fetcher_ok(config, storage, http_ok);
+  EXPECT_TRUE(fetcher_ok.fetchVerifyTarget(target));
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * An image already stored under another name is not downloaded again.
+ */
+TEST(Uptane, SkipStoredDownload) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  // nothing can be downloaded from there
+  config.uptane.repo_server = http->tls_server + "/nowhere";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  std::string content = Utils::readFile("tests/test_data/repo/repo/image/targets/primary_firmware.txt");
+  {
+    std::unique_ptr<StorageTargetWHandle> fhandle = storage->allocateTargetFile(false, "old_name.txt", content.size());
+    std::stringstream(content) >> *fhandle;
+  }
+
+  Uptane::Target target = makeFileTarget("primary_firmware.txt", content);
+  Uptane::Fetcher fetcher(config, storage, http);
+  EXPECT_TRUE(fetcher.fetchVerifyTarget(target));
+  EXPECT_FALSE(fetcher.fetchVerifyTarget(makeFileTarget("other_firmware.txt", "other content")));
+  EXPECT_EQ(storage->targetCacheStats().downloads_skipped, 1);
+
+  std::stringstream sstr;
+  sstr << *storage->openTargetFile(target.filename());
+  EXPECT_EQ(sstr.str(), content);
+}
+
+/*
+ * Several targets are downloaded in parallel, with a result for each of them.
+ */
+TEST(Uptane, ParallelDownload) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.uptane.download_concurrency = 2;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+
+  const std::string targets_dir = "tests/test_data/repo/repo/image/targets/";
+  std::vector<Uptane::Target> targets;
+  std::vector<std::string> contents;
+  for (const std::string filename : {"primary_firmware.txt", "secondary_firmware.txt", "secondary_firmware2.txt"}) {
+    contents.push_back(Utils::readFile(targets_dir + filename));
+    targets.push_back(makeFileTarget(filename, contents.back()));
+  }
+  targets.push_back(makeFileTarget("dummy_firmware.txt", "not the dummy firmware"));
+  targets.push_back(targets[0]);
+
+  Uptane::Fetcher fetcher(config, storage, http);
+  std::vector<bool> results = fetcher.fetchVerifyTargets(targets);
+  EXPECT_EQ(results, std::vector<bool>({true, true, true, false, true}));
+
+  for (size_t i = 0; i < contents.size(); ++i) {
+    std::stringstream sstr;
+    sstr << *storage->openTargetFile(targets[i].filename());
+    EXPECT_EQ(sstr.str(), contents[i]);
+  }
+  EXPECT_THROW(storage->openTargetFile("dummy_firmware.txt"), StorageTargetRHandle::ReadError);
+}
+
+/*
+ * Metadata that hasn't changed on the server is not downloaded again, but
+ * taken from the storage.
+ */
+TEST(Uptane, ConditionalFetch) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  Uptane::Fetcher fetcher(config, storage, http);
+
+  std::string targets;
+  bool not_modified = true;
+  EXPECT_TRUE(fetcher.fetchLatestRole(&targets, Uptane::kMaxDirectorTargetsSize, Uptane::RepositoryType::Director,
+                                      Uptane::Role::Targets(), &not_modified));
+  EXPECT_FALSE(not_modified);
+
+  // nothing stored yet, so there's nothing the server could validate
+  std::string targets2;
+  EXPECT_TRUE(fetcher.fetchLatestRole(&targets2, Uptane::kMaxDirectorTargetsSize, Uptane::RepositoryType::Director,
+                                      Uptane::Role::Targets(), &not_modified));
+  EXPECT_FALSE(not_modified);
+  EXPECT_EQ(http->not_modified_count, 0);
+
+  storage->storeNonRoot(targets, Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  std::string targets3;
+  EXPECT_TRUE(fetcher.fetchLatestRole(&targets3, Uptane::kMaxDirectorTargetsSize, Uptane::RepositoryType::Director,
+                                      Uptane::Role::Targets(), &not_modified));
+  EXPECT_TRUE(not_modified);
+  EXPECT_EQ(http->not_modified_count, 1);
+  EXPECT_EQ(targets3, targets);
+
+  // validators of a different copy of the metadata are not used
+  storage->storeNonRoot("{}", Uptane::RepositoryType::Director, Uptane::Role::Targets());
+  std::string targets4;
+  EXPECT_TRUE(fetcher.fetchLatestRole(&targets4, Uptane::kMaxDirectorTargetsSize, Uptane::RepositoryType::Director,
+                                      Uptane::Role::Targets(), &not_modified));
+  EXPECT_FALSE(not_modified);
+  EXPECT_EQ(http->not_modified_count, 1);
+  EXPECT_EQ(targets4, targets);
+}
+
+struct RepoMeta {
+  std::string director_root{Utils::readFile("tests/test_data/repo/repo/director/root.json")};
+  std::string director_targets{Utils::readFile("tests/test_data/repo/repo/director/targets_hasupdates.json")};
+  std::string images_root{Utils::readFile("tests/test_data/repo/repo/image/root.json")};
+  std::string images_timestamp{Utils::readFile("tests/test_data/repo/repo/image/timestamp_hasupdates.json")};
+  std::string images_snapshot{Utils::readFile("tests/test_data/repo/repo/image/snapshot_hasupdates.json")};
+  std::string images_targets{Utils::readFile("tests/test_data/repo/repo/image/targets_hasupdates.json")};
+};
+
+// the steps of SotaUptaneClient::updateDirectorMeta and updateImagesMeta without the fetching
+bool verifyRepoMeta(const RepoMeta& meta, Uptane::DirectorRepository* director, Uptane::ImagesRepository* images) {
+  director->resetMeta();
+  images->resetMeta();
+  return director->initRoot(meta.director_root) && director->verifyTargets(meta.director_targets) &&
+         images->initRoot(meta.images_root) && images->verifyTimestamp(meta.images_timestamp) &&
+         images->verifySnapshot(meta.images_snapshot) && images->verifyTargets(meta.images_targets);
+}
+
+/*
+ * Verified metadata is restored from the storage after a restart and in the
+ * following cycles, unless it has changed.
+ */
+TEST(Uptane, RestoreVerifiedMeta) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const RepoMeta meta;
+
+  // without a storage, as before
+  Uptane::DirectorRepository plain_director;
+  Uptane::ImagesRepository plain_images;
+  ASSERT_TRUE(verifyRepoMeta(meta, &plain_director, &plain_images));
+
+  // first start, everything is verified
+  Uptane::DirectorRepository director(storage);
+  Uptane::ImagesRepository images(storage);
+  ASSERT_TRUE(verifyRepoMeta(meta, &director, &images));
+  std::string record;
+  for (auto role : Uptane::Role::Roles()) {
+    EXPECT_TRUE(storage->loadVerifiedMeta(&record, Uptane::RepositoryType::Images, role));
+  }
+
+  // restart
+  Uptane::DirectorRepository restored_director(storage);
+  Uptane::ImagesRepository restored_images(storage);
+  ASSERT_TRUE(verifyRepoMeta(meta, &restored_director, &restored_images));
+  EXPECT_EQ(restored_director.rootVersion(), plain_director.rootVersion());
+  EXPECT_EQ(restored_images.rootVersion(), plain_images.rootVersion());
+  EXPECT_EQ(restored_images.snapshotSize(), plain_images.snapshotSize());
+  EXPECT_EQ(restored_images.targetsSize(), plain_images.targetsSize());
+  ASSERT_FALSE(plain_director.getTargets().empty());
+  EXPECT_EQ(restored_director.getTargets(), plain_director.getTargets());
+  for (const auto& target : plain_director.getTargets()) {
+    auto plain_target = plain_images.getTarget(target);
+    auto restored_target = restored_images.getTarget(target);
+    ASSERT_TRUE(plain_target != nullptr);
+    ASSERT_TRUE(restored_target != nullptr);
+    EXPECT_EQ(restored_target->filename(), plain_target->filename());
+    EXPECT_EQ(restored_target->length(), plain_target->length());
+    EXPECT_EQ(restored_target->ecus(), plain_target->ecus());
+  }
+
+  // following cycle with the same metadata
+  ASSERT_TRUE(verifyRepoMeta(meta, &restored_director, &restored_images));
+
+  // changed metadata is verified again, even if it was verified before
+  Json::Value tampered = Utils::parseJSON(meta.director_targets);
+  tampered["signed"]["version"] = tampered["signed"]["version"].asInt() + 1;
+  EXPECT_FALSE(restored_director.verifyTargets(Utils::jsonToStr(tampered)));
+  EXPECT_TRUE(restored_director.verifyTargets(meta.director_targets));
+  EXPECT_FALSE(restored_images.verifyTargets(meta.images_snapshot));
+
+  // a record is only restored in the context it was made in
+  ASSERT_TRUE(storage->loadVerifiedMeta(&record, Uptane::RepositoryType::Director, Uptane::Role::Root()));
+  Uptane::Root root;
+  EXPECT_TRUE(Uptane::VerifiedMeta::decode(record, Uptane::VerifiedMeta::hash(meta.director_root), &root));
+  EXPECT_FALSE(Uptane::VerifiedMeta::decode(record, Uptane::VerifiedMeta::hash(meta.images_root), &root));
+  EXPECT_FALSE(Uptane::VerifiedMeta::decode(record.substr(0, record.size() - 1),
+                                            Uptane::VerifiedMeta::hash(meta.director_root), &root));
+}
+
+/*
+ * Time to verify the metadata of both repositories without storage, on the
+ * first start, after a restart and in the following cycles.
+ * Uptane.RestoreVerifiedMeta checks the results; this only reports timings,
+ * so it is disabled by default. Run it with --gtest_also_run_disabled_tests.
+ */
+TEST(Uptane, DISABLED_RestoreVerifiedMetaBenchmark) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const RepoMeta meta;
+  const int cycles = 20;
+
+  Uptane::DirectorRepository plain_director;
+  Uptane::ImagesRepository plain_images;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < cycles; ++i) {
+    ASSERT_TRUE(verifyRepoMeta(meta, &plain_director, &plain_images));
+  }
+  auto plain_time = std::chrono::steady_clock::now() - start;
+
+  Uptane::DirectorRepository director(storage);
+  Uptane::ImagesRepository images(storage);
+  start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(verifyRepoMeta(meta, &director, &images));
+  auto first_time = std::chrono::steady_clock::now() - start;
+
+  Uptane::DirectorRepository restored_director(storage);
+  Uptane::ImagesRepository restored_images(storage);
+  start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(verifyRepoMeta(meta, &restored_director, &restored_images));
+  auto restart_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < cycles; ++i) {
+    ASSERT_TRUE(verifyRepoMeta(meta, &restored_director, &restored_images));
+  }
+  auto cycle_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Verification of the metadata without storage: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(plain_time).count() / cycles
+            << "us per cycle, first start: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(first_time).count()
+            << "us, restart: " << std::chrono::duration_cast<std::chrono::microseconds>(restart_time).count()
+            << "us, unchanged cycle: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(cycle_time).count() / cycles << "us\n";
+}
+
+/*
+ * The images repository only keeps the targets which the director asks for,
+ * also when verified metadata is restored.
+ */
+TEST(Uptane, WantedImagesTargets) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const RepoMeta meta;
+
+  for (int restart = 0; restart < 2; ++restart) {
+    Uptane::DirectorRepository director(storage);
+    Uptane::ImagesRepository images(storage);
+    for (bool all : {true, false}) {
+      director.resetMeta();
+      images.resetMeta();
+      ASSERT_TRUE(director.initRoot(meta.director_root) && director.verifyTargets(meta.director_targets));
+      const std::vector<Uptane::Target> director_targets = director.getTargets();
+      ASSERT_EQ(director_targets.size(), 2u);
+      if (!all) {
+        images.setWantedTargets({director_targets[1]});
+      }
+      ASSERT_TRUE(images.initRoot(meta.images_root) && images.verifyTimestamp(meta.images_timestamp) &&
+                  images.verifySnapshot(meta.images_snapshot) && images.verifyTargets(meta.images_targets));
+      EXPECT_EQ(images.getTarget(director_targets[0]) != nullptr, all);
+      EXPECT_NE(images.getTarget(director_targets[1]), nullptr);
+    }
+  }
+}
+
+/*
+ * Answers like HttpFake, after a delay. With concurrent set, the asynchronous
+ * requests wait at the same time, like requests in flight to a real server,
+ * otherwise one after the other.
+ */
+class LatencyHttpFake : public HttpFake {
+ public:
+  LatencyHttpFake(const boost::filesystem::path& test_dir_in, std::chrono::milliseconds latency_in, bool concurrent_in)
+      : HttpFake(test_dir_in), latency(latency_in), concurrent(concurrent_in) {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    return getConditional(url, maxsize, HttpValidators());
+  }
+
+  // ETag is the hash of the content, like in HttpFake
+  HttpResponse getConditional(const std::string& url, int64_t maxsize, const HttpValidators& validators) override {
+    std::this_thread::sleep_for(latency);
+    std::lock_guard<std::mutex> lock(mutex);
+    requested.push_back(url);
+    auto it = served.find(url);
+    HttpResponse response = (it != served.end()) ? HttpResponse(it->second, 200, CURLE_OK, "")
+                                                 : HttpFake::get(url, maxsize);
+    if (!response.isOk()) {
+      return response;
+    }
+    response.validators.etag = "\"" + boost::algorithm::hex(Crypto::sha256digest(response.body)) + "\"";
+    if (!validators.etag.empty() && validators.etag == response.validators.etag) {
+      ++not_modified_count;
+      response.body.clear();
+      response.http_status_code = 304;
+    }
+    return response;
+  }
+
+  std::future<HttpResponse> getAsync(const std::string& url, int64_t maxsize) override {
+    return getConditionalAsync(url, maxsize, HttpValidators());
+  }
+
+  std::future<HttpResponse> getConditionalAsync(const std::string& url, int64_t maxsize,
+                                                const HttpValidators& validators) override {
+    if (!concurrent) {
+      return readyResponse(getConditional(url, maxsize, validators));
+    }
+    return std::async(std::launch::async,
+                      [this, url, maxsize, validators]() { return getConditional(url, maxsize, validators); });
+  }
+
+  const std::chrono::milliseconds latency;
+  const bool concurrent;
+  std::mutex mutex;
+  // answered instead of the usual metadata
+  std::map<std::string, std::string> served;
+  std::vector<std::string> requested;
+};
+
+/*
+ * The metadata of both repositories is requested at once, and gives the same
+ * result as when it is requested one role after the other.
+ */
+TEST(Uptane, PipelinedMetaFetch) {
+  const std::chrono::milliseconds latency(100);
+  std::chrono::steady_clock::duration first_cycle[2];
+  std::chrono::steady_clock::duration unchanged_cycle[2];
+  std::vector<Uptane::Target> new_targets[2];
+  for (int concurrent = 0; concurrent < 2; ++concurrent) {
+    TemporaryDirectory temp_dir;
+    auto http = std::make_shared<LatencyHttpFake>(temp_dir.Path(), latency, concurrent == 1);
+    Config config("tests/config/basic.toml");
+    config.storage.path = temp_dir.Path();
+    config.uptane.director_server = http->tls_server + "director";
+    config.uptane.repo_server = http->tls_server + "repo";
+    config.pacman.type = PackageManager::kNone;
+    config.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+    config.provision.primary_ecu_hardware_id = "primary_hw";
+    UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hw");
+    config.postUpdateValues();
+
+    auto storage = INvStorage::newStorage(config.storage);
+    auto sota_client = SotaUptaneClient::newTestClient(config, storage, http);
+    EXPECT_NO_THROW(sota_client->initialize());
+    sota_client->AssembleManifest();
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(sota_client->uptaneIteration());
+    first_cycle[concurrent] = std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(sota_client->getNewTargets(&new_targets[concurrent]));
+
+    start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(sota_client->uptaneIteration());
+    unchanged_cycle[concurrent] = std::chrono::steady_clock::now() - start;
+
+    // without updates, only the director is asked, once the poll before had no updates either
+    for (const auto &target : new_targets[concurrent]) {
+      for (const auto &ecu : target.ecus()) {
+        sota_client->installed_images[ecu.first] = target.filename();
+      }
+    }
+    EXPECT_TRUE(sota_client->uptaneIteration());
+    http->requested.clear();
+    EXPECT_TRUE(sota_client->uptaneIteration());
+    EXPECT_FALSE(http->requested.empty());
+    for (const auto &url : http->requested) {
+      EXPECT_NE(url.find(config.uptane.repo_server), 0u) << url;
+    }
+  }
+  EXPECT_FALSE(new_targets[0].empty());
+  EXPECT_EQ(new_targets[0], new_targets[1]);
+  EXPECT_LT(first_cycle[1], first_cycle[0]);
+  EXPECT_LT(unchanged_cycle[1], unchanged_cycle[0]);
+
+  std::cout << "Update cycle with " << latency.count() << "ms of latency, first: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(first_cycle[0]).count()
+            << "ms one request at a time, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(first_cycle[1]).count()
+            << "ms pipelined, unchanged: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(unchanged_cycle[0]).count()
+            << "ms one request at a time, "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(unchanged_cycle[1]).count() << "ms pipelined\n";
+}
+
+/*
+ * The missing root versions are requested together as soon as the latest one
+ * is known, and taken in order. Roles requested before the root was rotated
+ * have to be verified again.
+ */
+TEST(Uptane, PrefetchRoots) {
+  TemporaryDirectory temp_dir;
+  const std::chrono::milliseconds latency(100);
+  auto http = std::make_shared<LatencyHttpFake>(temp_dir.Path(), latency, true);
+  Config config;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const int latest = 12;
+  for (int version = 1; version <= latest; ++version) {
+    const std::string root = "{\"signed\":{\"version\":" + std::to_string(version) + "}}";
+    http->served[config.uptane.director_server + "/" + std::to_string(version) + ".root.json"] = root;
+    if (version == latest) {
+      http->served[config.uptane.director_server + "/root.json"] = root;
+    }
+  }
+  Uptane::Fetcher fetcher(config, storage, http);
+  std::string targets;
+  ASSERT_TRUE(fetcher.fetchLatestRole(&targets, Uptane::kMaxDirectorTargetsSize, Uptane::RepositoryType::Director,
+                                      Uptane::Role::Targets()));
+  storage->storeNonRoot(targets, Uptane::RepositoryType::Director, Uptane::Role::Targets());
+
+  Uptane::MetaPrefetch prefetch(fetcher, Uptane::RepositoryType::Director, 2,
+                                {{Uptane::Role::Targets(), Uptane::kMaxDirectorTargetsSize}});
+  auto start = std::chrono::steady_clock::now();
+  prefetch.prefetchRoots();
+  std::string root;
+  ASSERT_TRUE(prefetch.fetchLatestRoot(&root));
+  EXPECT_EQ(Uptane::extractVersionUntrusted(root), latest);
+  for (int version = 3; version <= latest; ++version) {
+    ASSERT_TRUE(prefetch.fetchRoot(&root, Uptane::Version(version)));
+    EXPECT_EQ(Uptane::extractVersionUntrusted(root), version);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  // one round trip for the latest root, one or two for the others
+  EXPECT_LT(elapsed, 5 * latency);
+
+  bool not_modified = true;
+  std::string targets2;
+  ASSERT_TRUE(prefetch.fetchRole(&targets2, Uptane::kMaxDirectorTargetsSize, Uptane::Role::Targets(), &not_modified));
+  EXPECT_EQ(targets2, targets);
+  EXPECT_EQ(http->not_modified_count, 1u);
+  EXPECT_FALSE(not_modified);
+
+  std::lock_guard<std::mutex> lock(http->mutex);
+  for (const std::string& url : http->requested) {
+    EXPECT_NE(url, config.uptane.director_server + "/1.root.json");
+    EXPECT_NE(url, config.uptane.director_server + "/2.root.json");
+  }
+}
+
+/*
+ * A timestamp which points to the same snapshot as in the previous cycle
+ * means that the snapshot and targets have not changed, they are neither
+ * fetched nor verified again.
+ */
+TEST(Uptane, UnchangedSnapshot) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<LatencyHttpFake>(temp_dir.Path(), std::chrono::milliseconds(0), false);
+  Config config("tests/config/basic.toml");
+  config.storage.path = temp_dir.Path();
+  config.uptane.director_server = http->tls_server + "director";
+  config.uptane.repo_server = http->tls_server + "repo";
+  config.pacman.type = PackageManager::kNone;
+  config.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  config.provision.primary_ecu_hardware_id = "primary_hw";
+  UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hw");
+  config.postUpdateValues();
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = SotaUptaneClient::newTestClient(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+  sota_client->AssembleManifest();
+
+  auto cycle_requests = [&http, &sota_client]() {
+    {
+      std::lock_guard<std::mutex> lock(http->mutex);
+      http->requested.clear();
+    }
+    EXPECT_TRUE(sota_client->uptaneIteration());
+    std::lock_guard<std::mutex> lock(http->mutex);
+    return http->requested;
+  };
+  auto requested = [](const std::vector<std::string>& urls, const std::string& file) {
+    return std::any_of(urls.cbegin(), urls.cend(),
+                       [&file](const std::string& url) { return boost::algorithm::ends_with(url, file); });
+  };
+
+  std::vector<std::string> first = cycle_requests();
+  EXPECT_TRUE(requested(first, "repo/snapshot.json"));
+  EXPECT_TRUE(requested(first, "repo/targets.json"));
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_changed, 1u);
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_reused, 0u);
+
+  std::vector<std::string> unchanged = cycle_requests();
+  EXPECT_FALSE(requested(unchanged, "repo/snapshot.json"));
+  EXPECT_FALSE(requested(unchanged, "repo/targets.json"));
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_changed, 1u);
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_reused, 1u);
+  std::vector<Uptane::Target> new_targets;
+  ASSERT_TRUE(sota_client->getNewTargets(&new_targets));
+  ASSERT_FALSE(new_targets.empty());
+  for (const auto& target : new_targets) {
+    EXPECT_NE(sota_client->images_repo.getTarget(target), nullptr);
+  }
+
+  // a new snapshot is fetched
+  const std::string repo_dir = "tests/test_data/repo/repo/image/";
+  http->served[config.uptane.repo_server + "/timestamp.json"] = Utils::readFile(repo_dir + "timestamp_multisec.json");
+  http->served[config.uptane.repo_server + "/snapshot.json"] = Utils::readFile(repo_dir + "snapshot_multisec.json");
+  http->served[config.uptane.repo_server + "/targets.json"] = Utils::readFile(repo_dir + "targets_multisec.json");
+  std::vector<std::string> changed = cycle_requests();
+  EXPECT_TRUE(requested(changed, "repo/snapshot.json"));
+  EXPECT_TRUE(requested(changed, "repo/targets.json"));
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_changed, 2u);
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_reused, 1u);
+
+  // after a restart, the stored snapshot and targets are taken
+  sota_client = SotaUptaneClient::newTestClient(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+  sota_client->AssembleManifest();
+  std::vector<std::string> restarted = cycle_requests();
+  EXPECT_FALSE(requested(restarted, "repo/snapshot.json"));
+  EXPECT_FALSE(requested(restarted, "repo/targets.json"));
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_changed, 0u);
+  EXPECT_EQ(sota_client->images_repo.stats().snapshot_loaded, 1u);
+  ASSERT_TRUE(sota_client->getNewTargets(&new_targets));
+  ASSERT_FALSE(new_targets.empty());
+  for (const auto& target : new_targets) {
+    EXPECT_NE(sota_client->images_repo.getTarget(target), nullptr);
+  }
+
+  std::cout << "Requests per update cycle, first: " << first.size() << ", unchanged: " << unchanged.size()
+            << ", new snapshot: " << changed.size() << ", after a restart: " << restarted.size() << "\n";
 }
 
 TEST(Uptane, offlineIteration) {
@@ -20,9 +20,19 @@
 namespace Uptane {
 
 bool RepositoryCommon::initRoot(const std::string& root_raw) {
+  // a root which was verified against the previous one has also been verified against itself
+  const std::string root_hash = VerifiedMeta::hash(root_raw);
+  if (loadVerified(Role::Root(), root_hash, &root)) {
+    root.setVerificationPool(pool_);
+    root_hash_ = root_hash;
+    return true;
+  }
   try {
-    root = Root(type, Utils::parseJSON(root_raw));        // initialization and format check
+    root = Root(type, Utils::parseJSON(root_raw));  // initialization and format check
+    root.setVerificationPool(pool_);
     root = Root(type, Utils::parseJSON(root_raw), root);  // signature verification against itself
+    root_hash_ = root_hash;
+    storeVerified(Role::Root(), root_hash_, root);
   } catch (const std::exception& e) {
     LOG_ERROR << "Loading initial root failed: " << e.what();
     throw;
@@ -34,11 +44,14 @@ bool RepositoryCommon::initRoot(const std::string& root_raw) {
 bool RepositoryCommon::verifyRoot(const std::string& root_raw) {
   try {
     int prev_version = root.version();
+    root_hash_.clear();
     root = Root(type, Utils::parseJSON(root_raw), root);  // double signature verification
     if (root.version() != prev_version + 1) {
       LOG_ERROR << "Version in root metadata doesn't match the expected value";
       return false;
     }
+    root_hash_ = VerifiedMeta::hash(root_raw);
+    storeVerified(Role::Root(), root_hash_, root);
   } catch (const std::exception& e) {
     LOG_ERROR << "Signature verification for root metadata failed: " << e.what();
     return false;
@@ -46,7 +59,11 @@ bool RepositoryCommon::verifyRoot(const std::string& root_raw) {
   return true;
 }
 
-void RepositoryCommon::resetRoot() { root = Root(Root::Policy::kAcceptAll); }
+void RepositoryCommon::resetRoot() {
+  root = Root(Root::Policy::kAcceptAll);
+  root.setVerificationPool(pool_);
+  root_hash_.clear();
+}
 
 Json::Value Manifest::signManifest(const Json::Value& version_manifests) const {
   Json::Value manifest;
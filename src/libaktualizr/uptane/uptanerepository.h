@@ -10,6 +10,7 @@
 #include "crypto/keymanager.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
+#include "uptane/verifiedmeta.h"
 
 namespace Uptane {
 
@@ -35,19 +36,53 @@ class Manifest {
   KeyManager keys_;
 };
 
+/* With a storage, the metadata verified by the repositories is kept in the storage in binary form, see VerifiedMeta.
+ * Metadata which was already verified in the same context is then restored from there, without being parsed or
+ * verified again.
+ */
 class RepositoryCommon {
  public:
-  RepositoryCommon(RepositoryType type_in) : type{type_in} {}
+  explicit RepositoryCommon(RepositoryType type_in, std::shared_ptr<INvStorage> storage_in = nullptr)
+      : type{type_in}, storage_{std::move(storage_in)} {}
   bool initRoot(const std::string &root_raw);
   bool verifyRoot(const std::string &root_raw);
   int rootVersion() { return root.version(); }
   bool rootExpired() { return root.isExpired(TimeStamp::Now()); }
+  // Pool for checking the signatures of a role concurrently, see Root::setVerificationPool
+  void setVerificationPool(std::shared_ptr<WorkerPool> pool) {
+    pool_ = std::move(pool);
+    root.setVerificationPool(pool_);
+  }
 
  protected:
   void resetRoot();
+  template <class T>
+  bool loadVerified(Role role, const std::string &context, T *meta) const;
+  template <class T>
+  void storeVerified(Role role, const std::string &context, const T &meta) const;
+
   Root root;
   RepositoryType type;
+  std::shared_ptr<INvStorage> storage_;
+  std::string root_hash_;  // of the raw root metadata, empty if the root was not verified
+  std::shared_ptr<WorkerPool> pool_;
 };
+
+template <class T>
+bool RepositoryCommon::loadVerified(Role role, const std::string &context, T *meta) const {
+  std::string record;
+  if (storage_ == nullptr || !storage_->loadVerifiedMeta(&record, type, role)) {
+    return false;
+  }
+  return VerifiedMeta::decode(record, context, meta);
+}
+
+template <class T>
+void RepositoryCommon::storeVerified(Role role, const std::string &context, const T &meta) const {
+  if (storage_ != nullptr) {
+    storage_->storeVerifiedMeta(VerifiedMeta::encode(context, meta), type, role);
+  }
+}
 }  // namespace Uptane
 
 #endif
@@ -0,0 +1,298 @@
+#include "uptane/verifiedmeta.h"
+
+#include <cstdint>
+#include <stdexcept>
+
+#include <boost/algorithm/hex.hpp>
+
+#include "crypto/crypto.h"
+
+namespace Uptane {
+
+// the format of the records, records in any other format are ignored
+static const char kRecordFormat = 1;
+
+// Length-prefixed fields, in little endian. The records can hold tens of thousands of targets, so they are read in
+// place rather than with the ASN.1 deserializer.
+class VerifiedMeta::Writer {
+ public:
+  void u32(uint32_t val) {
+    for (int i = 0; i < 4; ++i) {
+      out.push_back(static_cast<char>((val >> (8 * i)) & 0xFF));
+    }
+  }
+  void i64(int64_t val) {
+    auto uval = static_cast<uint64_t>(val);
+    for (int i = 0; i < 8; ++i) {
+      out.push_back(static_cast<char>((uval >> (8 * i)) & 0xFF));
+    }
+  }
+  void str(const std::string &val) {
+    u32(static_cast<uint32_t>(val.size()));
+    out.append(val);
+  }
+
+  std::string out;
+};
+
+class VerifiedMeta::Reader {
+ public:
+  explicit Reader(const std::string &in) : in_(in) {}
+
+  uint32_t u32() {
+    need(4);
+    uint32_t val = 0;
+    for (int i = 0; i < 4; ++i) {
+      val |= static_cast<uint32_t>(static_cast<uint8_t>(in_[pos_++])) << (8 * i);
+    }
+    return val;
+  }
+  int64_t i64() {
+    need(8);
+    uint64_t val = 0;
+    for (int i = 0; i < 8; ++i) {
+      val |= static_cast<uint64_t>(static_cast<uint8_t>(in_[pos_++])) << (8 * i);
+    }
+    return static_cast<int64_t>(val);
+  }
+  int i32() { return static_cast<int>(static_cast<int32_t>(u32())); }
+  std::string str() {
+    uint32_t size = u32();
+    need(size);
+    std::string val = in_.substr(pos_, size);
+    pos_ += size;
+    return val;
+  }
+  void skip(size_t size) {
+    need(size);
+    pos_ += size;
+  }
+  bool atEnd() const { return pos_ == in_.size(); }
+
+ private:
+  void need(size_t size) const {
+    if (in_.size() - pos_ < size) {
+      throw std::runtime_error("truncated record");
+    }
+  }
+
+  const std::string &in_;
+  size_t pos_{0};
+};
+
+void VerifiedMeta::write(Writer &out, const BaseMeta &meta) {
+  out.u32(static_cast<uint32_t>(meta.version_));
+  out.str(meta.expiry_.ToString());
+}
+
+void VerifiedMeta::write(Writer &out, const Hash &hash) {
+  out.u32(static_cast<uint32_t>(hash.type()));
+  out.str(hash.HashString());
+}
+
+void VerifiedMeta::write(Writer &out, const Target &target) {
+  out.str(target.filename_);
+  out.str(target.type_);
+  out.u32(static_cast<uint32_t>(target.ecus_.size()));
+  for (const auto &ecu : target.ecus_) {
+    out.str(ecu.first.ToString());
+    out.str(ecu.second.ToString());
+  }
+  out.u32(static_cast<uint32_t>(target.hashes_.size()));
+  for (const auto &hash : target.hashes_) {
+    write(out, hash);
+  }
+  out.i64(target.length_);
+}
+
+void VerifiedMeta::read(Reader &in, BaseMeta *meta) {
+  meta->version_ = in.i32();
+  meta->expiry_ = TimeStamp(in.str());
+}
+
+Hash VerifiedMeta::readHash(Reader &in) {
+  uint32_t type = in.u32();
+  if (type > static_cast<uint32_t>(Hash::Type::kUnknownAlgorithm)) {
+    throw std::runtime_error("invalid hash type");
+  }
+  std::string value = in.str();
+  return Hash(static_cast<Hash::Type>(type), value);
+}
+
+Target VerifiedMeta::readTarget(Reader &in) {
+  Target target(in.str(), Json::Value());
+  target.type_ = in.str();
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    std::string serial = in.str();
+    target.ecus_.emplace(EcuSerial(serial), HardwareIdentifier(in.str()));
+  }
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    target.hashes_.push_back(readHash(in));
+  }
+  target.length_ = in.i64();
+  return target;
+}
+
+std::string VerifiedMeta::encode(const std::string &context, const Root &root) {
+  Writer out;
+  out.out.push_back(kRecordFormat);
+  out.str(context);
+  write(out, root);
+  out.u32(static_cast<uint32_t>(root.policy_));
+  out.u32(static_cast<uint32_t>(root.keys_.size()));
+  for (const auto &key : root.keys_) {
+    out.str(key.first);
+    out.u32(static_cast<uint32_t>(key.second.Type()));
+    out.str(key.second.Value());
+  }
+  out.u32(static_cast<uint32_t>(root.keys_for_role_.size()));
+  for (const auto &role_key : root.keys_for_role_) {
+    out.str(role_key.first.ToString());
+    out.str(role_key.second);
+  }
+  out.u32(static_cast<uint32_t>(root.thresholds_for_role_.size()));
+  for (const auto &threshold : root.thresholds_for_role_) {
+    out.str(threshold.first.ToString());
+    out.i64(threshold.second);
+  }
+  return out.out;
+}
+
+std::string VerifiedMeta::encode(const std::string &context, const Targets &targets) {
+  Writer out;
+  out.out.push_back(kRecordFormat);
+  out.str(context);
+  write(out, targets);
+  out.u32(static_cast<uint32_t>(targets.targets.size()));
+  for (const auto &target : targets.targets) {
+    write(out, target);
+  }
+  return out.out;
+}
+
+std::string VerifiedMeta::encode(const std::string &context, const TimestampMeta &timestamp) {
+  Writer out;
+  out.out.push_back(kRecordFormat);
+  out.str(context);
+  write(out, timestamp);
+  out.u32(static_cast<uint32_t>(timestamp.snapshot_hashes_.size()));
+  for (const auto &hash : timestamp.snapshot_hashes_) {
+    write(out, hash);
+  }
+  out.i64(timestamp.snapshot_size_);
+  out.i64(timestamp.snapshot_version_);
+  return out.out;
+}
+
+std::string VerifiedMeta::encode(const std::string &context, const Snapshot &snapshot) {
+  Writer out;
+  out.out.push_back(kRecordFormat);
+  out.str(context);
+  write(out, snapshot);
+  out.u32(static_cast<uint32_t>(snapshot.targets_hashes_.size()));
+  for (const auto &hash : snapshot.targets_hashes_) {
+    write(out, hash);
+  }
+  out.i64(snapshot.targets_size_);
+  out.i64(snapshot.targets_version_);
+  return out.out;
+}
+
+void VerifiedMeta::readPayload(Reader &in, Root *root) {
+  *root = Root(Root::Policy::kCheck);
+  read(in, root);
+  uint32_t policy = in.u32();
+  if (policy > static_cast<uint32_t>(Root::Policy::kCheck)) {
+    throw std::runtime_error("invalid root policy");
+  }
+  root->policy_ = static_cast<Root::Policy>(policy);
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    const KeyId keyid = in.str();
+    auto type = static_cast<KeyType>(in.u32());
+    root->keys_[keyid] = PublicKey(in.str(), type);
+  }
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    const Role role(in.str());
+    root->keys_for_role_.emplace(role, in.str());
+  }
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    const Role role(in.str());
+    root->thresholds_for_role_[role] = in.i64();
+  }
+}
+
+void VerifiedMeta::readPayload(Reader &in, Targets *targets) {
+  *targets = Targets();
+  read(in, targets);
+  uint32_t n = in.u32();
+  targets->targets.reserve(n);
+  for (; n > 0; --n) {
+    targets->targets.push_back(readTarget(in));
+  }
+  targets->reindex();
+}
+
+void VerifiedMeta::readPayload(Reader &in, TimestampMeta *timestamp) {
+  *timestamp = TimestampMeta();
+  read(in, timestamp);
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    timestamp->snapshot_hashes_.push_back(readHash(in));
+  }
+  timestamp->snapshot_size_ = in.i64();
+  timestamp->snapshot_version_ = static_cast<int>(in.i64());
+}
+
+void VerifiedMeta::readPayload(Reader &in, Snapshot *snapshot) {
+  *snapshot = Snapshot();
+  read(in, snapshot);
+  for (uint32_t n = in.u32(); n > 0; --n) {
+    snapshot->targets_hashes_.push_back(readHash(in));
+  }
+  snapshot->targets_size_ = in.i64();
+  snapshot->targets_version_ = static_cast<int>(in.i64());
+}
+
+template <class T>
+bool VerifiedMeta::decodeRecord(const std::string &record, const std::string &context, T *meta) {
+  if (record.empty() || record[0] != kRecordFormat) {
+    return false;
+  }
+  try {
+    Reader in(record);
+    in.skip(1);
+    if (in.str() != context) {
+      return false;
+    }
+    T decoded;
+    readPayload(in, &decoded);
+    if (!in.atEnd()) {
+      return false;
+    }
+    *meta = std::move(decoded);
+    return true;
+  } catch (const std::exception &) {
+    return false;
+  }
+}
+
+bool VerifiedMeta::decode(const std::string &record, const std::string &context, Root *root) {
+  return decodeRecord(record, context, root);
+}
+
+bool VerifiedMeta::decode(const std::string &record, const std::string &context, Targets *targets) {
+  return decodeRecord(record, context, targets);
+}
+
+bool VerifiedMeta::decode(const std::string &record, const std::string &context, TimestampMeta *timestamp) {
+  return decodeRecord(record, context, timestamp);
+}
+
+bool VerifiedMeta::decode(const std::string &record, const std::string &context, Snapshot *snapshot) {
+  return decodeRecord(record, context, snapshot);
+}
+
+std::string VerifiedMeta::hash(const std::string &raw) {
+  return boost::algorithm::hex(Crypto::sha256digest(raw));
+}
+
+}  // namespace Uptane
@@ -0,0 +1,56 @@
+#ifndef UPTANE_VERIFIEDMETA_H_
+#define UPTANE_VERIFIEDMETA_H_
+
+#include <string>
+
+#include "uptane/tuf.h"
+
+namespace Uptane {
+
+/**
+ * Compact binary form of metadata whose signatures have been checked, so that
+ * it can be restored without parsing the JSON and verifying it again.
+ *
+ * A record is tied to a context: the hashes of everything its verification
+ * depended on, that is the raw metadata, the root which verified it and the
+ * metadata which gave its expected hash. It is only restored for the very same
+ * context. The original JSON is not kept, restored objects have a null
+ * original().
+ */
+class VerifiedMeta {
+ public:
+  static std::string encode(const std::string &context, const Root &root);
+  static std::string encode(const std::string &context, const Targets &targets);
+  static std::string encode(const std::string &context, const TimestampMeta &timestamp);
+  static std::string encode(const std::string &context, const Snapshot &snapshot);
+
+  // Return false if the record was made in another context or can't be read
+  static bool decode(const std::string &record, const std::string &context, Root *root);
+  static bool decode(const std::string &record, const std::string &context, Targets *targets);
+  static bool decode(const std::string &record, const std::string &context, TimestampMeta *timestamp);
+  static bool decode(const std::string &record, const std::string &context, Snapshot *snapshot);
+
+  // Hash of raw metadata, as used in contexts
+  static std::string hash(const std::string &raw);
+
+ private:
+  class Writer;
+  class Reader;
+
+  static void write(Writer &out, const BaseMeta &meta);
+  static void write(Writer &out, const Hash &hash);
+  static void write(Writer &out, const Target &target);
+  static void read(Reader &in, BaseMeta *meta);
+  static Hash readHash(Reader &in);
+  static Target readTarget(Reader &in);
+  template <class T>
+  static bool decodeRecord(const std::string &record, const std::string &context, T *meta);
+  static void readPayload(Reader &in, Root *root);
+  static void readPayload(Reader &in, Targets *targets);
+  static void readPayload(Reader &in, TimestampMeta *timestamp);
+  static void readPayload(Reader &in, Snapshot *snapshot);
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_VERIFIEDMETA_H_
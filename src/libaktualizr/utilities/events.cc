@@ -41,6 +41,11 @@ SendDeviceDataComplete::SendDeviceDataComplete() { variant = "SendDeviceDataComp
 
 PutManifestComplete::PutManifestComplete() { variant = "PutManifestComplete"; }
 
+UnresponsiveSecondaries::UnresponsiveSecondaries(std::vector<Uptane::EcuSerial> serials_in)
+    : serials(std::move(serials_in)) {
+  variant = "UnresponsiveSecondaries";
+}
+
 std::string UpdateAvailable::toJson() {
   Json::Value json;
   Json::Value targets;
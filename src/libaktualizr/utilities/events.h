@@ -64,6 +64,15 @@ class PutManifestComplete : public BaseEvent {
   explicit PutManifestComplete();
 };
 
+/**
+ * Secondaries did not send their manifest in time and were left out of the manifest.
+ */
+class UnresponsiveSecondaries : public BaseEvent {
+ public:
+  explicit UnresponsiveSecondaries(std::vector<Uptane::EcuSerial> serials_in);
+  std::vector<Uptane::EcuSerial> serials;
+};
+
 /**
  * No update is available for download from the server.
  */
@@ -0,0 +1,48 @@
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed number of threads running tasks in the order they are posted. Tasks
+ * still queued when the pool is destroyed are run before the threads exit.
+ */
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t size);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  size_t size() const { return threads_.size(); }
+  void post(std::function<void()> task);
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F task);
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_{false};
+  std::vector<std::thread> threads_;
+};
+
+template <typename F>
+std::future<typename std::result_of<F()>::type> WorkerPool::submit(F task) {
+  // std::function needs a copyable target
+  auto packaged = std::make_shared<std::packaged_task<typename std::result_of<F()>::type()>>(std::move(task));
+  auto result = packaged->get_future();
+  post([packaged]() { (*packaged)(); });
+  return result;
+}
+
+#endif  // WORKERPOOL_H_
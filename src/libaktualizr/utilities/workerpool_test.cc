@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#include "utilities/workerpool.h"
+
+TEST(WorkerPool, RunsAllTasks) {
+  std::atomic<int> sum{0};
+  std::vector<std::future<int>> results;
+  {
+    WorkerPool pool(4);
+    EXPECT_EQ(pool.size(), 4u);
+    for (int i = 1; i <= 100; ++i) {
+      pool.post([&sum, i]() { sum += i; });
+      results.push_back(pool.submit([i]() { return i * 2; }));
+    }
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_EQ(results[static_cast<size_t>(i)].get(), (i + 1) * 2);
+    }
+  }
+  // the queue is drained before the pool is destroyed
+  EXPECT_EQ(sum, 5050);
+}
+
+TEST(WorkerPool, Exception) {
+  WorkerPool pool(1);
+  auto result = pool.submit([]() -> int { throw std::runtime_error("failed"); });
+  EXPECT_THROW(result.get(), std::runtime_error);
+  EXPECT_EQ(pool.submit([]() { return 1; }).get(), 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,5 +1,6 @@
 #!/usr/bin/python3
 
+import gzip
 import sys
 import socket
 from http.server import BaseHTTPRequestHandler, HTTPServer
@@ -18,6 +19,31 @@ class Handler(BaseHTTPRequestHandler):
             self.send_response(200)
             self.end_headers()
             self.wfile.write(b'content')
+        elif self.path == '/etag':
+            if self.headers.get('If-None-Match') == '"0123"':
+                self.send_response(304)
+                self.end_headers()
+            else:
+                self.send_response(200)
+                self.send_header('ETag', '"0123"')
+                self.end_headers()
+                self.wfile.write(b'content')
+        elif self.path == '/compressed':
+            body = b'{"data": "' + b'a' * 4096 + b'"}'
+            self.send_response(200)
+            if 'gzip' in self.headers.get('Accept-Encoding', ''):
+                body = gzip.compress(body)
+                self.send_header('Content-Encoding', 'gzip')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        elif self.path == '/gzip_bomb':
+            body = gzip.compress(b'0' * (1024 * 1024))
+            self.send_response(200)
+            self.send_header('Content-Encoding', 'gzip')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
         elif self.path == '/auth_call':
             self.send_response(200)
             self.end_headers()
@@ -31,6 +57,22 @@ class Handler(BaseHTTPRequestHandler):
             self.end_headers()
             for i in range(2048):
               self.wfile.write(b'@')
+        elif self.path in ('/range', '/range_ignored', '/range_error'):
+            body = b'0123456789'
+            range_header = self.headers.get('Range')
+            if range_header and self.path == '/range':
+                start = int(range_header[len('bytes='):].split('-')[0])
+                self.send_response(206)
+                self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, len(body) - 1, len(body)))
+                body = body[start:]
+            elif range_header and self.path == '/range_error':
+                self.send_response(503)
+                body = b'Internal server error'
+            else:
+                self.send_response(200)
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
         elif self.path == '/slow_file':
             self.send_response(200)
             self.end_headers()
@@ -73,7 +115,10 @@ class Handler(BaseHTTPRequestHandler):
             self.send_response(200)
             self.end_headers()
             length = int(self.headers.get('content-length'))
-            result = b'{"data": %b, "path": "%b"}'%(self.rfile.read(length), bytes(self.path, "utf8"))
+            data = self.rfile.read(length)
+            if self.headers.get('Content-Encoding') == 'gzip':
+                data = gzip.decompress(data)
+            result = b'{"data": %b, "path": "%b"}'%(data, bytes(self.path, "utf8"))
             self.wfile.write(result)
 
     def do_PUT(self):
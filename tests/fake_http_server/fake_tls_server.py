@@ -0,0 +1,70 @@
+#!/usr/bin/python3
+
+import json
+import os
+import ssl
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
+
+base_dir = os.path.dirname(os.path.abspath(__file__))
+
+counter_lock = threading.Lock()
+handshakes = 0
+resumed_sessions = 0
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def reply(self, body):
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        if self.path == '/handshakes':
+            with counter_lock:
+                body = {'handshakes': handshakes, 'resumed': resumed_sessions}
+            self.reply(bytes(json.dumps(body), 'utf8'))
+        else:
+            self.reply(b'{"path": "%b"}' % bytes(self.path, 'utf8'))
+
+    def do_PUT(self):
+        length = int(self.headers.get('content-length'))
+        data = self.rfile.read(length)
+        self.reply(b'{"data": %b, "path": "%b"}' % (data, bytes(self.path, 'utf8')))
+
+    def do_POST(self):
+        self.do_PUT()
+
+    def log_message(self, format, *args):
+        pass
+
+
+class TlsServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address):
+        super().__init__(address, Handler)
+        self.context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        self.context.load_cert_chain(os.path.join(base_dir, 'client.crt'), os.path.join(base_dir, 'client.key'))
+        self.context.load_verify_locations(os.path.join(base_dir, 'client.crt'))
+        self.context.verify_mode = ssl.CERT_REQUIRED
+
+    def get_request(self):
+        global handshakes, resumed_sessions
+        sock, addr = self.socket.accept()
+        tls_sock = self.context.wrap_socket(sock, server_side=True)
+        with counter_lock:
+            handshakes += 1
+            if tls_sock.session_reused:
+                resumed_sessions += 1
+        return tls_sock, addr
+
+
+server_address = ('localhost', int(sys.argv[1]))
+httpd = TlsServer(server_address)
+httpd.serve_forever()
@@ -47,7 +47,7 @@ class HttpFake : public HttpInterface {
    *
    * All other Uptane tests use the hasupdates set.
    */
-  HttpResponse get(const std::string &url, int64_t maxsize) {
+  HttpResponse get(const std::string &url, int64_t maxsize) override {
     (void)maxsize;
 
     std::cout << "URL requested: " << url << "\n";
@@ -127,7 +127,22 @@ class HttpFake : public HttpInterface {
     return HttpResponse(url, 200, CURLE_OK, "");
   }
 
-  HttpResponse post(const std::string &url, const Json::Value &data) {
+  // ETag is the hash of the content
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const HttpValidators &validators) override {
+    HttpResponse response = get(url, maxsize);
+    if (!response.isOk()) {
+      return response;
+    }
+    response.validators.etag = "\"" + boost::algorithm::hex(Crypto::sha256digest(response.body)) + "\"";
+    if (!validators.etag.empty() && validators.etag == response.validators.etag) {
+      ++not_modified_count;
+      response.body.clear();
+      response.http_status_code = 304;
+    }
+    return response;
+  }
+
+  HttpResponse post(const std::string &url, const Json::Value &data) override {
     if (url.find("tst149") == 0) {
       if (url == "tst149/devices") {
         EXPECT_EQ(data["deviceId"].asString(), "tst149_device_id");
@@ -174,7 +189,7 @@ class HttpFake : public HttpInterface {
     }
   }
 
-  HttpResponse put(const std::string &url, const Json::Value &data) {
+  HttpResponse put(const std::string &url, const Json::Value &data) override {
     if (url == "tst149/core/installed") {
       EXPECT_EQ(data.size(), 1);
       EXPECT_EQ(data[0]["name"].asString(), "fake-package");
@@ -209,24 +224,23 @@ class HttpFake : public HttpInterface {
     return HttpResponse(url, 200, CURLE_OK, "");
   }
 
-  HttpResponse download(const std::string &url, curl_write_callback callback, void *userp) {
-    (void)callback;
-    (void)userp;
+  HttpResponse download(const std::string &url, curl_write_callback callback, void *userp, size_t from = 0) override {
     std::cout << "URL requested: " << url << "\n";
     const boost::filesystem::path path = metadata_path / "repo/targets" / url.substr(url.rfind("/targets/") + 9);
     std::cout << "file served: " << path << "\n";
 
-    std::string content = Utils::readFile(path.string());
+    std::string content = Utils::readFile(path.string()).substr(from);
 
     // Hack since the signature strangely requires non-const.
     callback(const_cast<char *>(content.c_str()), content.size(), 1, userp);
-    return HttpResponse(content, 200, CURLE_OK, "");
+    return HttpResponse(content, (from > 0) ? 206 : 200, CURLE_OK, "");
   }
 
   ProvisioningResult provisioningResponse;
   const std::string test_manifest = "test_aktualizr_manifest.txt";
   const std::string tls_server = "https://tlsserver.com";
   size_t events_seen = 0;
+  size_t not_modified_count = 0;
 
  private:
   /**